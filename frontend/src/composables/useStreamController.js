@@ -21,25 +21,36 @@ const hostname = ref('chute')
 const volume = ref(0.8)
 const snapshotUrl = ref('')
 
-let vUrl = ''
-let aUrl = ''
+const telemetry = ref(null)
+
+let wsUrl = ''
 let vidEl = null
 let initialized = false
 let snapshotInterval = null
 
+// WebSocket state: one socket carries video, audio and telemetry
+let ws = null
+let frameUrl = ''
+let reconnectTimer = null
+
 // Web Audio API state
 let audioCtx = null
 let gainNode = null
-let abortCtrl = null
+let schedTime = 0
+
+// Message header (little-endian, 16 bytes):
+//   u8 type, u8 bits, u16 reserved, u32 arg, i64 ts_us
+const WS_HDR_LEN = 16
+const WS_MSG_VIDEO = 1
+const WS_MSG_AUDIO = 2
+const WS_MSG_TELEMETRY = 3
 
 async function init() {
   if (initialized) return
   initialized = true
   try {
     const info = await apiGet('/api/info')
-    const host = location.hostname
-    vUrl = 'http://' + host + ':' + info.stream_port + '/stream'
-    aUrl = 'http://' + host + ':' + info.audio_port + '/audio'
+    wsUrl = (location.protocol === 'https:' ? 'wss://' : 'ws://') + location.host + '/ws'
     hasCamera.value = info.camera !== false
     hasMic.value = info.mic !== false
     hostname.value = info.hostname || 'chute'
@@ -72,104 +83,95 @@ function unregisterElements() {
   vidEl = null
 }
 
-// --- Web Audio streaming ---
+// --- WebSocket streaming ---
 
-async function playAudio() {
-  if (!audioCtx || !aUrl) return
+function showFrame(data) {
+  if (!vidEl?.value) return
+  const url = URL.createObjectURL(new Blob([data], { type: 'image/jpeg' }))
+  vidEl.value.src = url
+  if (frameUrl) URL.revokeObjectURL(frameUrl)
+  frameUrl = url
+}
 
-  // Ensure context is running (may be suspended by autoplay policy)
-  if (audioCtx.state !== 'running') {
-    await audioCtx.resume()
+function playPcm(bytes, bits, sampleRate) {
+  if (!audioCtx || audioCtx.state === 'closed' || !sampleRate) return
+  const bytesPerSample = bits / 8
+  const numSamples = Math.floor(bytes.length / bytesPerSample)
+  if (!numSamples) return
+  const floats = new Float32Array(numSamples)
+
+  if (bits === 16) {
+    for (let i = 0; i < numSamples; i++) {
+      const o = i * 2
+      let v = bytes[o] | (bytes[o + 1] << 8)
+      if (v >= 32768) v -= 65536
+      floats[i] = v / 32768
+    }
+  } else if (bits === 24) {
+    for (let i = 0; i < numSamples; i++) {
+      const o = i * 3
+      let v = bytes[o] | (bytes[o + 1] << 8) | (bytes[o + 2] << 16)
+      if (v & 0x800000) v -= 0x1000000
+      floats[i] = v / 8388608
+    }
+  } else {
+    return
   }
 
-  abortCtrl = new AbortController()
-  try {
-    const res = await fetch(aUrl, { signal: abortCtrl.signal })
-    if (!res.ok || !res.body) return
-    const reader = res.body.getReader()
-
-    // Accumulate bytes until we have the 44-byte WAV header
-    let pending = new Uint8Array(0)
-    while (pending.length < 44) {
-      const { done, value } = await reader.read()
-      if (done) return
-      if (pending.length === 0) {
-        pending = value
-      } else {
-        const m = new Uint8Array(pending.length + value.length)
-        m.set(pending); m.set(value, pending.length)
-        pending = m
-      }
-    }
+  const buf = audioCtx.createBuffer(1, numSamples, sampleRate)
+  buf.getChannelData(0).set(floats)
+  const src = audioCtx.createBufferSource()
+  src.buffer = buf
+  src.connect(gainNode)
+  // Schedule 200ms ahead to absorb network jitter
+  const now = audioCtx.currentTime
+  if (schedTime < now) schedTime = now + 0.2
+  src.start(schedTime)
+  schedTime += buf.duration
+}
 
-    // Parse WAV header (little-endian)
-    const bitsPerSample = pending[34] | (pending[35] << 8)
-    const bytesPerSample = bitsPerSample / 8
-    const wavSampleRate = (pending[24] | (pending[25] << 8) | (pending[26] << 16) | (pending[27] << 24)) >>> 0
-
-    // Strip header, keep any extra audio bytes
-    pending = pending.slice(44)
-
-    // Start scheduling 200ms ahead to absorb network jitter
-    let schedTime = audioCtx.currentTime + 0.2
-
-    // Main decode + schedule loop
-    while (true) {
-      // Process complete samples from pending buffer
-      const usable = pending.length - (pending.length % bytesPerSample)
-      if (usable > 0) {
-        const numSamples = usable / bytesPerSample
-        const floats = new Float32Array(numSamples)
-
-        if (bitsPerSample === 16) {
-          for (let i = 0; i < numSamples; i++) {
-            const o = i * 2
-            let v = pending[o] | (pending[o + 1] << 8)
-            if (v >= 32768) v -= 65536
-            floats[i] = v / 32768
-          }
-        } else if (bitsPerSample === 24) {
-          for (let i = 0; i < numSamples; i++) {
-            const o = i * 3
-            let v = pending[o] | (pending[o + 1] << 8) | (pending[o + 2] << 16)
-            if (v & 0x800000) v -= 0x1000000
-            floats[i] = v / 8388608
-          }
-        }
-
-        pending = pending.slice(usable)
-
-        // Schedule playback — catch errors if context was closed during await
-        if (!audioCtx || audioCtx.state === 'closed') break
-        const buf = audioCtx.createBuffer(1, numSamples, wavSampleRate)
-        buf.getChannelData(0).set(floats)
-        const src = audioCtx.createBufferSource()
-        src.buffer = buf
-        src.connect(gainNode)
-        const now = audioCtx.currentTime
-        if (schedTime < now) schedTime = now
-        src.start(schedTime)
-        schedTime += buf.duration
-      }
-
-      // Read next chunk from network
-      const { done, value } = await reader.read()
-      if (done) break
-      if (pending.length > 0) {
-        const m = new Uint8Array(pending.length + value.length)
-        m.set(pending); m.set(value, pending.length)
-        pending = m
-      } else {
-        pending = value
-      }
-    }
-  } catch (e) {
-    if (e.name !== 'AbortError') console.error('[audio] stream error', e)
+function onMessage(ev) {
+  if (!(ev.data instanceof ArrayBuffer) || ev.data.byteLength < WS_HDR_LEN) return
+  const hdr = new DataView(ev.data, 0, WS_HDR_LEN)
+  const type = hdr.getUint8(0)
+  const payload = new Uint8Array(ev.data, WS_HDR_LEN)
+
+  if (type === WS_MSG_VIDEO) {
+    showFrame(payload)
+  } else if (type === WS_MSG_AUDIO) {
+    playPcm(payload, hdr.getUint8(1), hdr.getUint32(4, true))
+  } else if (type === WS_MSG_TELEMETRY) {
+    try { telemetry.value = JSON.parse(new TextDecoder().decode(payload)) } catch (e) { /* partial */ }
+  }
+}
+
+function connect() {
+  if (!wsUrl) return
+  const opts = []
+  if (!hasCamera.value || !vidEl?.value) opts.push('video=0')
+  if (!hasMic.value || !audioCtx) opts.push('audio=0')
+  const sock = new WebSocket(wsUrl + (opts.length ? '?' + opts.join('&') : ''))
+  sock.binaryType = 'arraybuffer'
+  sock.onmessage = onMessage
+  sock.onclose = () => {
+    if (ws !== sock) return
+    ws = null
+    // Unexpected close while playing (reboot, Wi-Fi drop): retry
+    if (playing.value) reconnectTimer = setTimeout(connect, 1000)
+  }
+  ws = sock
+}
+
+function disconnect() {
+  if (reconnectTimer) { clearTimeout(reconnectTimer); reconnectTimer = null }
+  if (ws) {
+    const sock = ws
+    ws = null
+    sock.close()
   }
 }
 
 function stopAudio() {
-  if (abortCtrl) { abortCtrl.abort(); abortCtrl = null }
   if (audioCtx && audioCtx.state !== 'closed') audioCtx.close().catch(() => {})
   audioCtx = null
   gainNode = null
@@ -192,7 +194,9 @@ function stopSnapshotTimer() {
 }
 
 function stop() {
+  disconnect()
   if (vidEl?.value) vidEl.value.src = ''
+  if (frameUrl) { URL.revokeObjectURL(frameUrl); frameUrl = '' }
   stopAudio()
   playing.value = false
   fetchSnapshot()
@@ -201,38 +205,40 @@ function stop() {
 
 function play() {
   stopSnapshotTimer()
-  if (hasCamera.value && vidEl?.value) {
-    vidEl.value.src = vUrl
-  }
-  if (hasMic.value && aUrl) {
+  if (hasMic.value) {
     // Create AudioContext synchronously within user gesture for autoplay compliance
     audioCtx = new AudioContext()
     audioCtx.resume()
     gainNode = audioCtx.createGain()
     gainNode.gain.value = volume.value
     gainNode.connect(audioCtx.destination)
-    playAudio()
+    schedTime = 0
   }
   playing.value = true
+  connect()
 }
 
 function togglePlay() {
   playing.value ? stop() : play()
 }
 
+// Reopen the socket after a settings change restarted a pipeline
+function restart() {
+  if (!playing.value) return
+  disconnect()
+  reconnectTimer = setTimeout(() => {
+    reconnectTimer = null
+    if (playing.value) connect()
+  }, 300)
+}
+
 function restartVideo() {
-  if (!playing.value || !vidEl?.value) return
-  vidEl.value.src = ''
-  setTimeout(() => { if (playing.value && vidEl?.value) vidEl.value.src = vUrl }, 300)
+  restart()
 }
 
 function restartAudio() {
-  if (!playing.value) return
-  if (abortCtrl) { abortCtrl.abort(); abortCtrl = null }
-  setTimeout(() => {
-    if (!playing.value || !audioCtx) return
-    playAudio()
-  }, 300)
+  schedTime = 0
+  restart()
 }
 
 function updateFrameDims(framesize) {
@@ -248,7 +254,7 @@ function setVolume(v) {
 
 export function useStreamController() {
   return {
-    playing, hasCamera, hasMic, camWidth, camHeight, hwWarning, hostname, volume, snapshotUrl,
+    playing, hasCamera, hasMic, camWidth, camHeight, hwWarning, hostname, volume, snapshotUrl, telemetry,
     init, registerElements, unregisterElements,
     play, stop, togglePlay,
     restartVideo, restartAudio, updateFrameDims, setVolume,
@@ -0,0 +1,224 @@
+#include "audio_codec.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int in_rate, out_rate;
+    int taps;
+    const int16_t *coef;
+} resample_table_t;
+
+// s_resample_tables, built with the firmware (gen_resample_coef.py)
+#include "resample_coef.h"
+
+static const int16_t s_adpcm_step[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767,
+};
+
+static const int8_t s_adpcm_index[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+// Quantize the difference to the prediction in 4 bits and step the
+// predictor exactly as a decoder will
+static uint8_t adpcm_encode_sample(adpcm_state_t *st, int sample)
+{
+    int step = s_adpcm_step[st->index];
+    int diff = sample - st->pred;
+    uint8_t code = 0;
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+    int delta = step >> 3;
+    if (diff >= step) {
+        code |= 4;
+        diff -= step;
+        delta += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        code |= 2;
+        diff -= step;
+        delta += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        code |= 1;
+        delta += step;
+    }
+
+    int pred = st->pred + (code & 8 ? -delta : delta);
+    st->pred = pred > 32767 ? 32767 : pred < -32768 ? -32768 : pred;
+    int index = st->index + s_adpcm_index[code & 7];
+    st->index = index < 0 ? 0 : index > 88 ? 88 : index;
+    return code;
+}
+
+void adpcm_encode_block(adpcm_state_t *st, const int16_t *pcm, int align, uint8_t *out)
+{
+    // The header sample is exact: the block starts from it
+    st->pred = pcm[0];
+    out[0] = (uint16_t)pcm[0] & 0xFF;
+    out[1] = (uint16_t)pcm[0] >> 8;
+    out[2] = st->index;
+    out[3] = 0;
+
+    const int16_t *p = pcm + 1;
+    for (int i = 4; i < align; i++, p += 2) {
+        uint8_t lo = adpcm_encode_sample(st, p[0]);
+        uint8_t hi = adpcm_encode_sample(st, p[1]);
+        out[i] = lo | (hi << 4);
+    }
+}
+
+// Segment of a biased sample magnitude, by its bits 7..14 (mu-law); A-law
+// looks up bits 8..14 and adds one
+static const uint8_t s_g711_seg[256] = {
+    0, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+};
+
+// On the 14-bit magnitude, like the reference coder (and Python's audioop)
+uint8_t g711_ulaw_encode(int16_t pcm)
+{
+    int v = pcm >> 2;
+    int mask = 0xFF;
+    if (v < 0) {
+        v = -v;
+        mask = 0x7F;
+    }
+    if (v > 8158) v = 8158;
+    v += 33;
+    int seg = s_g711_seg[v >> 5];
+    int mant = (v >> (seg + 1)) & 0x0F;
+    return ((seg << 4) | mant) ^ mask;
+}
+
+uint8_t g711_alaw_encode(int16_t pcm)
+{
+    int sign = pcm >= 0 ? 0x80 : 0;
+    int v = pcm >= 0 ? pcm : -(int)pcm - 1;
+    uint8_t code;
+    if (v >= 256) {
+        int seg = s_g711_seg[(v >> 8) & 0x7F] + 1;
+        code = (seg << 4) | ((v >> (seg + 3)) & 0x0F);
+    } else {
+        code = v >> 4;
+    }
+    return code ^ (sign | 0x55);
+}
+
+void g711_ulaw_encode_block(const int16_t *pcm, int samples, uint8_t *out)
+{
+    for (int i = 0; i < samples; i++) out[i] = g711_ulaw_encode(pcm[i]);
+}
+
+void g711_alaw_encode_block(const int16_t *pcm, int samples, uint8_t *out)
+{
+    for (int i = 0; i < samples; i++) out[i] = g711_alaw_encode(pcm[i]);
+}
+
+bool audio_resampler_init(audio_resampler_t *r, int in_rate, int out_rate)
+{
+    memset(r, 0, sizeof(*r));
+    r->in_rate = in_rate;
+    r->out_rate = out_rate;
+    if (in_rate == out_rate) return true;
+
+    for (size_t i = 0; i < sizeof(s_resample_tables) / sizeof(s_resample_tables[0]); i++) {
+        const resample_table_t *t = &s_resample_tables[i];
+        if (t->in_rate == in_rate && t->out_rate == out_rate) {
+            r->taps = t->taps;
+            r->coef = t->coef;
+        }
+    }
+    if (!r->coef) return false;
+
+    // History in internal RAM: every output reads all of it
+    r->buf = (int16_t *)calloc(r->taps + RESAMPLE_CHUNK, sizeof(int16_t));
+    if (!r->buf) return false;
+    r->step = in_rate / out_rate;
+    r->step_frac = in_rate % out_rate;
+    r->pos = r->taps / 2 - 1;
+    r->pos_frac = 0;
+    return true;
+}
+
+void audio_resampler_free(audio_resampler_t *r)
+{
+    free(r->buf);
+    r->buf = NULL;
+}
+
+static inline int32_t resample_dot(const int16_t *x, const int16_t *c, int taps)
+{
+    int32_t acc = 0;
+    for (int j = 0; j < taps; j++) acc += x[j] * c[j];
+    return acc;
+}
+
+int audio_resample(audio_resampler_t *r, const int16_t *in, int samples, int16_t *out)
+{
+    if (r->in_rate == r->out_rate) {
+        if (out != in) memmove(out, in, samples * sizeof(int16_t));
+        return samples;
+    }
+
+    int taps = r->taps, half = taps / 2;
+    int written = 0;
+    while (samples > 0) {
+        // buf: taps samples of history, then this chunk
+        int n = samples < RESAMPLE_CHUNK ? samples : RESAMPLE_CHUNK;
+        memcpy(r->buf + taps, in, n * sizeof(int16_t));
+        in += n;
+        samples -= n;
+        int len = taps + n;
+
+        // Outputs whose window (tap 0 at pos - half + 1) is all in buf
+        while (r->pos + taps - half < len) {
+            // Phase and the Q15 weight of the next one, from the exact fraction
+            uint32_t ph = r->pos_frac * RESAMPLE_PHASES;
+            int p = ph / r->out_rate;
+            int32_t a = ((ph % r->out_rate) << 15) / r->out_rate;
+            const int16_t *x = r->buf + r->pos - half + 1;
+            const int16_t *c = r->coef + p * taps;
+            int32_t d0 = resample_dot(x, c, taps);
+            int32_t d1 = resample_dot(x, c + taps, taps);
+            int64_t acc = d0 + ((((int64_t)d1 - d0) * a) >> 15);
+            int32_t v = (int32_t)((acc + (1 << 14)) >> 15);
+            out[written++] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+
+            r->pos += r->step;
+            r->pos_frac += r->step_frac;
+            if (r->pos_frac >= (uint32_t)r->out_rate) {
+                r->pos_frac -= r->out_rate;
+                r->pos++;
+            }
+        }
+
+        // Keep the last taps samples as the next chunk's history
+        memmove(r->buf, r->buf + n, taps * sizeof(int16_t));
+        r->pos -= n;
+    }
+    return written;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Audio encoders for the streaming paths; all fixed-point, working on the
+// 16-bit PCM the mic readers produce (gain already applied).
+
+// IMA ADPCM as in WAV format 0x11 (mono): blocks of ADPCM_BLOCK_ALIGN(rate)
+// bytes, each a 4-byte header (first sample, step index) and 4-bit codes
+// for the rest, low nibble first. Block size follows the usual convention
+// of 256 bytes per 11025 Hz (1024 at 44100 Hz, so a DMA block's worth of
+// samples never makes more than a few).
+#define ADPCM_BLOCK_ALIGN(rate)     (256 * ((rate) > 11025 ? (rate) / 11025 : 1))
+#define ADPCM_BLOCK_SAMPLES(align)  (((align) - 4) * 2 + 1)
+
+typedef struct {
+    int16_t pred;
+    uint8_t index;            // step table index, carried from block to block
+} adpcm_state_t;
+
+// Encode ADPCM_BLOCK_SAMPLES(align) samples into one block of align bytes
+void adpcm_encode_block(adpcm_state_t *st, const int16_t *pcm, int align, uint8_t *out);
+
+// ITU-T G.711, one byte per sample. Compression is table driven: the
+// segment (exponent) of a sample comes from one 256-entry table shared by
+// both laws, no search loop. Always at 8 kHz, as NVRs and SIP gateways
+// expect it: 64 kbit/s.
+#define G711_SAMPLE_RATE         8000
+uint8_t g711_ulaw_encode(int16_t pcm);
+uint8_t g711_alaw_encode(int16_t pcm);
+void g711_ulaw_encode_block(const int16_t *pcm, int samples, uint8_t *out);
+void g711_alaw_encode_block(const int16_t *pcm, int samples, uint8_t *out);
+
+// Sample-rate reduction from the mic's capture rate: a windowed-sinc
+// low-pass just below the output Nyquist, stored as sub-sample phases of
+// Q15 taps. Each output is the dot product of the inputs around it with
+// the two nearest phases, interpolated between them, all fixed point. The
+// tables are generated at build time for each supported rate pair
+// (gen_resample_coef.py, filter parameters there) and live in flash; their
+// taps grow with the in/out ratio (89 for 44100 -> 8000 Hz).
+#define RESAMPLE_CHUNK           256     // input samples per pass over the history
+
+typedef struct {
+    int in_rate, out_rate;
+    int taps;
+    const int16_t *coef;      // [phases + 1][taps], Q15, each phase sums to 1
+    int16_t *buf;             // last taps inputs, then up to RESAMPLE_CHUNK new ones
+    int step;                 // input samples per output: step + step_frac / out_rate
+    uint32_t step_frac;
+    int pos;                  // next output's position in buf: pos + pos_frac / out_rate
+    uint32_t pos_frac;
+} audio_resampler_t;
+
+// false without memory or without a table for the rates; equal rates pass
+// through
+bool audio_resampler_init(audio_resampler_t *r, int in_rate, int out_rate);
+void audio_resampler_free(audio_resampler_t *r);
+// Returns the number of samples written to out (at most samples, for any
+// ratio this allows); out may be in, the outputs never overtake the inputs
+int audio_resample(audio_resampler_t *r, const int16_t *in, int samples, int16_t *out);
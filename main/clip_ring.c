@@ -0,0 +1,339 @@
+#include "clip_ring.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "clip_ring";
+
+// Byte ring addressed by monotonic positions: data lives in [s_tail, s_head)
+// and position p is at s_buf[p % s_size]. Every record is contiguous in
+// memory and 4-byte aligned; a record that would straddle the end of the
+// buffer is preceded by a PAD record (or by implicit padding when fewer
+// than a header's worth of bytes remain) so it starts again at offset 0.
+#define REC_ALIGN(n) (((n) + 3) & ~(size_t)3)
+
+static SemaphoreHandle_t s_lock = NULL;     // ring positions and counters
+static SemaphoreHandle_t s_write = NULL;    // one writer at a time; the buffer stays put while it copies
+static uint8_t *s_buf = NULL;
+static size_t s_size = 0;
+static int s_size_kb = CLIP_RING_KB_DEFAULT;
+static uint64_t s_head = 0;
+static uint64_t s_tail = 0;
+static bool s_pinned = false;
+static uint64_t s_pin = 0;              // writers never evict at or past this
+static int64_t s_newest_us = 0;
+static int64_t s_last_video_us = 0;
+static uint32_t s_video_frames = 0;
+static uint32_t s_audio_blocks = 0;
+static uint32_t s_skipped = 0;
+
+// Header at a position, or NULL if the rest of the buffer is implicit padding
+static clip_rec_t *rec_at(uint64_t pos)
+{
+    size_t off = pos % s_size;
+    if (off + sizeof(clip_rec_t) > s_size) return NULL;
+    return (clip_rec_t *)(s_buf + off);
+}
+
+// Bytes the record at pos occupies, padding included
+static size_t rec_span(uint64_t pos)
+{
+    clip_rec_t *rec = rec_at(pos);
+    if (!rec || rec->type == CLIP_REC_PAD) return s_size - pos % s_size;
+    return REC_ALIGN(sizeof(clip_rec_t) + rec->len);
+}
+
+static void evict_tail(void)
+{
+    clip_rec_t *rec = rec_at(s_tail);
+    if (rec && rec->type == CLIP_REC_VIDEO) s_video_frames--;
+    if (rec && rec->type == CLIP_REC_AUDIO) s_audio_blocks--;
+    s_tail += rec_span(s_tail);
+}
+
+// Reserve under s_lock, copy without it, then publish: readers only see
+// up to s_head, so the record's bytes can be written after the lock is
+// dropped, and the capture task's frame copy never holds up an export or
+// a status request
+static void push(const clip_rec_t *hdr, const uint8_t *data)
+{
+    size_t need = REC_ALIGN(sizeof(clip_rec_t) + hdr->len);
+    if (!s_lock) return;
+
+    xSemaphoreTake(s_write, portMAX_DELAY);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (!s_buf || need > s_size / 2) {
+        xSemaphoreGive(s_lock);
+        xSemaphoreGive(s_write);
+        return;
+    }
+
+    size_t off = s_head % s_size;
+    size_t pad = (off + need > s_size) ? s_size - off : 0;
+
+    // Make room from the oldest end, but never under an export's feet
+    while (s_head + pad + need - s_tail > s_size) {
+        if (s_pinned && s_tail >= s_pin) {
+            s_skipped++;
+            xSemaphoreGive(s_lock);
+            xSemaphoreGive(s_write);
+            return;
+        }
+        evict_tail();
+    }
+    uint64_t at = s_head + pad;
+    xSemaphoreGive(s_lock);
+
+    if (pad) {
+        clip_rec_t *p = rec_at(s_head);
+        if (p) {
+            memset(p, 0, sizeof(*p));
+            p->type = CLIP_REC_PAD;
+            p->len = pad - sizeof(clip_rec_t);
+        }
+    }
+    uint8_t *dst = s_buf + at % s_size;
+    memcpy(dst, hdr, sizeof(clip_rec_t));
+    memcpy(dst + sizeof(clip_rec_t), data, hdr->len);
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_head = at + need;
+    if (hdr->type == CLIP_REC_VIDEO) s_video_frames++;
+    if (hdr->type == CLIP_REC_AUDIO) s_audio_blocks++;
+    if (hdr->ts_us > s_newest_us) s_newest_us = hdr->ts_us;
+    xSemaphoreGive(s_lock);
+    xSemaphoreGive(s_write);
+}
+
+// Allocate the ring, smaller than asked if PSRAM is short. Called locked.
+static esp_err_t ring_alloc(void)
+{
+    size_t want = (size_t)s_size_kb * 1024;
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    size_t avail = largest > CLIP_PSRAM_RESERVE_KB * 1024 ? largest - CLIP_PSRAM_RESERVE_KB * 1024 : 0;
+    size_t size = want < avail ? want : avail & ~(size_t)1023;
+    if (size < CLIP_RING_KB_MIN * 1024) {
+        ESP_LOGE(TAG, "No PSRAM for a %d KB clip ring", s_size_kb);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // PSRAM only — the ring is never worth internal RAM
+    s_buf = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!s_buf) {
+        ESP_LOGE(TAG, "No PSRAM for a %u KB clip ring", (unsigned)(size / 1024));
+        return ESP_ERR_NO_MEM;
+    }
+    s_size = size;
+    if (size < want) {
+        ESP_LOGW(TAG, "Clip ring enabled (%u KB of %d KB asked, PSRAM is short)",
+                 (unsigned)(size / 1024), s_size_kb);
+    } else {
+        ESP_LOGI(TAG, "Clip ring enabled (%u KB)", (unsigned)(size / 1024));
+    }
+    return ESP_OK;
+}
+
+static void ring_reset(void)
+{
+    s_head = s_tail = 0;
+    s_newest_us = s_last_video_us = 0;
+    s_video_frames = s_audio_blocks = 0;
+}
+
+esp_err_t clip_ring_enable(bool enable)
+{
+    if (!s_lock) {
+        s_write = xSemaphoreCreateMutex();
+        if (!s_write) return ESP_ERR_NO_MEM;
+        s_lock = xSemaphoreCreateMutex();
+        if (!s_lock) {
+            vSemaphoreDelete(s_write);
+            s_write = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    xSemaphoreTake(s_write, portMAX_DELAY);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_pinned) {
+        xSemaphoreGive(s_lock);
+        xSemaphoreGive(s_write);
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ESP_OK;
+    if (enable != (s_buf != NULL)) ring_reset();
+    if (enable && !s_buf) {
+        err = ring_alloc();
+    } else if (!enable && s_buf) {
+        heap_caps_free(s_buf);
+        s_buf = NULL;
+        s_size = 0;
+        ESP_LOGI(TAG, "Clip ring disabled");
+    }
+    xSemaphoreGive(s_lock);
+    xSemaphoreGive(s_write);
+    return err;
+}
+
+esp_err_t clip_ring_set_size_kb(int kb)
+{
+    if (kb < CLIP_RING_KB_MIN) kb = CLIP_RING_KB_MIN;
+    if (kb > CLIP_RING_KB_MAX) kb = CLIP_RING_KB_MAX;
+    if (!s_lock) {
+        s_size_kb = kb;
+        return ESP_OK;
+    }
+
+    xSemaphoreTake(s_write, portMAX_DELAY);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    esp_err_t err = ESP_OK;
+    if (s_buf && s_pinned) {
+        err = ESP_ERR_INVALID_STATE;
+    } else {
+        s_size_kb = kb;
+        if (s_buf) {
+            // Free first so the new ring can use the old one's PSRAM
+            heap_caps_free(s_buf);
+            s_buf = NULL;
+            s_size = 0;
+            ring_reset();
+            err = ring_alloc();
+        }
+    }
+    xSemaphoreGive(s_lock);
+    xSemaphoreGive(s_write);
+    return err;
+}
+
+int clip_ring_size_kb(void)
+{
+    return s_size_kb;
+}
+
+bool clip_ring_enabled(void)
+{
+    return s_buf != NULL;
+}
+
+void clip_ring_push_video(const uint8_t *jpg, size_t len, int64_t ts_us)
+{
+    if (!s_buf) return;
+
+    // Record at CLIP_FPS no matter how fast the sensor runs (10% slack so
+    // a camera at exactly CLIP_FPS isn't halved by jitter)
+    if (s_last_video_us && ts_us - s_last_video_us < 900000 / CLIP_FPS) return;
+    s_last_video_us = ts_us;
+
+    clip_rec_t hdr = {
+        .len = len,
+        .type = CLIP_REC_VIDEO,
+        .ts_us = ts_us,
+    };
+    push(&hdr, jpg);
+}
+
+void clip_ring_push_audio(const uint8_t *pcm, size_t len, int rate, int bits, int64_t ts_us)
+{
+    if (!s_buf) return;
+
+    clip_rec_t hdr = {
+        .len = len,
+        .type = CLIP_REC_AUDIO,
+        .bits = bits,
+        .rate = rate,
+        .ts_us = ts_us,
+    };
+    push(&hdr, pcm);
+}
+
+void clip_ring_get_status(clip_ring_status_t *status)
+{
+    memset(status, 0, sizeof(*status));
+    if (!s_lock) return;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    status->enabled = s_buf != NULL;
+    status->size = s_size;
+    status->size_wanted = (size_t)s_size_kb * 1024;
+    status->used = s_head - s_tail;
+    status->video_frames = s_video_frames;
+    status->audio_blocks = s_audio_blocks;
+    status->skipped = s_skipped;
+    status->exporting = s_pinned;
+
+    // Oldest timestamp: first real record from the tail
+    for (uint64_t pos = s_tail; pos < s_head; pos += rec_span(pos)) {
+        clip_rec_t *rec = rec_at(pos);
+        if (rec && rec->type != CLIP_REC_PAD) {
+            status->seconds = (s_newest_us - rec->ts_us) / 1000000.0f;
+            if (status->used && status->seconds > 0) {
+                status->full_seconds = status->seconds * s_size / status->used;
+            }
+            break;
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+esp_err_t clip_ring_pin(int64_t from_us, clip_cursor_t *cur)
+{
+    if (!s_lock) return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (!s_buf || s_pinned) {
+        xSemaphoreGive(s_lock);
+        return s_buf ? ESP_ERR_INVALID_STATE : ESP_ERR_NOT_FOUND;
+    }
+    uint64_t pos = s_tail;
+    while (pos < s_head) {
+        clip_rec_t *rec = rec_at(pos);
+        if (rec && rec->type != CLIP_REC_PAD && rec->ts_us >= from_us) break;
+        pos += rec_span(pos);
+    }
+    s_pinned = true;
+    s_pin = pos;
+    cur->pos = pos;
+    cur->end = UINT64_MAX;
+    xSemaphoreGive(s_lock);
+    return ESP_OK;
+}
+
+bool clip_ring_next(clip_cursor_t *cur, int64_t until_us, clip_rec_t *rec, const uint8_t **payload)
+{
+    bool found = false;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    while (cur->pos < s_head && cur->pos < cur->end) {
+        clip_rec_t *hdr = rec_at(cur->pos);
+        size_t span = rec_span(cur->pos);
+        if (hdr && hdr->type != CLIP_REC_PAD) {
+            if (hdr->ts_us > until_us) break;
+            *rec = *hdr;
+            *payload = (const uint8_t *)(hdr + 1);
+            cur->pos += span;
+            found = true;
+            break;
+        }
+        cur->pos += span;
+    }
+    xSemaphoreGive(s_lock);
+    return found;
+}
+
+void clip_ring_release(const clip_cursor_t *cur)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_pinned && cur->pos > s_pin) s_pin = cur->pos;
+    xSemaphoreGive(s_lock);
+}
+
+void clip_ring_unpin(void)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_pinned = false;
+    xSemaphoreGive(s_lock);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+// Pre-event ring: the last few seconds of JPEG frames and PCM blocks kept
+// in PSRAM so /api/clip can export what happened before a request. Its size
+// is the clip_kb camera setting. CLIP_RING_KB_DEFAULT fits next to the
+// frame buffers on a 4 MB PSRAM board and holds about 5 s of VGA at
+// CLIP_FPS plus 16-bit mic audio; before=10&after=5 takes about 6 MB. The
+// ring never takes the last CLIP_PSRAM_RESERVE_KB of PSRAM, so on a board
+// with less free it is smaller than asked (see clip_ring_status_t).
+#define CLIP_RING_KB_DEFAULT  2048
+#define CLIP_RING_KB_MIN      256
+#define CLIP_RING_KB_MAX      16384
+#define CLIP_PSRAM_RESERVE_KB 512     // frame cache, scaled streams, audio ring
+#define CLIP_FPS              10      // video frames recorded per second
+#define CLIP_MAX_AFTER_S      30      // longest ?after= accepted
+#define CLIP_MAX_BEFORE_S     600     // longest ?before= accepted, well past any ring
+
+typedef enum {
+    CLIP_REC_PAD = 0,
+    CLIP_REC_VIDEO,
+    CLIP_REC_AUDIO,
+} clip_rec_type_t;
+
+// Record header; the payload follows it in the ring
+typedef struct {
+    uint32_t len;
+    uint8_t type;
+    uint8_t bits;          // audio sample bits
+    uint16_t reserved;
+    uint32_t rate;         // audio sample rate
+    int64_t ts_us;         // capture time (start of block for audio)
+} clip_rec_t;
+
+typedef struct {
+    bool enabled;
+    size_t size;           // bytes allocated for the ring
+    size_t size_wanted;    // bytes asked for by clip_kb
+    size_t used;
+    float seconds;         // time span currently held
+    float full_seconds;    // span when full, estimated from what it holds, 0 = unknown
+    uint32_t video_frames;
+    uint32_t audio_blocks;
+    uint32_t skipped;      // records not stored because an export pinned the ring
+    bool exporting;
+} clip_ring_status_t;
+
+// Read position of an export. Records from the pin onwards are never
+// overwritten, so payload pointers stay valid until clip_ring_release()
+// moves the pin past them. A cursor can be copied to walk a span twice.
+typedef struct {
+    uint64_t pos;
+    uint64_t end;          // stop here (set after a first pass), UINT64_MAX = head
+} clip_cursor_t;
+
+esp_err_t clip_ring_enable(bool enable);
+bool clip_ring_enabled(void);
+// Ring size in KB; reallocates (and empties) an enabled ring
+esp_err_t clip_ring_set_size_kb(int kb);
+int clip_ring_size_kb(void);
+void clip_ring_push_video(const uint8_t *jpg, size_t len, int64_t ts_us);
+void clip_ring_push_audio(const uint8_t *pcm, size_t len, int rate, int bits, int64_t ts_us);
+void clip_ring_get_status(clip_ring_status_t *status);
+
+// Export side: only one reader at a time
+esp_err_t clip_ring_pin(int64_t from_us, clip_cursor_t *cur);
+bool clip_ring_next(clip_cursor_t *cur, int64_t until_us, clip_rec_t *rec, const uint8_t **payload);
+void clip_ring_release(const clip_cursor_t *cur);
+void clip_ring_unpin(void);
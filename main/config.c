@@ -1,10 +1,12 @@
 #include "config.h"
+#include "pcm_convert.h"
 
 #include <string.h>
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "esp_wifi.h"
 #include "esp_netif.h"
+#include "esp_netif_sntp.h"
 #include "esp_event.h"
 #include "nvs.h"
 #include "nvs_flash.h"
@@ -16,9 +18,11 @@
 static const char *TAG = "settings";
 
 #define NVS_NAMESPACE "chute"
+#define SNTP_SERVER   "pool.ntp.org"    // wall clock for the OSD timestamp
 
 // Globals
-volatile int mic_gain = 8;
+volatile int mic_gain_db = PCM_GAIN_DB_DEFAULT;
+volatile int32_t mic_gain_q15 = 0;
 int stored_sample_rate = 22050;
 int stored_wav_bits = 16;
 char stored_ssid[64] = "";
@@ -67,6 +71,12 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
         ESP_LOGI(TAG, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
         s_retry_num = 0;
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+
+        static bool sntp_started = false;
+        if (!sntp_started) {
+            esp_sntp_config_t sntp_config = ESP_NETIF_SNTP_DEFAULT_CONFIG(SNTP_SERVER);
+            sntp_started = esp_netif_sntp_init(&sntp_config) == ESP_OK;
+        }
     }
 }
 
@@ -114,9 +124,12 @@ void loadSettings(void)
             strcpy(stored_hostname, "chute");
         }
 
-        int32_t gain = 8;
-        if (nvs_get_i32(handle, "mic_gain", &gain) == ESP_OK) {
-            mic_gain = (int)gain;
+        // Gain in dB; before that, an integer multiplier under "mic_gain"
+        int32_t gain = 0;
+        if (nvs_get_i32(handle, "mic_gain_db", &gain) == ESP_OK) {
+            mic_gain_db = (int)gain;
+        } else if (nvs_get_i32(handle, "mic_gain", &gain) == ESP_OK && gain > 0) {
+            mic_gain_db = pcm_gain_db_from_factor((int)gain);
         }
 
         int32_t sr = 0;
@@ -134,11 +147,12 @@ void loadSettings(void)
         ESP_LOGW(TAG, "NVS open failed (first boot?), using defaults");
     }
 
-    if (mic_gain < 1) mic_gain = 1;
-    if (mic_gain > 32) mic_gain = 32;
+    if (mic_gain_db < PCM_GAIN_DB_MIN) mic_gain_db = PCM_GAIN_DB_MIN;
+    if (mic_gain_db > PCM_GAIN_DB_MAX) mic_gain_db = PCM_GAIN_DB_MAX;
+    mic_gain_q15 = pcm_gain_q15(mic_gain_db);
 
-    ESP_LOGI(TAG, "Settings loaded - SSID: '%s', pass: '%s', mic_gain: %d, wifi_mode: '%s', ap_ssid: '%s'",
-        stored_ssid, stored_password, mic_gain, stored_wifi_mode, stored_ap_ssid);
+    ESP_LOGI(TAG, "Settings loaded - SSID: '%s', pass: '%s', mic_gain: %d dB, wifi_mode: '%s', ap_ssid: '%s'",
+        stored_ssid, stored_password, mic_gain_db, stored_wifi_mode, stored_ap_ssid);
 }
 
 void saveWiFiCredentials(const char *ssid, const char *password)
@@ -159,20 +173,21 @@ void saveWiFiCredentials(const char *ssid, const char *password)
     ESP_LOGI(TAG, "WiFi credentials saved - SSID: '%s', pass: '%s'", stored_ssid, stored_password);
 }
 
-void saveMicGain(int gain)
+void saveMicGain(int db)
 {
-    if (gain < 1) gain = 1;
-    if (gain > 32) gain = 32;
-    mic_gain = gain;
+    if (db < PCM_GAIN_DB_MIN) db = PCM_GAIN_DB_MIN;
+    if (db > PCM_GAIN_DB_MAX) db = PCM_GAIN_DB_MAX;
+    mic_gain_db = db;
+    mic_gain_q15 = pcm_gain_q15(db);
 
     nvs_handle_t handle;
     if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
-        nvs_set_i32(handle, "mic_gain", gain);
+        nvs_set_i32(handle, "mic_gain_db", db);
         nvs_commit(handle);
         nvs_close(handle);
     }
 
-    ESP_LOGI(TAG, "Mic gain saved: %d", gain);
+    ESP_LOGI(TAG, "Mic gain saved: %d dB", db);
 }
 
 void saveAuthPassword(const char *pass)
@@ -5,7 +5,8 @@
 #include <stddef.h>
 
 // Persistent settings (globals)
-extern volatile int mic_gain;
+extern volatile int mic_gain_db;
+extern volatile int32_t mic_gain_q15;     // mic_gain_db for the PCM kernels (pcm_convert.h)
 extern int stored_sample_rate;
 extern int stored_wav_bits;
 extern char stored_ssid[64];
@@ -20,7 +21,7 @@ extern bool wifi_ap_active;
 // NVS
 void loadSettings(void);
 void saveWiFiCredentials(const char *ssid, const char *password);
-void saveMicGain(int gain);
+void saveMicGain(int db);
 void saveAuthPassword(const char *pass);
 void saveWiFiMode(const char *mode);
 void saveApSsid(const char *ssid);
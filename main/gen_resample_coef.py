@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+"""Generate the resampler's coefficient tables (resample_coef.h).
+
+Run by the build (main/CMakeLists.txt and test/CMakeLists.txt):
+    gen_resample_coef.py <http_audio_stream.h> <resample_coef.h>
+One table per output rate, all from the mic's capture rate (SAMPLE_RATE,
+read from http_audio_stream.h): a low-pass
+just below the output Nyquist, Blackman-windowed sinc, spanning
+ZERO_CROSSINGS output periods each side, as PHASES + 1 sub-sample phases of
+Q15 taps. Each phase sums to exactly 32768 (unity gain at DC).
+"""
+
+import math
+import re
+import sys
+
+OUT_RATES = (8000, 11025, 16000, 22050)
+PHASES = 64
+ZERO_CROSSINGS = 8
+CUTOFF_PCT = 90  # passband edge, % of the output Nyquist
+
+
+def tap(fc, t, span):
+    if abs(t) >= span:
+        return 0.0
+    x = 2 * fc * t
+    sinc = 1.0 if abs(x) < 1e-9 else math.sin(math.pi * x) / (math.pi * x)
+    w = 0.42 + 0.5 * math.cos(math.pi * t / span) + 0.08 * math.cos(2 * math.pi * t / span)
+    return 2 * fc * sinc * w
+
+
+def sample_rate(header):
+    with open(header) as f:
+        m = re.search(r"^#define\s+SAMPLE_RATE\s+(\d+)", f.read(), re.M)
+    if not m:
+        sys.exit("%s: no #define SAMPLE_RATE" % header)
+    return int(m.group(1))
+
+
+def table(in_rate, out_rate):
+    taps = (2 * ZERO_CROSSINGS * in_rate + out_rate - 1) // out_rate
+    half = taps // 2
+    fc = 0.5 * out_rate / in_rate * CUTOFF_PCT / 100
+    phases = []
+    for p in range(PHASES + 1):
+        h = [tap(fc, p / PHASES + half - 1 - j, taps / 2) for j in range(taps)]
+        s = sum(h)
+        q = [round(v / s * 32768) for v in h]
+        # Rounding leftovers go to the largest tap
+        q[max(range(taps), key=lambda j: h[j])] += 32768 - sum(q)
+        phases.append(q)
+    return taps, phases
+
+
+def main(header, path):
+    in_rate = sample_rate(header)
+    out = [
+        "// Generated by gen_resample_coef.py, do not edit",
+        "#pragma once",
+        "",
+        "#define RESAMPLE_PHASES          %d" % PHASES,
+        "",
+    ]
+    entries = []
+    # Rates at or above the capture rate pass through
+    for rate in (r for r in OUT_RATES if r < in_rate):
+        taps, phases = table(in_rate, rate)
+        name = "s_resample_%d_%d" % (in_rate, rate)
+        out.append("static const int16_t %s[%d][%d] = {" % (name, PHASES + 1, taps))
+        for q in phases:
+            out.append("    {" + ", ".join(str(v) for v in q) + "},")
+        out.append("};")
+        out.append("")
+        entries.append("    { %d, %d, %d, &%s[0][0] }," % (in_rate, rate, taps, name))
+    out.append("static const resample_table_t s_resample_tables[] = {")
+    out.extend(entries)
+    out.append("};")
+    with open(path, "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit("usage: gen_resample_coef.py <http_audio_stream.h> <resample_coef.h>")
+    main(sys.argv[1], sys.argv[2])
@@ -1,28 +1,71 @@
 #include "http_audio_stream.h"
+#include "audio_codec.h"
+#include "pcm_convert.h"
 #include "http_ui.h"
 #include "config.h"
+#include "clip_ring.h"
+#include "stream_engine.h"
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
 
-#include "esp_http_server.h"
+#include "esp_heap_caps.h"
+#include "esp_psram.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/i2s_std.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
 
 static const char *TAG = "http_audio";
 
 // Persistent I2S channel handle — allocated once at startup
 static i2s_chan_handle_t rx_handle = NULL;
 
-// Async streaming state
-static volatile bool s_audio_stop = false;
-static volatile TaskHandle_t s_audio_task = NULL;
+// One capture task reads the I2S channel into a ring of raw DMA blocks
+// while any reader is open. Readers follow it lock-free: the task fills
+// the slot after the newest one and only then publishes it by bumping
+// s_write_seq, and a reader checks after converting a block that it wasn't
+// overwritten meanwhile.
+typedef struct {
+    size_t len;
+    int64_t ts_us;              // capture time of the first sample
+    uint8_t *buf;               // DMA_BUF_LEN bytes of I2S samples
+} audio_block_t;
+
+struct audio_reader {
+    bool used;
+    volatile bool stopped;      // mic stopped or reconfigured
+    int rate;
+    audio_resampler_t resampler;  // from SAMPLE_RATE, unless rate is that
+    int bits;                   // PCM bits of the last read ...
+    pcm_convert_fn convert;     // ... and the kernel for them
+    uint32_t seq;               // next block to read
+    uint32_t dropped;
+    EventBits_t bit;
+};
+
+static audio_block_t s_ring[AUDIO_RING_BLOCKS];
+static uint32_t s_ring_blocks = 0;              // allocated, 0 without a ring
+static atomic_uint s_write_seq;                 // blocks published so far
+static audio_reader_t s_readers[AUDIO_MAX_READERS];
+static int s_reader_count = 0;
+static uint32_t s_dropped = 0;                  // by readers closed so far
+static volatile bool s_capture_stop = false;
+static volatile TaskHandle_t s_capture_task = NULL;
+static SemaphoreHandle_t s_reader_lock = NULL;  // reader slots and the task's lifetime
+static EventGroupHandle_t s_audio_events = NULL; // a reader's bit: new block published
+static volatile int s_listeners = 0;            // /audio listeners the engine serves
+static bool s_background = false;               // keep capturing with no listeners
+static audio_reader_t *s_bg_reader = NULL;      // holds the capture task open for that
 
 static esp_err_t mic_i2s_init(void)
 {
-    int sample_rate = stored_sample_rate;
+    int sample_rate = SAMPLE_RATE;
     int sample_bits = SAMPLE_BITS;
 
     i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_MIC_PORT, I2S_ROLE_MASTER);
@@ -70,26 +113,225 @@ static esp_err_t mic_i2s_init(void)
     return ESP_OK;
 }
 
-void mic_i2s_reinit(void)
+// Kernel converting I2S samples to out_bits PCM (16 or 24) with gain
+static pcm_convert_fn audio_kernel(int out_bits)
 {
-    // Stop active stream first
-    if (s_audio_task) {
-        s_audio_stop = true;
-        for (int i = 0; i < 30 && s_audio_task; i++) {
-            vTaskDelay(pdMS_TO_TICKS(100));
+    return pcm_convert_get(SAMPLE_BITS, SAMPLE_BITS == 32 ? out_bits : 16);
+}
+
+// One block through a kernel with the current gain; returns the PCM size
+static size_t audio_convert(pcm_convert_fn convert, int out_bits, const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t samples = len / (SAMPLE_BITS / 8);
+    convert(in, out, samples, mic_gain_q15);
+    return samples * (SAMPLE_BITS == 32 ? out_bits : 16) / 8;
+}
+
+static void audio_capture_task(void *arg)
+{
+    // Clip ring copy, at the capture rate in the /audio PCM bit depth
+    int clip_bits = (SAMPLE_BITS == 32 && stored_wav_bits == 24) ? 24 : 16;
+    pcm_convert_fn clip_convert = audio_kernel(clip_bits);
+    uint8_t *clip = (uint8_t *)malloc(DMA_BUF_LEN);
+
+    ESP_LOGI(TAG, "Audio capture started (I2S port %d, rate %d, bits %d, gain %d dB)",
+             I2S_MIC_PORT, SAMPLE_RATE, SAMPLE_BITS, mic_gain_db);
+    while (true) {
+        // Exit with the last reader; decided under the lock (and the channel
+        // disabled) so a reader opening now either sees us or starts anew
+        xSemaphoreTake(s_reader_lock, portMAX_DELAY);
+        if (!s_reader_count || s_capture_stop) {
+            // Readers still open (stop or error) end too
+            for (int i = 0; i < AUDIO_MAX_READERS; i++) {
+                if (s_readers[i].used) s_readers[i].stopped = true;
+            }
+            i2s_channel_disable(rx_handle);
+            s_capture_task = NULL;
+            xSemaphoreGive(s_reader_lock);
+            xEventGroupSetBits(s_audio_events, (1 << AUDIO_MAX_READERS) - 1);
+            if (s_listeners) stream_engine_wake();
+            break;
+        }
+        xSemaphoreGive(s_reader_lock);
+
+        uint32_t seq = atomic_load_explicit(&s_write_seq, memory_order_relaxed);
+        audio_block_t *b = &s_ring[seq % s_ring_blocks];
+        size_t bytes_read = 0;
+        esp_err_t rd = i2s_channel_read(rx_handle, b->buf, DMA_BUF_LEN,
+                                        &bytes_read, pdMS_TO_TICKS(1000));
+        if (rd == ESP_ERR_TIMEOUT) {
+            ESP_LOGW(TAG, "I2S read timeout");
+            continue;
+        }
+        if (rd != ESP_OK) {
+            ESP_LOGE(TAG, "I2S read failed: %s", esp_err_to_name(rd));
+            s_capture_stop = true;
+            continue;
+        }
+        if (!bytes_read) continue;
+
+        // Capture time of the block's first sample
+        b->len = bytes_read;
+        b->ts_us = esp_timer_get_time() -
+            (int64_t)(bytes_read / (SAMPLE_BITS / 8)) * 1000000 / SAMPLE_RATE;
+        atomic_store_explicit(&s_write_seq, seq + 1, memory_order_release);
+        xEventGroupSetBits(s_audio_events, (1 << AUDIO_MAX_READERS) - 1);
+        if (s_listeners) stream_engine_wake();
+
+        if (clip && clip_ring_enabled()) {
+            size_t n = audio_convert(clip_convert, clip_bits, b->buf, bytes_read, clip);
+            clip_ring_push_audio(clip, n, SAMPLE_RATE, clip_bits, b->ts_us);
         }
     }
 
-    if (rx_handle) {
-        i2s_del_channel(rx_handle);
-        rx_handle = NULL;
+    free(clip);
+    ESP_LOGI(TAG, "Audio capture stopped");
+    vTaskDelete(NULL);
+}
+
+// Stop the capture task (ending every reader) and wait for it to release
+// the channel
+static bool audio_capture_stop(void)
+{
+    if (!s_capture_task) return true;
+    s_capture_stop = true;
+    for (int i = 0; i < 30 && s_capture_task; i++) {
+        vTaskDelay(pdMS_TO_TICKS(100));
     }
+    return s_capture_task == NULL;
+}
 
-    if (mic_i2s_init() != ESP_OK) {
-        ESP_LOGE(TAG, "I2S reinit failed");
-        mic_available = false;
-    } else {
-        mic_available = true;
+audio_reader_t *audio_reader_open(int rate)
+{
+    if (!rx_handle || !s_reader_lock || !s_ring_blocks) return NULL;
+    if (!AUDIO_RATE_VALID(rate)) return NULL;
+
+    xSemaphoreTake(s_reader_lock, portMAX_DELAY);
+    audio_reader_t *r = NULL;
+    for (int i = 0; i < AUDIO_MAX_READERS && !r; i++) {
+        if (!s_readers[i].used) r = &s_readers[i];
+    }
+    if (!r) {
+        ESP_LOGW(TAG, "All %d audio readers in use", AUDIO_MAX_READERS);
+    } else if (!audio_resampler_init(&r->resampler, SAMPLE_RATE, rate)) {
+        ESP_LOGE(TAG, "No resampler for %d -> %d Hz", SAMPLE_RATE, rate);
+        r = NULL;
+    } else if (!s_capture_task) {
+        s_capture_stop = false;
+        TaskHandle_t task = NULL;
+        esp_err_t err = i2s_channel_enable(rx_handle);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "i2s_channel_enable failed: %s", esp_err_to_name(err));
+            audio_resampler_free(&r->resampler);
+            r = NULL;
+        } else if (xTaskCreate(audio_capture_task, "aud_cap", 3072, NULL, 6, &task) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create audio capture task");
+            i2s_channel_disable(rx_handle);
+            audio_resampler_free(&r->resampler);
+            r = NULL;
+        } else {
+            s_capture_task = task;
+        }
+    }
+    if (r) {
+        r->used = true;
+        r->stopped = false;
+        r->rate = rate;
+        r->bits = 0;
+        r->seq = atomic_load_explicit(&s_write_seq, memory_order_acquire);
+        r->dropped = 0;
+        r->bit = 1 << (r - s_readers);
+        xEventGroupClearBits(s_audio_events, r->bit);
+        s_reader_count++;
+    }
+    xSemaphoreGive(s_reader_lock);
+    return r;
+}
+
+bool audio_reader_stopped(audio_reader_t *r)
+{
+    return r->stopped;
+}
+
+void audio_reader_close(audio_reader_t *r)
+{
+    if (!r) return;
+    xSemaphoreTake(s_reader_lock, portMAX_DELAY);
+    r->used = false;
+    s_reader_count--;
+    s_dropped += r->dropped;
+    audio_resampler_free(&r->resampler);
+    xSemaphoreGive(s_reader_lock);
+}
+
+// Next block, waiting up to wait ticks for one
+static int audio_reader_take(audio_reader_t *r, uint8_t *out, int out_bits, int64_t *ts_us, TickType_t wait)
+{
+    while (!r->stopped) {
+        uint32_t w = atomic_load_explicit(&s_write_seq, memory_order_acquire);
+        if (w == r->seq) {
+            EventBits_t bits = xEventGroupWaitBits(s_audio_events, r->bit, pdTRUE, pdFALSE, wait);
+            if (!(bits & r->bit)) return 0;
+            continue;
+        }
+        // Fell behind the ring: skip to the newest block
+        if (w - r->seq >= s_ring_blocks) {
+            r->dropped += w - 1 - r->seq;
+            r->seq = w - 1;
+        }
+
+        const audio_block_t *b = &s_ring[r->seq % s_ring_blocks];
+        int64_t ts = b->ts_us;
+        bool resample = r->rate != SAMPLE_RATE;
+        int bits = resample ? 16 : out_bits;
+        if (bits != r->bits) {
+            r->bits = bits;
+            r->convert = audio_kernel(bits);
+        }
+        size_t out_bytes = audio_convert(r->convert, bits, b->buf, b->len, out);
+        // Overwritten while converting (the task is filling seq + RING)
+        if (atomic_load_explicit(&s_write_seq, memory_order_acquire) - r->seq >= s_ring_blocks) {
+            continue;
+        }
+        r->seq++;
+        *ts_us = ts;
+        if (resample) {
+            int16_t *pcm = (int16_t *)out;
+            out_bytes = audio_resample(&r->resampler, pcm, out_bytes / 2, pcm) * sizeof(int16_t);
+        }
+        return out_bytes;
+    }
+    return -1;
+}
+
+int audio_reader_read(audio_reader_t *r, uint8_t *out, int out_bits, int64_t *ts_us)
+{
+    return audio_reader_take(r, out, out_bits, ts_us, pdMS_TO_TICKS(1000));
+}
+
+void audio_get_stats(audio_stats_t *stats)
+{
+    xSemaphoreTake(s_reader_lock, portMAX_DELAY);
+    stats->readers = s_reader_count;
+    stats->blocks = atomic_load_explicit(&s_write_seq, memory_order_relaxed);
+    stats->dropped = s_dropped;
+    for (int i = 0; i < AUDIO_MAX_READERS; i++) {
+        if (s_readers[i].used) stats->dropped += s_readers[i].dropped;
+    }
+    xSemaphoreGive(s_reader_lock);
+}
+
+void audio_stream_set_background(bool enable)
+{
+    s_background = enable;
+    // A reader that's never read: it only keeps the capture task (and so
+    // the clip ring's audio) going. Reopened if capture stopped on an error.
+    if (s_bg_reader && (!enable || audio_reader_stopped(s_bg_reader))) {
+        audio_reader_close(s_bg_reader);
+        s_bg_reader = NULL;
+    }
+    if (enable && !s_bg_reader) {
+        s_bg_reader = audio_reader_open(SAMPLE_RATE);
     }
 }
 
@@ -112,209 +354,228 @@ static void initializeWAVHeader(struct WAVHeader *header, uint32_t sampleRate,
     header->subchunk2Size = 0xFFFFFFFF;
 }
 
-static void audio_stream_task(void *arg)
+static void initializeWAVHeaderAdpcm(struct WAVHeaderAdpcm *header, uint32_t sampleRate)
 {
-    httpd_req_t *req = (httpd_req_t *)arg;
-
-    if (!rx_handle) {
-        ESP_LOGE(TAG, "I2S not initialized");
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "I2S not ready");
-        goto done;
-    }
-
-    esp_err_t err = i2s_channel_enable(rx_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "i2s_channel_enable failed: %s", esp_err_to_name(err));
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "I2S enable failed");
-        goto done;
-    }
-
-    ESP_LOGI(TAG, "Audio stream started (I2S port %d, rate %d, wav_bits %d, gain %d)",
-             I2S_MIC_PORT, stored_sample_rate, stored_wav_bits, mic_gain);
-
-    int sample_rate = stored_sample_rate;
-    int wav_bits = stored_wav_bits;
-
-    struct WAVHeader wav_header;
-    initializeWAVHeader(&wav_header, sample_rate, wav_bits, 1);
+    uint16_t align = ADPCM_BLOCK_ALIGN(sampleRate);
+    uint16_t samples = ADPCM_BLOCK_SAMPLES(align);
 
-    httpd_resp_set_type(req, "audio/wav");
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    httpd_resp_set_hdr(req, "Accept-Ranges", "none");
-    httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store");
+    memcpy(header->chunkId, "RIFF", 4);
+    memcpy(header->format, "WAVE", 4);
+    memcpy(header->subchunk1Id, "fmt ", 4);
+    memcpy(header->factId, "fact", 4);
+    memcpy(header->subchunk2Id, "data", 4);
 
-    err = httpd_resp_send_chunk(req, (const char *)&wav_header, sizeof(wav_header));
-    if (err != ESP_OK) {
-        ESP_LOGW(TAG, "Failed to send WAV header: %s", esp_err_to_name(err));
-        i2s_channel_disable(rx_handle);
-        goto done;
-    }
+    header->chunkSize = 0xFFFFFFFF;
+    header->subchunk1Size = 20;
+    header->audioFormat = 0x11; // IMA ADPCM
+    header->numChannels = 1;
+    header->sampleRate = sampleRate;
+    header->byteRate = sampleRate * align / samples;
+    header->blockAlign = align;
+    header->bitsPerSample = 4;
+    header->cbSize = 2;
+    header->samplesPerBlock = samples;
+    header->factSize = 4;
+    header->sampleLength = 0xFFFFFFFF;
+    header->subchunk2Size = 0xFFFFFFFF;
+}
 
-    uint8_t i2s_buffer[DMA_BUF_LEN];
-    uint8_t out_buffer[DMA_BUF_LEN];
-    size_t bytes_read = 0;
-    int chunk_count = 0;
+// An /audio listener. The stream engine task converts and encodes its
+// blocks itself when the previous one has gone out, so a listener has no
+// task of its own; its buffers are in PSRAM when there is some.
+struct audio_listener {
+    int bits;
+    int rate;
+    audio_codec_t codec;
+    audio_reader_t *reader;
+    int16_t *in;                // encoded codecs: 16-bit PCM from the reader
+    int16_t *pcm;               // ADPCM: samples waiting for a whole block
+    int pcm_len;
+    int align;
+    adpcm_state_t adpcm;
+    uint8_t *block;             // being sent until the next call to next()
+};
+
+static void *audio_listener_alloc(size_t size)
+{
+    uint32_t caps = esp_psram_is_initialized() ? MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT
+                                               : MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    return heap_caps_malloc(size, caps);
+}
 
-    while (!s_audio_stop) {
-        esp_err_t rd = i2s_channel_read(rx_handle, i2s_buffer, sizeof(i2s_buffer),
-                                         &bytes_read, pdMS_TO_TICKS(1000));
-        if (rd == ESP_ERR_TIMEOUT) {
-            ESP_LOGW(TAG, "I2S read timeout");
-            continue;
-        }
-        if (rd != ESP_OK) {
-            ESP_LOGE(TAG, "I2S read failed: %s", esp_err_to_name(rd));
-            break;
-        }
+static void audio_listener_free(audio_listener_t *l)
+{
+    heap_caps_free(l->block);
+    heap_caps_free(l->in);
+    heap_caps_free(l->pcm);
+    free(l);
+}
 
-        if (bytes_read > 0) {
-            chunk_count++;
-            size_t out_bytes;
-            if (SAMPLE_BITS == 32 && wav_bits == 24) {
-                // 32-bit I2S → 24-bit PCM (3 bytes per sample, little-endian)
-                int samples_read = bytes_read / 4;
-                int32_t *samples32 = (int32_t *)i2s_buffer;
-                for (int i = 0; i < samples_read; i++) {
-                    int32_t amplified = (samples32[i] >> 8) * mic_gain;
-                    if (amplified > 8388607) amplified = 8388607;
-                    else if (amplified < -8388608) amplified = -8388608;
-                    out_buffer[i * 3]     = (amplified)       & 0xFF;
-                    out_buffer[i * 3 + 1] = (amplified >> 8)  & 0xFF;
-                    out_buffer[i * 3 + 2] = (amplified >> 16) & 0xFF;
-                }
-                out_bytes = samples_read * 3;
-            } else if (SAMPLE_BITS == 32) {
-                // 32-bit I2S → 16-bit PCM
-                int samples_read = bytes_read / 4;
-                int32_t *samples32 = (int32_t *)i2s_buffer;
-                int16_t *out16 = (int16_t *)out_buffer;
-                for (int i = 0; i < samples_read; i++) {
-                    int32_t amplified = (samples32[i] >> 16) * mic_gain;
-                    if (amplified > 32767) amplified = 32767;
-                    else if (amplified < -32768) amplified = -32768;
-                    out16[i] = (int16_t)amplified;
-                }
-                out_bytes = samples_read * sizeof(int16_t);
-            } else {
-                // 16-bit I2S → 16-bit PCM
-                int samples_read = bytes_read / 2;
-                int16_t *samples16 = (int16_t *)i2s_buffer;
-                int16_t *out16 = (int16_t *)out_buffer;
-                for (int i = 0; i < samples_read; i++) {
-                    int32_t amplified = (int32_t)samples16[i] * mic_gain;
-                    if (amplified > 32767) amplified = 32767;
-                    else if (amplified < -32768) amplified = -32768;
-                    out16[i] = (int16_t)amplified;
-                }
-                out_bytes = samples_read * sizeof(int16_t);
-            }
-            err = httpd_resp_send_chunk(req, (const char *)out_buffer, out_bytes);
-            if (err != ESP_OK) {
-                ESP_LOGI(TAG, "Audio client disconnected at chunk #%d", chunk_count);
-                break;
-            }
+// Add a block of 16-bit PCM to the listener's ADPCM input and encode every
+// whole ADPCM block into out; returns the bytes written
+static int audio_listener_encode(audio_listener_t *l, const int16_t *in, int samples, uint8_t *out)
+{
+    int per_block = ADPCM_BLOCK_SAMPLES(l->align);
+    int out_bytes = 0;
+    while (samples > 0) {
+        int n = per_block - l->pcm_len < samples ? per_block - l->pcm_len : samples;
+        memcpy(l->pcm + l->pcm_len, in, n * sizeof(int16_t));
+        l->pcm_len += n;
+        in += n;
+        samples -= n;
+        if (l->pcm_len == per_block) {
+            adpcm_encode_block(&l->adpcm, l->pcm, l->align, out + out_bytes);
+            out_bytes += l->align;
+            l->pcm_len = 0;
         }
     }
-
-    httpd_resp_send_chunk(req, NULL, 0);
-    i2s_channel_disable(rx_handle);
-
-done:
-    httpd_req_async_handler_complete(req);
-    ESP_LOGI(TAG, "Audio stream ended");
-    s_audio_task = NULL;
-    vTaskDelete(NULL);
+    return out_bytes;
 }
 
-static esp_err_t audio_stream_handler(httpd_req_t *req)
+static const char *audio_codec_name(const audio_listener_t *l)
 {
-    if (!rx_handle) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Mic not available");
-        return ESP_FAIL;
+    switch (l->codec) {
+    case AUDIO_CODEC_ADPCM: return "IMA ADPCM";
+    case AUDIO_CODEC_PCMU:  return "G.711 u-law";
+    case AUDIO_CODEC_PCMA:  return "G.711 A-law";
+    default:                return l->bits == 24 ? "24-bit PCM" : "16-bit PCM";
     }
+}
 
-    // Stop any existing audio stream task
-    if (s_audio_task) {
-        ESP_LOGI(TAG, "Stopping previous audio stream");
-        s_audio_stop = true;
-        for (int i = 0; i < 30 && s_audio_task; i++) {
-            vTaskDelay(pdMS_TO_TICKS(100));
-        }
-        if (s_audio_task) {
-            ESP_LOGW(TAG, "Previous audio task did not stop in time");
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Previous stream still running");
-            return ESP_FAIL;
-        }
+audio_listener_t *audio_listener_open(audio_codec_t codec, int rate, uint8_t *wav, size_t *wav_len)
+{
+    if (!rx_handle) return NULL;
+    if (codec == AUDIO_CODEC_PCMU || codec == AUDIO_CODEC_PCMA) rate = G711_SAMPLE_RATE;
+
+    audio_listener_t *l = (audio_listener_t *)calloc(1, sizeof(audio_listener_t));
+    if (!l) return NULL;
+    l->codec = codec;
+    l->rate = rate;
+    // 24-bit PCM only at the capture rate, the resampler is 16-bit
+    if (codec == AUDIO_CODEC_PCM) l->bits = rate == SAMPLE_RATE ? stored_wav_bits : 16;
+    else l->bits = codec == AUDIO_CODEC_ADPCM ? 4 : 8;
+    l->block = (uint8_t *)audio_listener_alloc(DMA_BUF_LEN);
+    bool ok = l->block != NULL;
+    if (codec != AUDIO_CODEC_PCM) {
+        ok = ok && (l->in = (int16_t *)audio_listener_alloc(DMA_BUF_LEN)) != NULL;
+    }
+    if (codec == AUDIO_CODEC_ADPCM) {
+        l->align = ADPCM_BLOCK_ALIGN(rate);
+        l->pcm = (int16_t *)audio_listener_alloc(ADPCM_BLOCK_SAMPLES(l->align) * sizeof(int16_t));
+        ok = ok && l->pcm;
+    }
+    if (!ok || !(l->reader = audio_reader_open(rate))) {
+        audio_listener_free(l);
+        return NULL;
+    }
+    if (codec == AUDIO_CODEC_ADPCM) {
+        struct WAVHeaderAdpcm hdr;
+        initializeWAVHeaderAdpcm(&hdr, rate);
+        memcpy(wav, &hdr, sizeof(hdr));
+        *wav_len = sizeof(hdr);
+    } else if (codec == AUDIO_CODEC_PCMU || codec == AUDIO_CODEC_PCMA) {
+        struct WAVHeader hdr;
+        initializeWAVHeader(&hdr, G711_SAMPLE_RATE, 8, 1);
+        hdr.audioFormat = codec == AUDIO_CODEC_PCMU ? 7 : 6;   // WAVE_FORMAT_MULAW / _ALAW
+        memcpy(wav, &hdr, sizeof(hdr));
+        *wav_len = sizeof(hdr);
+    } else {
+        struct WAVHeader hdr;
+        initializeWAVHeader(&hdr, rate, l->bits, 1);
+        memcpy(wav, &hdr, sizeof(hdr));
+        *wav_len = sizeof(hdr);
     }
 
-    s_audio_stop = false;
+    s_listeners++;
+    ESP_LOGI(TAG, "Audio stream started (rate %d, %s)", l->rate, audio_codec_name(l));
+    return l;
+}
 
-    // Create async copy of the request — frees the httpd server task
-    httpd_req_t *async_req = NULL;
-    esp_err_t err = httpd_req_async_handler_begin(req, &async_req);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "httpd_req_async_handler_begin failed: %s", esp_err_to_name(err));
-        return ESP_FAIL;
+const uint8_t *audio_listener_next(audio_listener_t *l, size_t *len)
+{
+    // ADPCM may need more than one block of input for a block of output
+    while (true) {
+        int64_t ts_us;
+        int out_bytes;
+        if (l->codec != AUDIO_CODEC_PCM) {
+            // After the gain stage: 16-bit PCM, then encoded into the block
+            int bytes = audio_reader_take(l->reader, (uint8_t *)l->in, 16, &ts_us, 0);
+            if (bytes <= 0) {
+                out_bytes = bytes;
+            } else if (l->codec == AUDIO_CODEC_ADPCM) {
+                out_bytes = audio_listener_encode(l, l->in, bytes / 2, l->block);
+                if (!out_bytes) continue;
+            } else {
+                out_bytes = bytes / 2;
+                if (l->codec == AUDIO_CODEC_PCMU) g711_ulaw_encode_block(l->in, out_bytes, l->block);
+                else g711_alaw_encode_block(l->in, out_bytes, l->block);
+            }
+        } else {
+            out_bytes = audio_reader_take(l->reader, l->block, l->bits, &ts_us, 0);
+        }
+        if (out_bytes <= 0) return NULL;
+        *len = out_bytes;
+        return l->block;
     }
+}
 
-    // Spawn streaming in a dedicated FreeRTOS task
-    BaseType_t ret = xTaskCreate(audio_stream_task, "aud_stream", 12288,
-                                 async_req, 5, (TaskHandle_t *)&s_audio_task);
-    if (ret != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create audio stream task");
-        httpd_req_async_handler_complete(async_req);
-        return ESP_FAIL;
-    }
+bool audio_listener_ended(audio_listener_t *l)
+{
+    return audio_reader_stopped(l->reader);
+}
 
-    ESP_LOGI(TAG, "Audio stream started (async)");
-    return ESP_OK;
+void audio_listener_close(audio_listener_t *l)
+{
+    s_listeners--;
+    audio_reader_close(l->reader);
+    audio_listener_free(l);
 }
 
 void stop_audio_stream(void)
 {
-    if (s_audio_task) {
-        s_audio_stop = true;
-        for (int i = 0; i < 30 && s_audio_task; i++) {
-            vTaskDelay(pdMS_TO_TICKS(100));
-        }
-    }
+    audio_capture_stop();
     if (rx_handle) {
         i2s_del_channel(rx_handle);
         rx_handle = NULL;
     }
 }
 
-void start_http_audio_stream(void)
+void init_audio_stream(void)
 {
+    s_reader_lock = xSemaphoreCreateMutex();
+    s_audio_events = xEventGroupCreate();
+    // PSRAM for the full ring, otherwise a short one in internal RAM
+    bool psram = esp_psram_is_initialized();
+    uint32_t blocks = psram ? AUDIO_RING_BLOCKS : AUDIO_RING_BLOCKS_DRAM;
+    uint32_t caps = psram ? MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT : MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    uint32_t n = 0;
+    for (; n < blocks; n++) {
+        s_ring[n].buf = (uint8_t *)heap_caps_malloc(DMA_BUF_LEN, caps);
+        if (!s_ring[n].buf) break;
+    }
+    if (n < blocks) {
+        // Readers see no ring and fail to open; the mic still comes up
+        ESP_LOGE(TAG, "No memory for the audio ring (%lu of %lu blocks)",
+                 (unsigned long)n, (unsigned long)blocks);
+        while (n > 0) {
+            n--;
+            free(s_ring[n].buf);
+            s_ring[n].buf = NULL;
+        }
+    } else {
+        s_ring_blocks = blocks;
+        ESP_LOGI(TAG, "Audio ring: %lu blocks in %s", (unsigned long)blocks, psram ? "PSRAM" : "internal RAM");
+    }
+
     // Initialize I2S once at startup
     esp_err_t err = mic_i2s_init();
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "I2S init failed, audio will be unavailable");
     } else {
         mic_available = true;
+        pcm_convert_log_cycles();
     }
 
-    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.server_port = 82;
-    config.ctrl_port = 32770;
-    config.max_open_sockets = 2;
-    config.lru_purge_enable = true;
-    config.send_wait_timeout = 2;
-    config.recv_wait_timeout = 2;
-
-    httpd_handle_t server = NULL;
-
-    ESP_LOGI(TAG, "Starting audio stream server on port %d", config.server_port);
-    if (httpd_start(&server, &config) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to start audio stream server");
-        return;
-    }
-
-    httpd_uri_t audio_uri = {
-        .uri = "/audio",
-        .method = HTTP_GET,
-        .handler = audio_stream_handler,
-        .user_ctx = NULL
-    };
-    httpd_register_uri_handler(server, &audio_uri);
+    // Background capture requested before the ring existed
+    if (s_background) audio_stream_set_background(true);
 }
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 // I2S pin configuration (AI-Thinker with INMP441)
 #define I2S_MIC_WS            2
@@ -16,14 +18,18 @@
 // XIAO_ESP32S3:
 // #define I2S_MIC_PORT       0
 
-// Sampling parameters
-#define SAMPLE_RATE       22050
+// Sampling parameters. The mic always captures at SAMPLE_RATE; every
+// reader resamples to its own rate (audio_codec.h), one of AUDIO_RATE_VALID.
+#define SAMPLE_RATE       44100
 #define SAMPLE_BITS       32
 // XIAO_ESP32S3:
 // #define SAMPLE_BITS    16
 #define DMA_BUF_COUNT     8
 #define DMA_BUF_LEN       4096
 
+#define AUDIO_RATE_VALID(rate) ((rate) == 8000 || (rate) == 11025 || (rate) == 16000 || \
+                                (rate) == 22050 || (rate) == 44100)
+
 struct WAVHeader {
     char chunkId[4];
     uint32_t chunkSize;
@@ -40,6 +46,85 @@ struct WAVHeader {
     uint32_t subchunk2Size;
 };
 
-void start_http_audio_stream(void);
+// IMA ADPCM (format 0x11): the fmt chunk grows by samplesPerBlock, and a
+// fact chunk follows as compressed formats require
+struct WAVHeaderAdpcm {
+    char chunkId[4];
+    uint32_t chunkSize;
+    char format[4];
+    char subchunk1Id[4];
+    uint32_t subchunk1Size;
+    uint16_t audioFormat;
+    uint16_t numChannels;
+    uint32_t sampleRate;
+    uint32_t byteRate;
+    uint16_t blockAlign;
+    uint16_t bitsPerSample;
+    uint16_t cbSize;
+    uint16_t samplesPerBlock;
+    char factId[4];
+    uint32_t factSize;
+    uint32_t sampleLength;
+    char subchunk2Id[4];
+    uint32_t subchunk2Size;
+};
+
+// Shared mic: one capture task reads the I2S channel into a ring of
+// AUDIO_RING_BLOCKS DMA blocks while any reader is open, and every reader
+// (/audio listeners in the stream engine, RTSP sessions, the WebSocket
+// audio pump) follows it
+// with its own cursor. A reader that falls more than the ring behind skips
+// to the newest block; it never holds up the capture task or the others.
+#define AUDIO_MAX_READERS     4       // at most 24 (event group bits)
+// Without PSRAM the ring comes from internal RAM and is cut to
+// AUDIO_RING_BLOCKS_DRAM (32 KB). Both are powers of two, so the block
+// index stays continuous when the sequence counter wraps.
+#define AUDIO_RING_BLOCKS     32      // ~0.75 s at 44100 Hz, 32-bit samples
+#define AUDIO_RING_BLOCKS_DRAM 8      // ~0.19 s
+
+// open() returns NULL without the mic, with all readers in use or for a
+// rate that isn't AUDIO_RATE_VALID. read() converts the reader's next
+// block to out_bits PCM (16 or 24) with gain into out (DMA_BUF_LEN bytes),
+// resampled to the reader's rate (always 16-bit then), and returns its
+// size; 0 if no block came within a second, -1 once the mic stopped
+// (reconfigured); close then.
+typedef struct audio_reader audio_reader_t;
+audio_reader_t *audio_reader_open(int rate);
+bool audio_reader_stopped(audio_reader_t *r);
+int audio_reader_read(audio_reader_t *r, uint8_t *out, int out_bits, int64_t *ts_us);
+void audio_reader_close(audio_reader_t *r);
+
+typedef struct {
+    int readers;
+    uint32_t blocks;          // blocks captured since boot
+    uint32_t dropped;         // blocks skipped by readers that fell behind
+} audio_stats_t;
+
+void audio_get_stats(audio_stats_t *stats);
+
+// /audio listener for the stream engine, used only from its task: open()
+// takes a reader at rate (G.711 is always 8000 Hz) and writes the
+// response's WAV header into wav (at most sizeof(struct WAVHeaderAdpcm)
+// bytes, *wav_len set). next() converts the reader's next captured block
+// into that format without waiting and returns it, NULL if none is ready;
+// it stays valid until the next call. The capture task wakes the engine
+// for every block. ended() is true once the mic stopped (reconfigured).
+typedef enum {
+    AUDIO_CODEC_PCM,          // 16/24-bit PCM, as set in the audio settings
+    AUDIO_CODEC_ADPCM,        // IMA ADPCM (audio_codec.h), a quarter of 16-bit PCM
+    AUDIO_CODEC_PCMU,         // G.711 u-law at 8 kHz
+    AUDIO_CODEC_PCMA,         // G.711 A-law at 8 kHz
+} audio_codec_t;
+
+typedef struct audio_listener audio_listener_t;
+audio_listener_t *audio_listener_open(audio_codec_t codec, int rate, uint8_t *wav, size_t *wav_len);
+const uint8_t *audio_listener_next(audio_listener_t *l, size_t *len);
+bool audio_listener_ended(audio_listener_t *l);
+void audio_listener_close(audio_listener_t *l);
+
+// Keep the capture task running without listeners (feeds the clip ring);
+// takes one of the AUDIO_MAX_READERS
+void audio_stream_set_background(bool enable);
+
+void init_audio_stream(void);
 void stop_audio_stream(void);
-void mic_i2s_reinit(void);
@@ -1,19 +1,26 @@
 #include "http_camera.h"
 #include "http_ui.h"
 #include "config.h"
-
+#include "video_adapt.h"
+#include "http_video_stream.h"
+#include "http_audio_stream.h"
+#include "clip_ring.h"
+#include "video_analyze.h"
+#include "video_overlay.h"
+
+#include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "esp_http_server.h"
 #include "esp_camera.h"
-#include "img_converters.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "nvs.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 
 static const char *TAG = "http_camera";
 
@@ -57,30 +64,51 @@ void loadCameraSettings(void)
     if (nvs_get_i32(h, "led_intensity", &val) == ESP_OK)  led_duty = val;
     if (nvs_get_i32(h, "led_stream", &val) == ESP_OK)    led_stream_enabled = (val != 0);
 
+    int32_t adaptive = 0, adaptive_fps = 15, adaptive_kbps = 0;
+    nvs_get_i32(h, "adaptive", &adaptive);
+    nvs_get_i32(h, "adaptive_fps", &adaptive_fps);
+    nvs_get_i32(h, "adaptive_kbps", &adaptive_kbps);
+    video_adapt_set_baseline(s->status.quality, s->status.framesize);
+    video_adapt_configure(adaptive != 0, adaptive_fps, adaptive_kbps);
+
+    int32_t motion = 0, motion_thresh = MOTION_THRESH_DEFAULT, motion_area = MOTION_AREA_DEFAULT;
+    nvs_get_i32(h, "motion", &motion);
+    nvs_get_i32(h, "motion_thresh", &motion_thresh);
+    nvs_get_i32(h, "motion_area", &motion_area);
+    video_motion_configure(motion != 0, motion_thresh, motion_area);
+    if (nvs_get_i32(h, "dedup", &val) == ESP_OK)           video_dedup_configure(val != 0);
+    int32_t focus = 0, focus_roi = FOCUS_ROI_DEFAULT;
+    nvs_get_i32(h, "focus", &focus);
+    nvs_get_i32(h, "focus_roi", &focus_roi);
+    video_focus_configure(focus != 0, focus_roi);
+    int32_t exposure = 0, exposure_assist = 0;
+    nvs_get_i32(h, "exposure", &exposure);
+    nvs_get_i32(h, "exposure_assist", &exposure_assist);
+    video_exposure_configure(exposure != 0, exposure_assist != 0);
+
+    video_mask_t masks[MASK_MAX];
+    int mask_count = 0;
+    for (int i = 0; i < MASK_MAX; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "mask%d", i);
+        if (nvs_get_i32(h, key, &val) == ESP_OK && video_mask_unpack(val, &masks[mask_count])) mask_count++;
+    }
+    if (mask_count) video_mask_set(masks, mask_count);
+    if (nvs_get_i32(h, "osd", &val) == ESP_OK)             video_osd_configure(val != 0);
+
+    if (nvs_get_i32(h, "clip_kb", &val) == ESP_OK)         clip_ring_set_size_kb(val);
+    bool clip = nvs_get_i32(h, "clip", &val) == ESP_OK && val && clip_ring_enable(true) == ESP_OK;
+    if (clip || motion)
+        video_stream_set_background(true);
+    if (clip)
+        audio_stream_set_background(true);
+
     nvs_close(h);
     ESP_LOGI(TAG, "Camera settings restored from NVS");
 }
 
 // ---------- Helpers ----------
 
-typedef struct {
-    httpd_req_t *req;
-    size_t len;
-} jpg_chunking_t;
-
-static size_t jpg_encode_stream(void *arg, size_t index, const void *data, size_t len)
-{
-    jpg_chunking_t *j = (jpg_chunking_t *)arg;
-    if (!index) {
-        j->len = 0;
-    }
-    if (httpd_resp_send_chunk(j->req, (const char *)data, len) != ESP_OK) {
-        return 0;
-    }
-    j->len += len;
-    return len;
-}
-
 static esp_err_t parse_get(httpd_req_t *req, char **obuf)
 {
     char *buf = NULL;
@@ -103,9 +131,20 @@ static esp_err_t parse_get(httpd_req_t *req, char **obuf)
     return ESP_FAIL;
 }
 
-static int print_reg(char *p, sensor_t *s, uint16_t reg, uint32_t mask)
+// Appends at *p without writing past end; on overflow *p is left at end
+static void json_add(char **p, char *end, const char *fmt, ...)
+{
+    size_t room = end - *p;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(*p, room, fmt, ap);
+    va_end(ap);
+    *p += (n < 0 || (size_t)n >= room) ? room : (size_t)n;
+}
+
+static void print_reg(char **p, char *end, sensor_t *s, uint16_t reg, uint32_t mask)
 {
-    return sprintf(p, "\"0x%x\":%u,", reg, s->get_reg(s, reg, mask));
+    json_add(p, end, "\"0x%x\":%u,", reg, s->get_reg(s, reg, mask));
 }
 
 // ---------- Handlers ----------
@@ -152,13 +191,63 @@ esp_err_t camera_control_handler(httpd_req_t *req)
     }
     int res = 0;
 
+    video_adapt_status_t adapt;
+    video_adapt_get_status(&adapt);
+    video_motion_status_t motion;
+    video_motion_get_status(&motion);
+    video_focus_status_t focus;
+    video_focus_get_status(&focus);
+    video_exposure_status_t expo;
+    video_exposure_get_status(&expo);
+
     if (!strcmp(variable, "framesize")) {
         if (s->pixformat == PIXFORMAT_JPEG) {
             res = s->set_framesize(s, (framesize_t)val);
+            if (res == 0) video_adapt_set_baseline(-1, val);
         }
     }
-    else if (!strcmp(variable, "quality"))
+    else if (!strcmp(variable, "quality")) {
         res = s->set_quality(s, val);
+        if (res == 0) video_adapt_set_baseline(val, -1);
+    }
+    else if (!strcmp(variable, "adaptive"))
+        video_adapt_configure(val != 0, adapt.target_fps, adapt.max_kbps);
+    else if (!strcmp(variable, "adaptive_fps"))
+        video_adapt_configure(adapt.enabled, val, adapt.max_kbps);
+    else if (!strcmp(variable, "adaptive_kbps"))
+        video_adapt_configure(adapt.enabled, adapt.target_fps, val);
+    else if (!strcmp(variable, "clip")) {
+        res = clip_ring_enable(val != 0) == ESP_OK ? 0 : -1;
+        if (res == 0) video_stream_set_background(val != 0 || motion.enabled);
+        if (res == 0) audio_stream_set_background(val != 0);
+    }
+    // Resizing an enabled ring can fail for lack of PSRAM, which turns it off
+    else if (!strcmp(variable, "clip_kb")) {
+        res = clip_ring_set_size_kb(val) == ESP_OK ? 0 : -1;
+        video_stream_set_background(clip_ring_enabled() || motion.enabled);
+        audio_stream_set_background(clip_ring_enabled());
+    }
+    // Motion detection needs frames without viewers too
+    else if (!strcmp(variable, "motion")) {
+        video_motion_configure(val != 0, motion.thresh, motion.area);
+        video_stream_set_background(val != 0 || clip_ring_enabled());
+    }
+    else if (!strcmp(variable, "motion_thresh"))
+        video_motion_configure(motion.enabled, val, motion.area);
+    else if (!strcmp(variable, "motion_area"))
+        video_motion_configure(motion.enabled, motion.thresh, val);
+    else if (!strcmp(variable, "dedup"))
+        video_dedup_configure(val != 0);
+    else if (!strcmp(variable, "focus"))
+        video_focus_configure(val != 0, focus.roi);
+    else if (!strcmp(variable, "focus_roi"))
+        video_focus_configure(focus.enabled, val);
+    else if (!strcmp(variable, "exposure"))
+        video_exposure_configure(val != 0, expo.assist);
+    else if (!strcmp(variable, "exposure_assist"))
+        video_exposure_configure(expo.enabled, val != 0);
+    else if (!strcmp(variable, "osd"))
+        video_osd_configure(val != 0);
     else if (!strcmp(variable, "contrast"))
         res = s->set_contrast(s, val);
     else if (!strcmp(variable, "brightness"))
@@ -229,117 +318,308 @@ esp_err_t camera_status_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
-    char json_response[1536];
+    char json_response[2048];
     char *p = json_response;
+    char *end = json_response + sizeof(json_response) - 1; // room for '}'
     *p++ = '{';
 
     if (s->id.PID == OV5640_PID || s->id.PID == OV3660_PID) {
         for (int reg = 0x3400; reg < 0x3406; reg += 2) {
-            p += print_reg(p, s, reg, 0xFFF);
+            print_reg(&p, end, s, reg, 0xFFF);
         }
-        p += print_reg(p, s, 0x3406, 0xFF);
-        p += print_reg(p, s, 0x3500, 0xFFFF0);
-        p += print_reg(p, s, 0x3503, 0xFF);
-        p += print_reg(p, s, 0x350a, 0x3FF);
-        p += print_reg(p, s, 0x350c, 0xFFFF);
+        print_reg(&p, end, s, 0x3406, 0xFF);
+        print_reg(&p, end, s, 0x3500, 0xFFFF0);
+        print_reg(&p, end, s, 0x3503, 0xFF);
+        print_reg(&p, end, s, 0x350a, 0x3FF);
+        print_reg(&p, end, s, 0x350c, 0xFFFF);
 
         for (int reg = 0x5480; reg <= 0x5490; reg++) {
-            p += print_reg(p, s, reg, 0xFF);
+            print_reg(&p, end, s, reg, 0xFF);
         }
         for (int reg = 0x5380; reg <= 0x538b; reg++) {
-            p += print_reg(p, s, reg, 0xFF);
+            print_reg(&p, end, s, reg, 0xFF);
         }
         for (int reg = 0x5580; reg < 0x558a; reg++) {
-            p += print_reg(p, s, reg, 0xFF);
+            print_reg(&p, end, s, reg, 0xFF);
         }
-        p += print_reg(p, s, 0x558a, 0x1FF);
+        print_reg(&p, end, s, 0x558a, 0x1FF);
     } else if (s->id.PID == OV2640_PID) {
-        p += print_reg(p, s, 0xd3, 0xFF);
-        p += print_reg(p, s, 0x111, 0xFF);
-        p += print_reg(p, s, 0x132, 0xFF);
+        print_reg(&p, end, s, 0xd3, 0xFF);
+        print_reg(&p, end, s, 0x111, 0xFF);
+        print_reg(&p, end, s, 0x132, 0xFF);
     }
 
-    p += sprintf(p, "\"xclk\":%u,", s->xclk_freq_hz / 1000000);
-    p += sprintf(p, "\"pixformat\":%u,", s->pixformat);
-    p += sprintf(p, "\"framesize\":%u,", s->status.framesize);
-    p += sprintf(p, "\"quality\":%u,", s->status.quality);
-    p += sprintf(p, "\"brightness\":%d,", s->status.brightness);
-    p += sprintf(p, "\"contrast\":%d,", s->status.contrast);
-    p += sprintf(p, "\"saturation\":%d,", s->status.saturation);
-    p += sprintf(p, "\"sharpness\":%d,", s->status.sharpness);
-    p += sprintf(p, "\"special_effect\":%u,", s->status.special_effect);
-    p += sprintf(p, "\"wb_mode\":%u,", s->status.wb_mode);
-    p += sprintf(p, "\"awb\":%u,", s->status.awb);
-    p += sprintf(p, "\"awb_gain\":%u,", s->status.awb_gain);
-    p += sprintf(p, "\"aec\":%u,", s->status.aec);
-    p += sprintf(p, "\"aec2\":%u,", s->status.aec2);
-    p += sprintf(p, "\"ae_level\":%d,", s->status.ae_level);
-    p += sprintf(p, "\"aec_value\":%u,", s->status.aec_value);
-    p += sprintf(p, "\"agc\":%u,", s->status.agc);
-    p += sprintf(p, "\"agc_gain\":%u,", s->status.agc_gain);
-    p += sprintf(p, "\"gainceiling\":%u,", s->status.gainceiling);
-    p += sprintf(p, "\"bpc\":%u,", s->status.bpc);
-    p += sprintf(p, "\"wpc\":%u,", s->status.wpc);
-    p += sprintf(p, "\"raw_gma\":%u,", s->status.raw_gma);
-    p += sprintf(p, "\"lenc\":%u,", s->status.lenc);
-    p += sprintf(p, "\"hmirror\":%u,", s->status.hmirror);
-    p += sprintf(p, "\"vflip\":%u,", s->status.vflip);
-    p += sprintf(p, "\"dcw\":%u,", s->status.dcw);
-    p += sprintf(p, "\"colorbar\":%u", s->status.colorbar);
+    // With the adaptive controller on, report the user's settings here and
+    // what is actually applied in the adapt_* fields below
+    video_adapt_status_t adapt;
+    video_adapt_get_status(&adapt);
+    bool adapted = adapt.enabled && adapt.base_quality >= 0;
+
+    json_add(&p, end, "\"xclk\":%u,", s->xclk_freq_hz / 1000000);
+    json_add(&p, end, "\"pixformat\":%u,", s->pixformat);
+    json_add(&p, end, "\"framesize\":%u,", adapted ? adapt.base_framesize : s->status.framesize);
+    json_add(&p, end, "\"quality\":%u,", adapted ? adapt.base_quality : s->status.quality);
+    json_add(&p, end, "\"brightness\":%d,", s->status.brightness);
+    json_add(&p, end, "\"contrast\":%d,", s->status.contrast);
+    json_add(&p, end, "\"saturation\":%d,", s->status.saturation);
+    json_add(&p, end, "\"sharpness\":%d,", s->status.sharpness);
+    json_add(&p, end, "\"special_effect\":%u,", s->status.special_effect);
+    json_add(&p, end, "\"wb_mode\":%u,", s->status.wb_mode);
+    json_add(&p, end, "\"awb\":%u,", s->status.awb);
+    json_add(&p, end, "\"awb_gain\":%u,", s->status.awb_gain);
+    json_add(&p, end, "\"aec\":%u,", s->status.aec);
+    json_add(&p, end, "\"aec2\":%u,", s->status.aec2);
+    json_add(&p, end, "\"ae_level\":%d,", s->status.ae_level);
+    json_add(&p, end, "\"aec_value\":%u,", s->status.aec_value);
+    json_add(&p, end, "\"agc\":%u,", s->status.agc);
+    json_add(&p, end, "\"agc_gain\":%u,", s->status.agc_gain);
+    json_add(&p, end, "\"gainceiling\":%u,", s->status.gainceiling);
+    json_add(&p, end, "\"bpc\":%u,", s->status.bpc);
+    json_add(&p, end, "\"wpc\":%u,", s->status.wpc);
+    json_add(&p, end, "\"raw_gma\":%u,", s->status.raw_gma);
+    json_add(&p, end, "\"lenc\":%u,", s->status.lenc);
+    json_add(&p, end, "\"hmirror\":%u,", s->status.hmirror);
+    json_add(&p, end, "\"vflip\":%u,", s->status.vflip);
+    json_add(&p, end, "\"dcw\":%u,", s->status.dcw);
+    json_add(&p, end, "\"colorbar\":%u,", s->status.colorbar);
+    json_add(&p, end, "\"adaptive\":%u,", adapt.enabled);
+    json_add(&p, end, "\"adaptive_fps\":%d,", adapt.target_fps);
+    json_add(&p, end, "\"adaptive_kbps\":%d,", adapt.max_kbps);
+    json_add(&p, end, "\"adapt_quality\":%d,", adapt.quality);
+    json_add(&p, end, "\"adapt_framesize\":%d,", adapt.framesize);
+    json_add(&p, end, "\"adapt_base_quality\":%d,", adapt.base_quality);
+    json_add(&p, end, "\"adapt_base_framesize\":%d,", adapt.base_framesize);
+    json_add(&p, end, "\"adapt_est_kbps\":%d,", adapt.est_kbps);
+    json_add(&p, end, "\"adapt_need_kbps\":%d,", adapt.stream_kbps);
+    json_add(&p, end, "\"adapt_action\":\"%s\",", adapt.last_action);
+    json_add(&p, end, "\"clip\":%u,", clip_ring_enabled());
+    json_add(&p, end, "\"clip_kb\":%d,", clip_ring_size_kb());
+
+    video_motion_status_t motion;
+    video_motion_get_status(&motion);
+    json_add(&p, end, "\"motion\":%u,", motion.enabled);
+    json_add(&p, end, "\"motion_thresh\":%d,", motion.thresh);
+    json_add(&p, end, "\"motion_area\":%d,", motion.area);
+    json_add(&p, end, "\"dedup\":%u,", video_dedup_enabled());
+    video_focus_status_t focus;
+    video_focus_get_status(&focus);
+    json_add(&p, end, "\"focus\":%u,", focus.enabled);
+    json_add(&p, end, "\"focus_roi\":%d,", focus.roi);
+    video_exposure_status_t expo;
+    video_exposure_get_status(&expo);
+    json_add(&p, end, "\"exposure\":%u,", expo.enabled);
+    json_add(&p, end, "\"exposure_assist\":%u,", expo.assist);
+    json_add(&p, end, "\"osd\":%u", video_osd_enabled());
+    if (p == end) {
+        ESP_LOGE(TAG, "Status JSON exceeds %u bytes", (unsigned)sizeof(json_response));
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
     *p++ = '}';
-    *p++ = 0;
+    *p = 0;
 
     httpd_resp_set_type(req, "application/json");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
     return httpd_resp_send(req, json_response, strlen(json_response));
 }
 
-esp_err_t camera_capture_handler(httpd_req_t *req)
+// Grab a fresh frame from the sensor, with the LED strobed if enabled
+static stream_frame_t *capture_fresh_frame(void)
 {
-    if (!esp_camera_sensor_get()) {
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
-    }
-
     camera_fb_t *fb = NULL;
-    esp_err_t res = ESP_OK;
-    int64_t fr_start = esp_timer_get_time();
 
     if (led_stream_enabled) {
+        // Count frames instead of sleeping a fixed time: drop anything whose
+        // exposure started before the LED came on, then let AE settle
+        int64_t led_on_us = esp_timer_get_time();
         enable_led(true);
-        vTaskDelay(pdMS_TO_TICKS(150));
+        int settle = SNAPSHOT_LED_SETTLE_FRAMES;
+        for (int i = 0; i < SNAPSHOT_LED_SETTLE_FRAMES + 4; i++) {
+            fb = esp_camera_fb_get();
+            if (!fb) break;
+            int64_t ts = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+            if (ts > led_on_us && settle-- <= 0) break;
+            esp_camera_fb_return(fb);
+            fb = NULL;
+        }
+        // Out of tries (or a grab failed): take the next frame while the LED
+        // is still on, so the fallback isn't an unlit one
+        if (!fb) {
+            fb = esp_camera_fb_get();
+        }
+        if (!led_on) {
+            enable_led(false);
+        }
+    } else {
+        fb = esp_camera_fb_get();
     }
-    fb = esp_camera_fb_get();
-    if (led_stream_enabled && !led_on) {
-        enable_led(false);
+    if (!fb) {
+        return NULL;
     }
 
-    if (!fb) {
-        ESP_LOGE(TAG, "Camera capture failed");
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
+    stream_frame_t *frame = stream_frame_from_fb(fb);
+    if (frame) {
+        video_cache_frame(frame);
     }
+    return frame;
+}
 
+static esp_err_t send_snapshot(httpd_req_t *req, stream_frame_t *frame,
+                               const char *source, int64_t fr_start)
+{
     httpd_resp_set_type(req, "image/jpeg");
     httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
 
     char ts[32];
-    snprintf(ts, 32, "%lld.%06ld", (long long)fb->timestamp.tv_sec, (long)fb->timestamp.tv_usec);
+    snprintf(ts, 32, "%lld.%06ld", (long long)frame->timestamp.tv_sec, (long)frame->timestamp.tv_usec);
     httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
 
-    size_t fb_len = 0;
-    if (fb->format == PIXFORMAT_JPEG) {
-        fb_len = fb->len;
-        res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
-    } else {
-        jpg_chunking_t jchunk = {req, 0};
-        res = frame2jpg_cb(fb, 80, jpg_encode_stream, &jchunk) ? ESP_OK : ESP_FAIL;
-        httpd_resp_send_chunk(req, NULL, 0);
-        fb_len = jchunk.len;
-    }
-    esp_camera_fb_return(fb);
+    int64_t age_ms = (esp_timer_get_time() - stream_frame_time_us(frame)) / 1000;
+    if (age_ms < 0) age_ms = 0;
+    char age[16];
+    snprintf(age, sizeof(age), "%lld", (long long)(age_ms / 1000));
+    httpd_resp_set_hdr(req, "Age", age);
+    char age_ms_str[16];
+    snprintf(age_ms_str, sizeof(age_ms_str), "%lld", (long long)age_ms);
+    httpd_resp_set_hdr(req, "X-Frame-Age-Ms", age_ms_str);
+
+    esp_err_t res = httpd_resp_send(req, (const char *)frame->buf, frame->len);
+
     int64_t fr_end = esp_timer_get_time();
-    ESP_LOGI(TAG, "JPG: %uB %ums", (uint32_t)fb_len, (uint32_t)((fr_end - fr_start) / 1000));
+    ESP_LOGI(TAG, "JPG: %uB %ums (%s, age %lldms)", (uint32_t)frame->len,
+             (uint32_t)((fr_end - fr_start) / 1000), source, (long long)age_ms);
+    return res;
+}
+
+// Single-flight capture: requests that need a fresh frame while a grab is
+// already in progress join it instead of running their own LED warm-up,
+// sensor grab and JPEG conversion. The grab runs in its own task so the UI
+// server isn't blocked while the sensor works.
+typedef struct {
+    httpd_req_t *reqs[SNAPSHOT_MAX_WAITERS];
+    int64_t started[SNAPSHOT_MAX_WAITERS];
+    int count;
+} capture_flight_t;
+
+static SemaphoreHandle_t s_flight_lock = NULL;
+static capture_flight_t *s_flight = NULL;
+
+static void capture_flight_task(void *arg)
+{
+    capture_flight_t *flight = (capture_flight_t *)arg;
+
+    stream_frame_t *frame = capture_fresh_frame();
+
+    // Close the flight; later requests will see the cached frame
+    xSemaphoreTake(s_flight_lock, portMAX_DELAY);
+    s_flight = NULL;
+    xSemaphoreGive(s_flight_lock);
+
+    if (!frame) {
+        ESP_LOGE(TAG, "Camera capture failed");
+    } else if (flight->count > 1) {
+        ESP_LOGD(TAG, "Capture shared by %d requests", flight->count);
+    }
+    for (int i = 0; i < flight->count; i++) {
+        if (frame) {
+            send_snapshot(flight->reqs[i], frame, i ? "shared" : "fresh", flight->started[i]);
+        } else {
+            httpd_resp_send_500(flight->reqs[i]);
+        }
+        httpd_req_async_handler_complete(flight->reqs[i]);
+    }
+
+    stream_frame_release(frame);
+    free(flight);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t capture_join_flight(httpd_req_t *req, int64_t fr_start)
+{
+    httpd_req_t *async_req = NULL;
+    esp_err_t err = httpd_req_async_handler_begin(req, &async_req);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "httpd_req_async_handler_begin failed: %s", esp_err_to_name(err));
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    xSemaphoreTake(s_flight_lock, portMAX_DELAY);
+    capture_flight_t *flight = s_flight;
+    if (flight && flight->count < SNAPSHOT_MAX_WAITERS) {
+        flight->reqs[flight->count] = async_req;
+        flight->started[flight->count] = fr_start;
+        flight->count++;
+        xSemaphoreGive(s_flight_lock);
+        return ESP_OK;
+    }
+    if (flight) {
+        xSemaphoreGive(s_flight_lock);
+        httpd_resp_send_err(async_req, HTTPD_500_INTERNAL_SERVER_ERROR, "Too many pending captures");
+        httpd_req_async_handler_complete(async_req);
+        return ESP_FAIL;
+    }
+
+    flight = (capture_flight_t *)calloc(1, sizeof(capture_flight_t));
+    if (flight) {
+        flight->reqs[0] = async_req;
+        flight->started[0] = fr_start;
+        flight->count = 1;
+        if (xTaskCreate(capture_flight_task, "snapshot", 4096, flight, 5, NULL) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create capture task");
+            free(flight);
+            flight = NULL;
+        }
+    }
+    s_flight = flight;
+    xSemaphoreGive(s_flight_lock);
+
+    if (!flight) {
+        httpd_resp_send_500(async_req);
+        httpd_req_async_handler_complete(async_req);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t camera_capture_handler(httpd_req_t *req)
+{
+    if (!esp_camera_sensor_get()) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    int64_t fr_start = esp_timer_get_time();
+
+    // ?maxage_ms=N: accept a cached frame up to N ms old (default SNAPSHOT_MAX_AGE_MS)
+    int64_t max_age_us = SNAPSHOT_MAX_AGE_MS * 1000LL;
+    char query[64];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "maxage_ms", value, sizeof(value)) == ESP_OK) {
+        max_age_us = atoll(value) * 1000;
+    }
+
+    // While streaming, the live frame is at most one frame period old and
+    // grabbing another buffer would only stall the stream
+    bool live = false;
+    stream_frame_t *frame = video_latest_frame(&live);
+    if (frame && !live && fr_start - stream_frame_time_us(frame) > max_age_us) {
+        stream_frame_release(frame);
+        frame = NULL;
+    }
+    if (!frame) {
+        return capture_join_flight(req, fr_start);
+    }
+
+    esp_err_t res = send_snapshot(req, frame, live ? "live" : "cached", fr_start);
+    stream_frame_release(frame);
     return res;
 }
+
+void init_camera_capture(void)
+{
+    s_flight_lock = xSemaphoreCreateMutex();
+}
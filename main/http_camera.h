@@ -2,7 +2,19 @@
 
 #include "esp_http_server.h"
 
+// /api/camera/capture serves the live or cached frame if it is at most this
+// old (override per request with ?maxage_ms=), otherwise grabs a new one
+#define SNAPSHOT_MAX_AGE_MS   10000
+
+// With the LED on for snapshots, frames exposed before the LED came on are
+// skipped, then this many more to let auto-exposure settle
+#define SNAPSHOT_LED_SETTLE_FRAMES  1
+
+// Requests that can join one in-flight snapshot capture
+#define SNAPSHOT_MAX_WAITERS  8
+
 void loadCameraSettings(void);
+void init_camera_capture(void);
 
 esp_err_t camera_info_handler(httpd_req_t *req);
 esp_err_t camera_status_handler(httpd_req_t *req);
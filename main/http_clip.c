@@ -0,0 +1,500 @@
+#include "http_clip.h"
+#include "clip_ring.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "esp_http_server.h"
+#include "esp_camera.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+
+static const char *TAG = "http_clip";
+
+#define AVIF_HASINDEX       0x10
+#define AVIF_ISINTERLEAVED  0x100
+#define AVIIF_KEYFRAME      0x10
+#define RIFF_PAD(n)         ((n) + ((n) & 1))
+
+typedef struct {
+    httpd_req_t *req;
+    clip_cursor_t cur;
+    int64_t start_us;      // time of the request
+    int64_t until_us;
+} clip_export_t;
+
+// What a first pass over the pinned records found; the AVI headers need
+// every size up front because the body is streamed straight from the ring
+typedef struct {
+    uint32_t frames;
+    uint32_t blocks;
+    uint32_t max_frame;
+    uint32_t max_block;
+    uint64_t video_bytes;
+    uint64_t audio_bytes;
+    uint32_t movi_size;
+    int64_t first_video_us;
+    int64_t last_video_us;
+    int64_t first_audio_us;
+    int width;
+    int height;
+    uint32_t rate;
+    int bits;
+} clip_scan_t;
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+    return p + 4;
+}
+
+static uint8_t *put_cc(uint8_t *p, const char *fourcc)
+{
+    memcpy(p, fourcc, 4);
+    return p + 4;
+}
+
+// Frame size from the JPEG's SOF marker
+static bool jpeg_dimensions(const uint8_t *buf, size_t len, int *w, int *h)
+{
+    size_t i = 2;
+    while (i + 9 < len && buf[i] == 0xFF) {
+        uint8_t marker = buf[i + 1];
+        if (marker >= 0xC0 && marker <= 0xC2) {
+            *h = buf[i + 5] << 8 | buf[i + 6];
+            *w = buf[i + 7] << 8 | buf[i + 8];
+            return true;
+        }
+        i += 2 + (buf[i + 2] << 8 | buf[i + 3]);
+    }
+    return false;
+}
+
+// Audio blocks in another format than the first one (sample rate changed
+// mid-clip) are left out; an AVI stream has a single format
+static bool audio_matches(const clip_scan_t *scan, const clip_rec_t *rec)
+{
+    return rec->rate == scan->rate && rec->bits == scan->bits;
+}
+
+static void clip_scan(clip_export_t *exp, clip_scan_t *scan)
+{
+    clip_cursor_t c = exp->cur;
+    clip_rec_t rec;
+    const uint8_t *payload;
+
+    memset(scan, 0, sizeof(*scan));
+    scan->movi_size = 4;
+    while (clip_ring_next(&c, exp->until_us, &rec, &payload)) {
+        if (rec.type == CLIP_REC_VIDEO) {
+            if (!scan->frames) {
+                scan->first_video_us = rec.ts_us;
+                jpeg_dimensions(payload, rec.len, &scan->width, &scan->height);
+            }
+            scan->last_video_us = rec.ts_us;
+            scan->frames++;
+            scan->video_bytes += rec.len;
+            if (rec.len > scan->max_frame) scan->max_frame = rec.len;
+        } else if (rec.type == CLIP_REC_AUDIO) {
+            if (!scan->blocks) {
+                scan->rate = rec.rate;
+                scan->bits = rec.bits;
+                scan->first_audio_us = rec.ts_us;
+            } else if (!audio_matches(scan, &rec)) {
+                continue;
+            }
+            scan->blocks++;
+            scan->audio_bytes += rec.len;
+            if (rec.len > scan->max_block) scan->max_block = rec.len;
+        } else {
+            continue;
+        }
+        scan->movi_size += 8 + RIFF_PAD(rec.len);
+    }
+    // The second pass sends exactly these records, even if more arrive
+    exp->cur.end = c.pos;
+
+    if (!scan->width) {
+        sensor_t *s = esp_camera_sensor_get();
+        if (s) {
+            scan->width = resolution[s->status.framesize].width;
+            scan->height = resolution[s->status.framesize].height;
+        }
+    }
+}
+
+// RIFF/AVI header up to and including the 'movi' list header
+static size_t build_avi_header(uint8_t *buf, const clip_scan_t *scan, uint32_t idx_size)
+{
+    bool audio = scan->blocks > 0;
+    uint32_t us_per_frame = scan->frames > 1
+        ? (uint32_t)((scan->last_video_us - scan->first_video_us) / (scan->frames - 1))
+        : 1000000 / CLIP_FPS;
+    if (!us_per_frame) us_per_frame = 1000000 / CLIP_FPS;
+    int64_t duration_us = (int64_t)us_per_frame * scan->frames;
+    uint32_t strl_video = 4 + 8 + 56 + 8 + 40;
+    uint32_t strl_audio = 4 + 8 + 56 + 8 + 16;
+    uint32_t hdrl = 4 + 8 + 56 + 8 + strl_video + (audio ? 8 + strl_audio : 0);
+    uint32_t riff = 4 + 8 + hdrl + 8 + scan->movi_size + 8 + idx_size;
+    uint8_t *p = buf;
+
+    p = put_cc(p, "RIFF");
+    p = put_u32(p, riff);
+    p = put_cc(p, "AVI ");
+    p = put_cc(p, "LIST");
+    p = put_u32(p, hdrl);
+    p = put_cc(p, "hdrl");
+
+    p = put_cc(p, "avih");
+    p = put_u32(p, 56);
+    p = put_u32(p, us_per_frame);
+    p = put_u32(p, (uint32_t)((scan->video_bytes + scan->audio_bytes) * 1000000 / duration_us));
+    p = put_u32(p, 0);                          // padding granularity
+    p = put_u32(p, AVIF_HASINDEX | AVIF_ISINTERLEAVED);
+    p = put_u32(p, scan->frames);
+    p = put_u32(p, 0);                          // initial frames
+    p = put_u32(p, audio ? 2 : 1);
+    p = put_u32(p, scan->max_frame);
+    p = put_u32(p, scan->width);
+    p = put_u32(p, scan->height);
+    memset(p, 0, 16);
+    p += 16;
+
+    // Video stream: MJPEG, one JPEG per chunk
+    p = put_cc(p, "LIST");
+    p = put_u32(p, strl_video);
+    p = put_cc(p, "strl");
+    p = put_cc(p, "strh");
+    p = put_u32(p, 56);
+    p = put_cc(p, "vids");
+    p = put_cc(p, "MJPG");
+    p = put_u32(p, 0);                          // flags
+    p = put_u32(p, 0);                          // priority, language
+    p = put_u32(p, 0);                          // initial frames
+    p = put_u32(p, us_per_frame);               // scale / rate = seconds per frame
+    p = put_u32(p, 1000000);
+    p = put_u32(p, 0);                          // start
+    p = put_u32(p, scan->frames);
+    p = put_u32(p, scan->max_frame);
+    p = put_u32(p, 0xFFFFFFFF);                 // quality: default
+    p = put_u32(p, 0);                          // sample size: varies
+    p = put_u16(p, 0);
+    p = put_u16(p, 0);
+    p = put_u16(p, scan->width);
+    p = put_u16(p, scan->height);
+    p = put_cc(p, "strf");
+    p = put_u32(p, 40);
+    p = put_u32(p, 40);                         // BITMAPINFOHEADER
+    p = put_u32(p, scan->width);
+    p = put_u32(p, scan->height);
+    p = put_u16(p, 1);
+    p = put_u16(p, 24);
+    p = put_cc(p, "MJPG");
+    p = put_u32(p, scan->width * scan->height * 3);
+    memset(p, 0, 16);
+    p += 16;
+
+    if (audio) {
+        // Audio stream: mono PCM, placed in time relative to the first frame
+        uint16_t block_align = scan->bits / 8;
+        uint32_t start = scan->first_audio_us > scan->first_video_us
+            ? (uint32_t)((scan->first_audio_us - scan->first_video_us) * scan->rate / 1000000)
+            : 0;
+        p = put_cc(p, "LIST");
+        p = put_u32(p, strl_audio);
+        p = put_cc(p, "strl");
+        p = put_cc(p, "strh");
+        p = put_u32(p, 56);
+        p = put_cc(p, "auds");
+        p = put_u32(p, 0);                      // handler
+        p = put_u32(p, 0);
+        p = put_u32(p, 0);
+        p = put_u32(p, 0);
+        p = put_u32(p, block_align);
+        p = put_u32(p, scan->rate * block_align);
+        p = put_u32(p, start);
+        p = put_u32(p, (uint32_t)(scan->audio_bytes / block_align));
+        p = put_u32(p, scan->max_block);
+        p = put_u32(p, 0xFFFFFFFF);
+        p = put_u32(p, block_align);
+        memset(p, 0, 8);
+        p += 8;
+        p = put_cc(p, "strf");
+        p = put_u32(p, 16);
+        p = put_u16(p, 1);                      // WAVE_FORMAT_PCM
+        p = put_u16(p, 1);
+        p = put_u32(p, scan->rate);
+        p = put_u32(p, scan->rate * block_align);
+        p = put_u16(p, block_align);
+        p = put_u16(p, scan->bits);
+    }
+
+    p = put_cc(p, "LIST");
+    p = put_u32(p, scan->movi_size);
+    p = put_cc(p, "movi");
+    return p - buf;
+}
+
+// Send the pinned records as 00dc/01wb chunks straight out of the ring,
+// letting the writer reuse each record's space once it is on the wire
+static esp_err_t send_movi(clip_export_t *exp, const clip_scan_t *scan, uint8_t *idx, uint32_t entries)
+{
+    clip_cursor_t c = exp->cur;
+    clip_rec_t rec;
+    const uint8_t *payload;
+    uint32_t offset = 4;
+    uint32_t n = 0;
+    esp_err_t res = ESP_OK;
+
+    while (res == ESP_OK && clip_ring_next(&c, exp->until_us, &rec, &payload)) {
+        const char *ckid;
+        if (rec.type == CLIP_REC_VIDEO) {
+            ckid = "00dc";
+        } else if (rec.type == CLIP_REC_AUDIO && audio_matches(scan, &rec)) {
+            ckid = "01wb";
+        } else {
+            clip_ring_release(&c);
+            continue;
+        }
+
+        uint8_t ck[8];
+        put_u32(put_cc(ck, ckid), rec.len);
+        res = httpd_resp_send_chunk(exp->req, (const char *)ck, sizeof(ck));
+        if (res == ESP_OK) {
+            res = httpd_resp_send_chunk(exp->req, (const char *)payload, rec.len);
+        }
+        if (res == ESP_OK && (rec.len & 1)) {
+            res = httpd_resp_send_chunk(exp->req, "", 1);
+        }
+        clip_ring_release(&c);
+
+        if (n < entries) {
+            uint8_t *e = idx + n++ * 16;
+            e = put_cc(e, ckid);
+            e = put_u32(e, AVIIF_KEYFRAME);
+            e = put_u32(e, offset);
+            put_u32(e, rec.len);
+        }
+        offset += 8 + RIFF_PAD(rec.len);
+    }
+    return res;
+}
+
+// The writer can't evict at or past the pin, so before + after must fit
+// in the ring or the post-event records are skipped. 0 while the ring is
+// empty and its span unknown.
+static int clip_span_ms(void)
+{
+    clip_ring_status_t st;
+    clip_ring_get_status(&st);
+    return (int)(st.full_seconds * 1000.0f * CLIP_RING_FILL_PCT / 100);
+}
+
+// The client closed (or reset) the connection
+static bool client_gone(httpd_req_t *req)
+{
+    char c;
+    int n = recv(httpd_req_to_sockfd(req), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+static void clip_export_task(void *arg)
+{
+    clip_export_t *exp = (clip_export_t *)arg;
+    httpd_req_t *req = exp->req;
+    uint8_t *idx = NULL;
+    clip_scan_t scan;
+
+    // Wait for the "after" part in short steps, so a client that gives up
+    // releases the request, this task and the ring's pin right away
+    while (esp_timer_get_time() < exp->until_us) {
+        if (client_gone(req)) {
+            ESP_LOGW(TAG, "Clip export cancelled, client disconnected");
+            goto done;
+        }
+        vTaskDelay(pdMS_TO_TICKS(CLIP_WAIT_POLL_MS));
+    }
+
+    clip_scan(exp, &scan);
+    if (!scan.frames) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No frames recorded in range");
+        goto done;
+    }
+
+    uint32_t entries = scan.frames + scan.blocks;
+    idx = (uint8_t *)heap_caps_malloc(entries * 16, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!idx) idx = (uint8_t *)malloc(entries * 16);
+    if (!idx) {
+        httpd_resp_send_500(req);
+        goto done;
+    }
+
+    ESP_LOGI(TAG, "Exporting clip: %u frames %dx%d, %u audio blocks, %u KB",
+             (unsigned)scan.frames, scan.width, scan.height, (unsigned)scan.blocks,
+             (unsigned)(scan.movi_size / 1024));
+
+    httpd_resp_set_type(req, "video/x-msvideo");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=clip.avi");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store");
+    // Pre-event seconds actually in the clip, less than ?before= once the
+    // ring has wrapped or ?before= was capped, and post-event seconds
+    char before[16], after[16];
+    int64_t before_us = exp->start_us - scan.first_video_us;
+    int64_t after_us = scan.last_video_us - exp->start_us;
+    snprintf(before, sizeof(before), "%.1f", before_us > 0 ? before_us / 1e6 : 0.0);
+    snprintf(after, sizeof(after), "%.1f", after_us > 0 ? after_us / 1e6 : 0.0);
+    httpd_resp_set_hdr(req, "X-Clip-Before", before);
+    httpd_resp_set_hdr(req, "X-Clip-After", after);
+    httpd_resp_set_hdr(req, "Access-Control-Expose-Headers", "X-Clip-Before, X-Clip-After");
+
+    uint8_t header[384];
+    size_t hlen = build_avi_header(header, &scan, entries * 16);
+    esp_err_t res = httpd_resp_send_chunk(req, (const char *)header, hlen);
+    if (res == ESP_OK) {
+        res = send_movi(exp, &scan, idx, entries);
+    }
+    if (res == ESP_OK) {
+        uint8_t ck[8];
+        put_u32(put_cc(ck, "idx1"), entries * 16);
+        res = httpd_resp_send_chunk(req, (const char *)ck, sizeof(ck));
+    }
+    if (res == ESP_OK) {
+        res = httpd_resp_send_chunk(req, (const char *)idx, entries * 16);
+    }
+    if (res == ESP_OK) {
+        httpd_resp_send_chunk(req, NULL, 0);
+    } else {
+        ESP_LOGW(TAG, "Clip export aborted, client disconnected");
+    }
+
+done:
+    clip_ring_unpin();
+    httpd_req_async_handler_complete(req);
+    free(idx);
+    free(exp);
+    vTaskDelete(NULL);
+}
+
+esp_err_t clip_export_handler(httpd_req_t *req)
+{
+    char query[64];
+    char value[16];
+    int before = CLIP_DEFAULT_BEFORE_S;
+    int after = CLIP_DEFAULT_AFTER_S;
+    bool explicit = false;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "before", value, sizeof(value)) == ESP_OK) {
+            before = atoi(value);
+            explicit = true;
+        }
+        if (httpd_query_key_value(query, "after", value, sizeof(value)) == ESP_OK) {
+            after = atoi(value);
+            explicit = true;
+        }
+    }
+
+    char msg[96];
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    // Bounded before the seconds become milliseconds in an int
+    if (before < 0 || before > CLIP_MAX_BEFORE_S || after < 0 || after > CLIP_MAX_AFTER_S) {
+        snprintf(msg, sizeof(msg), "before must be 0 to %d, after 0 to %d", CLIP_MAX_BEFORE_S, CLIP_MAX_AFTER_S);
+        httpd_resp_set_status(req, "400 Bad Request");
+        return httpd_resp_send(req, msg, HTTPD_RESP_USE_STRLEN);
+    }
+    if (!clip_ring_enabled()) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, "Clip recording is disabled", HTTPD_RESP_USE_STRLEN);
+    }
+
+    int before_ms = before * 1000, after_ms = after * 1000;
+    int span_ms = clip_span_ms();
+    if (span_ms && before_ms + after_ms > span_ms) {
+        if (explicit) {
+            snprintf(msg, sizeof(msg), "The clip ring holds about %.1fs; before + after must fit (clip_kb)",
+                     span_ms / 1000.0);
+            httpd_resp_set_status(req, "416 Range Not Satisfiable");
+            return httpd_resp_send(req, msg, HTTPD_RESP_USE_STRLEN);
+        }
+        if (after_ms > span_ms) after_ms = span_ms;
+        before_ms = span_ms - after_ms;
+    }
+
+    clip_export_t *exp = (clip_export_t *)calloc(1, sizeof(clip_export_t));
+    if (!exp) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    // Pin now so the "before" part can't age out while we wait for "after"
+    int64_t now = esp_timer_get_time();
+    exp->start_us = now;
+    exp->until_us = now + (int64_t)after_ms * 1000;
+    if (clip_ring_pin(now - (int64_t)before_ms * 1000, &exp->cur) != ESP_OK) {
+        free(exp);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, "Another clip export is running", HTTPD_RESP_USE_STRLEN);
+    }
+
+    esp_err_t err = httpd_req_async_handler_begin(req, &exp->req);
+    if (err == ESP_OK &&
+        xTaskCreate(clip_export_task, "clip_export", 4096, exp, 4, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create clip export task");
+        httpd_req_async_handler_complete(exp->req);
+        err = ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        clip_ring_unpin();
+        free(exp);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Clip export started (%.1fs before, %.1fs after of %ds/%ds asked)",
+             before_ms / 1000.0, after_ms / 1000.0, before, after);
+    return ESP_OK;
+}
+
+esp_err_t clip_status_handler(httpd_req_t *req)
+{
+    clip_ring_status_t st;
+    clip_ring_get_status(&st);
+
+    char json_response[384];
+    char *p = json_response;
+    *p++ = '{';
+    p += sprintf(p, "\"enabled\":%u,", st.enabled);
+    p += sprintf(p, "\"size\":%u,", (unsigned)st.size);
+    p += sprintf(p, "\"size_wanted\":%u,", (unsigned)st.size_wanted);
+    p += sprintf(p, "\"used\":%u,", (unsigned)st.used);
+    p += sprintf(p, "\"seconds\":%.1f,", st.seconds);
+    p += sprintf(p, "\"full_seconds\":%.1f,", st.full_seconds);
+    p += sprintf(p, "\"max_clip_seconds\":%.1f,", st.full_seconds * CLIP_RING_FILL_PCT / 100);
+    p += sprintf(p, "\"fps\":%d,", CLIP_FPS);
+    p += sprintf(p, "\"video_frames\":%u,", (unsigned)st.video_frames);
+    p += sprintf(p, "\"audio_blocks\":%u,", (unsigned)st.audio_blocks);
+    p += sprintf(p, "\"skipped\":%u,", (unsigned)st.skipped);
+    p += sprintf(p, "\"exporting\":%u", st.exporting);
+    *p++ = '}';
+    *p++ = 0;
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json_response, strlen(json_response));
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "esp_http_server.h"
+
+// Defaults for /api/clip?before=&after= (seconds). The export pins the ring
+// from "before" on while "after" is recorded, so the two together must fit
+// in CLIP_RING_FILL_PCT of the span the full ring holds (full_seconds in
+// /api/clip/status). Explicit values that don't fit get 416; the defaults
+// are shortened to fit instead, "after" first. X-Clip-Before and
+// X-Clip-After in the response give the seconds the clip actually has,
+// less than asked for "before" while the ring is still filling.
+#define CLIP_DEFAULT_BEFORE_S 10
+#define CLIP_DEFAULT_AFTER_S  5
+#define CLIP_RING_FILL_PCT    90      // of the ring's span; frame sizes vary
+#define CLIP_WAIT_POLL_MS     250     // client check while waiting for "after"
+
+esp_err_t clip_export_handler(httpd_req_t *req);
+esp_err_t clip_status_handler(httpd_req_t *req);
@@ -18,6 +18,14 @@
 #include "config.h"
 #include "http_audio_stream.h"
 #include "http_video_stream.h"
+#include "http_clip.h"
+#include "stream_engine.h"
+#include "video_scale.h"
+#include "video_analyze.h"
+#include "video_overlay.h"
+#include "rtsp_server.h"
+#include "ws_stream.h"
+#include "pcm_convert.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -62,6 +70,9 @@ bool mic_available = false;
 void safe_restart(void)
 {
     ESP_LOGI(TAG, "Shutting down before restart...");
+    stop_rtsp_server();
+    stop_ws_stream();
+    stop_stream_engine();
     stop_video_stream();
     stop_audio_stream();
     esp_camera_deinit();
@@ -304,12 +315,13 @@ static esp_err_t api_info_handler(httpd_req_t *req)
     }
     cJSON_AddStringToObject(root, "hostname", stored_hostname);
     cJSON_AddNumberToObject(root, "rssi", get_wifi_rssi());
-    cJSON_AddNumberToObject(root, "mic_gain", (int)mic_gain);
+    cJSON_AddNumberToObject(root, "mic_gain_db", (int)mic_gain_db);
+    cJSON_AddNumberToObject(root, "mic_gain", pcm_gain_factor(mic_gain_db));  // former multiplier
     cJSON_AddBoolToObject(root, "auth_enabled", stored_auth_pass[0] != '\0');
     cJSON_AddStringToObject(root, "running_partition", run ? run->label : "?");
     cJSON_AddStringToObject(root, "boot_partition", boot ? boot->label : "?");
-    cJSON_AddNumberToObject(root, "stream_port", 81);
-    cJSON_AddNumberToObject(root, "audio_port", 82);
+    cJSON_AddNumberToObject(root, "stream_port", STREAM_VIDEO_PORT);
+    cJSON_AddNumberToObject(root, "audio_port", STREAM_AUDIO_PORT);
     cJSON_AddBoolToObject(root, "camera", camera_available);
     cJSON_AddBoolToObject(root, "mic", mic_available);
 
@@ -349,6 +361,7 @@ static esp_err_t api_system_info_handler(httpd_req_t *req)
     cJSON *root = cJSON_CreateObject();
     cJSON_AddNumberToObject(root, "free_heap", esp_get_free_heap_size());
     cJSON_AddNumberToObject(root, "min_free_heap", esp_get_minimum_free_heap_size());
+    cJSON_AddNumberToObject(root, "free_internal", esp_get_free_internal_heap_size());
     cJSON_AddNumberToObject(root, "psram_free", esp_psram_is_initialized() ?
         esp_psram_get_size() - (esp_get_free_heap_size() - esp_get_free_internal_heap_size()) : 0);
     cJSON_AddNumberToObject(root, "psram_total", esp_psram_is_initialized() ? esp_psram_get_size() : 0);
@@ -369,6 +382,217 @@ static esp_err_t api_system_info_handler(httpd_req_t *req)
     return send_json(req, root);
 }
 
+static esp_err_t api_stream_stats_handler(httpd_req_t *req)
+{
+    video_stream_stats_t st;
+    video_stream_get_stats(&st);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON *video = cJSON_AddObjectToObject(root, "video");
+    cJSON_AddNumberToObject(video, "viewers", st.viewers);
+    cJSON_AddNumberToObject(video, "fps", st.fps);
+    cJSON_AddNumberToObject(video, "frames", st.frames);
+    cJSON_AddNumberToObject(video, "sent", st.sent);
+    cJSON_AddNumberToObject(video, "dropped", st.dropped);
+    cJSON_AddNumberToObject(video, "duplicates", st.duplicates);
+    cJSON_AddNumberToObject(video, "suppressed", st.suppressed);
+    cJSON_AddNumberToObject(video, "capture_us", st.capture_us);
+    cJSON_AddNumberToObject(video, "encode_us", st.encode_us);
+    cJSON_AddNumberToObject(video, "wait_us", st.wait_us);
+    cJSON_AddNumberToObject(video, "send_us", st.send_us);
+    cJSON_AddNumberToObject(video, "latency_us", st.latency_us);
+
+    stream_engine_stats_t es;
+    stream_engine_get_stats(&es);
+    cJSON *engine = cJSON_AddObjectToObject(root, "engine");
+    cJSON_AddNumberToObject(engine, "conns", es.conns);
+    cJSON_AddNumberToObject(engine, "video", es.video);
+    cJSON_AddNumberToObject(engine, "audio", es.audio);
+    cJSON_AddNumberToObject(engine, "events", es.events);
+    cJSON_AddNumberToObject(engine, "loops", es.loops);
+    cJSON_AddNumberToObject(engine, "writes", es.writes);
+    cJSON_AddNumberToObject(engine, "bytes", (double)es.bytes);
+    cJSON_AddNumberToObject(engine, "stack_free", es.stack_free);
+
+    audio_stats_t as;
+    audio_get_stats(&as);
+    cJSON *audio = cJSON_AddObjectToObject(root, "audio");
+    cJSON_AddNumberToObject(audio, "readers", as.readers);
+    cJSON_AddNumberToObject(audio, "max_readers", AUDIO_MAX_READERS);
+    cJSON_AddNumberToObject(audio, "blocks", as.blocks);
+    cJSON_AddNumberToObject(audio, "dropped", as.dropped);
+
+    video_scale_stats_t ss;
+    video_scale_get_stats(&ss);
+    cJSON *sub = cJSON_AddObjectToObject(root, "substream");
+    cJSON_AddNumberToObject(sub, "scaled", ss.scaled);
+    cJSON_AddNumberToObject(sub, "scale_us", ss.scale_us);
+    cJSON_AddNumberToObject(sub, "requantized", ss.requantized);
+    cJSON_AddNumberToObject(sub, "requant_us", ss.requant_us);
+    cJSON_AddNumberToObject(sub, "requant_in", ss.requant_in);
+    cJSON_AddNumberToObject(sub, "requant_out", ss.requant_out);
+    cJSON_AddNumberToObject(sub, "requant_mbps", ss.requant_us ? (double)ss.requant_in / ss.requant_us : 0);
+    cJSON_AddNumberToObject(sub, "failed", ss.failed);
+
+    video_overlay_stats_t os;
+    video_overlay_get_stats(&os);
+    cJSON *overlay = cJSON_AddObjectToObject(root, "overlay");
+    cJSON_AddNumberToObject(overlay, "masks", os.masks);
+    cJSON_AddBoolToObject(overlay, "osd", os.osd);
+    cJSON_AddNumberToObject(overlay, "frames", os.frames);
+    cJSON_AddNumberToObject(overlay, "edit_us", os.edit_us);
+    cJSON_AddNumberToObject(overlay, "osd_updates", os.osd_updates);
+    cJSON_AddNumberToObject(overlay, "osd_build_us", os.osd_build_us);
+    cJSON_AddNumberToObject(overlay, "failed", os.failed);
+
+    return send_json(req, root);
+}
+
+static esp_err_t api_motion_handler(httpd_req_t *req)
+{
+    video_motion_status_t m;
+    video_motion_get_status(&m);
+
+    char grid[20];
+    snprintf(grid, sizeof(grid), "%012llx", (unsigned long long)m.grid);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "enabled", m.enabled);
+    cJSON_AddBoolToObject(root, "active", m.active);
+    cJSON_AddNumberToObject(root, "score", m.score);
+    cJSON_AddStringToObject(root, "grid", grid);
+    cJSON *box = cJSON_AddArrayToObject(root, "box");
+    for (int i = 0; i < 4; i++) cJSON_AddItemToArray(box, cJSON_CreateNumber(m.box[i]));
+    cJSON_AddNumberToObject(root, "age_ms",
+                            m.last_motion_us ? (double)((esp_timer_get_time() - m.last_motion_us) / 1000) : -1);
+    cJSON_AddNumberToObject(root, "events", m.events);
+    cJSON_AddNumberToObject(root, "frames", m.frames);
+    cJSON_AddNumberToObject(root, "analyze_us", m.analyze_us);
+
+    return send_json(req, root);
+}
+
+static esp_err_t api_focus_handler(httpd_req_t *req)
+{
+    video_focus_status_t f;
+    video_focus_get_status(&f);
+    video_motion_status_t m;
+    video_motion_get_status(&m);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "enabled", f.enabled);
+    cJSON_AddNumberToObject(root, "score", f.score);
+    cJSON_AddNumberToObject(root, "roi", f.roi);
+    cJSON_AddNumberToObject(root, "roi_score", f.roi_score);
+    cJSON_AddNumberToObject(root, "peak", f.peak);
+    cJSON_AddNumberToObject(root, "detail", f.detail);
+    cJSON_AddNumberToObject(root, "frames", f.frames);
+    cJSON_AddNumberToObject(root, "analyze_us", m.analyze_us);
+
+    return send_json(req, root);
+}
+
+static esp_err_t api_exposure_handler(httpd_req_t *req)
+{
+    video_exposure_status_t e;
+    video_exposure_get_status(&e);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "enabled", e.enabled);
+    cJSON_AddBoolToObject(root, "assist", e.assist);
+    cJSON_AddNumberToObject(root, "mean", e.mean);
+    cJSON_AddNumberToObject(root, "p5", e.p5);
+    cJSON_AddNumberToObject(root, "p50", e.p50);
+    cJSON_AddNumberToObject(root, "p95", e.p95);
+    cJSON_AddNumberToObject(root, "dark", e.dark);
+    cJSON_AddNumberToObject(root, "bright", e.bright);
+    cJSON_AddNumberToObject(root, "blocks", e.blocks);
+    cJSON *hist = cJSON_AddArrayToObject(root, "hist");
+    for (int i = 0; i < EXPO_BINS; i++) cJSON_AddItemToArray(hist, cJSON_CreateNumber(e.hist[i]));
+    cJSON_AddNumberToObject(root, "ae_level", e.ae_level);
+    cJSON_AddNumberToObject(root, "aec_value", e.aec_value);
+    cJSON_AddStringToObject(root, "action", e.action);
+    cJSON_AddNumberToObject(root, "adjustments", e.adjustments);
+    cJSON_AddNumberToObject(root, "frames", e.frames);
+
+    return send_json(req, root);
+}
+
+// ---------- Privacy Mask API ----------
+
+static esp_err_t api_masks_get_handler(httpd_req_t *req)
+{
+    video_mask_t masks[MASK_MAX];
+    int count = video_mask_get(masks);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "max", MASK_MAX);
+    cJSON *list = cJSON_AddArrayToObject(root, "masks");
+    for (int i = 0; i < count; i++) {
+        cJSON *m = cJSON_CreateObject();
+        cJSON_AddNumberToObject(m, "x", masks[i].x);
+        cJSON_AddNumberToObject(m, "y", masks[i].y);
+        cJSON_AddNumberToObject(m, "w", masks[i].w);
+        cJSON_AddNumberToObject(m, "h", masks[i].h);
+        cJSON_AddItemToArray(list, m);
+    }
+    return send_json(req, root);
+}
+
+// {"masks":[{"x":..,"y":..,"w":..,"h":..}, ...]}, percent of the frame;
+// replaces the whole list, [] removes all masks
+static esp_err_t api_masks_post_handler(httpd_req_t *req)
+{
+    if (!check_auth(req)) return send_auth_required(req);
+
+    char body[512];
+    if (read_body(req, body, sizeof(body)) < 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid body");
+        return ESP_FAIL;
+    }
+
+    cJSON *root = cJSON_Parse(body);
+    cJSON *list = root ? cJSON_GetObjectItem(root, "masks") : NULL;
+    if (!cJSON_IsArray(list) || cJSON_GetArraySize(list) > MASK_MAX) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return ESP_FAIL;
+    }
+
+    video_mask_t masks[MASK_MAX];
+    int count = 0;
+    cJSON *item;
+    cJSON_ArrayForEach(item, list) {
+        cJSON *x = cJSON_GetObjectItem(item, "x");
+        cJSON *y = cJSON_GetObjectItem(item, "y");
+        cJSON *w = cJSON_GetObjectItem(item, "w");
+        cJSON *h = cJSON_GetObjectItem(item, "h");
+        if (!cJSON_IsNumber(x) || !cJSON_IsNumber(y) || !cJSON_IsNumber(w) || !cJSON_IsNumber(h) ||
+            x->valueint < 0 || x->valueint > 100 || y->valueint < 0 || y->valueint > 100 ||
+            w->valueint < 0 || w->valueint > 100 || h->valueint < 0 || h->valueint > 100) {
+            cJSON_Delete(root);
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid mask");
+            return ESP_FAIL;
+        }
+        masks[count++] = (video_mask_t){ x->valueint, y->valueint, w->valueint, h->valueint };
+    }
+    cJSON_Delete(root);
+
+    // Persist what was accepted, clear the remaining slots
+    count = video_mask_set(masks, count);
+    video_mask_get(masks);
+    for (int i = 0; i < MASK_MAX; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "mask%d", i);
+        saveCameraSetting(key, i < count ? video_mask_pack(&masks[i]) : 0);
+    }
+
+    cJSON *resp = cJSON_CreateObject();
+    cJSON_AddBoolToObject(resp, "ok", true);
+    cJSON_AddNumberToObject(resp, "masks", count);
+    return send_json(req, resp);
+}
+
 static esp_err_t api_auth_check_handler(httpd_req_t *req)
 {
     cJSON *root = cJSON_CreateObject();
@@ -523,8 +747,10 @@ static esp_err_t api_wifi_scan_handler(httpd_req_t *req)
 static esp_err_t api_audio_config_get_handler(httpd_req_t *req)
 {
     cJSON *root = cJSON_CreateObject();
-    cJSON_AddNumberToObject(root, "mic_gain", (int)mic_gain);
+    cJSON_AddNumberToObject(root, "mic_gain_db", (int)mic_gain_db);
+    cJSON_AddNumberToObject(root, "mic_gain", pcm_gain_factor(mic_gain_db));  // former multiplier
     cJSON_AddNumberToObject(root, "sample_rate", stored_sample_rate);
+    cJSON_AddNumberToObject(root, "capture_rate", SAMPLE_RATE);
     cJSON_AddNumberToObject(root, "mic_bits", SAMPLE_BITS);
     cJSON_AddNumberToObject(root, "wav_bits", stored_wav_bits);
     return send_json(req, root);
@@ -546,23 +772,26 @@ static esp_err_t api_audio_config_post_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
-    cJSON *gain_item = cJSON_GetObjectItem(root, "mic_gain");
-    if (cJSON_IsNumber(gain_item) && gain_item->valueint >= 1 && gain_item->valueint <= 32) {
+    // mic_gain_db, or the former multiplier mic_gain (1-32) from older clients
+    cJSON *gain_item = cJSON_GetObjectItem(root, "mic_gain_db");
+    cJSON *factor_item = cJSON_GetObjectItem(root, "mic_gain");
+    if (cJSON_IsNumber(gain_item) && gain_item->valueint >= PCM_GAIN_DB_MIN &&
+        gain_item->valueint <= PCM_GAIN_DB_MAX) {
         saveMicGain(gain_item->valueint);
+    } else if (cJSON_IsNumber(factor_item) && factor_item->valueint >= 1 &&
+               factor_item->valueint <= PCM_GAIN_FACTOR_MAX) {
+        saveMicGain(pcm_gain_db_from_factor(factor_item->valueint));
     }
 
     cJSON *sr_item = cJSON_GetObjectItem(root, "sample_rate");
     cJSON *wb_item = cJSON_GetObjectItem(root, "wav_bits");
     int new_sr = stored_sample_rate;
     int new_wb = stored_wav_bits;
-    bool rate_changed = false;
 
-    if (cJSON_IsNumber(sr_item)) {
-        int sr = sr_item->valueint;
-        if (sr == 8000 || sr == 11025 || sr == 16000 || sr == 22050 || sr == 44100) {
-            if (sr != stored_sample_rate) rate_changed = true;
-            new_sr = sr;
-        }
+    // The mic keeps capturing at SAMPLE_RATE: the rate only sets what new
+    // streams get, the ones running keep theirs
+    if (cJSON_IsNumber(sr_item) && AUDIO_RATE_VALID(sr_item->valueint)) {
+        new_sr = sr_item->valueint;
     }
     if (cJSON_IsNumber(wb_item)) {
         int wb = wb_item->valueint;
@@ -577,10 +806,6 @@ static esp_err_t api_audio_config_post_handler(httpd_req_t *req)
         saveAudioConfig(new_sr, new_wb);
     }
 
-    if (rate_changed) {
-        mic_i2s_reinit();
-    }
-
     cJSON *resp = cJSON_CreateObject();
     cJSON_AddBoolToObject(resp, "ok", true);
     return send_json(req, resp);
@@ -684,12 +909,18 @@ void start_http_ui(void)
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = 80;
     config.ctrl_port = 32768;
-    config.max_uri_handlers = 34;
-    config.max_open_sockets = 4;
+    config.max_uri_handlers = 48;
+    // LRU purge makes room for API requests by closing the idlest session.
+    // WebSocket viewers only send, so ws_stream.c stamps their sessions
+    // each WS_TELEMETRY_MS and an idle keep-alive API socket goes first.
+    config.max_open_sockets = HTTP_UI_OPEN_SOCKETS;
     config.lru_purge_enable = true;
+    config.close_fn = ws_stream_close_fn;
 
     httpd_handle_t server = NULL;
 
+    init_camera_capture();
+
     ESP_LOGI(TAG, "Starting UI server on port %d", config.server_port);
     if (httpd_start(&server, &config) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to start UI server");
@@ -706,6 +937,7 @@ void start_http_ui(void)
         // Info APIs
         { .uri = "/api/info",               .method = HTTP_GET,  .handler = api_info_handler,             .user_ctx = NULL },
         { .uri = "/api/system/info",        .method = HTTP_GET,  .handler = api_system_info_handler,      .user_ctx = NULL },
+        { .uri = "/api/stream/stats",       .method = HTTP_GET,  .handler = api_stream_stats_handler,     .user_ctx = NULL },
 
         // Auth APIs
         { .uri = "/api/auth/check",         .method = HTTP_GET,  .handler = api_auth_check_handler,       .user_ctx = NULL },
@@ -733,6 +965,19 @@ void start_http_ui(void)
         { .uri = "/api/camera/control",     .method = HTTP_POST, .handler = camera_control_handler,       .user_ctx = NULL },
         { .uri = "/api/camera/control",     .method = HTTP_OPTIONS, .handler = cors_handler,              .user_ctx = NULL },
         { .uri = "/api/camera/capture",     .method = HTTP_GET,  .handler = camera_capture_handler,       .user_ctx = NULL },
+        { .uri = "/api/motion",             .method = HTTP_GET,  .handler = api_motion_handler,           .user_ctx = NULL },
+        { .uri = "/api/focus",              .method = HTTP_GET,  .handler = api_focus_handler,            .user_ctx = NULL },
+        { .uri = "/api/exposure",           .method = HTTP_GET,  .handler = api_exposure_handler,         .user_ctx = NULL },
+        { .uri = "/api/camera/masks",       .method = HTTP_GET,  .handler = api_masks_get_handler,        .user_ctx = NULL },
+        { .uri = "/api/camera/masks",       .method = HTTP_POST, .handler = api_masks_post_handler,       .user_ctx = NULL },
+        { .uri = "/api/camera/masks",       .method = HTTP_OPTIONS, .handler = cors_handler,              .user_ctx = NULL },
+
+        // Live stream (WebSocket)
+        { .uri = "/ws",                     .method = HTTP_GET,  .handler = ws_stream_handler,            .user_ctx = NULL, .is_websocket = true },
+
+        // Clip APIs
+        { .uri = "/api/clip",               .method = HTTP_GET,  .handler = clip_export_handler,          .user_ctx = NULL },
+        { .uri = "/api/clip/status",        .method = HTTP_GET,  .handler = clip_status_handler,          .user_ctx = NULL },
 
         // System action APIs
         { .uri = "/api/system/reboot",     .method = HTTP_POST, .handler = api_system_reboot_handler,     .user_ctx = NULL },
@@ -2,6 +2,15 @@
 
 #include <stdbool.h>
 #include "esp_http_server.h"
+#include "ws_stream.h"
+
+// Port 80: API requests and the WebSocket viewers share the open sockets
+// (least recently used is purged, and WebSocket clients are stamped each
+// WS_TELEMETRY_MS); plus the three sockets httpd uses internally (TCP listener,
+// and a UDP control socket each to send and receive)
+#define HTTP_UI_OPEN_SOCKETS  3
+#define HTTP_UI_SOCKETS       (HTTP_UI_OPEN_SOCKETS + 3)
+_Static_assert(WS_MAX_CLIENTS < HTTP_UI_OPEN_SOCKETS, "WebSocket viewers must leave a socket for the API");
 
 void start_http_ui(void);
 void setupLedFlash(int pin);
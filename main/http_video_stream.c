@@ -1,23 +1,26 @@
 #include "http_video_stream.h"
 #include "http_ui.h"
+#include "video_adapt.h"
+#include "clip_ring.h"
+#include "stream_engine.h"
+#include "video_analyze.h"
+#include "video_overlay.h"
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "esp_http_server.h"
 #include "esp_timer.h"
 #include "esp_camera.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 
 static const char *TAG = "http_video";
 
-#define PART_BOUNDARY "123456789000000000000987654321"
-static const char *_STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
-static const char *_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char *_STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %lld.%06ld\r\n\r\n";
-
 // Running average filter for frame rate logging
 typedef struct {
     size_t size;
@@ -57,181 +60,468 @@ static int ra_filter_run(ra_filter_t *filter, int value)
     return filter->sum / filter->count;
 }
 
-// Async streaming state
-static volatile bool s_stream_stop = false;
-static volatile TaskHandle_t s_stream_task = NULL;
+// Fan-out state: one capture task publishes the latest frame, each viewer
+// (stream engine connection, RTSP session, WebSocket) picks it up.
+// Everything below is guarded by s_lock.
+typedef struct {
+    bool used;
+    SemaphoreHandle_t ready;    // given by the capture task on every new frame
+    int64_t interval_us;        // pacing interval, 0 = every captured frame
+    int64_t next_due_us;        // capture timestamp the next sent frame aims for
+    int64_t taken_us;           // last frame handed to the viewer
+} stream_client_t;
+
+// Exponential moving average, 1/8 weight for the new sample
+#define EMA_UPDATE(avg, sample) ((avg) += ((int32_t)(sample) - (int32_t)(avg)) / 8)
+
+static SemaphoreHandle_t s_lock = NULL;
+static stream_client_t s_clients[STREAM_MAX_CLIENTS];
+static int s_client_count = 0;
+static stream_frame_t *s_latest = NULL;
+static uint32_t s_frame_seq = 0;
+static volatile bool s_capture_stop = false;
+static volatile TaskHandle_t s_capture_task = NULL;
+static bool s_background = false;           // keep capturing with no viewers
+static video_stream_stats_t s_stats;
+static stream_frame_t *s_cached = NULL;     // PSRAM copy of the last frame
 
-static void video_stream_task(void *arg)
+int64_t stream_frame_time_us(const stream_frame_t *frame)
 {
-    httpd_req_t *req = (httpd_req_t *)arg;
-    camera_fb_t *fb = NULL;
-    struct timeval _timestamp;
-    esp_err_t res = ESP_OK;
-    size_t _jpg_buf_len = 0;
-    uint8_t *_jpg_buf = NULL;
-    char part_buf[128];
+    return (int64_t)frame->timestamp.tv_sec * 1000000 + frame->timestamp.tv_usec;
+}
 
-    int64_t last_frame = esp_timer_get_time();
+stream_frame_t *stream_frame_ref(stream_frame_t *frame)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    frame->refs++;
+    xSemaphoreGive(s_lock);
+    return frame;
+}
 
-    res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-    if (res != ESP_OK) {
-        goto cleanup;
+static void frame_destroy(stream_frame_t *frame)
+{
+    if (frame->fb) {
+        esp_camera_fb_return(frame->fb);
+    } else {
+        free(frame->buf);
     }
+    free(frame);
+}
+
+void stream_frame_release(stream_frame_t *frame)
+{
+    if (!frame) return;
 
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    httpd_resp_set_hdr(req, "X-Framerate", "60");
-    httpd_resp_set_hdr(req, "Accept-Ranges", "none");
-    httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store");
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool last = (--frame->refs == 0);
+    xSemaphoreGive(s_lock);
 
-    isStreaming = true;
-    if (led_stream_enabled)
+    if (!last) return;
+    frame_destroy(frame);
+}
+
+// Wrap a camera buffer into a shared frame, converting to JPEG if needed
+// and applying the overlay edits (video_overlay.h); NULL if dropped
+stream_frame_t *stream_frame_from_fb(camera_fb_t *fb)
+{
+    stream_frame_t *frame = (stream_frame_t *)calloc(1, sizeof(stream_frame_t));
+    if (!frame) {
+        esp_camera_fb_return(fb);
+        return NULL;
+    }
+    frame->timestamp = fb->timestamp;
+    frame->refs = 1;
+
+    if (fb->format == PIXFORMAT_JPEG) {
+        frame->fb = fb;
+        frame->buf = fb->buf;
+        frame->len = fb->len;
+    } else {
+        int64_t t0 = esp_timer_get_time();
+        bool jpeg_converted = frame2jpg(fb, 80, &frame->buf, &frame->len);
+        esp_camera_fb_return(fb);
+        // Also reached from the snapshot handler, not just the capture task
+        int64_t encode_us = esp_timer_get_time() - t0;
+        if (s_lock) {
+            xSemaphoreTake(s_lock, portMAX_DELAY);
+            EMA_UPDATE(s_stats.encode_us, encode_us);
+            xSemaphoreGive(s_lock);
+        }
+        if (!jpeg_converted) {
+            ESP_LOGE(TAG, "JPEG compression failed");
+            free(frame);
+            return NULL;
+        }
+    }
+
+    // Privacy masks go in before anything can see the frame
+    if (!video_overlay_apply(frame)) {
+        frame_destroy(frame);
+        return NULL;
+    }
+    return frame;
+}
+
+stream_frame_t *video_latest_frame(bool *live)
+{
+    if (!s_lock) return NULL;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    stream_frame_t *frame = s_latest;
+    *live = (frame != NULL);
+    if (!frame) frame = s_cached;
+    if (frame) frame->refs++;
+    xSemaphoreGive(s_lock);
+    return frame;
+}
+
+void video_cache_frame(const stream_frame_t *frame)
+{
+    if (!frame || !s_lock) return;
+
+    stream_frame_t *copy = (stream_frame_t *)calloc(1, sizeof(stream_frame_t));
+    if (!copy) return;
+    copy->buf = (uint8_t *)heap_caps_malloc(frame->len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!copy->buf) copy->buf = (uint8_t *)malloc(frame->len);
+    if (!copy->buf) {
+        free(copy);
+        return;
+    }
+    memcpy(copy->buf, frame->buf, frame->len);
+    copy->len = frame->len;
+    copy->timestamp = frame->timestamp;
+    copy->seq = frame->seq;
+    copy->refs = 1;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    stream_frame_t *prev = s_cached;
+    s_cached = copy;
+    xSemaphoreGive(s_lock);
+    stream_frame_release(prev);
+}
+
+// The stream LED and isStreaming follow viewers, not background capture
+static void stream_led(bool viewing)
+{
+    if (viewing && led_stream_enabled)
         enable_led(true);
+    else if (!viewing && !led_on)
+        enable_led(false);
+}
+
+static void video_capture_task(void *arg)
+{
+    int64_t last_frame = esp_timer_get_time();
+    stream_frame_t *last = NULL;
+
+    while (true) {
+        // Exit once the last viewer is gone (unless capturing in the
+        // background); decided under the lock so a viewer joining right now
+        // either sees us running or restarts us
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        if (s_client_count == 0 && !s_background) {
+            s_capture_stop = true;
+        }
+        if (s_capture_stop) {
+            last = s_latest;
+            s_latest = NULL;
+            s_capture_task = NULL;
+            s_stats.fps = 0;
+            isStreaming = false;
+            xSemaphoreGive(s_lock);
+            break;
+        }
+        bool viewing = s_client_count > 0;
+        bool changed = (viewing != isStreaming);
+        isStreaming = viewing;
+        xSemaphoreGive(s_lock);
+        if (changed) stream_led(viewing);
 
-    while (!s_stream_stop) {
-        fb = esp_camera_fb_get();
+        int64_t t0 = esp_timer_get_time();
+        camera_fb_t *fb = esp_camera_fb_get();
+        int64_t capture_us = esp_timer_get_time() - t0;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        EMA_UPDATE(s_stats.capture_us, capture_us);
+        xSemaphoreGive(s_lock);
         if (!fb) {
             ESP_LOGE(TAG, "Camera capture failed");
-            res = ESP_FAIL;
+            vTaskDelay(pdMS_TO_TICKS(100));
         } else {
-            _timestamp.tv_sec = fb->timestamp.tv_sec;
-            _timestamp.tv_usec = fb->timestamp.tv_usec;
-            if (fb->format != PIXFORMAT_JPEG) {
-                bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-                esp_camera_fb_return(fb);
-                fb = NULL;
-                if (!jpeg_converted) {
-                    ESP_LOGE(TAG, "JPEG compression failed");
-                    res = ESP_FAIL;
+            stream_frame_t *frame = stream_frame_from_fb(fb);
+            if (frame) {
+                // Before publishing, so viewers see this frame's motion state
+                video_analyze_frame(frame);
+
+                xSemaphoreTake(s_lock, portMAX_DELAY);
+                stream_frame_t *prev = s_latest;
+                frame->seq = ++s_frame_seq;
+                s_latest = frame;
+                s_stats.frames++;
+                if (frame->dup) s_stats.duplicates++;
+                for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+                    if (s_clients[i].used) xSemaphoreGive(s_clients[i].ready);
                 }
-            } else {
-                _jpg_buf_len = fb->len;
-                _jpg_buf = fb->buf;
+                xSemaphoreGive(s_lock);
+                stream_frame_release(prev);
+                stream_engine_wake();
+
+                clip_ring_push_video(frame->buf, frame->len, stream_frame_time_us(frame));
+
+                int64_t fr_end = esp_timer_get_time();
+                int64_t frame_time = fr_end - last_frame;
+                last_frame = fr_end;
+                frame_time /= 1000;
+                uint32_t avg_frame_time = ra_filter_run(&ra_filter, frame_time);
+                xSemaphoreTake(s_lock, portMAX_DELAY);
+                s_stats.fps = avg_frame_time ? 1000.0f / avg_frame_time : 0;
+                xSemaphoreGive(s_lock);
+                ESP_LOGD(TAG, "MJPG: %uB %ums (%.1ffps), AVG: %ums (%.1ffps), %d viewer(s)",
+                         (uint32_t)frame->len,
+                         (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time,
+                         avg_frame_time, 1000.0 / avg_frame_time, s_client_count);
             }
         }
-        if (res == ESP_OK) {
-            res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
-        }
-        if (res == ESP_OK) {
-            size_t hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART,
-                                   _jpg_buf_len, (long long)_timestamp.tv_sec,
-                                   (long)_timestamp.tv_usec);
-            res = httpd_resp_send_chunk(req, part_buf, hlen);
-        }
-        if (res == ESP_OK) {
-            res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
-        }
-        if (fb) {
-            esp_camera_fb_return(fb);
-            fb = NULL;
-            _jpg_buf = NULL;
-        } else if (_jpg_buf) {
-            free(_jpg_buf);
-            _jpg_buf = NULL;
-        }
-        if (res != ESP_OK) {
-            ESP_LOGI(TAG, "Stream send failed, client disconnected");
-            break;
-        }
-        int64_t fr_end = esp_timer_get_time();
-        int64_t frame_time = fr_end - last_frame;
-        last_frame = fr_end;
-        frame_time /= 1000;
-        uint32_t avg_frame_time = ra_filter_run(&ra_filter, frame_time);
-        ESP_LOGD(TAG, "MJPG: %uB %ums (%.1ffps), AVG: %ums (%.1ffps)",
-                 (uint32_t)_jpg_buf_len,
-                 (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time,
-                 avg_frame_time, 1000.0 / avg_frame_time);
-    }
-
-cleanup:
-    isStreaming = false;
-    if (!led_on)
+        video_adapt_tick();
+    }
+
+    // Snapshots keep being served from this copy once the stream is gone
+    video_cache_frame(last);
+    stream_frame_release(last);
+    if (!led_on && !isStreaming)
         enable_led(false);
-    httpd_req_async_handler_complete(req);
-    ESP_LOGI(TAG, "Video stream ended");
-    s_stream_task = NULL;
+    ESP_LOGI(TAG, "Video capture stopped");
     vTaskDelete(NULL);
 }
 
-static esp_err_t stream_handler(httpd_req_t *req)
+// Start the capture task if it isn't running; call with s_lock held
+static bool start_capture_task(void)
 {
-    if (!esp_camera_sensor_get()) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Camera not available");
-        return ESP_FAIL;
+    if (s_capture_task) return true;
+
+    s_capture_stop = false;
+    if (xTaskCreatePinnedToCore(video_capture_task, "vid_capture", 6144,
+                                NULL, 6, (TaskHandle_t *)&s_capture_task,
+                                STREAM_CAPTURE_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create video capture task");
+        s_capture_task = NULL;
+        return false;
     }
+    return true;
+}
 
-    // Stop any existing stream task
-    if (s_stream_task) {
-        ESP_LOGI(TAG, "Stopping previous stream");
-        s_stream_stop = true;
-        for (int i = 0; i < 30 && s_stream_task; i++) {
-            vTaskDelay(pdMS_TO_TICKS(100));
+// Take a reference to the newest frame this viewer has not sent yet.
+// The hand-off is a one-deep mailbox: a viewer that falls behind skips
+// straight to the latest frame, so a slow link never adds queueing delay.
+// Duplicates are skipped unless the viewer has had nothing for a while.
+static stream_frame_t *stream_take_latest(stream_client_t *client, uint32_t *last_seq)
+{
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    stream_frame_t *frame = s_latest;
+    if (frame && frame->seq != *last_seq) {
+        if (*last_seq && frame->seq - *last_seq > 1) {
+            s_stats.dropped += frame->seq - *last_seq - 1;
         }
-        if (s_stream_task) {
-            ESP_LOGW(TAG, "Previous stream task did not stop in time");
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Previous stream still running");
-            return ESP_FAIL;
+        *last_seq = frame->seq;
+        if (frame->dup && client->taken_us &&
+            now - client->taken_us < DEDUP_KEEPALIVE_S * 1000000LL) {
+            s_stats.suppressed++;
+            frame = NULL;
+        } else {
+            frame->refs++;
+            client->taken_us = now;
         }
+    } else {
+        frame = NULL;
     }
+    xSemaphoreGive(s_lock);
+    return frame;
+}
 
-    s_stream_stop = false;
+// Decide whether a paced viewer sends this frame. Deadlines advance on a
+// fixed grid (not "interval since last send"), and a frame is taken when it
+// is the one closest to the deadline, so the output rate has no drift and
+// at most half a capture period of jitter.
+static bool stream_pace(stream_client_t *client, const stream_frame_t *frame)
+{
+    if (!client->interval_us) return true;
 
-    // Create async copy of the request — frees the httpd server task
-    httpd_req_t *async_req = NULL;
-    esp_err_t err = httpd_req_async_handler_begin(req, &async_req);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "httpd_req_async_handler_begin failed: %s", esp_err_to_name(err));
-        return ESP_FAIL;
-    }
+    int64_t ts = stream_frame_time_us(frame);
+    float fps = s_stats.fps;
+    int64_t half_period = fps > 0 ? (int64_t)(500000.0f / fps) : 0;
 
-    // Spawn streaming in a dedicated FreeRTOS task
-    BaseType_t ret = xTaskCreate(video_stream_task, "vid_stream", 4096,
-                                 async_req, 5, (TaskHandle_t *)&s_stream_task);
-    if (ret != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create video stream task");
-        httpd_req_async_handler_complete(async_req);
-        return ESP_FAIL;
+    if (client->next_due_us && ts < client->next_due_us - half_period) {
+        return false;
     }
+    client->next_due_us += client->interval_us;
+    if (client->next_due_us < ts) {
+        // First frame, or fell a whole interval behind — re-anchor the grid
+        client->next_due_us = ts + client->interval_us;
+    }
+    return true;
+}
 
-    ESP_LOGI(TAG, "Video stream started (async)");
-    return ESP_OK;
+// Account a delivered frame: t0 = started waiting for it, t1 = started sending
+static void stream_sent(stream_client_t *client, const stream_frame_t *frame, int64_t t0, int64_t t1)
+{
+    int64_t t2 = esp_timer_get_time();
+    int64_t captured = stream_frame_time_us(frame);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_stats.sent++;
+    EMA_UPDATE(s_stats.wait_us, t1 - t0);
+    EMA_UPDATE(s_stats.send_us, t2 - t1);
+    EMA_UPDATE(s_stats.latency_us, t2 - captured);
+    xSemaphoreGive(s_lock);
+    video_adapt_on_sent(client - s_clients, frame->len, t2 - t1);
 }
 
-void stop_video_stream(void)
+// Reserve a viewer slot; NULL when all STREAM_MAX_CLIENTS are taken
+static stream_client_t *viewer_reserve(int64_t interval_us)
 {
-    if (s_stream_task) {
-        s_stream_stop = true;
-        for (int i = 0; i < 30 && s_stream_task; i++) {
-            vTaskDelay(pdMS_TO_TICKS(100));
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    stream_client_t *client = NULL;
+    for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+        if (!s_clients[i].used) {
+            client = &s_clients[i];
+            break;
+        }
+    }
+    if (client) {
+        memset(client, 0, sizeof(*client));
+        client->interval_us = interval_us;
+        client->ready = xSemaphoreCreateBinary();
+        if (client->ready) {
+            client->used = true;
+            s_client_count++;
+        } else {
+            client = NULL;
         }
     }
+    xSemaphoreGive(s_lock);
+    return client;
 }
 
-void start_http_video_stream(void)
+static int viewer_release(stream_client_t *client)
 {
-    ra_filter_init(&ra_filter, 20);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    vSemaphoreDelete(client->ready);
+    client->ready = NULL;
+    client->used = false;
+    s_client_count--;
+    int remaining = s_client_count;
+    xSemaphoreGive(s_lock);
+    return remaining;
+}
+
+void video_stream_get_stats(video_stream_stats_t *stats)
+{
+    if (!s_lock) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *stats = s_stats;
+    stats->viewers = s_client_count;
+    xSemaphoreGive(s_lock);
+}
+
+int video_viewer_open(int64_t interval_us)
+{
+    if (!s_lock || !esp_camera_sensor_get()) return -1;
+
+    stream_client_t *client = viewer_reserve(interval_us);
+    if (!client) return -1;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool running = start_capture_task();
+    xSemaphoreGive(s_lock);
+    if (!running) {
+        viewer_release(client);
+        return -1;
+    }
+    return client - s_clients;
+}
+
+stream_frame_t *video_viewer_next(int viewer, uint32_t *last_seq)
+{
+    if (xSemaphoreTake(s_clients[viewer].ready, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        return NULL;
+    }
+    return stream_take_latest(&s_clients[viewer], last_seq);
+}
+
+stream_frame_t *video_viewer_poll(int viewer, uint32_t *last_seq)
+{
+    stream_frame_t *frame = stream_take_latest(&s_clients[viewer], last_seq);
+    if (frame && !stream_pace(&s_clients[viewer], frame)) {
+        stream_frame_release(frame);
+        frame = NULL;
+    }
+    return frame;
+}
+
+void video_viewer_sent(int viewer, const stream_frame_t *frame, int64_t t0, int64_t t1)
+{
+    stream_sent(&s_clients[viewer], frame, t0, t1);
+}
+
+void video_viewer_close(int viewer)
+{
+    int remaining = viewer_release(&s_clients[viewer]);
+    ESP_LOGI(TAG, "Viewer closed (%d viewer(s) left)", remaining);
+}
+
+// Per-viewer rate cap from ?fps=N or ?interval_ms=N (0 = no cap)
+int64_t video_parse_interval(const char *query)
+{
+    char value[16];
+    int64_t interval_us = 0;
 
-    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.server_port = 81;
-    config.ctrl_port = 32769;
-    config.max_open_sockets = 2;
-    config.lru_purge_enable = true;
-    config.send_wait_timeout = 2;
-    config.recv_wait_timeout = 2;
+    if (httpd_query_key_value(query, "interval_ms", value, sizeof(value)) == ESP_OK) {
+        int ms = atoi(value);
+        if (ms > 0 && ms <= 3600000) interval_us = (int64_t)ms * 1000;
+    } else if (httpd_query_key_value(query, "fps", value, sizeof(value)) == ESP_OK) {
+        float fps = strtof(value, NULL);
+        if (fps > 0 && fps <= 60) interval_us = (int64_t)(1000000.0f / fps);
+    }
+    return interval_us;
+}
+
+void video_stream_set_background(bool enable)
+{
+    s_background = enable;
+    if (!s_lock || !enable || !esp_camera_sensor_get()) return;
 
-    httpd_handle_t server = NULL;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    start_capture_task();
+    xSemaphoreGive(s_lock);
+}
+
+void stop_video_stream(void)
+{
+    if (!s_lock) return;
+
+    // Viewers belong to the stream engine, RTSP and WebSocket servers, which
+    // are stopped first; this only winds down the capture task
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_capture_stop = true;
+    xSemaphoreGive(s_lock);
+
+    for (int i = 0; i < 30 && (s_capture_task || s_client_count > 0); i++) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+
+void init_video_stream(void)
+{
+    ra_filter_init(&ra_filter, 20);
 
-    ESP_LOGI(TAG, "Starting video stream server on port %d", config.server_port);
-    if (httpd_start(&server, &config) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to start video stream server");
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+        ESP_LOGE(TAG, "Failed to create stream lock");
         return;
     }
 
-    httpd_uri_t stream_uri = {
-        .uri = "/stream",
-        .method = HTTP_GET,
-        .handler = stream_handler,
-        .user_ctx = NULL
-    };
-    httpd_register_uri_handler(server, &stream_uri);
+    // Background capture requested before the pipeline existed
+    if (s_background) video_stream_set_background(true);
 }
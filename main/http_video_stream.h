@@ -1,4 +1,89 @@
 #pragma once
 
-void start_http_video_stream(void);
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+
+// Maximum concurrent viewers (/stream, RTSP, /ws). All viewers share one
+// sensor readout. main.c checks the total of all servers' sockets against
+// CONFIG_LWIP_MAX_SOCKETS.
+#define STREAM_MAX_CLIENTS    3
+
+// Core affinity of the video pipeline: the capture task keeps the sensor
+// busy on one core while the stream engine (and the RTSP and WebSocket
+// tasks) send on the other
+#if CONFIG_FREERTOS_UNICORE
+#define STREAM_CAPTURE_CORE   tskNO_AFFINITY
+#define STREAM_SEND_CORE      tskNO_AFFINITY
+#else
+#define STREAM_CAPTURE_CORE   1
+#define STREAM_SEND_CORE      0
+#endif
+
+// Refcounted JPEG frame shared by the capture task and all viewers.
+// The camera buffer (or converted JPEG) is released with the last reference.
+typedef struct {
+    camera_fb_t *fb;      // camera buffer, NULL if buf is a malloc'd JPEG
+    uint8_t *buf;
+    size_t len;
+    struct timeval timestamp;
+    uint32_t seq;
+    bool dup;             // same picture as the last distinct frame (video_analyze.h)
+    int refs;
+} stream_frame_t;
+
+stream_frame_t *stream_frame_ref(stream_frame_t *frame);
+void stream_frame_release(stream_frame_t *frame);
+stream_frame_t *stream_frame_from_fb(camera_fb_t *fb);
+int64_t stream_frame_time_us(const stream_frame_t *frame);
+
+// Newest frame available without touching the sensor: the live frame while
+// a stream is running, otherwise the PSRAM copy of the last captured frame.
+// Returns a reference (release it) or NULL; *live tells which one it is.
+stream_frame_t *video_latest_frame(bool *live);
+
+// Keep a PSRAM copy of a frame for video_latest_frame()
+void video_cache_frame(const stream_frame_t *frame);
+
+// Pipeline statistics (averages are exponential, in microseconds)
+typedef struct {
+    int viewers;
+    float fps;                // capture rate
+    uint32_t frames;          // frames published by the capture task
+    uint32_t sent;            // frames delivered, summed over viewers
+    uint32_t dropped;         // frames skipped by viewers that fell behind
+    uint32_t duplicates;      // captured frames marked as duplicates
+    uint32_t suppressed;      // duplicates withheld from viewers, summed over viewers
+    uint32_t capture_us;      // time blocked in esp_camera_fb_get()
+    uint32_t encode_us;       // JPEG conversion (non-JPEG sensors only)
+    uint32_t wait_us;         // viewer idle time waiting for a new frame
+    uint32_t send_us;         // boundary + header + JPEG send
+    uint32_t latency_us;      // sensor timestamp to last byte handed to lwIP
+} video_stream_stats_t;
+
+void video_stream_get_stats(video_stream_stats_t *stats);
+
+// Frame fan-out. A viewer takes one of the STREAM_MAX_CLIENTS slots and
+// keeps capture running; interval_us caps its rate (0 = every frame).
+// video_viewer_next() waits up to a second for a frame newer than *last_seq,
+// video_viewer_poll() returns one only if it is ready and due (NULL
+// otherwise). Report delivered frames (t0 = began waiting, t1 = began
+// sending) so they show up in the stats and the adaptive controller.
+int video_viewer_open(int64_t interval_us);
+stream_frame_t *video_viewer_next(int viewer, uint32_t *last_seq);
+stream_frame_t *video_viewer_poll(int viewer, uint32_t *last_seq);
+void video_viewer_sent(int viewer, const stream_frame_t *frame, int64_t t0, int64_t t1);
+void video_viewer_close(int viewer);
+
+// Per-viewer rate cap from a ?fps=N or ?interval_ms=N query string
+int64_t video_parse_interval(const char *query);
+
+// Keep the capture task running without viewers (feeds the clip ring)
+void video_stream_set_background(bool enable);
+
+void init_video_stream(void);
 void stop_video_stream(void);
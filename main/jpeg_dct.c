@@ -0,0 +1,825 @@
+#include "jpeg_dct.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define HUFF_LOOKAHEAD  9       // bits resolved by one table lookup
+
+// Decoding table for one DHT (JPEG spec F.2.2.3 plus a lookahead table)
+typedef struct {
+    uint16_t lookup[1 << HUFF_LOOKAHEAD];   // (length << 8) | symbol, 0 = longer code
+    int32_t maxcode[17];                     // largest code of each length, -1 = none
+    int32_t mincode[17];
+    uint16_t valptr[17];
+    uint8_t vals[256];
+    bool valid;
+} huff_dec_t;
+
+// Encoding table: code and length per symbol
+typedef struct {
+    uint16_t code[256];
+    uint8_t size[256];
+} huff_enc_t;
+
+// Bit reader over the entropy-coded data
+typedef struct {
+    const uint8_t *p, *end;
+    uint32_t acc;               // MSB-aligned
+    int bits;
+    int pad;                    // zero bytes fed after reaching a marker
+    bool marker;
+    uint32_t consumed;          // bits taken since the scan or restart interval began
+} bit_reader_t;
+
+struct jpeg_dct {
+    jpeg_dct_info_t info;
+    huff_dec_t dc[2], ac[2];
+    const uint8_t *dht_bits[2][2], *dht_vals[2][2];   // source tables, [class][index]
+    uint8_t td[JPEG_DCT_MAX_COMPS], ta[JPEG_DCT_MAX_COMPS];
+    const uint8_t *src;
+    size_t header_len;          // bytes before the entropy-coded data
+    const uint8_t *sof;         // SOF segment of the source, marker included
+    size_t sof_len;
+
+    bit_reader_t br;
+    int16_t pred[JPEG_DCT_MAX_COMPS];
+    uint32_t mcu;
+    bit_reader_t mcu_start;     // reader and predictors before the last MCU read
+    int16_t mcu_pred[JPEG_DCT_MAX_COMPS];
+
+    // Bit writer
+    huff_enc_t enc_dc[2], enc_ac[2];
+    bool enc_std;               // encoding tables are the standard ones
+    uint8_t wtd[JPEG_DCT_MAX_COMPS], wta[JPEG_DCT_MAX_COMPS];
+    bool edit;                  // source headers and tables kept, MCUs copied
+    uint8_t *out;
+    size_t out_size, out_pos;
+    bool failed;                // out too small, or a symbol the tables can't code
+    uint32_t wacc;
+    int wbits;
+    int16_t wpred[JPEG_DCT_MAX_COMPS];
+    uint32_t wmcu;
+    int wrst;
+    bool run;                   // unchanged MCUs waiting to be copied
+    bit_reader_t run_start;
+    uint32_t run_end;           // br.consumed after the last of them
+};
+
+// Zigzag index -> natural (row-major) position in the 8x8 block
+static const uint8_t zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// Huffman tables from the JPEG spec (K.3), used for re-encoded frames
+static const uint8_t std_dc_luma_bits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t std_dc_chroma_bits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const uint8_t std_dc_vals[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uint8_t std_ac_luma_bits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const uint8_t std_ac_luma_vals[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+static const uint8_t std_ac_chroma_bits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const uint8_t std_ac_chroma_vals[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+static bool huff_dec_build(huff_dec_t *h, const uint8_t *bits, const uint8_t *vals, int count)
+{
+    memset(h->lookup, 0, sizeof(h->lookup));
+    int32_t code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; len++) {
+        h->valptr[len] = k;
+        h->mincode[len] = code;
+        for (int i = 0; i < bits[len - 1]; i++, k++, code++) {
+            if (code >= (1 << len)) return false;   // over-subscribed
+            if (len <= HUFF_LOOKAHEAD) {
+                int shift = HUFF_LOOKAHEAD - len;
+                for (int j = 0; j < (1 << shift); j++) {
+                    h->lookup[(code << shift) | j] = (uint16_t)((len << 8) | vals[k]);
+                }
+            }
+        }
+        h->maxcode[len] = bits[len - 1] ? code - 1 : -1;
+        code <<= 1;
+    }
+    memcpy(h->vals, vals, count);
+    h->valid = true;
+    return true;
+}
+
+static void huff_enc_build(huff_enc_t *e, const uint8_t *bits, const uint8_t *vals)
+{
+    memset(e, 0, sizeof(*e));
+    uint16_t code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; len++) {
+        for (int i = 0; i < bits[len - 1]; i++, k++, code++) {
+            e->code[vals[k]] = code;
+            e->size[vals[k]] = len;
+        }
+        code <<= 1;
+    }
+}
+
+static void enc_build_std(jpeg_dct_t *d)
+{
+    huff_enc_build(&d->enc_dc[0], std_dc_luma_bits, std_dc_vals);
+    huff_enc_build(&d->enc_dc[1], std_dc_chroma_bits, std_dc_vals);
+    huff_enc_build(&d->enc_ac[0], std_ac_luma_bits, std_ac_luma_vals);
+    huff_enc_build(&d->enc_ac[1], std_ac_chroma_bits, std_ac_chroma_vals);
+    d->enc_std = true;
+}
+
+jpeg_dct_t *jpeg_dct_new(void)
+{
+    jpeg_dct_t *d = (jpeg_dct_t *)calloc(1, sizeof(jpeg_dct_t));
+    if (!d) return NULL;
+    enc_build_std(d);
+    return d;
+}
+
+void jpeg_dct_free(jpeg_dct_t *d)
+{
+    free(d);
+}
+
+const jpeg_dct_info_t *jpeg_dct_info(const jpeg_dct_t *d)
+{
+    return &d->info;
+}
+
+static bool parse_sof(jpeg_dct_t *d, const uint8_t *seg, int n)
+{
+    jpeg_dct_info_t *info = &d->info;
+    if (n < 6 || seg[0] != 8) return false;
+    info->height = (seg[1] << 8) | seg[2];
+    info->width = (seg[3] << 8) | seg[4];
+    info->ncomp = seg[5];
+    if (!info->width || !info->height || info->ncomp < 1 || info->ncomp > JPEG_DCT_MAX_COMPS ||
+        n < 6 + 3 * info->ncomp) {
+        return false;
+    }
+
+    int hmax = 1, vmax = 1;
+    for (int c = 0; c < info->ncomp; c++) {
+        jpeg_dct_comp_t *comp = &info->comp[c];
+        comp->id = seg[6 + 3 * c];
+        comp->h = seg[7 + 3 * c] >> 4;
+        comp->v = seg[7 + 3 * c] & 15;
+        comp->tq = seg[8 + 3 * c];
+        if (comp->h < 1 || comp->h > 4 || comp->v < 1 || comp->v > 4 || comp->tq > 3) return false;
+        // A single-component scan is not interleaved: one block per MCU
+        if (info->ncomp == 1) comp->h = comp->v = 1;
+        if (comp->h > hmax) hmax = comp->h;
+        if (comp->v > vmax) vmax = comp->v;
+    }
+
+    info->mcu_w = 8 * hmax;
+    info->mcu_h = 8 * vmax;
+    info->mcus_x = (info->width + info->mcu_w - 1) / info->mcu_w;
+    info->mcus_y = (info->height + info->mcu_h - 1) / info->mcu_h;
+    info->blocks = 0;
+    for (int c = 0; c < info->ncomp; c++) {
+        jpeg_dct_comp_t *comp = &info->comp[c];
+        comp->blocks_x = info->mcus_x * comp->h;
+        comp->blocks_y = info->mcus_y * comp->v;
+        for (int y = 0; y < comp->v; y++) {
+            for (int x = 0; x < comp->h; x++) {
+                if (info->blocks == JPEG_DCT_MAX_BLOCKS) return false;
+                info->block_comp[info->blocks] = c;
+                info->block_x[info->blocks] = x;
+                info->block_y[info->blocks] = y;
+                info->blocks++;
+            }
+        }
+    }
+    return true;
+}
+
+static bool parse_dht(jpeg_dct_t *d, const uint8_t *seg, int n)
+{
+    while (n > 0) {
+        if (n < 17) return false;
+        int tc = seg[0] >> 4, th = seg[0] & 15;
+        int count = 0;
+        for (int i = 1; i <= 16; i++) count += seg[i];
+        if (tc > 1 || th > 1 || count > 256 || n < 17 + count) return false;
+        huff_dec_t *h = tc ? &d->ac[th] : &d->dc[th];
+        if (!huff_dec_build(h, seg + 1, seg + 17, count)) return false;
+        d->dht_bits[tc][th] = seg + 1;
+        d->dht_vals[tc][th] = seg + 17;
+        seg += 17 + count;
+        n -= 17 + count;
+    }
+    return true;
+}
+
+static bool parse_sos(jpeg_dct_t *d, const uint8_t *seg, int n)
+{
+    jpeg_dct_info_t *info = &d->info;
+    // One interleaved scan with every component, full spectrum
+    if (!info->ncomp || n < 1 || seg[0] != info->ncomp || n < 4 + 2 * info->ncomp) return false;
+    for (int i = 0; i < info->ncomp; i++) {
+        uint8_t id = seg[1 + 2 * i];
+        if (info->comp[i].id != id) return false;
+        d->td[i] = seg[2 + 2 * i] >> 4;
+        d->ta[i] = seg[2 + 2 * i] & 15;
+        if (d->td[i] > 1 || d->ta[i] > 1 || !d->dc[d->td[i]].valid || !d->ac[d->ta[i]].valid) {
+            return false;
+        }
+    }
+    const uint8_t *spec = seg + 1 + 2 * info->ncomp;
+    return spec[0] == 0 && spec[1] == 63 && spec[2] == 0;
+}
+
+bool jpeg_dct_begin(jpeg_dct_t *d, const uint8_t *buf, size_t len)
+{
+    memset(&d->info, 0, sizeof(d->info));
+    d->dc[0].valid = d->dc[1].valid = d->ac[0].valid = d->ac[1].valid = false;
+    memset(d->dht_bits, 0, sizeof(d->dht_bits));
+    d->sof = NULL;
+
+    if (len < 4 || buf[0] != 0xFF || buf[1] != 0xD8) return false;
+    size_t p = 2;
+    while (p + 4 <= len) {
+        if (buf[p] != 0xFF) return false;
+        uint8_t marker = buf[p + 1];
+        if (marker == 0xFF) {           // fill byte
+            p++;
+            continue;
+        }
+        size_t seg_len = (buf[p + 2] << 8) | buf[p + 3];
+        if (seg_len < 2 || p + 2 + seg_len > len) return false;
+        const uint8_t *seg = buf + p + 4;
+        int n = (int)seg_len - 2;
+
+        switch (marker) {
+            case 0xC0:                  // baseline
+            case 0xC1:                  // extended sequential, Huffman
+                if (!parse_sof(d, seg, n)) return false;
+                d->sof = buf + p;
+                d->sof_len = seg_len + 2;
+                break;
+            case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+            case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+                return false;           // progressive, lossless or arithmetic
+            case 0xC4:
+                if (!parse_dht(d, seg, n)) return false;
+                break;
+            case 0xDB:
+                while (n > 0) {
+                    if (n < 65 || (seg[0] >> 4) != 0 || (seg[0] & 15) > 3) return false;
+                    memcpy(d->info.qt[seg[0] & 15], seg + 1, 64);
+                    seg += 65;
+                    n -= 65;
+                }
+                break;
+            case 0xDD:
+                if (n < 2) return false;
+                d->info.restart = (seg[0] << 8) | seg[1];
+                break;
+            case 0xDA:
+                if (!d->sof || !parse_sos(d, seg, n)) return false;
+                d->src = buf;
+                d->header_len = p + 2 + seg_len;
+                memset(&d->br, 0, sizeof(d->br));
+                d->br.p = buf + d->header_len;
+                d->br.end = buf + len;
+                memset(d->pred, 0, sizeof(d->pred));
+                d->mcu = 0;
+                return true;
+            case 0xD9:
+                return false;
+            default:
+                break;                  // APPn, COM, ...
+        }
+        p += 2 + seg_len;
+    }
+    return false;
+}
+
+// Top up the bit buffer to at least 25 bits; past a marker, feed zeros
+static inline void fill_bits(bit_reader_t *r)
+{
+    while (r->bits <= 24) {
+        uint32_t byte = 0;
+        bool data = false;
+        if (!r->marker && r->p < r->end) {
+            byte = *r->p++;
+            data = true;
+            if (byte == 0xFF) {
+                if (r->p < r->end && *r->p == 0x00) {
+                    r->p++;             // stuffed 0xFF data byte
+                } else {
+                    r->p--;             // leave the marker for read_restart()
+                    r->marker = true;
+                    byte = 0;
+                    data = false;
+                }
+            }
+        }
+        if (!data) r->pad++;
+        r->acc |= byte << (24 - r->bits);
+        r->bits += 8;
+    }
+}
+
+static inline void skip_bits(bit_reader_t *r, int n)
+{
+    r->acc <<= n;
+    r->bits -= n;
+    r->consumed += n;
+}
+
+// Read s bits and sign-extend them to a coefficient value (F.2.2.1)
+static inline int receive_extend(bit_reader_t *r, int s)
+{
+    if (r->bits < 16) fill_bits(r);
+    int v = (int)(r->acc >> (32 - s));
+    skip_bits(r, s);
+    return v < (1 << (s - 1)) ? v - (1 << s) + 1 : v;
+}
+
+static inline int huff_decode(bit_reader_t *r, const huff_dec_t *h)
+{
+    if (r->bits < 16) fill_bits(r);
+    uint16_t e = h->lookup[r->acc >> (32 - HUFF_LOOKAHEAD)];
+    if (e) {
+        skip_bits(r, e >> 8);
+        return e & 0xFF;
+    }
+    for (int len = HUFF_LOOKAHEAD + 1; len <= 16; len++) {
+        int32_t code = (int32_t)(r->acc >> (32 - len));
+        if (code <= h->maxcode[len]) {
+            skip_bits(r, len);
+            return h->vals[h->valptr[len] + code - h->mincode[len]];
+        }
+    }
+    return -1;
+}
+
+static bool decode_block(jpeg_dct_t *d, int c, int16_t *coef, bool dc_only)
+{
+    bit_reader_t *r = &d->br;
+    const huff_dec_t *ac = &d->ac[d->ta[c]];
+
+    int s = huff_decode(r, &d->dc[d->td[c]]);
+    if (s < 0 || s > 11) return false;
+    if (s) d->pred[c] += receive_extend(r, s);
+    coef[0] = d->pred[c];
+
+    if (!dc_only) memset(coef + 1, 0, 63 * sizeof(int16_t));
+    for (int k = 1; k < 64; k++) {
+        int rs = huff_decode(r, ac);
+        if (rs < 0) return false;
+        s = rs & 15;
+        if (!s) {
+            if (rs != 0xF0) break;      // EOB
+            k += 15;                    // ZRL: sixteen zeros
+            continue;
+        }
+        k += rs >> 4;
+        if (k > 63) return false;
+        if (dc_only) {
+            if (r->bits < 16) fill_bits(r);
+            skip_bits(r, s);
+        } else {
+            coef[k] = receive_extend(r, s);
+        }
+    }
+    return true;
+}
+
+// Skip to the RSTn marker ending this interval and reset the predictors
+static bool read_restart(jpeg_dct_t *d)
+{
+    bit_reader_t *r = &d->br;
+    const uint8_t *p = r->p;
+    while (p + 1 < r->end && !(p[0] == 0xFF && p[1] >= 0xD0 && p[1] <= 0xD7)) p++;
+    if (p + 1 >= r->end) return false;
+    r->p = p + 2;
+    r->acc = 0;
+    r->bits = 0;
+    r->pad = 0;
+    r->marker = false;
+    r->consumed = 0;
+    memset(d->pred, 0, sizeof(d->pred));
+    return true;
+}
+
+bool jpeg_dct_read_mcu(jpeg_dct_t *d, int16_t (*blocks)[64], bool dc_only)
+{
+    const jpeg_dct_info_t *info = &d->info;
+    if (d->mcu >= (uint32_t)info->mcus_x * info->mcus_y) return false;
+    if (info->restart && d->mcu && d->mcu % info->restart == 0 && !read_restart(d)) return false;
+
+    d->mcu_start = d->br;
+    memcpy(d->mcu_pred, d->pred, sizeof(d->pred));
+    for (int i = 0; i < info->blocks; i++) {
+        if (!decode_block(d, info->block_comp[i], blocks[i], dc_only)) return false;
+    }
+    d->mcu++;
+    // Bits consumed beyond the end of the data: truncated frame
+    return d->br.pad * 8 <= d->br.bits;
+}
+
+static inline void put_byte(jpeg_dct_t *d, uint8_t b)
+{
+    if (d->out_pos < d->out_size) {
+        d->out[d->out_pos++] = b;
+    } else {
+        d->failed = true;
+    }
+}
+
+static void put_raw(jpeg_dct_t *d, const uint8_t *data, size_t n)
+{
+    if (d->out_pos + n > d->out_size) {
+        d->failed = true;
+        return;
+    }
+    memcpy(d->out + d->out_pos, data, n);
+    d->out_pos += n;
+}
+
+static inline void put_bits(jpeg_dct_t *d, uint32_t code, int size)
+{
+    d->wacc = (d->wacc << size) | (code & ((1u << size) - 1));
+    d->wbits += size;
+    while (d->wbits >= 8) {
+        d->wbits -= 8;
+        uint8_t b = (uint8_t)(d->wacc >> d->wbits);
+        put_byte(d, b);
+        if (b == 0xFF) put_byte(d, 0x00);
+    }
+}
+
+// Pad the last byte with ones
+static void flush_bits(jpeg_dct_t *d)
+{
+    if (d->wbits) put_bits(d, 0xFF, 8 - d->wbits);
+}
+
+static void put_dht(jpeg_dct_t *d, uint8_t tc_th, const uint8_t *bits, const uint8_t *vals, int count)
+{
+    put_byte(d, tc_th);
+    put_raw(d, bits, 16);
+    put_raw(d, vals, count);
+}
+
+static void writer_reset(jpeg_dct_t *d, uint8_t *out, size_t size)
+{
+    d->out = out;
+    d->out_size = size;
+    d->out_pos = 0;
+    d->failed = false;
+    d->wacc = 0;
+    d->wbits = 0;
+    d->wmcu = 0;
+    d->wrst = 0;
+    d->run = false;
+    memset(d->wpred, 0, sizeof(d->wpred));
+}
+
+void jpeg_dct_write_begin(jpeg_dct_t *d, uint8_t *out, size_t size, const uint8_t (*qt)[64])
+{
+    const jpeg_dct_info_t *info = &d->info;
+    writer_reset(d, out, size);
+    d->edit = false;
+    if (!d->enc_std) enc_build_std(d);
+    for (int c = 0; c < info->ncomp; c++) d->wtd[c] = d->wta[c] = c ? 1 : 0;
+
+    static const uint8_t soi[] = { 0xFF, 0xD8 };
+    put_raw(d, soi, sizeof(soi));
+
+    bool used[4] = { false };
+    int ntables = 0;
+    for (int c = 0; c < info->ncomp; c++) {
+        if (!used[info->comp[c].tq]) ntables++;
+        used[info->comp[c].tq] = true;
+    }
+    int dqt_len = 2 + 65 * ntables;
+    uint8_t dqt[] = { 0xFF, 0xDB, dqt_len >> 8, dqt_len & 0xFF };
+    put_raw(d, dqt, sizeof(dqt));
+    for (int t = 0; t < 4; t++) {
+        if (!used[t]) continue;
+        put_byte(d, t);
+        put_raw(d, qt ? qt[t] : info->qt[t], 64);
+    }
+
+    put_raw(d, d->sof, d->sof_len);
+
+    // Luma tables always, chroma tables for colour frames
+    bool chroma = info->ncomp > 1;
+    int dht_len = 2 + (17 + 12) + (17 + 162);
+    if (chroma) dht_len += (17 + 12) + (17 + 162);
+    uint8_t dht[] = { 0xFF, 0xC4, dht_len >> 8, dht_len & 0xFF };
+    put_raw(d, dht, sizeof(dht));
+    put_dht(d, 0x00, std_dc_luma_bits, std_dc_vals, 12);
+    put_dht(d, 0x10, std_ac_luma_bits, std_ac_luma_vals, 162);
+    if (chroma) {
+        put_dht(d, 0x01, std_dc_chroma_bits, std_dc_vals, 12);
+        put_dht(d, 0x11, std_ac_chroma_bits, std_ac_chroma_vals, 162);
+    }
+
+    if (info->restart) {
+        uint8_t dri[] = { 0xFF, 0xDD, 0x00, 0x04, info->restart >> 8, info->restart & 0xFF };
+        put_raw(d, dri, sizeof(dri));
+    }
+
+    int sos_len = 6 + 2 * info->ncomp;
+    uint8_t sos[] = { 0xFF, 0xDA, sos_len >> 8, sos_len & 0xFF, info->ncomp };
+    put_raw(d, sos, sizeof(sos));
+    for (int c = 0; c < info->ncomp; c++) {
+        put_byte(d, info->comp[c].id);
+        put_byte(d, c ? 0x11 : 0x00);
+    }
+    static const uint8_t spectrum[] = { 0, 63, 0 };
+    put_raw(d, spectrum, sizeof(spectrum));
+}
+
+void jpeg_dct_edit_begin(jpeg_dct_t *d, uint8_t *out, size_t size)
+{
+    writer_reset(d, out, size);
+    d->edit = true;
+    // Edited blocks are coded with the source's own tables
+    for (int tc = 0; tc < 2; tc++) {
+        for (int th = 0; th < 2; th++) {
+            huff_enc_t *e = tc ? &d->enc_ac[th] : &d->enc_dc[th];
+            if (d->dht_bits[tc][th]) {
+                huff_enc_build(e, d->dht_bits[tc][th], d->dht_vals[tc][th]);
+            } else {
+                memset(e, 0, sizeof(*e));
+            }
+        }
+    }
+    d->enc_std = false;
+    memcpy(d->wtd, d->td, sizeof(d->wtd));
+    memcpy(d->wta, d->ta, sizeof(d->wta));
+    put_raw(d, d->src, d->header_len);
+}
+
+void jpeg_dct_fdct(const uint8_t *px, int stride, const uint8_t *qt, int16_t *coef)
+{
+    // cos((2x + 1) * u * pi / 16), with the C(u) / 2 scale folded in
+    static float basis[8][8];
+    static bool basis_ready = false;
+    if (!basis_ready) {
+        for (int x = 0; x < 8; x++) {
+            for (int u = 0; u < 8; u++) {
+                basis[x][u] = cosf((2 * x + 1) * u * (float)M_PI / 16) * (u ? 0.5f : 0.35355339f);
+            }
+        }
+        basis_ready = true;
+    }
+
+    float rows[8][8];
+    for (int y = 0; y < 8; y++) {
+        for (int u = 0; u < 8; u++) {
+            float sum = 0;
+            for (int x = 0; x < 8; x++) sum += (px[y * stride + x] - 128) * basis[x][u];
+            rows[y][u] = sum;
+        }
+    }
+    for (int k = 0; k < 64; k++) {
+        int u = zigzag[k] & 7, v = zigzag[k] >> 3;
+        float sum = 0;
+        for (int y = 0; y < 8; y++) sum += rows[y][u] * basis[y][v];
+        coef[k] = (int16_t)lroundf(sum / qt[k]);
+    }
+}
+
+void jpeg_dct_scale_qt(const jpeg_dct_info_t *info, int factor, uint8_t (*qt)[64])
+{
+    for (int t = 0; t < 4; t++) {
+        for (int k = 0; k < 64; k++) {
+            int q = info->qt[t][k] * factor;
+            qt[t][k] = q < 1 ? 1 : q > 255 ? 255 : q;
+        }
+    }
+}
+
+void jpeg_dct_requant(int16_t *coef, const uint8_t *from, const uint8_t *to)
+{
+    for (int k = 0; k < 64; k++) {
+        int v = coef[k];
+        if (!v || from[k] == to[k]) continue;
+        int num = v * from[k];
+        int half = to[k] / 2;
+        coef[k] = (num + (num < 0 ? -half : half)) / to[k];
+    }
+}
+
+// Bit length of a coefficient magnitude (its JPEG size category)
+static inline int coef_size(int a)
+{
+    return a ? 32 - __builtin_clz((unsigned)a) : 0;
+}
+
+static inline void put_code(jpeg_dct_t *d, const huff_enc_t *e, int sym)
+{
+    if (!e->size[sym]) d->failed = true;    // not in the source's table
+    put_bits(d, e->code[sym], e->size[sym]);
+}
+
+static void encode_block(jpeg_dct_t *d, int c, const int16_t *coef)
+{
+    const huff_enc_t *dc = &d->enc_dc[d->wtd[c]];
+    const huff_enc_t *ac = &d->enc_ac[d->wta[c]];
+
+    int diff = coef[0] - d->wpred[c];
+    if (diff > 2047) diff = 2047;
+    if (diff < -2047) diff = -2047;
+    d->wpred[c] += diff;
+    int s = coef_size(diff < 0 ? -diff : diff);
+    put_code(d, dc, s);
+    if (s) put_bits(d, diff < 0 ? diff - 1 : diff, s);
+
+    int run = 0;
+    for (int k = 1; k < 64; k++) {
+        int v = coef[k];
+        if (!v) {
+            run++;
+            continue;
+        }
+        while (run > 15) {
+            put_code(d, ac, 0xF0);
+            run -= 16;
+        }
+        if (v > 1023) v = 1023;
+        if (v < -1023) v = -1023;
+        s = coef_size(v < 0 ? -v : v);
+        int rs = (run << 4) | s;
+        put_code(d, ac, rs);
+        put_bits(d, v < 0 ? v - 1 : v, s);
+        run = 0;
+    }
+    if (run) put_code(d, ac, 0x00);
+}
+
+// Copy the pending unchanged MCUs' bits from the source, 24 at a time
+static void flush_run(jpeg_dct_t *d)
+{
+    if (!d->run) return;
+    d->run = false;
+    bit_reader_t r = d->run_start;
+    uint32_t n = d->run_end - r.consumed;
+    while (n) {
+        int k = n > 24 ? 24 : (int)n;
+        if (r.bits < k) fill_bits(&r);
+        put_bits(d, r.acc >> (32 - k), k);
+        skip_bits(&r, k);
+        n -= k;
+    }
+}
+
+// RSTn before the first MCU of every interval but the first
+static void write_restart(jpeg_dct_t *d)
+{
+    const jpeg_dct_info_t *info = &d->info;
+    if (info->restart && d->wmcu && d->wmcu % info->restart == 0) {
+        flush_run(d);
+        flush_bits(d);
+        put_byte(d, 0xFF);
+        put_byte(d, 0xD0 + d->wrst);
+        d->wrst = (d->wrst + 1) & 7;
+        memset(d->wpred, 0, sizeof(d->wpred));
+    }
+}
+
+static void encode_mcu(jpeg_dct_t *d, const int16_t (*blocks)[64])
+{
+    const jpeg_dct_info_t *info = &d->info;
+    flush_run(d);
+    for (int i = 0; i < info->blocks; i++) {
+        encode_block(d, info->block_comp[i], blocks[i]);
+    }
+    d->wmcu++;
+}
+
+void jpeg_dct_write_mcu(jpeg_dct_t *d, const int16_t (*blocks)[64])
+{
+    write_restart(d);
+    encode_mcu(d, blocks);
+}
+
+void jpeg_dct_copy_mcu(jpeg_dct_t *d, const int16_t (*blocks)[64])
+{
+    write_restart(d);
+    // The source bits only decode right while the DC predictors match
+    if (!d->edit || memcmp(d->wpred, d->mcu_pred, sizeof(d->wpred))) {
+        encode_mcu(d, blocks);
+        return;
+    }
+    if (!d->run) {
+        d->run_start = d->mcu_start;
+        d->run = true;
+    }
+    d->run_end = d->br.consumed;
+    memcpy(d->wpred, d->pred, sizeof(d->wpred));
+    d->wmcu++;
+}
+
+// Copy the remaining entropy-coded data to the end of the scan: the
+// reader's buffered bits first, then byte by byte, shifted into the
+// writer's bit position
+static void copy_tail(jpeg_dct_t *d)
+{
+    bit_reader_t *r = &d->br;
+    int k = r->bits - r->pad * 8;       // real data bits buffered
+    while (k > 0) {
+        int n = k > 24 ? 24 : k;
+        put_bits(d, r->acc >> (32 - n), n);
+        skip_bits(r, n);
+        k -= n;
+    }
+    if (r->marker) return;
+
+    const uint8_t *p = r->p, *end = r->end;
+    uint32_t acc = d->wacc;
+    int shift = d->wbits;
+    while (p < end) {
+        uint8_t b = *p++;
+        if (b == 0xFF) {
+            if (p >= end || *p != 0x00) break;  // end of scan
+            p++;
+        }
+        acc = (acc << 8) | b;
+        uint8_t o = (uint8_t)(acc >> shift);
+        put_byte(d, o);
+        if (o == 0xFF) put_byte(d, 0x00);
+    }
+    d->wacc = acc;
+}
+
+bool jpeg_dct_copy_rest(jpeg_dct_t *d, int16_t (*blocks)[64])
+{
+    const jpeg_dct_info_t *info = &d->info;
+    uint32_t total = (uint32_t)info->mcus_x * info->mcus_y;
+
+    // MCU by MCU until the source bits decode right as they are: DC
+    // predictors in step, or at the start of a restart interval
+    while (d->mcu < total) {
+        if (d->edit && d->wmcu == d->mcu &&
+            (info->restart ? d->mcu % info->restart == 0 : !memcmp(d->wpred, d->pred, sizeof(d->wpred)))) {
+            break;
+        }
+        if (!jpeg_dct_read_mcu(d, blocks, false)) return false;
+        jpeg_dct_copy_mcu(d, blocks);
+    }
+    if (d->mcu == total) return true;
+
+    flush_run(d);
+    if (!info->restart) {
+        copy_tail(d);
+    } else {
+        // Byte-aligned from the next RSTn on: copy it up to the EOI
+        const uint8_t *p = d->br.p, *end = d->br.end;
+        if (d->mcu) {
+            while (p + 1 < end && !(p[0] == 0xFF && p[1] >= 0xD0 && p[1] <= 0xD7)) p++;
+        }
+        const uint8_t *q = p + (d->mcu ? 2 : 0);
+        while (q + 1 < end && !(q[0] == 0xFF && q[1] != 0x00 && (q[1] < 0xD0 || q[1] > 0xD7))) q++;
+        if (q + 1 >= end) return false;
+        flush_bits(d);
+        put_raw(d, p, q - p);
+    }
+    d->mcu = d->wmcu = total;
+    return true;
+}
+
+size_t jpeg_dct_write_end(jpeg_dct_t *d)
+{
+    flush_run(d);
+    flush_bits(d);
+    put_byte(d, 0xFF);
+    put_byte(d, 0xD9);
+    return d->failed ? 0 : d->out_pos;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Compressed-domain access to the camera's baseline JPEGs: entropy-decode
+// the quantized DCT coefficients MCU by MCU and, optionally, Huffman-encode
+// them again — no IDCT/FDCT and no pixels. Analyzers read DC/AC values,
+// bitstream edits (requantization, masks, overlays) rewrite blocks.
+//
+// Coefficients are in zigzag order, DC as an absolute value (not the
+// difference to the previous block). Blocks of an MCU come in scan order:
+// all blocks of component 0, then component 1, ... (info.block_comp).
+
+#define JPEG_DCT_MAX_COMPS    3
+#define JPEG_DCT_MAX_BLOCKS   10      // blocks per MCU (baseline limit)
+
+typedef struct {
+    uint8_t id;
+    uint8_t h, v;                     // sampling factors (blocks per MCU across/down)
+    uint8_t tq;                       // quantization table
+    uint16_t blocks_x, blocks_y;      // block grid, padded to whole MCUs
+} jpeg_dct_comp_t;
+
+typedef struct {
+    uint16_t width, height;
+    uint8_t ncomp;
+    jpeg_dct_comp_t comp[JPEG_DCT_MAX_COMPS];
+    uint16_t mcu_w, mcu_h;            // MCU size in pixels
+    uint16_t mcus_x, mcus_y;
+    uint16_t restart;                 // MCUs per restart interval, 0 = none
+    uint8_t blocks;                   // blocks per MCU
+    uint8_t block_comp[JPEG_DCT_MAX_BLOCKS];
+    uint8_t block_x[JPEG_DCT_MAX_BLOCKS];   // block offset inside the MCU, in blocks
+    uint8_t block_y[JPEG_DCT_MAX_BLOCKS];
+    uint8_t qt[4][64];                // quantization tables, zigzag order
+} jpeg_dct_info_t;
+
+typedef struct jpeg_dct jpeg_dct_t;
+
+// One context per task: decode tables, bit reader and writer (~8KB)
+jpeg_dct_t *jpeg_dct_new(void);
+void jpeg_dct_free(jpeg_dct_t *d);
+
+// Parse the headers and position the reader at the first MCU. false if
+// buf is not a single-scan baseline Huffman JPEG with 8-bit tables.
+bool jpeg_dct_begin(jpeg_dct_t *d, const uint8_t *buf, size_t len);
+const jpeg_dct_info_t *jpeg_dct_info(const jpeg_dct_t *d);
+
+// Decode the next MCU (raster order) into blocks[info.blocks]. With
+// dc_only, AC coefficients are skipped and only blocks[i][0] is written.
+bool jpeg_dct_read_mcu(jpeg_dct_t *d, int16_t (*blocks)[64], bool dc_only);
+
+// Write a new JPEG into out: the source's frame header, quantization
+// tables qt (NULL keeps the source's) and the standard Huffman tables, so
+// any coefficient values can be coded. Feed it every MCU in order;
+// jpeg_dct_write_end() returns the JPEG size, or 0 if out was too small.
+void jpeg_dct_write_begin(jpeg_dct_t *d, uint8_t *out, size_t size, const uint8_t (*qt)[64]);
+void jpeg_dct_write_mcu(jpeg_dct_t *d, const int16_t (*blocks)[64]);
+size_t jpeg_dct_write_end(jpeg_dct_t *d);
+
+// Edit the source in place instead: its headers and Huffman tables are
+// kept, MCUs passed on with jpeg_dct_copy_mcu() are copied bit for bit and
+// only those given to jpeg_dct_write_mcu() are encoded. Read each MCU
+// (dc_only false) right before passing it on. jpeg_dct_write_end() also
+// returns 0 if the source's tables can't code an edited block; start over
+// with jpeg_dct_write_begin() then.
+void jpeg_dct_edit_begin(jpeg_dct_t *d, uint8_t *out, size_t size);
+void jpeg_dct_copy_mcu(jpeg_dct_t *d, const int16_t (*blocks)[64]);
+
+// Pass every MCU not read yet through unchanged. In edit mode the rest of
+// the scan is copied without decoding it once the DC predictors are back in
+// step (right away at a restart interval boundary). blocks is scratch.
+bool jpeg_dct_copy_rest(jpeg_dct_t *d, int16_t (*blocks)[64]);
+
+// Synthesized blocks: forward DCT of 8x8 pixels (one component, row
+// stride in bytes), quantized with qt into zigzag-ordered coefficients
+void jpeg_dct_fdct(const uint8_t *px, int stride, const uint8_t *qt, int16_t *coef);
+
+// Requantization: the source's tables with every step multiplied by factor
+// (clamped to 1..255), and one block's coefficients moved from steps from
+// to steps to (c * from / to, rounded to nearest)
+void jpeg_dct_scale_qt(const jpeg_dct_info_t *info, int factor, uint8_t (*qt)[64]);
+void jpeg_dct_requant(int16_t *coef, const uint8_t *from, const uint8_t *to);
@@ -19,9 +19,15 @@
 #include "http_camera.h"
 #include "http_video_stream.h"
 #include "http_audio_stream.h"
+#include "stream_engine.h"
+#include "rtsp_server.h"
 
 static const char *TAG = "main";
 
+// All servers at their limits at once (6 + 7 + 3 with the defaults)
+_Static_assert(HTTP_UI_SOCKETS + STREAM_ENGINE_SOCKETS + RTSP_SOCKETS <= CONFIG_LWIP_MAX_SOCKETS,
+               "The servers can open more sockets than CONFIG_LWIP_MAX_SOCKETS");
+
 void app_main(void)
 {
     // Chip info
@@ -107,7 +113,8 @@ void app_main(void)
 
     if (esp_psram_is_initialized()) {
         config.jpeg_quality = 10;
-        config.fb_count = 2;
+        // One extra buffer so a slow viewer holding a frame doesn't stall capture
+        config.fb_count = 3;
         config.grab_mode = CAMERA_GRAB_LATEST;
     } else {
         config.frame_size = FRAMESIZE_SVGA;
@@ -164,10 +171,12 @@ void app_main(void)
     // 7. WiFi
     initWiFi();
 
-    // 8-10. Start HTTP servers
+    // 8-10. Start servers
     start_http_ui();           // port 80
-    start_http_video_stream(); // port 81
-    start_http_audio_stream(); // port 82
+    init_video_stream();
+    init_audio_stream();
+    start_stream_engine();     // ports 81, 82
+    start_rtsp_server();       // port 554
 
     char ip_str[16];
     get_current_ip_str(ip_str, sizeof(ip_str));
@@ -0,0 +1,148 @@
+#include "overlay_blocks.h"
+
+#include <string.h>
+
+// 5x7 glyphs, one row per byte (bit 4 = leftmost column); lower case is
+// drawn as upper case, anything else as a space
+static const struct {
+    char c;
+    uint8_t rows[7];
+} s_font[] = {
+    { '0', { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E } },
+    { '1', { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E } },
+    { '2', { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F } },
+    { '3', { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E } },
+    { '4', { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 } },
+    { '5', { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E } },
+    { '6', { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E } },
+    { '7', { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 } },
+    { '8', { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E } },
+    { '9', { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C } },
+    { 'A', { 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 } },
+    { 'B', { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E } },
+    { 'C', { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E } },
+    { 'D', { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C } },
+    { 'E', { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F } },
+    { 'F', { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 } },
+    { 'G', { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F } },
+    { 'H', { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 } },
+    { 'I', { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E } },
+    { 'J', { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C } },
+    { 'K', { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 } },
+    { 'L', { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F } },
+    { 'M', { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 } },
+    { 'N', { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 } },
+    { 'O', { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E } },
+    { 'P', { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 } },
+    { 'Q', { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D } },
+    { 'R', { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 } },
+    { 'S', { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E } },
+    { 'T', { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 } },
+    { 'U', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E } },
+    { 'V', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 } },
+    { 'W', { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A } },
+    { 'X', { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 } },
+    { 'Y', { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 } },
+    { 'Z', { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F } },
+    { '-', { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 } },
+    { '+', { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 } },
+    { '.', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C } },
+    { ':', { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 } },
+    { '/', { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 } },
+    { '_', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F } },
+};
+
+int overlay_mask_rects(const jpeg_dct_info_t *info, const video_mask_t *masks, int count,
+                       video_mcu_rect_t *rects)
+{
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        const video_mask_t *m = &masks[i];
+        video_mcu_rect_t *r = &rects[n];
+        r->x0 = m->x * info->width / 100 / info->mcu_w;
+        r->y0 = m->y * info->height / 100 / info->mcu_h;
+        r->x1 = ((m->x + m->w) * info->width / 100 + info->mcu_w - 1) / info->mcu_w;
+        r->y1 = ((m->y + m->h) * info->height / 100 + info->mcu_h - 1) / info->mcu_h;
+        if (r->x1 > info->mcus_x) r->x1 = info->mcus_x;
+        if (r->y1 > info->mcus_y) r->y1 = info->mcus_y;
+        if (r->x1 > r->x0 && r->y1 > r->y0) n++;
+    }
+    return n;
+}
+
+// DC = 8 * (0 - 128) / step on luma, zero elsewhere
+void overlay_flat_block(const jpeg_dct_info_t *info, int16_t (*blocks)[64])
+{
+    memset(blocks, 0, (size_t)info->blocks * sizeof(*blocks));
+    int dc = -1024 / info->qt[info->comp[0].tq][0];
+    for (int i = 0; i < info->blocks; i++) {
+        if (info->block_comp[i] == 0) blocks[i][0] = dc;
+    }
+}
+
+static const uint8_t *osd_glyph(char c)
+{
+    if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+    for (size_t i = 0; i < sizeof(s_font) / sizeof(s_font[0]); i++) {
+        if (s_font[i].c == c) return s_font[i].rows;
+    }
+    return NULL;
+}
+
+bool overlay_osd_size(const jpeg_dct_info_t *info, const char *text, int *cols, int *rows)
+{
+    const jpeg_dct_comp_t *luma = &info->comp[0];
+    if (luma->h * 8 != info->mcu_w || luma->v * 8 != info->mcu_h) return false;
+
+    int cell = 8 * (1 + info->width / OSD_SCALE_STEP);
+    *cols = ((int)strlen(text) * cell + info->mcu_w - 1) / info->mcu_w;
+    *rows = (cell + info->mcu_h - 1) / info->mcu_h;
+    if (*cols > info->mcus_x) *cols = info->mcus_x;
+    if (*rows > info->mcus_y) *rows = info->mcus_y;
+    return true;
+}
+
+// Each 8x8 luma block is drawn straight from the font: glyph pixel
+// (gx, gy) of character i covers x from i * cell + (gx + 1) * scale and
+// y from gy * scale, scale pixels each way
+void overlay_osd_render(const jpeg_dct_info_t *info, const char *text, int cols, int rows,
+                        int16_t (*blocks)[64])
+{
+    const uint8_t *qt = info->qt[info->comp[0].tq];
+    int scale = 1 + info->width / OSD_SCALE_STEP;
+    int cell = 8 * scale;
+    int len = strlen(text);
+    int fit = cols * info->mcu_w / cell;        // whole glyphs across the band
+    if (len > fit) len = fit;
+
+    int16_t (*b)[64] = blocks;
+    for (int my = 0; my < rows; my++) {
+        for (int mx = 0; mx < cols; mx++) {
+            for (int i = 0; i < info->blocks; i++, b++) {
+                if (info->block_comp[i] != 0) {
+                    memset(*b, 0, sizeof(*b));
+                    continue;
+                }
+                uint8_t px[64];
+                int x0 = mx * info->mcu_w + info->block_x[i] * 8;
+                int y0 = my * info->mcu_h + info->block_y[i] * 8;
+                int at = -1;
+                const uint8_t *g = NULL;
+                for (int x = 0; x < 8; x++) {
+                    int c = (x0 + x) / cell;
+                    if (c != at) {
+                        at = c;
+                        g = c < len ? osd_glyph(text[c]) : NULL;
+                    }
+                    int gx = (x0 + x - c * cell) / scale - 1;
+                    for (int y = 0; y < 8; y++) {
+                        int gy = (y0 + y) / scale;
+                        bool on = g && gx >= 0 && gx < 5 && gy < 7 && (g[gy] & (0x10 >> gx));
+                        px[y * 8 + x] = on ? 255 : 0;
+                    }
+                }
+                jpeg_dct_fdct(px, 8, qt, *b);
+            }
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "jpeg_dct.h"
+
+// The blocks video_overlay.c writes over a frame, worked out from the
+// frame's layout alone. Plain C without ESP-IDF, so the host tests
+// (test/test_jpeg_dct.c) run this very code on the test frames.
+
+typedef struct {
+    uint8_t x, y, w, h;       // percent of the frame width/height
+} video_mask_t;
+
+typedef struct {
+    uint16_t x0, y0, x1, y1;
+} video_mcu_rect_t;
+
+// Mask rectangles in MCUs, rounded outwards and clamped to the frame;
+// empty ones are left out. Returns the number written to rects.
+int overlay_mask_rects(const jpeg_dct_info_t *info, const video_mask_t *masks, int count,
+                       video_mcu_rect_t *rects);
+
+// One MCU of black luma and neutral chroma, info->blocks blocks
+void overlay_flat_block(const jpeg_dct_info_t *info, int16_t (*blocks)[64]);
+
+// OSD text: a 5x7 font in 8x8 cells, white on black from the top left
+// corner, each glyph pixel scale x scale pixels with
+// scale = 1 + width / OSD_SCALE_STEP. The band is cols x rows MCUs, enough
+// for the text but no more than the frame; glyphs that don't fit whole are
+// left out.
+#define OSD_SCALE_STEP        1280    // glyphs grow one size step per this much frame width
+
+// Band size for the text; false if the layout has subsampled luma (no
+// camera JPEG has)
+bool overlay_osd_size(const jpeg_dct_info_t *info, const char *text, int *cols, int *rows);
+
+// The band's MCUs, row by row, info->blocks blocks each: luma through
+// jpeg_dct_fdct with the frame's table, chroma neutral
+void overlay_osd_render(const jpeg_dct_info_t *info, const char *text, int cols, int rows,
+                        int16_t (*blocks)[64]);
@@ -0,0 +1,204 @@
+#include "pcm_convert.h"
+
+#include <math.h>
+
+#include "esp_attr.h"
+
+int32_t pcm_gain_q15(int db)
+{
+    if (db < PCM_GAIN_DB_MIN) db = PCM_GAIN_DB_MIN;
+    if (db > PCM_GAIN_DB_MAX) db = PCM_GAIN_DB_MAX;
+    return (int32_t)lrintf(powf(10.0f, db / 20.0f) * 32768);
+}
+
+int pcm_gain_db_from_factor(int factor)
+{
+    if (factor < 1) factor = 1;
+    if (factor > PCM_GAIN_FACTOR_MAX) factor = PCM_GAIN_FACTOR_MAX;
+    return (int)lrintf(20 * log10f((float)factor));
+}
+
+int pcm_gain_factor(int db)
+{
+    int factor = (int)lrintf(powf(10.0f, db / 20.0f));
+    return factor < 1 ? 1 : factor > PCM_GAIN_FACTOR_MAX ? PCM_GAIN_FACTOR_MAX : factor;
+}
+
+pcm_convert_fn pcm_convert_get(int in_bits, int out_bits)
+{
+    if (in_bits == 32 && out_bits == 16) return pcm_s32_to_s16;
+    if (in_bits == 32 && out_bits == 24) return pcm_s32_to_s24;
+    if (in_bits == 16 && out_bits == 16) return pcm_s16_to_s16;
+    return NULL;
+}
+
+// min/max rather than branches; the compiler makes these MIN and MAX
+static inline int32_t sat16(int32_t v)
+{
+    v = v < -32768 ? -32768 : v;
+    return v > 32767 ? 32767 : v;
+}
+
+static inline int32_t sat24(int32_t v)
+{
+    v = v < -8388608 ? -8388608 : v;
+    return v > 8388607 ? 8388607 : v;
+}
+
+// ---------- 16-bit ----------
+
+// One sample at a time, the scalar references for the unrolled versions
+void pcm_s32_to_s16_ref(const void *in, void *out, size_t samples, int32_t gain)
+{
+    const int32_t *s = (const int32_t *)in;
+    int16_t *d = (int16_t *)out;
+    for (size_t i = 0; i < samples; i++) {
+        int32_t v = (int32_t)(((int64_t)s[i] * gain) >> 31);
+        if (v > 32767) v = 32767;
+        else if (v < -32768) v = -32768;
+        d[i] = (int16_t)v;
+    }
+}
+
+void pcm_s16_to_s16_ref(const void *in, void *out, size_t samples, int32_t gain)
+{
+    const int16_t *s = (const int16_t *)in;
+    int16_t *d = (int16_t *)out;
+    for (size_t i = 0; i < samples; i++) {
+        int32_t v = (int32_t)(((int64_t)s[i] * gain) >> 15);
+        if (v > 32767) v = 32767;
+        else if (v < -32768) v = -32768;
+        d[i] = (int16_t)v;
+    }
+}
+
+// Four independent multiplies per pass keep the MULL/MULSH pipeline busy
+IRAM_ATTR void pcm_s32_to_s16(const void *in, void *out, size_t samples, int32_t gain)
+{
+    const int32_t *s = (const int32_t *)in;
+    int16_t *d = (int16_t *)out;
+    size_t i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        int32_t a = (int32_t)(((int64_t)s[i] * gain) >> 31);
+        int32_t b = (int32_t)(((int64_t)s[i + 1] * gain) >> 31);
+        int32_t c = (int32_t)(((int64_t)s[i + 2] * gain) >> 31);
+        int32_t e = (int32_t)(((int64_t)s[i + 3] * gain) >> 31);
+        d[i] = sat16(a);
+        d[i + 1] = sat16(b);
+        d[i + 2] = sat16(c);
+        d[i + 3] = sat16(e);
+    }
+    for (; i < samples; i++) d[i] = sat16((int32_t)(((int64_t)s[i] * gain) >> 31));
+}
+
+IRAM_ATTR void pcm_s16_to_s16(const void *in, void *out, size_t samples, int32_t gain)
+{
+    const int16_t *s = (const int16_t *)in;
+    int16_t *d = (int16_t *)out;
+    size_t i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        int32_t a = (int32_t)(((int64_t)s[i] * gain) >> 15);
+        int32_t b = (int32_t)(((int64_t)s[i + 1] * gain) >> 15);
+        int32_t c = (int32_t)(((int64_t)s[i + 2] * gain) >> 15);
+        int32_t e = (int32_t)(((int64_t)s[i + 3] * gain) >> 15);
+        d[i] = sat16(a);
+        d[i + 1] = sat16(b);
+        d[i + 2] = sat16(c);
+        d[i + 3] = sat16(e);
+    }
+    for (; i < samples; i++) d[i] = sat16((int32_t)(((int64_t)s[i] * gain) >> 15));
+}
+
+// ---------- 24-bit ----------
+
+// Byte at a time, the scalar reference for the packed version below
+void pcm_s32_to_s24_ref(const void *in, void *out, size_t samples, int32_t gain)
+{
+    const int32_t *s = (const int32_t *)in;
+    uint8_t *d = (uint8_t *)out;
+    for (size_t i = 0; i < samples; i++) {
+        int32_t v = (int32_t)(((int64_t)s[i] * gain) >> 23);
+        if (v > 8388607) v = 8388607;
+        else if (v < -8388608) v = -8388608;
+        d[i * 3]     = v & 0xFF;
+        d[i * 3 + 1] = (v >> 8) & 0xFF;
+        d[i * 3 + 2] = (v >> 16) & 0xFF;
+    }
+}
+
+// Four samples to three 32-bit stores instead of twelve byte stores
+IRAM_ATTR void pcm_s32_to_s24(const void *in, void *out, size_t samples, int32_t gain)
+{
+    // Word stores need an aligned output (DMA-sized blocks from malloc are)
+    if ((uintptr_t)out & 3) {
+        pcm_s32_to_s24_ref(in, out, samples, gain);
+        return;
+    }
+
+    const int32_t *s = (const int32_t *)in;
+    uint32_t *w = (uint32_t *)out;
+    size_t i = 0;
+    for (; i + 4 <= samples; i += 4, w += 3) {
+        uint32_t a = sat24((int32_t)(((int64_t)s[i] * gain) >> 23)) & 0xFFFFFF;
+        uint32_t b = sat24((int32_t)(((int64_t)s[i + 1] * gain) >> 23)) & 0xFFFFFF;
+        uint32_t c = sat24((int32_t)(((int64_t)s[i + 2] * gain) >> 23)) & 0xFFFFFF;
+        uint32_t e = sat24((int32_t)(((int64_t)s[i + 3] * gain) >> 23)) & 0xFFFFFF;
+        // Little-endian: a0 a1 a2 b0 | b1 b2 c0 c1 | c2 e0 e1 e2
+        w[0] = a | (b << 24);
+        w[1] = (b >> 8) | (c << 16);
+        w[2] = (c >> 16) | (e << 8);
+    }
+    uint8_t *d = (uint8_t *)w;
+    for (; i < samples; i++, d += 3) {
+        int32_t v = sat24((int32_t)(((int64_t)s[i] * gain) >> 23));
+        d[0] = v & 0xFF;
+        d[1] = (v >> 8) & 0xFF;
+        d[2] = (v >> 16) & 0xFF;
+    }
+}
+
+// ---------- On-target timing ----------
+
+#ifdef ESP_PLATFORM
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#define CYCLES_SAMPLES  1024          // a DMA_BUF_LEN block of 32-bit samples
+#define CYCLES_RUNS     8
+
+// Best of a few runs, so an interrupt doesn't count
+static uint32_t kernel_cycles(pcm_convert_fn fn, const void *in, void *out, int32_t gain)
+{
+    uint32_t best = UINT32_MAX;
+    for (int r = 0; r < CYCLES_RUNS; r++) {
+        uint32_t c0 = esp_cpu_get_cycle_count();
+        fn(in, out, CYCLES_SAMPLES, gain);
+        uint32_t c = esp_cpu_get_cycle_count() - c0;
+        if (c < best) best = c;
+    }
+    return best;
+}
+
+void pcm_convert_log_cycles(void)
+{
+    int32_t *in = heap_caps_malloc(CYCLES_SAMPLES * 4, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    uint32_t *out = heap_caps_malloc(CYCLES_SAMPLES * 4, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (in && out) {
+        for (int i = 0; i < CYCLES_SAMPLES; i++) in[i] = (int32_t)(i * 2654435761u);
+        int32_t gain = pcm_gain_q15(PCM_GAIN_DB_DEFAULT);
+        // x100 to print two decimals without float formatting
+        #define PER(fn) (kernel_cycles(fn, in, out, gain) * 100 / CYCLES_SAMPLES)
+        unsigned long a = PER(pcm_s32_to_s16), ar = PER(pcm_s32_to_s16_ref);
+        unsigned long b = PER(pcm_s32_to_s24), br = PER(pcm_s32_to_s24_ref);
+        unsigned long c = PER(pcm_s16_to_s16), cr = PER(pcm_s16_to_s16_ref);
+        #undef PER
+        ESP_LOGI("pcm_convert", "cycles/sample (ref): s32->s16 %lu.%02lu (%lu.%02lu), "
+                 "s32->s24 %lu.%02lu (%lu.%02lu), s16->s16 %lu.%02lu (%lu.%02lu)",
+                 a / 100, a % 100, ar / 100, ar % 100, b / 100, b % 100,
+                 br / 100, br % 100, c / 100, c % 100, cr / 100, cr % 100);
+    }
+    heap_caps_free(in);
+    heap_caps_free(out);
+}
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// I2S sample to PCM conversion with the mic gain: multiply, saturate and
+// pack in one pass over a DMA block. Gain is Q15, 32768 = 0 dB; the I2S
+// sample's top 16 (or 24) bits are the signal, so 32-bit input is scaled
+// by gain / 2^31 (or / 2^23), 16-bit input by gain / 2^15.
+//
+// Each kernel has a scalar reference (one sample at a time, as written in
+// the spec above) and a fast version in IRAM: unrolled by four, branchless
+// clamps (Xtensa MIN/MAX), and 24-bit output packed four samples to three
+// 32-bit stores. The two give bit-identical output for every input
+// (test/test_pcm_convert.c, which also benchmarks them on the host;
+// pcm_convert_log_cycles() times them on the ESP32).
+#define PCM_GAIN_DB_MIN       -12
+#define PCM_GAIN_DB_MAX       36
+#define PCM_GAIN_DB_DEFAULT   18      // about the former 8x
+
+typedef void (*pcm_convert_fn)(const void *in, void *out, size_t samples, int32_t gain);
+
+// Q15 gain for a dB value (clamped to the range above)
+int32_t pcm_gain_q15(int db);
+
+// The former setting, an integer multiplier of 1 to 32, in dB and back
+// (nearest, clamped to 1..32): NVS and API clients from before still use it
+#define PCM_GAIN_FACTOR_MAX   32
+int pcm_gain_db_from_factor(int factor);
+int pcm_gain_factor(int db);
+
+// Kernel for I2S in_bits (16, 32) to PCM out_bits (16, 24; 24 needs 32-bit
+// input), NULL for other pairs. Pick once per stream, not per block.
+pcm_convert_fn pcm_convert_get(int in_bits, int out_bits);
+
+void pcm_s32_to_s16(const void *in, void *out, size_t samples, int32_t gain);
+void pcm_s32_to_s24(const void *in, void *out, size_t samples, int32_t gain);
+void pcm_s16_to_s16(const void *in, void *out, size_t samples, int32_t gain);
+
+void pcm_s32_to_s16_ref(const void *in, void *out, size_t samples, int32_t gain);
+void pcm_s32_to_s24_ref(const void *in, void *out, size_t samples, int32_t gain);
+void pcm_s16_to_s16_ref(const void *in, void *out, size_t samples, int32_t gain);
+
+#ifdef ESP_PLATFORM
+// Logs each kernel's and its reference's CPU cycles per sample on a DMA
+// block (esp_cpu_get_cycle_count, best of a few runs). Called once at boot.
+void pcm_convert_log_cycles(void);
+#endif
@@ -0,0 +1,934 @@
+#include "rtsp_server.h"
+#include "http_video_stream.h"
+#include "http_audio_stream.h"
+#include "audio_codec.h"
+#include "http_ui.h"
+#include "config.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "lwip/sockets.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "rtsp";
+
+#define RTP_HDR_LEN       12
+#define RTP_PT_JPEG       26
+#define RTP_PT_PCMU       0       // static: 8 kHz mono (RFC 3551)
+#define RTP_PT_L16_DYN    97
+#define RTP_PCMU_RATE     8000
+#define NTP_UNIX_OFFSET   2208988800ULL
+
+typedef enum {
+    RTSP_AUDIO_NONE,
+    RTSP_AUDIO_L16,
+    RTSP_AUDIO_PCMU,
+} rtsp_audio_t;
+
+typedef struct {
+    bool setup;
+    bool tcp;
+    uint8_t channel;                // interleaved RTP channel, RTCP is channel + 1
+    struct sockaddr_in rtp_to;      // UDP destinations
+    struct sockaddr_in rtcp_to;
+    uint8_t pt;
+    uint32_t clock;
+    uint32_t ssrc;
+    uint16_t seq;
+    uint32_t ts_offset;
+    uint32_t packets;
+    uint32_t octets;
+    uint32_t last_ts;               // RTP time of the last media sent ...
+    int64_t last_us;                // ... and its capture time, for sender reports
+    int64_t sr_due_us;
+    uint8_t buf[4 + RTP_HDR_LEN + RTP_MAX_PAYLOAD];  // room for the '$' prefix
+} rtp_stream_t;
+
+typedef struct {
+    int sock;
+    int udp;                        // RTP/RTCP for UDP transport, -1 until needed
+    struct sockaddr_in peer;
+    uint32_t session;
+    bool has_session;
+    bool described;
+    rtsp_audio_t audio_codec;
+    volatile bool playing;
+    volatile bool stop;
+    int viewer;                     // video fan-out slot while playing, -1 otherwise
+    uint32_t last_seq;
+    int64_t last_seen_us;
+    SemaphoreHandle_t tx_lock;      // TCP writes from the session and audio tasks
+    SemaphoreHandle_t audio_done;   // given by the audio task as it exits
+    bool audio_running;             // owned by the session task
+    rtp_stream_t video;
+    rtp_stream_t audio;
+    char rx[1024];
+    size_t rx_len;
+} rtsp_session_t;
+
+static SemaphoreHandle_t s_lock = NULL;
+static SemaphoreHandle_t s_free = NULL;     // counts free session slots
+static rtsp_session_t *s_sessions[RTSP_MAX_CLIENTS];
+static int s_listen = -1;
+static volatile bool s_stop = false;
+
+// ---------- RTP / RTCP ----------
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t rtp_time(const rtp_stream_t *st, int64_t us)
+{
+    return (uint32_t)(us * st->clock / 1000000) + st->ts_offset;
+}
+
+// Write all of data to the control connection. Serialized, so an RTP packet
+// from the audio task never lands inside a response or another packet.
+static bool sock_write(rtsp_session_t *sess, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    xSemaphoreTake(sess->tx_lock, portMAX_DELAY);
+    while (len) {
+        int n = send(sess->sock, p, len, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        p += n;
+        len -= n;
+    }
+    xSemaphoreGive(sess->tx_lock);
+    return len == 0;
+}
+
+// pkt points 4 bytes into st->buf so the interleave prefix fits in front
+static bool rtp_send(rtsp_session_t *sess, rtp_stream_t *st, uint8_t *pkt, size_t len, bool rtcp)
+{
+    if (st->tcp) {
+        uint8_t *frame = pkt - 4;
+        frame[0] = '$';
+        frame[1] = st->channel + (rtcp ? 1 : 0);
+        frame[2] = len >> 8;
+        frame[3] = len;
+        return sock_write(sess, frame, len + 4);
+    }
+
+    const struct sockaddr_in *to = rtcp ? &st->rtcp_to : &st->rtp_to;
+    for (int tries = 0; tries < 3; tries++) {
+        if (sendto(sess->udp, pkt, len, 0, (const struct sockaddr *)to, sizeof(*to)) >= 0) {
+            return true;
+        }
+        if (errno != ENOMEM && errno != EAGAIN) return false;
+        // lwIP ran out of buffers on a frame burst; give it a tick to drain
+        vTaskDelay(1);
+    }
+    return true;    // drop this packet, the stream goes on
+}
+
+static uint8_t *rtp_header(rtp_stream_t *st, uint8_t *pkt, uint32_t ts, bool marker)
+{
+    pkt[0] = 0x80;
+    pkt[1] = st->pt | (marker ? 0x80 : 0);
+    pkt[2] = st->seq >> 8;
+    pkt[3] = st->seq;
+    put_be32(pkt + 4, ts);
+    put_be32(pkt + 8, st->ssrc);
+    st->seq++;
+    return pkt + RTP_HDR_LEN;
+}
+
+// Sender report + CNAME: lets the player line up audio and video by
+// mapping each stream's RTP clock to the same wallclock
+static void rtcp_sender_report(rtsp_session_t *sess, rtp_stream_t *st)
+{
+    int64_t now = esp_timer_get_time();
+    if (!st->packets || now < st->sr_due_us) return;
+    st->sr_due_us = now + RTCP_SR_INTERVAL_MS * 1000LL;
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t wall_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - (now - st->last_us);
+
+    uint8_t *p = st->buf + 4;
+    p[0] = 0x80;
+    p[1] = 200;                     // SR
+    p[2] = 0;
+    p[3] = 6;
+    put_be32(p + 4, st->ssrc);
+    put_be32(p + 8, (uint32_t)(wall_us / 1000000 + NTP_UNIX_OFFSET));
+    put_be32(p + 12, (uint32_t)(((uint64_t)(wall_us % 1000000) << 32) / 1000000));
+    put_be32(p + 16, st->last_ts);
+    put_be32(p + 20, st->packets);
+    put_be32(p + 24, st->octets);
+    p[28] = 0x81;
+    p[29] = 202;                    // SDES
+    p[30] = 0;
+    p[31] = 3;
+    put_be32(p + 32, st->ssrc);
+    p[36] = 1;                      // CNAME
+    p[37] = 5;
+    memcpy(p + 38, "chute", 5);
+    p[43] = 0;
+    rtp_send(sess, st, p, 44, true);
+}
+
+// ---------- RTP/JPEG (RFC 2435) ----------
+
+typedef struct {
+    int width;
+    int height;
+    uint8_t type;                   // 0 = 4:2:2, 1 = 4:2:0, +64 with restart markers
+    uint16_t dri;
+    const uint8_t *qt[2];           // luma/chroma tables, zigzag order as in DQT
+    const uint8_t *scan;            // entropy-coded data, without EOI
+    size_t scan_len;
+} rtp_jpeg_t;
+
+// Pull what RTP/JPEG carries out of a baseline JPEG: the receiver rebuilds
+// the headers from type, size and the quantization tables
+static bool rtp_jpeg_parse(const uint8_t *buf, size_t len, rtp_jpeg_t *j)
+{
+    memset(j, 0, sizeof(*j));
+    if (len < 4 || buf[0] != 0xFF || buf[1] != 0xD8) return false;
+
+    size_t i = 2;
+    while (i + 4 <= len) {
+        if (buf[i] != 0xFF) return false;
+        uint8_t marker = buf[i + 1];
+        if (marker == 0xFF) {
+            i++;
+            continue;
+        }
+        size_t seg = buf[i + 2] << 8 | buf[i + 3];
+        const uint8_t *d = buf + i + 4;
+        if (seg < 2 || i + 2 + seg > len) return false;
+
+        switch (marker) {
+        case 0xDB:      // DQT, possibly several tables
+            for (size_t k = 0; k + 65 <= seg - 2; k += 65) {
+                if (d[k] >> 4) return false;            // 16-bit tables can't be sent
+                if ((d[k] & 0x0F) < 2) j->qt[d[k] & 0x0F] = d + k + 1;
+            }
+            break;
+        case 0xC0:      // SOF0 / SOF1
+        case 0xC1:
+            if (seg < 17 || d[5] != 3) return false;    // three components only
+            j->height = d[1] << 8 | d[2];
+            j->width = d[3] << 8 | d[4];
+            if (d[7] == 0x21) j->type = 0;
+            else if (d[7] == 0x22) j->type = 1;
+            else return false;
+            break;
+        case 0xDD:      // DRI
+            j->dri = d[0] << 8 | d[1];
+            break;
+        case 0xDA:      // SOS: the scan runs to EOI
+            j->scan = buf + i + 2 + seg;
+            j->scan_len = len - (i + 2 + seg);
+            for (size_t k = j->scan_len; k >= 2 && k + 32 > j->scan_len; k--) {
+                if (j->scan[k - 2] == 0xFF && j->scan[k - 1] == 0xD9) {
+                    j->scan_len = k - 2;
+                    break;
+                }
+            }
+            if (j->dri) j->type |= 64;
+            return j->width && j->qt[0] && j->qt[1] &&
+                   j->width <= 2040 && j->height <= 2040;
+        default:
+            break;
+        }
+        i += 2 + seg;
+    }
+    return false;
+}
+
+static bool rtp_send_jpeg(rtsp_session_t *sess, const stream_frame_t *frame)
+{
+    static bool warned = false;
+    rtp_stream_t *st = &sess->video;
+    rtp_jpeg_t j;
+
+    if (!rtp_jpeg_parse(frame->buf, frame->len, &j)) {
+        if (!warned) ESP_LOGW(TAG, "Frame can't be sent as RTP/JPEG (unsupported JPEG layout or size)");
+        warned = true;
+        return true;
+    }
+
+    int64_t us = stream_frame_time_us(frame);
+    uint32_t ts = rtp_time(st, us);
+    size_t off = 0;
+    while (off < j.scan_len) {
+        uint8_t *pkt = st->buf + 4;
+        uint8_t *p = pkt + RTP_HDR_LEN;
+
+        // Main JPEG header; Q=255 means the tables travel in-band
+        p[0] = 0;
+        p[1] = off >> 16;
+        p[2] = off >> 8;
+        p[3] = off;
+        p[4] = j.type;
+        p[5] = 255;
+        p[6] = j.width / 8;
+        p[7] = j.height / 8;
+        p += 8;
+        if (j.dri) {
+            // Restart marker header; F=L=1 and count 0x3FFF allow any split
+            p[0] = j.dri >> 8;
+            p[1] = j.dri;
+            p[2] = 0xFF;
+            p[3] = 0xFF;
+            p += 4;
+        }
+        if (off == 0) {
+            p[0] = 0;
+            p[1] = 0;
+            p[2] = 0;
+            p[3] = 128;
+            memcpy(p + 4, j.qt[0], 64);
+            memcpy(p + 68, j.qt[1], 64);
+            p += 132;
+        }
+
+        size_t room = RTP_MAX_PAYLOAD - (p - (pkt + RTP_HDR_LEN));
+        size_t n = j.scan_len - off < room ? j.scan_len - off : room;
+        memcpy(p, j.scan + off, n);
+        off += n;
+        rtp_header(st, pkt, ts, off == j.scan_len);
+
+        size_t len = (p - pkt) + n;
+        if (!rtp_send(sess, st, pkt, len, false)) return false;
+        st->packets++;
+        st->octets += len - RTP_HDR_LEN;
+    }
+    st->last_ts = ts;
+    st->last_us = us;
+    rtcp_sender_report(sess, st);
+    return true;
+}
+
+// ---------- Audio ----------
+
+static bool rtp_send_audio(rtsp_session_t *sess, const int16_t *pcm, int samples,
+                           uint32_t ts, int64_t us)
+{
+    rtp_stream_t *st = &sess->audio;
+    int bytes_per = sess->audio_codec == RTSP_AUDIO_PCMU ? 1 : 2;
+    int per_packet = RTP_MAX_PAYLOAD / bytes_per;
+
+    for (int i = 0; i < samples; i += per_packet) {
+        int n = samples - i < per_packet ? samples - i : per_packet;
+        uint8_t *pkt = st->buf + 4;
+        uint8_t *p = rtp_header(st, pkt, ts + i, st->packets == 0);
+        if (bytes_per == 1) {
+            g711_ulaw_encode_block(pcm + i, n, p);
+        } else {
+            // L16 is big-endian
+            for (int k = 0; k < n; k++) {
+                p[2 * k] = pcm[i + k] >> 8;
+                p[2 * k + 1] = pcm[i + k];
+            }
+        }
+        if (!rtp_send(sess, st, pkt, RTP_HDR_LEN + n * bytes_per, false)) return false;
+        st->packets++;
+        st->octets += n * bytes_per;
+    }
+    st->last_ts = ts;
+    st->last_us = us;
+    rtcp_sender_report(sess, st);
+    return true;
+}
+
+static void rtsp_audio_task(void *arg)
+{
+    rtsp_session_t *sess = (rtsp_session_t *)arg;
+    rtp_stream_t *st = &sess->audio;
+    int16_t *pcm = (int16_t *)malloc(DMA_BUF_LEN);
+    audio_reader_t *reader = pcm ? audio_reader_open(st->clock) : NULL;
+    if (!reader) {
+        ESP_LOGW(TAG, "Mic not available for RTSP audio");
+        goto done;
+    }
+
+    uint32_t next_ts = 0;
+    bool anchored = false;
+    while (sess->playing && !sess->stop && !audio_reader_stopped(reader)) {
+        int64_t us;
+        int bytes = audio_reader_read(reader, (uint8_t *)pcm, 16, &us);
+        if (bytes < 0) break;
+        if (bytes == 0) continue;
+
+        // Timestamps advance by sample count; re-anchor to the capture clock
+        // on start or after a gap so they stay in step with video
+        int32_t drift = (int32_t)(rtp_time(st, us) - next_ts);
+        if (!anchored || drift > (int32_t)st->clock / 10 || drift < -(int32_t)st->clock / 10) {
+            next_ts = rtp_time(st, us);
+            anchored = true;
+        }
+        int samples = bytes / 2;
+        if (!rtp_send_audio(sess, pcm, samples, next_ts, us)) {
+            sess->stop = true;
+            break;
+        }
+        next_ts += samples;
+    }
+
+done:
+    audio_reader_close(reader);
+    free(pcm);
+    xSemaphoreGive(sess->audio_done);   // last touch of sess
+    vTaskDelete(NULL);
+}
+
+// ---------- RTSP ----------
+
+static rtsp_audio_t rtsp_audio_from_url(const char *url)
+{
+    if (!mic_available) return RTSP_AUDIO_NONE;
+    if (strstr(url, "/video")) return RTSP_AUDIO_NONE;
+    if (strstr(url, "/pcmu")) return RTSP_AUDIO_PCMU;
+    return RTSP_AUDIO_L16;
+}
+
+static uint8_t rtsp_audio_pt(rtsp_audio_t codec)
+{
+    return codec == RTSP_AUDIO_PCMU ? RTP_PT_PCMU : RTP_PT_L16_DYN;
+}
+
+// PCMU is always resampled to 8 kHz, so players that only know the static
+// payload type (no rtpmap) get it right; L16 goes at the mic rate
+static int rtsp_audio_rate(rtsp_audio_t codec)
+{
+    return codec == RTSP_AUDIO_PCMU ? RTP_PCMU_RATE : stored_sample_rate;
+}
+
+// Value of a request header (case-insensitive name); "" if absent
+static void rtsp_header(const char *req, const char *name, char *out, size_t size)
+{
+    size_t nlen = strlen(name);
+    out[0] = 0;
+    for (const char *line = strstr(req, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (!strncasecmp(line, name, nlen) && line[nlen] == ':') {
+            const char *v = line + nlen + 1;
+            while (*v == ' ') v++;
+            size_t len = strcspn(v, "\r\n");
+            if (len >= size) len = size - 1;
+            memcpy(out, v, len);
+            out[len] = 0;
+            return;
+        }
+    }
+}
+
+static bool rtsp_reply(rtsp_session_t *sess, int code, const char *reason, const char *cseq,
+                       const char *extra, const char *body)
+{
+    char hdr[768];
+    int n = snprintf(hdr, sizeof(hdr), "RTSP/1.0 %d %s\r\nCSeq: %s\r\nServer: chute\r\n%s",
+                     code, reason, cseq, extra ? extra : "");
+    if (n < sizeof(hdr) && sess->has_session) {
+        n += snprintf(hdr + n, sizeof(hdr) - n, "Session: %08lX;timeout=%d\r\n",
+                      (unsigned long)sess->session, RTSP_SESSION_TIMEOUT_S);
+    }
+    if (n < sizeof(hdr) && body) {
+        n += snprintf(hdr + n, sizeof(hdr) - n, "Content-Length: %d\r\n", (int)strlen(body));
+    }
+    if (n < sizeof(hdr)) {
+        n += snprintf(hdr + n, sizeof(hdr) - n, "\r\n");
+    }
+    if (n >= sizeof(hdr)) {
+        ESP_LOGE(TAG, "RTSP response too long");
+        return false;
+    }
+    return sock_write(sess, hdr, n) && (!body || sock_write(sess, body, strlen(body)));
+}
+
+// Request URL without a trailing slash, for Content-Base and RTP-Info
+static void rtsp_base_url(const char *url, char *out, size_t size)
+{
+    snprintf(out, size, "%s", url);
+    size_t len = strlen(out);
+    if (len && out[len - 1] == '/') out[len - 1] = 0;
+}
+
+static void rtsp_describe(rtsp_session_t *sess, const char *url, const char *cseq)
+{
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    char ip[16] = "0.0.0.0";
+    if (getsockname(sess->sock, (struct sockaddr *)&local, &len) == 0) {
+        inet_ntoa_r(local.sin_addr, ip, sizeof(ip));
+    }
+
+    sess->audio_codec = rtsp_audio_from_url(url);
+    sess->described = true;
+
+    char sdp[512];
+    int n = snprintf(sdp, sizeof(sdp),
+                     "v=0\r\n"
+                     "o=- %lu 1 IN IP4 %s\r\n"
+                     "s=%s\r\n"
+                     "c=IN IP4 0.0.0.0\r\n"
+                     "t=0 0\r\n"
+                     "a=control:*\r\n"
+                     "a=range:npt=0-\r\n"
+                     "m=video 0 RTP/AVP %d\r\n"
+                     "a=control:trackID=0\r\n",
+                     (unsigned long)esp_random(), ip, stored_hostname, RTP_PT_JPEG);
+    if (sess->audio_codec != RTSP_AUDIO_NONE) {
+        int rate = rtsp_audio_rate(sess->audio_codec);
+        int pt = rtsp_audio_pt(sess->audio_codec);
+        snprintf(sdp + n, sizeof(sdp) - n,
+                 "m=audio 0 RTP/AVP %d\r\n"
+                 "a=rtpmap:%d %s/%d/1\r\n"
+                 "a=control:trackID=1\r\n",
+                 pt, pt, sess->audio_codec == RTSP_AUDIO_PCMU ? "PCMU" : "L16", rate);
+    }
+
+    char base[160];
+    char extra[256];
+    rtsp_base_url(url, base, sizeof(base));
+    snprintf(extra, sizeof(extra), "Content-Type: application/sdp\r\nContent-Base: %s/\r\n", base);
+    rtsp_reply(sess, 200, "OK", cseq, extra, sdp);
+}
+
+static void rtsp_setup(rtsp_session_t *sess, const char *req, const char *url, const char *cseq)
+{
+    char transport[128];
+    rtsp_header(req, "Transport", transport, sizeof(transport));
+
+    if (!sess->described) sess->audio_codec = rtsp_audio_from_url(url);
+    int track = strstr(url, "trackID=1") ? 1 : 0;
+    if (track == 1 && sess->audio_codec == RTSP_AUDIO_NONE) {
+        rtsp_reply(sess, 404, "Stream Not Found", cseq, NULL, NULL);
+        return;
+    }
+    if (sess->playing) {
+        rtsp_reply(sess, 455, "Method Not Valid in This State", cseq, NULL, NULL);
+        return;
+    }
+    if (strstr(transport, "multicast")) {
+        rtsp_reply(sess, 461, "Unsupported Transport", cseq, NULL, NULL);
+        return;
+    }
+
+    rtp_stream_t *st = track ? &sess->audio : &sess->video;
+    memset(st, 0, offsetof(rtp_stream_t, buf));
+    st->tcp = strstr(transport, "RTP/AVP/TCP") != NULL;
+
+    char extra[192];
+    int a, b;
+    if (st->tcp) {
+        const char *il = strstr(transport, "interleaved=");
+        if (!il || sscanf(il, "interleaved=%d-%d", &a, &b) < 1) a = track * 2;
+        st->channel = a;
+        snprintf(extra, sizeof(extra), "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d\r\n", a, a + 1);
+    } else {
+        const char *cp = strstr(transport, "client_port=");
+        if (!cp || sscanf(cp, "client_port=%d-%d", &a, &b) < 1) {
+            rtsp_reply(sess, 461, "Unsupported Transport", cseq, NULL, NULL);
+            return;
+        }
+        if (sscanf(cp, "client_port=%d-%d", &a, &b) < 2) b = a + 1;
+        if (sess->udp < 0) {
+            sess->udp = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            struct sockaddr_in any = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY) };
+            if (sess->udp < 0 || bind(sess->udp, (struct sockaddr *)&any, sizeof(any)) != 0) {
+                ESP_LOGE(TAG, "Failed to open RTP socket: errno %d", errno);
+                if (sess->udp >= 0) close(sess->udp);
+                sess->udp = -1;
+                rtsp_reply(sess, 453, "Not Enough Bandwidth", cseq, NULL, NULL);
+                return;
+            }
+        }
+        struct sockaddr_in local;
+        socklen_t len = sizeof(local);
+        getsockname(sess->udp, (struct sockaddr *)&local, &len);
+        int port = ntohs(local.sin_port);
+
+        st->rtp_to = sess->peer;
+        st->rtp_to.sin_port = htons(a);
+        st->rtcp_to = sess->peer;
+        st->rtcp_to.sin_port = htons(b);
+        // RTP and RTCP both go out of the session's one socket, so that's
+        // the port for both (an RTP/RTCP pair would cost a socket each)
+        snprintf(extra, sizeof(extra), "Transport: RTP/AVP;unicast;client_port=%d-%d;server_port=%d-%d\r\n",
+                 a, b, port, port);
+    }
+
+    if (track == 1) {
+        st->clock = rtsp_audio_rate(sess->audio_codec);
+        st->pt = rtsp_audio_pt(sess->audio_codec);
+    } else {
+        st->clock = 90000;
+        st->pt = RTP_PT_JPEG;
+    }
+    st->ssrc = esp_random();
+    st->seq = esp_random();
+    st->ts_offset = esp_random();
+    st->setup = true;
+
+    if (!sess->has_session) {
+        sess->session = esp_random();
+        sess->has_session = true;
+    }
+    rtsp_reply(sess, 200, "OK", cseq, extra, NULL);
+}
+
+static void rtsp_pause(rtsp_session_t *sess)
+{
+    // The audio task can sit in a read or a stalled TCP write for seconds;
+    // it must be gone before the session is freed or another one starts
+    sess->playing = false;
+    if (sess->audio_running) {
+        xSemaphoreTake(sess->audio_done, portMAX_DELAY);
+        sess->audio_running = false;
+    }
+    if (sess->viewer >= 0) {
+        video_viewer_close(sess->viewer);
+        sess->viewer = -1;
+    }
+}
+
+static void rtsp_play(rtsp_session_t *sess, const char *url, const char *cseq)
+{
+    if (!sess->video.setup && !sess->audio.setup) {
+        rtsp_reply(sess, 455, "Method Not Valid in This State", cseq, NULL, NULL);
+        return;
+    }
+
+    if (!sess->playing) {
+        if (sess->video.setup) {
+            sess->viewer = video_viewer_open(0);
+            if (sess->viewer < 0) {
+                ESP_LOGW(TAG, "No video viewer slot for RTSP session");
+                rtsp_reply(sess, 453, "Not Enough Bandwidth", cseq, NULL, NULL);
+                return;
+            }
+            sess->last_seq = 0;
+        }
+        sess->playing = true;
+        if (sess->audio.setup) {
+            sess->audio_running = xTaskCreatePinnedToCore(rtsp_audio_task, "rtsp_audio", 4096, sess, 5,
+                                                          NULL, STREAM_SEND_CORE) == pdPASS;
+            if (!sess->audio_running) ESP_LOGE(TAG, "Failed to create RTSP audio task");
+        }
+    }
+
+    char base[160];
+    char extra[384];
+    int64_t now = esp_timer_get_time();
+    rtsp_base_url(url, base, sizeof(base));
+    int n = snprintf(extra, sizeof(extra), "Range: npt=0.000-\r\nRTP-Info: ");
+    const char *sep = "";
+    for (int track = 0; track < 2 && n < sizeof(extra); track++) {
+        rtp_stream_t *st = track ? &sess->audio : &sess->video;
+        if (!st->setup) continue;
+        n += snprintf(extra + n, sizeof(extra) - n, "%surl=%s/trackID=%d;seq=%u;rtptime=%lu",
+                      sep, base, track, st->seq, (unsigned long)rtp_time(st, now));
+        sep = ",";
+    }
+    if (n < sizeof(extra)) snprintf(extra + n, sizeof(extra) - n, "\r\n");
+    rtsp_reply(sess, 200, "OK", cseq, extra, NULL);
+}
+
+static void rtsp_handle(rtsp_session_t *sess, const char *req)
+{
+    char method[16];
+    char url[160];
+    char cseq[16];
+    char session[32];
+
+    if (sscanf(req, "%15s %159s", method, url) != 2) {
+        sess->stop = true;
+        return;
+    }
+    rtsp_header(req, "CSeq", cseq, sizeof(cseq));
+    rtsp_header(req, "Session", session, sizeof(session));
+    ESP_LOGD(TAG, "%s %s", method, url);
+
+    bool needs_session = !strcmp(method, "PLAY") || !strcmp(method, "PAUSE") ||
+                         !strcmp(method, "TEARDOWN");
+    if (needs_session && (!sess->has_session || strtoul(session, NULL, 16) != sess->session)) {
+        rtsp_reply(sess, 454, "Session Not Found", cseq, NULL, NULL);
+        return;
+    }
+
+    if (!strcmp(method, "OPTIONS")) {
+        rtsp_reply(sess, 200, "OK", cseq,
+                   "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN, GET_PARAMETER, SET_PARAMETER\r\n",
+                   NULL);
+    } else if (!strcmp(method, "DESCRIBE")) {
+        rtsp_describe(sess, url, cseq);
+    } else if (!strcmp(method, "SETUP")) {
+        rtsp_setup(sess, req, url, cseq);
+    } else if (!strcmp(method, "PLAY")) {
+        rtsp_play(sess, url, cseq);
+    } else if (!strcmp(method, "PAUSE")) {
+        rtsp_pause(sess);
+        rtsp_reply(sess, 200, "OK", cseq, NULL, NULL);
+    } else if (!strcmp(method, "TEARDOWN")) {
+        rtsp_reply(sess, 200, "OK", cseq, NULL, NULL);
+        sess->stop = true;
+    } else if (!strcmp(method, "GET_PARAMETER") || !strcmp(method, "SET_PARAMETER")) {
+        rtsp_reply(sess, 200, "OK", cseq, NULL, NULL);     // keepalive
+    } else {
+        rtsp_reply(sess, 501, "Not Implemented", cseq, NULL, NULL);
+    }
+}
+
+static void rtsp_consume(rtsp_session_t *sess, size_t n)
+{
+    memmove(sess->rx, sess->rx + n, sess->rx_len - n);
+    sess->rx_len -= n;
+}
+
+// Read from the control connection and handle every complete message.
+// Returns false once the connection is gone.
+static bool rtsp_poll(rtsp_session_t *sess, int timeout_ms)
+{
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(sess->sock, &rfds);
+    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    int r = select(sess->sock + 1, &rfds, NULL, NULL, &tv);
+    if (r <= 0) return r == 0;
+
+    int n = recv(sess->sock, sess->rx + sess->rx_len, sizeof(sess->rx) - 1 - sess->rx_len, 0);
+    if (n <= 0) return false;
+    sess->rx_len += n;
+    sess->last_seen_us = esp_timer_get_time();
+
+    while (sess->rx_len && !sess->stop) {
+        if (sess->rx[0] == '$') {
+            // Interleaved RTCP from the client — nothing to do with it
+            if (sess->rx_len < 4) break;
+            size_t len = 4 + ((uint8_t)sess->rx[2] << 8 | (uint8_t)sess->rx[3]);
+            if (len >= sizeof(sess->rx)) return false;
+            if (sess->rx_len < len) break;
+            rtsp_consume(sess, len);
+            continue;
+        }
+
+        sess->rx[sess->rx_len] = 0;
+        char *end = strstr(sess->rx, "\r\n\r\n");
+        if (!end) {
+            return sess->rx_len < sizeof(sess->rx) - 1;
+        }
+        end[2] = 0;
+        char clen[12];
+        rtsp_header(sess->rx, "Content-Length", clen, sizeof(clen));
+        size_t total = (end + 4 - sess->rx) + atoi(clen);
+        if (total >= sizeof(sess->rx)) return false;
+        if (sess->rx_len < total) {
+            end[2] = '\r';
+            break;
+        }
+        rtsp_handle(sess, sess->rx);
+        rtsp_consume(sess, total);
+    }
+    return true;
+}
+
+static void rtsp_session_task(void *arg)
+{
+    rtsp_session_t *sess = (rtsp_session_t *)arg;
+    char addr[16];
+    inet_ntoa_r(sess->peer.sin_addr, addr, sizeof(addr));
+    ESP_LOGI(TAG, "Client %s connected", addr);
+
+    while (!sess->stop && !s_stop) {
+        if (sess->playing && sess->viewer >= 0) {
+            int64_t t0 = esp_timer_get_time();
+            stream_frame_t *frame = video_viewer_next(sess->viewer, &sess->last_seq);
+            if (frame) {
+                int64_t t1 = esp_timer_get_time();
+                bool ok = rtp_send_jpeg(sess, frame);
+                if (ok) video_viewer_sent(sess->viewer, frame, t0, t1);
+                stream_frame_release(frame);
+                if (!ok) break;
+            }
+            if (!rtsp_poll(sess, 0)) break;
+        } else if (!rtsp_poll(sess, sess->playing ? 100 : 1000)) {
+            break;
+        }
+
+        // Over UDP nothing fails when the client vanishes; rely on keepalives
+        bool interleaved = sess->video.tcp || sess->audio.tcp;
+        if (sess->playing && !interleaved &&
+            esp_timer_get_time() - sess->last_seen_us > RTSP_SESSION_TIMEOUT_S * 1000000LL) {
+            ESP_LOGW(TAG, "Session timed out");
+            break;
+        }
+    }
+
+    sess->stop = true;
+    rtsp_pause(sess);
+    close(sess->sock);
+    if (sess->udp >= 0) close(sess->udp);
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        if (s_sessions[i] == sess) s_sessions[i] = NULL;
+    }
+    xSemaphoreGive(s_lock);
+    xSemaphoreGive(s_free);
+
+    ESP_LOGI(TAG, "Client %s disconnected", addr);
+    vSemaphoreDelete(sess->tx_lock);
+    vSemaphoreDelete(sess->audio_done);
+    free(sess);
+    vTaskDelete(NULL);
+}
+
+static void rtsp_accept(int sock, const struct sockaddr_in *peer)
+{
+    rtsp_session_t *sess = (rtsp_session_t *)calloc(1, sizeof(rtsp_session_t));
+    if (sess) {
+        sess->tx_lock = xSemaphoreCreateMutex();
+        sess->audio_done = xSemaphoreCreateBinary();
+    }
+    if (!sess || !sess->tx_lock || !sess->audio_done) {
+        if (sess && sess->tx_lock) vSemaphoreDelete(sess->tx_lock);
+        if (sess && sess->audio_done) vSemaphoreDelete(sess->audio_done);
+        free(sess);
+        close(sock);
+        xSemaphoreGive(s_free);
+        return;
+    }
+    sess->sock = sock;
+    sess->udp = -1;
+    sess->viewer = -1;
+    sess->peer = *peer;
+    sess->last_seen_us = esp_timer_get_time();
+
+    // A stalled client must not block the sender (or the audio task) forever
+    struct timeval tv = { .tv_sec = 2 };
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int slot = -1;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < RTSP_MAX_CLIENTS; i++) {
+        if (!s_sessions[i]) {
+            s_sessions[i] = sess;
+            slot = i;
+            break;
+        }
+    }
+    xSemaphoreGive(s_lock);
+
+    if (slot < 0) {
+        ESP_LOGE(TAG, "No RTSP session slot");
+    } else if (xTaskCreatePinnedToCore(rtsp_session_task, "rtsp_session", 6144, sess, 5,
+                                       NULL, STREAM_SEND_CORE) == pdPASS) {
+        return;
+    } else {
+        ESP_LOGE(TAG, "Failed to create RTSP session task");
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        s_sessions[slot] = NULL;
+        xSemaphoreGive(s_lock);
+    }
+    close(sock);
+    vSemaphoreDelete(sess->tx_lock);
+    vSemaphoreDelete(sess->audio_done);
+    free(sess);
+    xSemaphoreGive(s_free);
+}
+
+// Accepts only while a session slot is free: further clients wait in the
+// listen backlog rather than take a socket just to be turned away, so
+// RTSP_SOCKETS holds
+static void rtsp_listen_task(void *arg)
+{
+    while (!s_stop) {
+        if (xSemaphoreTake(s_free, pdMS_TO_TICKS(1000)) != pdTRUE) continue;
+        struct sockaddr_in peer;
+        socklen_t len = sizeof(peer);
+        int sock = accept(s_listen, (struct sockaddr *)&peer, &len);
+        if (sock < 0) {
+            xSemaphoreGive(s_free);
+            if (!s_stop) vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        rtsp_accept(sock, &peer);
+    }
+    vTaskDelete(NULL);
+}
+
+void stop_rtsp_server(void)
+{
+    if (!s_lock) return;
+
+    s_stop = true;
+    if (s_listen >= 0) {
+        shutdown(s_listen, SHUT_RDWR);
+        close(s_listen);
+        s_listen = -1;
+    }
+    for (int i = 0; i < 30; i++) {
+        bool active = false;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        for (int k = 0; k < RTSP_MAX_CLIENTS; k++) {
+            if (s_sessions[k]) active = true;
+        }
+        xSemaphoreGive(s_lock);
+        if (!active) break;
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+
+void start_rtsp_server(void)
+{
+    s_lock = xSemaphoreCreateMutex();
+    s_free = xSemaphoreCreateCounting(RTSP_MAX_CLIENTS, RTSP_MAX_CLIENTS);
+    if (!s_lock || !s_free) {
+        ESP_LOGE(TAG, "Failed to create RTSP lock");
+        return;
+    }
+
+    s_listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s_listen < 0) {
+        ESP_LOGE(TAG, "Failed to create RTSP socket: errno %d", errno);
+        return;
+    }
+    int one = 1;
+    setsockopt(s_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(RTSP_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    ESP_LOGI(TAG, "Starting RTSP server on port %d", RTSP_PORT);
+    if (bind(s_listen, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(s_listen, 2) != 0) {
+        ESP_LOGE(TAG, "Failed to start RTSP server: errno %d", errno);
+        close(s_listen);
+        s_listen = -1;
+        return;
+    }
+
+    if (xTaskCreate(rtsp_listen_task, "rtsp", 3072, NULL, 5, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create RTSP listener task");
+        close(s_listen);
+        s_listen = -1;
+    }
+}
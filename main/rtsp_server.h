@@ -0,0 +1,16 @@
+#pragma once
+
+// Built-in RTSP server: the capture pipeline's JPEG frames as RTP/JPEG
+// (RFC 2435) and the mic as RTP L16 or PCMU, over UDP or TCP-interleaved.
+//   rtsp://<ip>/         video + L16 audio
+//   rtsp://<ip>/pcmu     video + PCMU audio
+//   rtsp://<ip>/video    video only
+#define RTSP_PORT              554
+#define RTSP_MAX_CLIENTS       1       // sessions; each playing one takes a video viewer slot
+#define RTSP_SESSION_TIMEOUT_S 60      // UDP sessions without a keepalive request are dropped
+#define RTP_MAX_PAYLOAD        1400    // bytes after the RTP header, keeps packets under the MTU
+#define RTCP_SR_INTERVAL_MS    5000    // sender reports map RTP time to wallclock for A/V sync
+#define RTSP_SOCKETS           (1 + RTSP_MAX_CLIENTS * 2)  // listener, each session's TCP + UDP
+
+void start_rtsp_server(void);
+void stop_rtsp_server(void);
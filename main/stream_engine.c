@@ -0,0 +1,668 @@
+#include "stream_engine.h"
+#include "http_video_stream.h"
+#include "http_audio_stream.h"
+#include "video_scale.h"
+#include "video_analyze.h"
+#include "http_ui.h"
+#include "config.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+#include "esp_http_server.h"
+#include "esp_camera.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "stream_engine";
+
+// Streams are plain HTTP/1.1 bodies delimited by closing the connection:
+// multipart/x-mixed-replace is self-delimiting, so no chunked framing.
+// Per frame only the part header's values are formatted; the boundary and
+// the fixed header text before them are sent from this template.
+#define PART_BOUNDARY "123456789000000000000987654321"
+static const char *_STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
+static const char _STREAM_PART_PREFIX[] = "\r\n--" PART_BOUNDARY "\r\n"
+                                          "Content-Type: image/jpeg\r\nContent-Length: ";
+static const char *_STREAM_PART = "%u\r\nX-Timestamp: %lld.%06ld\r\n\r\n";
+
+#define REQ_LINE_MAX    256
+#define HEAD_MAX        288
+
+typedef enum {
+    CONN_FREE = 0,
+    CONN_REQUEST,               // reading the request
+    CONN_VIDEO,                 // multipart JPEG stream
+    CONN_AUDIO,                 // WAV stream
+    CONN_EVENTS,                // server-sent events (motion)
+    CONN_CLOSING,               // flushing a last response, then close
+} conn_state_t;
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+} seg_t;
+
+typedef struct {
+    conn_state_t state;
+    int fd;
+    int port;                   // listener it came in on
+    int64_t since_us;           // accepted, or last output queued / progress
+
+    // Request line, then a rolling match for the blank line ending the headers
+    char line[REQ_LINE_MAX];
+    size_t line_len;
+    bool line_done;
+    uint32_t last4;
+
+    // Pending output: up to three segments, sent with one writev()
+    char head[HEAD_MAX];
+    seg_t seg[3];
+    int nseg;
+    int cur;
+    size_t off;
+
+    // Stream source
+    int viewer;
+    uint32_t last_seq;
+    int scale;                  // sub-stream scale (video_scale.h), 0 = full size
+    int tier;                   // quality tier, 0 = as captured
+    bool on_motion;             // only send frames while there is motion
+    stream_frame_t *scale_src;  // frame waiting for its scaled/requantized version
+    stream_frame_t *frame;      // frame being sent
+    int64_t t0, t1;             // began waiting for it, began sending it
+    audio_listener_t *audio;
+    uint32_t event_seq;         // last motion event sent
+    uint32_t focus_seq;         // last focus event sent
+} engine_conn_t;
+
+static engine_conn_t s_conns[STREAM_ENGINE_MAX_CONNS];
+static int s_listen[2] = { -1, -1 };
+static const int s_ports[2] = { STREAM_VIDEO_PORT, STREAM_AUDIO_PORT };
+static int s_ctrl = -1;                 // wake socket: any task sends to it, from it
+static struct sockaddr_in s_ctrl_addr;
+static volatile bool s_wake_pending = false;
+static volatile bool s_stop = false;
+static volatile TaskHandle_t s_task = NULL;
+static uint32_t s_loops = 0;
+static uint32_t s_writes = 0;
+static uint64_t s_bytes = 0;
+
+void stream_engine_wake(void)
+{
+    if (s_ctrl < 0 || s_wake_pending) return;
+    s_wake_pending = true;
+    // A datagram that wasn't queued (no pbufs) must not leave the flag set,
+    // or every later wake would be skipped
+    if (sendto(s_ctrl, "w", 1, 0, (struct sockaddr *)&s_ctrl_addr, sizeof(s_ctrl_addr)) < 0) {
+        s_wake_pending = false;
+    }
+}
+
+static bool conn_pending(const engine_conn_t *c)
+{
+    return c->cur < c->nseg;
+}
+
+static void conn_clear(engine_conn_t *c)
+{
+    c->nseg = 0;
+    c->cur = 0;
+    c->off = 0;
+    c->since_us = esp_timer_get_time();
+}
+
+static void conn_add(engine_conn_t *c, const void *buf, size_t len)
+{
+    if (len) c->seg[c->nseg++] = (seg_t){ (const uint8_t *)buf, len };
+}
+
+// Send as much pending output as the socket takes, all remaining segments
+// in one writev(); false if the client is gone
+static bool conn_flush(engine_conn_t *c)
+{
+    while (c->cur < c->nseg) {
+        struct iovec iov[3];
+        int n = 0;
+        for (int i = c->cur; i < c->nseg; i++, n++) {
+            size_t skip = (i == c->cur) ? c->off : 0;
+            iov[n].iov_base = (void *)(c->seg[i].buf + skip);
+            iov[n].iov_len = c->seg[i].len - skip;
+        }
+        ssize_t sent = writev(c->fd, iov, n);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        s_writes++;
+        s_bytes += sent;
+        c->since_us = esp_timer_get_time();
+
+        // Advance past what went out
+        size_t left = sent;
+        while (c->cur < c->nseg && left >= c->seg[c->cur].len - c->off) {
+            left -= c->seg[c->cur].len - c->off;
+            c->cur++;
+            c->off = 0;
+        }
+        c->off += left;
+        if (c->cur < c->nseg) return true;    // socket buffer full
+    }
+    return true;
+}
+
+static void conn_close(engine_conn_t *c)
+{
+    close(c->fd);
+    c->fd = -1;
+
+    if (c->scale_src) {
+        stream_frame_release(c->scale_src);
+        c->scale_src = NULL;
+    }
+    if (c->frame) {
+        stream_frame_release(c->frame);
+        c->frame = NULL;
+    }
+    if (c->state == CONN_VIDEO) {
+        video_viewer_close(c->viewer);
+    }
+    if (c->audio) {
+        audio_listener_close(c->audio);
+        c->audio = NULL;
+        ESP_LOGI(TAG, "Audio listener closed");
+    }
+    c->state = CONN_FREE;
+}
+
+static void conn_error(engine_conn_t *c, const char *status, const char *msg)
+{
+    int n = snprintf(c->head, sizeof(c->head),
+                     "HTTP/1.1 %s\r\nContent-Type: text/plain\r\nAccess-Control-Allow-Origin: *\r\n"
+                     "Content-Length: %u\r\nConnection: close\r\n\r\n%s",
+                     status, (unsigned)strlen(msg), msg);
+    conn_clear(c);
+    conn_add(c, c->head, n);
+    c->state = CONN_CLOSING;
+}
+
+static void open_video(engine_conn_t *c, const char *query)
+{
+    if (!esp_camera_sensor_get()) {
+        conn_error(c, "500 Internal Server Error", "Camera not available");
+        return;
+    }
+
+    int64_t interval_us = query ? video_parse_interval(query) : 0;
+    c->viewer = video_viewer_open(interval_us);
+    if (c->viewer < 0) {
+        ESP_LOGW(TAG, "Viewer limit (%d) reached", STREAM_MAX_CLIENTS);
+        conn_error(c, "503 Service Unavailable", "Too many viewers");
+        return;
+    }
+    c->state = CONN_VIDEO;
+    c->last_seq = 0;
+    c->scale = video_scale_parse(query);
+    c->tier = video_quality_parse(query);
+    char value[8];
+    c->on_motion = query && httpd_query_key_value(query, "on_motion", value, sizeof(value)) == ESP_OK &&
+                   atoi(value) != 0;
+    c->t0 = esp_timer_get_time();
+
+    int fps = interval_us ? (int)((1000000 + interval_us / 2) / interval_us) : 60;
+    int n = snprintf(c->head, sizeof(c->head),
+                     "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nConnection: close\r\n"
+                     "Access-Control-Allow-Origin: *\r\nX-Framerate: %d\r\n"
+                     "Accept-Ranges: none\r\nCache-Control: no-cache, no-store\r\n\r\n",
+                     _STREAM_CONTENT_TYPE, fps);
+    conn_clear(c);
+    conn_add(c, c->head, n);
+
+    video_stream_stats_t st;
+    video_stream_get_stats(&st);
+    ESP_LOGI(TAG, "Video stream started (%d viewer(s), interval %dms, scale 1/%d, tier %d%s)",
+             st.viewers, (int)(interval_us / 1000), 1 << c->scale, c->tier,
+             c->on_motion ? ", on motion" : "");
+}
+
+static void open_events(engine_conn_t *c)
+{
+    video_motion_status_t m;
+    video_motion_get_status(&m);
+    c->state = CONN_EVENTS;
+    c->event_seq = m.seq - 1;   // the current state goes out first
+    video_focus_status_t f;
+    video_focus_get_status(&f);
+    c->focus_seq = f.seq;
+
+    int n = snprintf(c->head, sizeof(c->head),
+                     "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nConnection: close\r\n"
+                     "Access-Control-Allow-Origin: *\r\nCache-Control: no-cache, no-store\r\n\r\n");
+    conn_clear(c);
+    conn_add(c, c->head, n);
+    ESP_LOGI(TAG, "Event stream started");
+}
+
+static void open_audio(engine_conn_t *c, const char *query)
+{
+    // ?codec=adpcm for IMA ADPCM, pcmu/pcma for G.711, PCM otherwise;
+    // ?rate= for another rate than the configured one (not for G.711).
+    // The resampler is 16-bit, so 24-bit PCM comes at the capture rate.
+    char value[8];
+    audio_codec_t codec = AUDIO_CODEC_PCM;
+    int rate = stored_sample_rate;
+    if (query && httpd_query_key_value(query, "codec", value, sizeof(value)) == ESP_OK) {
+        if (strcmp(value, "adpcm") == 0) {
+            codec = AUDIO_CODEC_ADPCM;
+        } else if (strcmp(value, "pcmu") == 0) {
+            codec = AUDIO_CODEC_PCMU;
+        } else if (strcmp(value, "pcma") == 0) {
+            codec = AUDIO_CODEC_PCMA;
+        } else if (strcmp(value, "pcm") != 0) {
+            conn_error(c, "400 Bad Request", "Unknown codec");
+            return;
+        }
+    }
+    if (query && httpd_query_key_value(query, "rate", value, sizeof(value)) == ESP_OK) {
+        rate = atoi(value);
+        if (!AUDIO_RATE_VALID(rate) || codec == AUDIO_CODEC_PCMU || codec == AUDIO_CODEC_PCMA) {
+            conn_error(c, "400 Bad Request", "Unsupported rate");
+            return;
+        }
+        if (codec == AUDIO_CODEC_PCM && stored_wav_bits == 24 && rate != SAMPLE_RATE) {
+            conn_error(c, "400 Bad Request", "24-bit PCM is only available at the capture rate");
+            return;
+        }
+    } else if (codec == AUDIO_CODEC_PCM && stored_wav_bits == 24) {
+        rate = SAMPLE_RATE;
+    }
+
+    uint8_t wav[sizeof(struct WAVHeaderAdpcm)];
+    size_t wav_len = 0;
+    if (!mic_available) {
+        conn_error(c, "500 Internal Server Error", "Mic not available");
+        return;
+    }
+    if (!(c->audio = audio_listener_open(codec, rate, wav, &wav_len))) {
+        conn_error(c, "503 Service Unavailable", "Too many listeners");
+        return;
+    }
+    c->state = CONN_AUDIO;
+
+    int n = snprintf(c->head, sizeof(c->head),
+                     "HTTP/1.1 200 OK\r\nContent-Type: audio/wav\r\nConnection: close\r\n"
+                     "Access-Control-Allow-Origin: *\r\n"
+                     "Accept-Ranges: none\r\nCache-Control: no-cache, no-store\r\n\r\n");
+    memcpy(c->head + n, wav, wav_len);
+    conn_clear(c);
+    conn_add(c, c->head, n + wav_len);
+}
+
+// The request is in; route it by listener and path
+static void conn_route(engine_conn_t *c)
+{
+    char *method = c->line;
+    char *uri = strchr(method, ' ');
+    if (!uri) {
+        conn_error(c, "400 Bad Request", "Bad request");
+        return;
+    }
+    *uri++ = '\0';
+    char *end = strchr(uri, ' ');
+    if (end) *end = '\0';
+    char *query = strchr(uri, '?');
+    if (query) *query++ = '\0';
+
+    if (strcmp(method, "GET") != 0) {
+        conn_error(c, "405 Method Not Allowed", "Method not allowed");
+    } else if (c->port == STREAM_VIDEO_PORT && strcmp(uri, "/stream") == 0) {
+        open_video(c, query);
+    } else if (c->port == STREAM_VIDEO_PORT && strcmp(uri, "/events") == 0) {
+        open_events(c);
+    } else if (c->port == STREAM_AUDIO_PORT && strcmp(uri, "/audio") == 0) {
+        open_audio(c, query);
+    } else {
+        conn_error(c, "404 Not Found", "Not found");
+    }
+}
+
+// Read what the client sent: the request while in CONN_REQUEST, afterwards
+// only to notice the client hanging up. False if the connection is done.
+static bool conn_read(engine_conn_t *c)
+{
+    char buf[128];
+    int n = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0) return false;
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+    if (c->state != CONN_REQUEST) return true;
+
+    for (int i = 0; i < n; i++) {
+        c->last4 = (c->last4 << 8) | (uint8_t)buf[i];
+        if (!c->line_done) {
+            if (buf[i] == '\n') {
+                if (c->line_len && c->line[c->line_len - 1] == '\r') c->line_len--;
+                c->line[c->line_len] = '\0';
+                c->line_done = true;
+            } else if (c->line_len < sizeof(c->line) - 1) {
+                c->line[c->line_len++] = buf[i];
+            } else {
+                conn_error(c, "414 URI Too Long", "URI too long");
+                return true;
+            }
+        } else if (c->last4 == 0x0d0a0d0a) {
+            conn_route(c);
+            return true;
+        }
+    }
+    return true;
+}
+
+// Queue the next frame or audio block once the previous one is out.
+// False if the stream is over.
+static bool conn_next(engine_conn_t *c)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (c->state == CONN_VIDEO) {
+        if (c->frame) {
+            video_viewer_sent(c->viewer, c->frame, c->t0, c->t1);
+            stream_frame_release(c->frame);
+            c->frame = NULL;
+            c->t0 = now;
+        }
+        stream_frame_t *frame = c->scale_src;
+        if (!frame) {
+            frame = video_viewer_poll(c->viewer, &c->last_seq);
+            // Motion-gated viewers get a frame now and then while nothing moves
+            if (frame && c->on_motion && video_motion_enabled() && !video_motion_active() &&
+                now - c->t1 < MOTION_IDLE_INTERVAL_S * 1000000LL) {
+                stream_frame_release(frame);
+                frame = NULL;
+            }
+        }
+        if (!frame) return true;
+        if (c->scale || c->tier) {
+            // Sub-stream: wait (on later passes) for the worker's output
+            stream_frame_t *scaled = video_scale_get(frame, c->scale, c->tier);
+            if (!scaled) {
+                c->scale_src = frame;
+                return true;
+            }
+            stream_frame_release(frame);
+            c->scale_src = NULL;
+            frame = scaled;
+            // The shared output may be newer than what this viewer asked for
+            if ((int32_t)(frame->seq - c->last_seq) > 0) c->last_seq = frame->seq;
+        }
+        c->frame = frame;
+        c->t1 = now;
+
+        int n = snprintf(c->head, sizeof(c->head), _STREAM_PART,
+                         frame->len, (long long)frame->timestamp.tv_sec,
+                         (long)frame->timestamp.tv_usec);
+        conn_clear(c);
+        conn_add(c, _STREAM_PART_PREFIX, sizeof(_STREAM_PART_PREFIX) - 1);
+        conn_add(c, c->head, n);
+        conn_add(c, frame->buf, frame->len);
+        return true;
+    }
+
+    if (c->state == CONN_AUDIO) {
+        size_t len;
+        const uint8_t *block = audio_listener_next(c->audio, &len);
+        if (block) {
+            conn_clear(c);
+            conn_add(c, block, len);
+        } else if (audio_listener_ended(c->audio)) {
+            // The mic stopped (reconfigured): end the stream by closing
+            // the connection
+            audio_listener_close(c->audio);
+            c->audio = NULL;
+            c->state = CONN_CLOSING;
+            ESP_LOGI(TAG, "Audio listener ended");
+        }
+        return true;
+    }
+
+    if (c->state == CONN_EVENTS) {
+        video_motion_status_t m;
+        video_focus_status_t f;
+        video_motion_get_status(&m);
+        video_focus_get_status(&f);
+        int n = 0;
+        if (m.seq != c->event_seq) {
+            c->event_seq = m.seq;
+            n = snprintf(c->head, sizeof(c->head),
+                         "event: motion\ndata: {\"active\":%s,\"score\":%lu,\"grid\":\"%012llx\","
+                         "\"box\":[%u,%u,%u,%u],\"events\":%lu}\n\n",
+                         m.active ? "true" : "false", (unsigned long)m.score,
+                         (unsigned long long)m.grid, m.box[0], m.box[1], m.box[2], m.box[3],
+                         (unsigned long)m.events);
+        } else if (f.enabled && f.seq != c->focus_seq) {
+            c->focus_seq = f.seq;
+            n = snprintf(c->head, sizeof(c->head),
+                         "event: focus\ndata: {\"score\":%lu,\"roi_score\":%lu,\"roi\":%d,"
+                         "\"peak\":%lu,\"detail\":%lu}\n\n",
+                         (unsigned long)f.score, (unsigned long)f.roi_score, f.roi,
+                         (unsigned long)f.peak, (unsigned long)f.detail);
+        } else if (now - c->since_us > STREAM_EVENTS_KEEPALIVE_S * 1000000LL) {
+            n = snprintf(c->head, sizeof(c->head), ": keepalive\n\n");
+        }
+        if (n > 0) {
+            conn_clear(c);
+            conn_add(c, c->head, n);
+        }
+        return true;
+    }
+
+    // CONN_CLOSING with everything sent
+    return false;
+}
+
+// Flush, then keep queueing new output while the socket takes it
+static bool conn_service(engine_conn_t *c)
+{
+    while (true) {
+        if (!conn_flush(c)) return false;
+        if (conn_pending(c)) return true;
+        if (c->state == CONN_REQUEST) return true;
+        if (!conn_next(c)) return false;
+        if (!conn_pending(c)) return true;
+    }
+}
+
+static void engine_accept(int listen_idx)
+{
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    int fd = accept(s_listen[listen_idx], (struct sockaddr *)&peer, &len);
+    if (fd < 0) return;
+
+    engine_conn_t *c = NULL;
+    for (int i = 0; i < STREAM_ENGINE_MAX_CONNS; i++) {
+        if (s_conns[i].state == CONN_FREE) {
+            c = &s_conns[i];
+            break;
+        }
+    }
+    if (!c) {
+        close(fd);
+        return;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    memset(c, 0, sizeof(*c));
+    c->state = CONN_REQUEST;
+    c->fd = fd;
+    c->port = s_ports[listen_idx];
+    c->viewer = -1;
+    c->since_us = esp_timer_get_time();
+}
+
+static void stream_engine_task(void *arg)
+{
+    while (!s_stop) {
+        fd_set rfds, wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        int maxfd = s_ctrl;
+        FD_SET(s_ctrl, &rfds);
+        bool room = false;
+        for (int i = 0; i < STREAM_ENGINE_MAX_CONNS; i++) {
+            engine_conn_t *c = &s_conns[i];
+            if (c->state == CONN_FREE) {
+                room = true;
+                continue;
+            }
+            FD_SET(c->fd, &rfds);
+            if (conn_pending(c)) FD_SET(c->fd, &wfds);
+            if (c->fd > maxfd) maxfd = c->fd;
+        }
+        // With every slot taken, new clients wait in the listen backlog
+        // instead of taking a socket just to be closed
+        for (int i = 0; i < 2 && room; i++) {
+            if (s_listen[i] < 0) continue;
+            FD_SET(s_listen[i], &rfds);
+            if (s_listen[i] > maxfd) maxfd = s_listen[i];
+        }
+
+        struct timeval tv = { .tv_sec = 1 };
+        int r = select(maxfd + 1, &rfds, &wfds, NULL, &tv);
+        if (r < 0) {
+            ESP_LOGE(TAG, "select failed: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        s_loops++;
+
+        if (FD_ISSET(s_ctrl, &rfds)) {
+            // Clear first: a wake arriving while draining is not lost
+            s_wake_pending = false;
+            char buf[16];
+            while (recv(s_ctrl, buf, sizeof(buf), MSG_DONTWAIT) > 0) {}
+        }
+        for (int i = 0; i < 2; i++) {
+            if (s_listen[i] >= 0 && FD_ISSET(s_listen[i], &rfds)) engine_accept(i);
+        }
+
+        // Every stream is serviced on every pass: a wake means new data for
+        // some of them, and with a handful of sockets checking is cheaper
+        // than tracking which
+        int64_t now = esp_timer_get_time();
+        for (int i = 0; i < STREAM_ENGINE_MAX_CONNS; i++) {
+            engine_conn_t *c = &s_conns[i];
+            if (c->state == CONN_FREE) continue;
+
+            bool ok = true;
+            if (FD_ISSET(c->fd, &rfds)) ok = conn_read(c);
+            if (ok) ok = conn_service(c);
+            if (ok && c->state == CONN_REQUEST &&
+                now - c->since_us > STREAM_REQ_TIMEOUT_S * 1000000LL) {
+                ok = false;
+            }
+            if (ok && conn_pending(c) &&
+                now - c->since_us > STREAM_SEND_TIMEOUT_S * 1000000LL) {
+                ESP_LOGI(TAG, "Client stalled, closing");
+                ok = false;
+            }
+            if (!ok) conn_close(c);
+        }
+    }
+
+    for (int i = 0; i < STREAM_ENGINE_MAX_CONNS; i++) {
+        if (s_conns[i].state != CONN_FREE) conn_close(&s_conns[i]);
+    }
+    s_task = NULL;
+    vTaskDelete(NULL);
+}
+
+void stream_engine_get_stats(stream_engine_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < STREAM_ENGINE_MAX_CONNS; i++) {
+        conn_state_t state = s_conns[i].state;
+        if (state == CONN_FREE) continue;
+        stats->conns++;
+        if (state == CONN_VIDEO) stats->video++;
+        if (state == CONN_AUDIO) stats->audio++;
+        if (state == CONN_EVENTS) stats->events++;
+    }
+    stats->loops = s_loops;
+    stats->writes = s_writes;
+    stats->bytes = s_bytes;
+    TaskHandle_t task = s_task;
+    if (task) stats->stack_free = uxTaskGetStackHighWaterMark(task);
+}
+
+static int engine_listen(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Failed to create socket for port %d: errno %d", port, errno);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+        ESP_LOGE(TAG, "Failed to listen on port %d: errno %d", port, errno);
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+void stop_stream_engine(void)
+{
+    if (!s_task) return;
+
+    s_stop = true;
+    s_wake_pending = false;
+    stream_engine_wake();
+    for (int i = 0; i < 30 && s_task; i++) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+
+void start_stream_engine(void)
+{
+    s_ctrl_addr = (struct sockaddr_in){
+        .sin_family = AF_INET,
+        .sin_port = htons(STREAM_ENGINE_CTRL_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    s_ctrl = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s_ctrl < 0 || bind(s_ctrl, (struct sockaddr *)&s_ctrl_addr, sizeof(s_ctrl_addr)) != 0) {
+        ESP_LOGE(TAG, "Failed to create control socket: errno %d", errno);
+        if (s_ctrl >= 0) close(s_ctrl);
+        s_ctrl = -1;
+        return;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        ESP_LOGI(TAG, "Starting %s stream on port %d", i ? "audio" : "video", s_ports[i]);
+        s_listen[i] = engine_listen(s_ports[i]);
+    }
+
+    if (xTaskCreatePinnedToCore(stream_engine_task, "stream_engine", 4096, NULL, 5,
+                                (TaskHandle_t *)&s_task, STREAM_SEND_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create stream engine task");
+        s_task = NULL;
+    }
+}
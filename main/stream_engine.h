@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "http_video_stream.h"
+
+// One task serves every /stream and /events (port 81) and /audio (port 82) connection
+// with non-blocking sockets and select(), instead of an httpd instance per
+// port and a blocking sender task per stream.
+#define STREAM_VIDEO_PORT        81
+#define STREAM_AUDIO_PORT        82
+#define STREAM_ENGINE_MAX_CONNS  (STREAM_MAX_CLIENTS + 1)  // viewers, and /audio, /events or one to turn away
+#define STREAM_ENGINE_SOCKETS    (STREAM_ENGINE_MAX_CONNS + 3)  // + two listeners and the wake socket
+#define STREAM_ENGINE_CTRL_PORT  32769                      // loopback UDP port that wakes the task
+#define STREAM_SEND_TIMEOUT_S    2                          // drop a client that takes no data this long
+#define STREAM_REQ_TIMEOUT_S     5                          // ... or sends no complete request
+#define STREAM_EVENTS_KEEPALIVE_S 15                        // comment line on an idle /events stream
+
+typedef struct {
+    int conns;                // open connections, including ones still sending a request
+    int video;                // /stream viewers
+    int events;               // /events subscribers
+    int audio;                // /audio listeners
+    uint32_t loops;           // select() wakeups
+    uint32_t writes;          // socket writes (one writev per frame unless the buffer fills)
+    uint64_t bytes;           // bytes written, headers included
+    uint32_t stack_free;      // engine task stack high-water mark, bytes
+} stream_engine_stats_t;
+
+// New data to send (frame published, audio block ready); cheap and coalesced
+void stream_engine_wake(void);
+void stream_engine_get_stats(stream_engine_stats_t *stats);
+
+void start_stream_engine(void);
+void stop_stream_engine(void);
@@ -0,0 +1,259 @@
+#include "video_adapt.h"
+#include "http_video_stream.h"
+
+#include <string.h>
+
+#include "esp_camera.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "video_adapt";
+
+// The controller steps through the framesizes with the same aspect ratio
+// as the user's (so the player's doesn't jump), none smaller than
+// ADAPT_MIN_FRAMESIZE. For 4:3 that's QVGA, VGA, SVGA, XGA, UXGA; other
+// aspects may have no smaller size, and then only quality adapts.
+
+typedef struct {
+    uint32_t frames;
+    uint64_t bytes;
+    int64_t send_us;
+    int64_t max_send_us;
+} viewer_window_t;
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static viewer_window_t s_window[STREAM_MAX_CLIENTS];
+static video_adapt_status_t s_status = {
+    .enabled = false,
+    .target_fps = 15,
+    .base_quality = -1,
+    .base_framesize = -1,
+    .quality = -1,
+    .framesize = -1,
+    .last_action = "off",
+};
+static int64_t s_window_start = 0;
+static int s_bad_windows = 0;
+static int s_good_windows = 0;
+
+static uint32_t frame_area(int fs)
+{
+    return (uint32_t)resolution[fs].width * resolution[fs].height;
+}
+
+static bool same_aspect(int a, int b)
+{
+    return (uint32_t)resolution[a].width * resolution[b].height ==
+           (uint32_t)resolution[b].width * resolution[a].height;
+}
+
+// Next ladder size below (dir < 0) or above (dir > 0) the current one;
+// never larger than the user's framesize
+static int framesize_step(int current, int base, int dir)
+{
+    uint32_t cur = frame_area(current);
+    uint32_t min = frame_area(ADAPT_MIN_FRAMESIZE);
+    int best = -1;
+    for (int fs = 0; fs < FRAMESIZE_INVALID; fs++) {
+        uint32_t a = frame_area(fs);
+        if (a < min || !same_aspect(fs, base)) continue;
+        if (dir < 0 && a < cur && (best < 0 || a > frame_area(best))) best = fs;
+        if (dir > 0 && a > cur && (best < 0 || a < frame_area(best))) best = fs;
+    }
+    if (dir > 0 && (best < 0 || frame_area(best) >= frame_area(base))) {
+        best = (current != base) ? base : -1;
+    }
+    return best;
+}
+
+// Move the sensor from the settings in *from to quality/framesize. The
+// status is claimed under the lock first and the sensor (I2C) set outside
+// it; a step the capture task decided is dropped if the controller was
+// turned off or the settings changed since (configure, set_baseline).
+static bool apply(sensor_t *s, const video_adapt_status_t *from, int quality, int framesize,
+                  const char *action, bool step)
+{
+    portENTER_CRITICAL(&s_mux);
+    bool stale = s_status.quality != from->quality || s_status.framesize != from->framesize;
+    if (step && (stale || !s_status.enabled)) {
+        portEXIT_CRITICAL(&s_mux);
+        return false;
+    }
+    s_status.quality = quality;
+    s_status.framesize = framesize;
+    s_status.last_action = action;
+    portEXIT_CRITICAL(&s_mux);
+
+    if (quality != from->quality) s->set_quality(s, quality);
+    if (framesize != from->framesize) s->set_framesize(s, (framesize_t)framesize);
+    ESP_LOGI(TAG, "%s: quality %d -> %d, framesize %d -> %d (est %d kbps, need %d kbps)",
+             action, from->quality, quality, from->framesize, framesize,
+             from->est_kbps, from->stream_kbps);
+    return true;
+}
+
+static bool step_down(sensor_t *s, const video_adapt_status_t *st)
+{
+    if (st->quality < ADAPT_QUALITY_MAX) {
+        int q = st->quality + ADAPT_QUALITY_STEP;
+        apply(s, st, q > ADAPT_QUALITY_MAX ? ADAPT_QUALITY_MAX : q, st->framesize, "down", true);
+        return true;
+    }
+    int fs = framesize_step(st->framesize, st->base_framesize, -1);
+    if (fs < 0) return false;
+    // Smaller frames leave headroom, so start them at the user's quality again
+    apply(s, st, st->base_quality, fs, "down", true);
+    return true;
+}
+
+static bool step_up(sensor_t *s, const video_adapt_status_t *st)
+{
+    if (st->framesize != st->base_framesize) {
+        int fs = framesize_step(st->framesize, st->base_framesize, 1);
+        if (fs >= 0) {
+            apply(s, st, ADAPT_QUALITY_MAX, fs, "up", true);
+            return true;
+        }
+    }
+    if (st->quality > st->base_quality) {
+        int q = st->quality - ADAPT_QUALITY_STEP;
+        apply(s, st, q < st->base_quality ? st->base_quality : q, st->framesize, "up", true);
+        return true;
+    }
+    return false;
+}
+
+void video_adapt_configure(bool enabled, int target_fps, int max_kbps)
+{
+    if (target_fps < 1) target_fps = 1;
+    if (target_fps > 30) target_fps = 30;
+    if (max_kbps < 0) max_kbps = 0;
+
+    portENTER_CRITICAL(&s_mux);
+    bool was_enabled = s_status.enabled;
+    s_status.target_fps = target_fps;
+    s_status.max_kbps = max_kbps;
+    s_status.enabled = enabled;
+    s_bad_windows = s_good_windows = 0;
+    if (enabled && !was_enabled) s_status.last_action = "hold";
+    video_adapt_status_t st = s_status;
+    portEXIT_CRITICAL(&s_mux);
+
+    if (was_enabled && !enabled) {
+        // Back to the user's settings
+        sensor_t *s = esp_camera_sensor_get();
+        if (s && st.base_quality >= 0 &&
+            (st.quality != st.base_quality || st.framesize != st.base_framesize)) {
+            apply(s, &st, st.base_quality, st.base_framesize, "restore", false);
+        }
+        portENTER_CRITICAL(&s_mux);
+        s_status.last_action = "off";
+        portEXIT_CRITICAL(&s_mux);
+    }
+}
+
+void video_adapt_set_baseline(int quality, int framesize)
+{
+    portENTER_CRITICAL(&s_mux);
+    if (quality >= 0) s_status.base_quality = s_status.quality = quality;
+    if (framesize >= 0) s_status.base_framesize = s_status.framesize = framesize;
+    s_bad_windows = s_good_windows = 0;
+    portEXIT_CRITICAL(&s_mux);
+}
+
+void video_adapt_on_sent(int viewer, size_t bytes, int64_t send_us)
+{
+    if (!s_status.enabled || viewer < 0 || viewer >= STREAM_MAX_CLIENTS) return;
+
+    portENTER_CRITICAL(&s_mux);
+    viewer_window_t *w = &s_window[viewer];
+    w->frames++;
+    w->bytes += bytes;
+    w->send_us += send_us;
+    if (send_us > w->max_send_us) w->max_send_us = send_us;
+    portEXIT_CRITICAL(&s_mux);
+}
+
+// Called by the capture task after every frame
+void video_adapt_tick(void)
+{
+    if (!s_status.enabled) return;
+
+    int64_t now = esp_timer_get_time();
+    if (now - s_window_start < ADAPT_WINDOW_MS * 1000LL) return;
+    s_window_start = now;
+
+    viewer_window_t win[STREAM_MAX_CLIENTS];
+    portENTER_CRITICAL(&s_mux);
+    memcpy(win, s_window, sizeof(win));
+    memset(s_window, 0, sizeof(s_window));
+    portEXIT_CRITICAL(&s_mux);
+
+    sensor_t *s = esp_camera_sensor_get();
+    if (!s) return;
+    if (s_status.base_quality < 0) {
+        video_adapt_set_baseline(s->status.quality, s->status.framesize);
+    }
+    video_adapt_status_t st;
+    portENTER_CRITICAL(&s_mux);
+    st = s_status;
+    portEXIT_CRITICAL(&s_mux);
+
+    // Throughput of the slowest viewer while it was actually sending
+    uint64_t est_bps = 0, frames = 0, bytes = 0;
+    int64_t max_send_us = 0;
+    for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+        if (!win[i].frames || win[i].send_us <= 0) continue;
+        uint64_t bps = win[i].bytes * 8 * 1000000ULL / win[i].send_us;
+        if (!est_bps || bps < est_bps) est_bps = bps;
+        frames += win[i].frames;
+        bytes += win[i].bytes;
+        if (win[i].max_send_us > max_send_us) max_send_us = win[i].max_send_us;
+    }
+    if (!frames) return;
+
+    uint64_t need_bps = bytes * 8 / frames * st.target_fps;
+    st.est_kbps = (int)(est_bps / 1000);
+    st.stream_kbps = (int)(need_bps / 1000);
+    portENTER_CRITICAL(&s_mux);
+    s_status.est_kbps = st.est_kbps;
+    s_status.stream_kbps = st.stream_kbps;
+    portEXIT_CRITICAL(&s_mux);
+    uint64_t cap_bps = (uint64_t)st.max_kbps * 1000;
+
+    bool bad = est_bps < need_bps || (cap_bps && need_bps > cap_bps);
+    bool good = est_bps > need_bps * 3 / 2 && (!cap_bps || need_bps * 3 / 2 < cap_bps);
+
+    if (max_send_us > ADAPT_STALL_MS * 1000LL) {
+        // The link is about to hit send_wait_timeout — don't wait for a trend
+        s_bad_windows = ADAPT_DOWN_WINDOWS;
+    } else if (bad) {
+        s_bad_windows++;
+    } else {
+        s_bad_windows = 0;
+    }
+    s_good_windows = good ? s_good_windows + 1 : 0;
+
+    const char *idle = NULL;
+    if (s_bad_windows >= ADAPT_DOWN_WINDOWS) {
+        if (!step_down(s, &st)) idle = "floor";
+        s_bad_windows = 0;
+        s_good_windows = 0;
+    } else if (s_good_windows >= ADAPT_UP_WINDOWS) {
+        if (!step_up(s, &st)) idle = "hold";
+        s_good_windows = 0;
+    }
+    if (idle) {
+        portENTER_CRITICAL(&s_mux);
+        if (s_status.enabled) s_status.last_action = idle;
+        portEXIT_CRITICAL(&s_mux);
+    }
+}
+
+void video_adapt_get_status(video_adapt_status_t *status)
+{
+    portENTER_CRITICAL(&s_mux);
+    *status = s_status;
+    portEXIT_CRITICAL(&s_mux);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Adaptive JPEG quality/framesize controller for the video pipeline.
+// Viewers report how long each frame took to send; once per window the
+// controller estimates link throughput and steps quality first, then
+// framesize, down or back up towards the user's settings.
+
+#define ADAPT_WINDOW_MS        1000
+#define ADAPT_QUALITY_STEP     5
+#define ADAPT_QUALITY_MAX      40      // worst quality the controller will use
+#define ADAPT_DOWN_WINDOWS     2       // consecutive bad windows before stepping down
+#define ADAPT_UP_WINDOWS       5       // consecutive good windows before stepping up
+#define ADAPT_STALL_MS         1000    // a single send this slow steps down at once
+#define ADAPT_MIN_FRAMESIZE    FRAMESIZE_QVGA  // smallest framesize it steps down to
+
+typedef struct {
+    bool enabled;
+    int target_fps;
+    int max_kbps;          // 0 = no bitrate cap
+    int base_quality;      // user's settings the controller returns to
+    int base_framesize;
+    int quality;           // currently applied
+    int framesize;
+    int est_kbps;          // throughput of the slowest viewer, last window
+    int stream_kbps;       // bitrate needed at target fps, last window
+    const char *last_action;
+} video_adapt_status_t;
+
+void video_adapt_configure(bool enabled, int target_fps, int max_kbps);
+void video_adapt_set_baseline(int quality, int framesize);
+void video_adapt_on_sent(int viewer, size_t bytes, int64_t send_us);
+void video_adapt_tick(void);
+void video_adapt_get_status(video_adapt_status_t *status);
@@ -0,0 +1,498 @@
+#include "video_analyze.h"
+#include "video_overlay.h"
+#include "jpeg_dct.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "esp_camera.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "video_analyze";
+
+// Exponential moving average, 1/8 weight for the new sample
+#define EMA_UPDATE(avg, sample) ((avg) += ((int32_t)(sample) - (int32_t)(avg)) / 8)
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static video_motion_status_t s_motion = {
+    .thresh = MOTION_THRESH_DEFAULT,
+    .area = MOTION_AREA_DEFAULT,
+};
+static volatile bool s_reset = false;   // rebuild the background on the next frame
+static volatile bool s_dedup = false;
+static video_focus_status_t s_focus = {
+    .roi = FOCUS_ROI_DEFAULT,
+};
+static int64_t s_last_focus_us = 0;
+static video_exposure_status_t s_expo = {
+    .action = "off",
+};
+static int s_base_ae_level, s_base_aec_value;   // restored when the assist stops
+static int64_t s_last_assist_us = 0;
+
+// Capture task only
+static jpeg_dct_t *s_dct = NULL;
+static int16_t s_blocks[JPEG_DCT_MAX_BLOCKS][64];
+static uint16_t s_mcus_x, s_mcus_y;
+static uint8_t *s_luma = NULL;          // this frame's mean luma per MCU
+static uint8_t *s_edited = NULL;        // per MCU: a mask or the OSD, not the scene
+static uint32_t s_scene_cells;          // MCUs not edited
+static uint16_t *s_bg = NULL;           // background per MCU, luma << 4
+static bool s_bg_valid = false;
+static uint8_t *s_ref = NULL;           // MCU luma of the last distinct frame
+static size_t s_ref_len = 0;            // ... and its JPEG size, 0 = none yet
+static int64_t s_last_event_us = 0;
+static uint64_t s_ac_low, s_ac_high;    // this frame's luma AC energy, whole frame
+static uint64_t s_roi_low, s_roi_high;  // ... and inside the focus ROI
+static uint32_t s_ac_blocks;
+static uint32_t s_hist[EXPO_BINS];      // this frame's luma block histogram
+
+void video_motion_configure(bool enabled, int thresh, int area)
+{
+    if (thresh < 1) thresh = 1;
+    if (thresh > 255) thresh = 255;
+    if (area < 0) area = 0;
+    if (area > 100) area = 100;
+
+    portENTER_CRITICAL(&s_mux);
+    if (enabled != s_motion.enabled) {
+        s_motion.active = false;
+        s_motion.seq++;
+        s_reset = true;
+    }
+    s_motion.enabled = enabled;
+    s_motion.thresh = thresh;
+    s_motion.area = area;
+    portEXIT_CRITICAL(&s_mux);
+    ESP_LOGI(TAG, "Motion detection %s (threshold %d, area %d%%)",
+             enabled ? "on" : "off", thresh, area);
+}
+
+void video_dedup_configure(bool enabled)
+{
+    s_dedup = enabled;
+    ESP_LOGI(TAG, "Duplicate frame suppression %s", enabled ? "on" : "off");
+}
+
+bool video_dedup_enabled(void)
+{
+    return s_dedup;
+}
+
+void video_focus_configure(bool enabled, int roi)
+{
+    if (roi < 0) roi = 0;
+    if (roi > 100) roi = 100;
+
+    portENTER_CRITICAL(&s_mux);
+    if (enabled != s_focus.enabled || roi != s_focus.roi) s_focus.peak = 0;
+    s_focus.enabled = enabled;
+    s_focus.roi = roi;
+    s_focus.seq++;
+    portEXIT_CRITICAL(&s_mux);
+    ESP_LOGI(TAG, "Focus measurement %s (ROI %d%%)", enabled ? "on" : "off", roi);
+}
+
+void video_focus_get_status(video_focus_status_t *status)
+{
+    portENTER_CRITICAL(&s_mux);
+    *status = s_focus;
+    portEXIT_CRITICAL(&s_mux);
+}
+
+void video_exposure_configure(bool enabled, bool assist)
+{
+    sensor_t *s = esp_camera_sensor_get();
+    bool was_assist = s_expo.assist;
+    if (s && assist && !was_assist) {
+        s_base_ae_level = s->status.ae_level;
+        s_base_aec_value = s->status.aec_value;
+    } else if (s && was_assist && !assist) {
+        s->set_ae_level(s, s_base_ae_level);
+        if (!s->status.aec) s->set_aec_value(s, s_base_aec_value);
+    }
+
+    portENTER_CRITICAL(&s_mux);
+    s_expo.enabled = enabled;
+    s_expo.assist = assist;
+    s_expo.action = assist ? "hold" : "off";
+    portEXIT_CRITICAL(&s_mux);
+    ESP_LOGI(TAG, "Exposure statistics %s, assist %s", enabled ? "on" : "off", assist ? "on" : "off");
+}
+
+void video_exposure_get_status(video_exposure_status_t *status)
+{
+    portENTER_CRITICAL(&s_mux);
+    *status = s_expo;
+    portEXIT_CRITICAL(&s_mux);
+}
+
+bool video_motion_enabled(void)
+{
+    return s_motion.enabled;
+}
+
+bool video_motion_active(void)
+{
+    return s_motion.active;
+}
+
+void video_motion_get_status(video_motion_status_t *status)
+{
+    portENTER_CRITICAL(&s_mux);
+    *status = s_motion;
+    portEXIT_CRITICAL(&s_mux);
+}
+
+static void *analyze_alloc(size_t size)
+{
+    void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return p ? p : malloc(size);
+}
+
+// Dequantized AC magnitude of a luma block, split at FOCUS_HF_START
+static inline void ac_energy(const int16_t *coef, const uint8_t *qt, uint32_t *low, uint32_t *high)
+{
+    uint32_t l = 0, h = 0;
+    for (int k = 1; k < FOCUS_HF_START; k++) l += abs(coef[k]) * qt[k];
+    for (int k = FOCUS_HF_START; k < 64; k++) h += abs(coef[k]) * qt[k];
+    *low += l;
+    *high += h;
+}
+
+// Mean luma of every MCU from its luma blocks' DC coefficients; with
+// focus, also the AC energy (same pass, the coefficients are kept instead
+// of skipped), and with expo the histogram of the blocks' luma
+static bool read_luma(const stream_frame_t *frame, bool focus, int roi, bool expo)
+{
+    if (!s_dct && !(s_dct = jpeg_dct_new())) return false;
+    if (!jpeg_dct_begin(s_dct, frame->buf, frame->len)) return false;
+    const jpeg_dct_info_t *info = jpeg_dct_info(s_dct);
+
+    if (info->mcus_x != s_mcus_x || info->mcus_y != s_mcus_y || !s_luma) {
+        // New framesize: start the model over
+        free(s_luma);
+        free(s_bg);
+        free(s_ref);
+        free(s_edited);
+        size_t cells = (size_t)info->mcus_x * info->mcus_y;
+        s_luma = (uint8_t *)analyze_alloc(cells);
+        s_bg = (uint16_t *)analyze_alloc(cells * sizeof(uint16_t));
+        s_ref = (uint8_t *)analyze_alloc(cells);
+        s_edited = (uint8_t *)analyze_alloc(cells);
+        if (!s_luma || !s_bg || !s_ref || !s_edited) {
+            free(s_luma);
+            free(s_bg);
+            free(s_ref);
+            free(s_edited);
+            s_luma = NULL;
+            s_bg = NULL;
+            s_ref = NULL;
+            s_edited = NULL;
+            s_mcus_x = s_mcus_y = 0;
+            return false;
+        }
+        s_mcus_x = info->mcus_x;
+        s_mcus_y = info->mcus_y;
+        s_bg_valid = false;
+        s_ref_len = 0;
+    }
+
+    // Luma blocks come first in each MCU; DC = 8 * (mean - 128) / step
+    int ny = info->comp[0].h * info->comp[0].v;
+    int q = info->qt[info->comp[0].tq][0];
+    int div = 8 * ny;
+    const uint8_t *qt = info->qt[info->comp[0].tq];
+
+    // Focus ROI in MCUs, centred, at least one
+    int rw = (s_mcus_x * roi + 50) / 100, rh = (s_mcus_y * roi + 50) / 100;
+    if (roi && rw < 1) rw = 1;
+    if (roi && rh < 1) rh = 1;
+    int rx0 = (s_mcus_x - rw) / 2, ry0 = (s_mcus_y - rh) / 2;
+    s_ac_low = s_ac_high = s_roi_low = s_roi_high = 0;
+    s_ac_blocks = 0;
+    if (expo) memset(s_hist, 0, sizeof(s_hist));
+
+    // Masked MCUs are black and the OSD is white on black whatever the
+    // scene: keep them out of the statistics and the motion model
+    video_mcu_rect_t rects[OVERLAY_MAX_RECTS];
+    int nrects = video_overlay_mcu_rects(info, rects);
+    memset(s_edited, 0, (size_t)s_mcus_x * s_mcus_y);
+    s_scene_cells = (uint32_t)s_mcus_x * s_mcus_y;
+    for (int r = 0; r < nrects; r++) {
+        for (int y = rects[r].y0; y < rects[r].y1; y++) {
+            for (int x = rects[r].x0; x < rects[r].x1; x++) {
+                uint8_t *e = &s_edited[y * s_mcus_x + x];
+                if (!*e) s_scene_cells--;
+                *e = 1;
+            }
+        }
+    }
+
+    uint32_t m = 0;
+    for (int y = 0; y < s_mcus_y; y++) {
+        for (int x = 0; x < s_mcus_x; x++, m++) {
+            if (!jpeg_dct_read_mcu(s_dct, s_blocks, !focus)) return false;
+            int sum = 0;
+            for (int i = 0; i < ny; i++) sum += s_blocks[i][0];
+            int l = sum * q / div + 128;
+            s_luma[m] = l < 0 ? 0 : l > 255 ? 255 : l;
+            if (s_edited[m]) continue;
+
+            if (expo) {
+                for (int i = 0; i < ny; i++) {
+                    int b = s_blocks[i][0] * q / 8 + 128;
+                    s_hist[b < 0 ? 0 : b > 255 ? EXPO_BINS - 1 : b * EXPO_BINS / 256]++;
+                }
+            }
+            if (focus) {
+                uint32_t low = 0, high = 0;
+                for (int i = 0; i < ny; i++) ac_energy(s_blocks[i], qt, &low, &high);
+                s_ac_low += low;
+                s_ac_high += high;
+                s_ac_blocks += ny;
+                if (x >= rx0 && x < rx0 + rw && y >= ry0 && y < ry0 + rh) {
+                    s_roi_low += low;
+                    s_roi_high += high;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static void detect_motion(const jpeg_dct_info_t *info, int64_t now)
+{
+    uint32_t cells = (uint32_t)s_mcus_x * s_mcus_y;
+    if (s_reset || !s_bg_valid) {
+        s_reset = false;
+        for (uint32_t i = 0; i < cells; i++) s_bg[i] = s_luma[i] << 4;
+        s_bg_valid = true;
+        return;
+    }
+    // Edited MCUs (the OSD clock ticks every second) are never motion;
+    // area and score are shares of the rest
+    uint32_t scene = s_scene_cells;
+    if (!scene) return;
+
+    // Overall brightness change (auto-exposure, lights) is not motion
+    int32_t shift = 0;
+    for (uint32_t i = 0; i < cells; i++) {
+        if (!s_edited[i]) shift += (s_luma[i] << 4) - s_bg[i];
+    }
+    shift /= (int32_t)scene;
+
+    int thresh = s_motion.thresh << 4;
+    uint32_t moving = 0;
+    uint64_t grid = 0;
+    int x0 = s_mcus_x, y0 = s_mcus_y, x1 = -1, y1 = -1;
+    uint32_t i = 0;
+    for (int y = 0; y < s_mcus_y; y++) {
+        for (int x = 0; x < s_mcus_x; x++, i++) {
+            int cur = s_luma[i] << 4;
+            int d = cur - s_bg[i] - shift;
+            if (!s_edited[i] && (d > thresh || d < -thresh)) {
+                moving++;
+                grid |= 1ULL << ((y * MOTION_GRID_H / s_mcus_y) * MOTION_GRID_W +
+                                 x * MOTION_GRID_W / s_mcus_x);
+                if (x < x0) x0 = x;
+                if (x > x1) x1 = x;
+                if (y < y0) y0 = y;
+                if (y > y1) y1 = y;
+            }
+            s_bg[i] += (cur - s_bg[i]) / (1 << MOTION_BG_SHIFT);
+        }
+    }
+    bool motion = moving && moving * 100 >= (uint32_t)s_motion.area * scene;
+
+    bool started = false, ended = false;
+    portENTER_CRITICAL(&s_mux);
+    s_motion.score = moving * 1000 / scene;
+    if (motion) {
+        s_motion.grid = grid;
+        s_motion.box[0] = x0 * info->mcu_w;
+        s_motion.box[1] = y0 * info->mcu_h;
+        s_motion.box[2] = (x1 + 1) * info->mcu_w < info->width ? (x1 + 1) * info->mcu_w : info->width;
+        s_motion.box[3] = (y1 + 1) * info->mcu_h < info->height ? (y1 + 1) * info->mcu_h : info->height;
+        s_motion.last_motion_us = now;
+        if (!s_motion.active) {
+            s_motion.active = started = true;
+            s_motion.events++;
+            s_motion.seq++;
+            s_last_event_us = now;
+        } else if (now - s_last_event_us >= MOTION_EVENT_MS * 1000LL) {
+            s_motion.seq++;
+            s_last_event_us = now;
+        }
+    } else if (s_motion.active && now - s_motion.last_motion_us > MOTION_HOLD_MS * 1000LL) {
+        s_motion.active = false;
+        s_motion.seq++;
+        ended = true;
+    }
+    portEXIT_CRITICAL(&s_mux);
+
+    if (started) ESP_LOGI(TAG, "Motion started (%lu per mille of frame)", (unsigned long)moving * 1000 / scene);
+    if (ended) ESP_LOGI(TAG, "Motion ended");
+}
+
+static void measure_focus(int roi, int64_t now)
+{
+    uint64_t total = s_ac_low + s_ac_high, roi_total = s_roi_low + s_roi_high;
+    uint32_t score = total ? s_ac_high * 1000 / total : 0;
+    uint32_t roi_score = roi_total ? s_roi_high * 1000 / roi_total : 0;
+    uint32_t detail = s_ac_blocks ? total / s_ac_blocks : 0;
+    uint32_t best = roi ? roi_score : score;
+
+    portENTER_CRITICAL(&s_mux);
+    if (s_focus.enabled && s_focus.roi == roi) {
+        s_focus.score = score;
+        s_focus.roi_score = roi_score;
+        s_focus.detail = detail;
+        if (best > s_focus.peak) s_focus.peak = best;
+        s_focus.frames++;
+        if (now - s_last_focus_us >= FOCUS_EVENT_MS * 1000LL) {
+            s_focus.seq++;
+            s_last_focus_us = now;
+        }
+    }
+    portEXIT_CRITICAL(&s_mux);
+}
+
+// Luma below which pct % of the blocks lie (bin centre)
+static uint8_t hist_percentile(uint32_t blocks, int pct)
+{
+    uint32_t want = (blocks * pct + 99) / 100, n = 0;
+    for (int b = 0; b < EXPO_BINS; b++) {
+        n += s_hist[b];
+        if (n >= want) return b * (256 / EXPO_BINS) + 256 / EXPO_BINS / 2;
+    }
+    return 255;
+}
+
+// One ae_level step with auto exposure, an aec_value step of up to
+// EXPO_AEC_STEP_PCT without; clipped highlights win over a dark mean
+static void exposure_assist(const video_exposure_status_t *e, int64_t now)
+{
+    if (now - s_last_assist_us < EXPO_ASSIST_MS * 1000LL) return;
+    s_last_assist_us = now;
+    sensor_t *s = esp_camera_sensor_get();
+    if (!s) return;
+
+    int dir = 0;
+    if (e->mean > EXPO_TARGET + EXPO_TOLERANCE ||
+        (e->bright > EXPO_CLIP_PERMILLE && e->mean > EXPO_TARGET - EXPO_TOLERANCE)) {
+        dir = -1;
+    } else if (e->mean < EXPO_TARGET - EXPO_TOLERANCE && e->bright <= EXPO_CLIP_PERMILLE / 4) {
+        dir = 1;
+    }
+
+    const char *action = dir < 0 ? "down" : dir > 0 ? "up" : "hold";
+    int level = s->status.ae_level, value = s->status.aec_value;
+    if (dir && s->status.aec) {
+        level += dir;
+        if (level < -2 || level > 2) {
+            level -= dir;
+            action = "limit";
+        } else {
+            s->set_ae_level(s, level);
+        }
+    } else if (dir) {
+        int step = value * EXPO_AEC_STEP_PCT / 100;
+        if (dir > 0) value += step > 0 ? step : 1;
+        else value -= step > 0 ? step : 1;
+        if (value < 0) value = 0;
+        if (value > EXPO_AEC_MAX) value = EXPO_AEC_MAX;
+        if (value == s->status.aec_value) action = "limit";
+        else s->set_aec_value(s, value);
+    }
+
+    bool changed = dir && strcmp(action, "limit");
+    portENTER_CRITICAL(&s_mux);
+    s_expo.ae_level = level;
+    s_expo.aec_value = value;
+    s_expo.action = action;
+    if (changed) s_expo.adjustments++;
+    portEXIT_CRITICAL(&s_mux);
+    if (changed) {
+        ESP_LOGI(TAG, "Exposure %s: mean %u, %u/1000 bright, ae_level %d, aec_value %d",
+                 action, e->mean, e->bright, level, value);
+    }
+}
+
+static void measure_exposure(bool assist, int64_t now)
+{
+    video_exposure_status_t e;
+    uint32_t blocks = 0;
+    uint64_t sum = 0;
+    for (int b = 0; b < EXPO_BINS; b++) {
+        blocks += s_hist[b];
+        sum += (uint64_t)s_hist[b] * (b * (256 / EXPO_BINS) + 256 / EXPO_BINS / 2);
+    }
+    if (!blocks) return;
+
+    portENTER_CRITICAL(&s_mux);
+    memcpy(s_expo.hist, s_hist, sizeof(s_hist));
+    s_expo.blocks = blocks;
+    s_expo.mean = sum / blocks;
+    s_expo.p5 = hist_percentile(blocks, 5);
+    s_expo.p50 = hist_percentile(blocks, 50);
+    s_expo.p95 = hist_percentile(blocks, 95);
+    s_expo.dark = s_hist[0] * 1000 / blocks;
+    s_expo.bright = s_hist[EXPO_BINS - 1] * 1000 / blocks;
+    s_expo.frames++;
+    e = s_expo;
+    portEXIT_CRITICAL(&s_mux);
+
+    if (assist) exposure_assist(&e, now);
+}
+
+// Near-identical to the last distinct frame, edited MCUs aside (the OSD
+// clock alone doesn't make a frame distinct)? Otherwise it becomes the
+// new reference.
+static bool is_duplicate(const stream_frame_t *frame)
+{
+    uint32_t cells = (uint32_t)s_mcus_x * s_mcus_y;
+    bool dup = s_ref_len &&
+               frame->len * 100 <= s_ref_len * (100 + DEDUP_SIZE_PCT) &&
+               frame->len * 100 >= s_ref_len * (100 - DEDUP_SIZE_PCT);
+    for (uint32_t i = 0; dup && i < cells; i++) {
+        if (s_edited[i]) continue;
+        int d = s_luma[i] - s_ref[i];
+        if (d > DEDUP_THRESH || d < -DEDUP_THRESH) dup = false;
+    }
+    if (!dup) {
+        memcpy(s_ref, s_luma, cells);
+        s_ref_len = frame->len;
+    }
+    return dup;
+}
+
+void video_analyze_frame(stream_frame_t *frame)
+{
+    bool motion = s_motion.enabled;
+    bool dedup = s_dedup;
+    bool focus = s_focus.enabled;
+    int roi = s_focus.roi;
+    bool assist = s_expo.assist;
+    bool expo = s_expo.enabled || assist;   // the assist works from the statistics
+    if (!motion && !dedup && !focus && !expo) return;
+
+    int64_t t0 = esp_timer_get_time();
+    if (!read_luma(frame, focus, roi, expo)) {
+        ESP_LOGD(TAG, "Frame not analyzable (%u bytes)", (unsigned)frame->len);
+        return;
+    }
+    if (motion) detect_motion(jpeg_dct_info(s_dct), t0);
+    if (dedup) frame->dup = is_duplicate(frame);
+    if (focus) measure_focus(roi, t0);
+    if (expo) measure_exposure(assist, t0);
+
+    uint32_t us = esp_timer_get_time() - t0;
+    portENTER_CRITICAL(&s_mux);
+    s_motion.frames++;
+    EMA_UPDATE(s_motion.analyze_us, us);
+    portEXIT_CRITICAL(&s_mux);
+}
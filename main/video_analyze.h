@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "http_video_stream.h"
+
+// Frame analysis on the capture path, in the compressed domain: each
+// frame's luma DC coefficients (the mean of every 8x8 block), and its AC
+// coefficients for the focus score, are read by entropy decoding alone
+// (jpeg_dct.h), no IDCT. Runs in the capture task before a frame is
+// published, only while an analysis is enabled. It sees frames after the
+// privacy masks and OSD are applied; those MCUs (video_overlay_mcu_rects)
+// are left out of motion, focus and exposure.
+// Analysis time per frame is in the motion status (analyze_us).
+
+// Motion detection: per-MCU luma against a running background, with the
+// frame's overall brightness change (auto-exposure) taken out first
+#define MOTION_THRESH_DEFAULT  12      // luma change (0-255) that marks an MCU as moving
+#define MOTION_AREA_DEFAULT    1       // % of MCUs moving to count as motion
+#define MOTION_BG_SHIFT        4       // background follows each frame by 1/16
+#define MOTION_HOLD_MS         3000    // motion stays active this long after the last moving frame
+#define MOTION_EVENT_MS        500     // event rate while motion goes on
+#define MOTION_GRID_W          8       // coarse region grid reported with events
+#define MOTION_GRID_H          6
+#define MOTION_IDLE_INTERVAL_S 10      // ?on_motion=1 viewers get a frame this often without motion
+
+// Duplicate suppression: a frame whose MCU luma is within DEDUP_THRESH of
+// the last distinct frame everywhere (and about the same size) is marked
+// dup; viewers skip such frames but still get one every DEDUP_KEEPALIVE_S.
+// Masked and OSD MCUs aren't compared, as for motion: on a still scene the
+// OSD clock moves on with the keepalive frames, not every second.
+#define DEDUP_THRESH           3       // luma levels
+#define DEDUP_SIZE_PCT         10      // JPEG size change that always counts as distinct
+#define DEDUP_KEEPALIVE_S      5
+
+// Focus: share of the luma AC energy (dequantized |coefficient|) in the
+// higher frequencies, from the same entropy-decoding pass. Sharper focus
+// moves energy up; the score only compares frames of one scene at one
+// quality. detail is the AC energy per block: near zero (blank wall, dark)
+// means the score has nothing to go on. Computed on every captured frame,
+// so it needs a viewer (or background capture) to be running.
+#define FOCUS_HF_START         6       // zigzag index where "high" frequencies begin
+#define FOCUS_ROI_DEFAULT      25      // centre ROI, % of width and height (0 = none)
+#define FOCUS_EVENT_MS         100     // event rate on /events while focus is on
+
+typedef struct {
+    bool enabled;
+    int roi;                  // centre ROI size in %, 0 = none
+    uint32_t score;           // whole frame, per mille of AC energy in high frequencies
+    uint32_t roi_score;       // the same inside the ROI
+    uint32_t peak;            // best ROI (or frame) score since focus was turned on
+    uint32_t detail;          // mean AC energy per luma block
+    uint32_t seq;             // bumped at most every FOCUS_EVENT_MS with a new score
+    uint32_t frames;          // frames measured
+} video_focus_status_t;
+
+// Exposure statistics: a luma histogram of every luma block's DC (its mean
+// brightness), so a block is only "clipped" if it's entirely blown out or
+// black. The optional assist steps ae_level (auto exposure) or aec_value
+// (manual exposure) towards a mid-grey mean, at most once per
+// EXPO_ASSIST_MS so the sensor's own loop can settle; while it runs it
+// owns those settings and puts the previous values back when turned off.
+#define EXPO_BINS              64      // histogram bins, 4 luma levels each
+#define EXPO_TARGET            118     // mean luma the assist aims for
+#define EXPO_TOLERANCE         16      // ... and how far off it may be
+#define EXPO_CLIP_PERMILLE     20      // blocks in the top/bottom bin that count as clipping
+#define EXPO_ASSIST_MS         1000
+#define EXPO_AEC_STEP_PCT      25      // largest aec_value change per step
+#define EXPO_AEC_MAX           1200
+
+typedef struct {
+    bool enabled;
+    bool assist;              // also keeps the statistics going
+    uint32_t hist[EXPO_BINS]; // luma blocks per bin, last frame
+    uint32_t blocks;          // luma blocks in the last frame
+    uint8_t mean;             // mean luma 0-255
+    uint8_t p5, p50, p95;     // percentiles
+    uint16_t dark, bright;    // blocks in the bottom/top bin, per mille
+    int ae_level;             // last value set by the assist
+    int aec_value;
+    const char *action;       // last assist decision
+    uint32_t adjustments;     // sensor changes made by the assist
+    uint32_t frames;          // frames measured
+} video_exposure_status_t;
+
+typedef struct {
+    bool enabled;
+    int thresh;
+    int area;
+    bool active;              // motion now (held for MOTION_HOLD_MS)
+    uint32_t score;           // MCUs moving in the last frame, per mille
+    uint64_t grid;            // regions with motion in the last moving frame, bit y * MOTION_GRID_W + x
+    uint16_t box[4];          // their bounding box in pixels: x0, y0, x1, y1
+    int64_t last_motion_us;
+    uint32_t events;          // motion starts since boot
+    uint32_t seq;             // bumped for every event (start, update, end)
+    uint32_t frames;          // frames analyzed
+    uint32_t analyze_us;      // average analysis time per frame
+} video_motion_status_t;
+
+void video_motion_configure(bool enabled, int thresh, int area);
+bool video_motion_enabled(void);
+bool video_motion_active(void);
+void video_motion_get_status(video_motion_status_t *status);
+
+void video_dedup_configure(bool enabled);
+bool video_dedup_enabled(void);
+
+void video_focus_configure(bool enabled, int roi);
+void video_focus_get_status(video_focus_status_t *status);
+
+void video_exposure_configure(bool enabled, bool assist);
+void video_exposure_get_status(video_exposure_status_t *status);
+
+// Capture task: analyze a new frame before it is published (sets frame->dup)
+void video_analyze_frame(stream_frame_t *frame);
@@ -0,0 +1,323 @@
+#include "video_overlay.h"
+#include "jpeg_dct.h"
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "esp_camera.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "video_overlay";
+
+// Exponential moving average, 1/8 weight for the new sample
+#define EMA_UPDATE(avg, sample) ((avg) += ((int32_t)(sample) - (int32_t)(avg)) / 8)
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static video_mask_t s_masks[MASK_MAX];
+static int s_mask_count = 0;
+static video_overlay_stats_t s_stats = { 0 };
+
+// The decode context is shared by the capture task and snapshot grabs
+static SemaphoreHandle_t s_lock = NULL;
+static jpeg_dct_t *s_dct = NULL;
+static int16_t s_blocks[JPEG_DCT_MAX_BLOCKS][64];
+static int16_t s_flat[JPEG_DCT_MAX_BLOCKS][64];
+
+static volatile bool s_osd_enabled = false;
+
+// OSD blocks, rebuilt when the text or the frame layout changes
+static struct {
+    char text[OSD_MAX_CHARS + 1];
+    uint16_t width, height;             // frame layout they were built for
+    uint16_t mcu_w, mcu_h;
+    uint8_t ncomp;
+    uint8_t qt[64];                     // ... and its luma quantization table
+    uint16_t cols, rows;                // band size in MCUs, 0 = none
+    int16_t (*blocks)[64];              // cols * rows MCUs, info.blocks each
+    size_t capacity;                    // blocks allocated
+} s_osd;
+
+int video_mask_set(const video_mask_t *masks, int count)
+{
+    if (!s_lock) {
+        s_lock = xSemaphoreCreateMutex();
+        if (!s_lock) return 0;
+    }
+
+    video_mask_t valid[MASK_MAX];
+    int n = 0;
+    for (int i = 0; i < count && n < MASK_MAX; i++) {
+        video_mask_t m = masks[i];
+        if (m.x >= 100 || m.y >= 100 || !m.w || !m.h) continue;
+        if (m.w > 100 - m.x) m.w = 100 - m.x;
+        if (m.h > 100 - m.y) m.h = 100 - m.y;
+        valid[n++] = m;
+    }
+
+    portENTER_CRITICAL(&s_mux);
+    memcpy(s_masks, valid, n * sizeof(video_mask_t));
+    s_mask_count = n;
+    portEXIT_CRITICAL(&s_mux);
+    ESP_LOGI(TAG, "%d privacy mask(s) active", n);
+    return n;
+}
+
+int video_mask_get(video_mask_t *masks)
+{
+    portENTER_CRITICAL(&s_mux);
+    int n = s_mask_count;
+    memcpy(masks, s_masks, n * sizeof(video_mask_t));
+    portEXIT_CRITICAL(&s_mux);
+    return n;
+}
+
+// 7 bits per field: x | y << 7 | w << 14 | h << 21
+int32_t video_mask_pack(const video_mask_t *mask)
+{
+    if (!mask->w || !mask->h) return 0;
+    return (int32_t)(mask->x | mask->y << 7 | mask->w << 14 | mask->h << 21);
+}
+
+bool video_mask_unpack(int32_t packed, video_mask_t *mask)
+{
+    mask->x = packed & 0x7F;
+    mask->y = (packed >> 7) & 0x7F;
+    mask->w = (packed >> 14) & 0x7F;
+    mask->h = (packed >> 21) & 0x7F;
+    return mask->w && mask->h;
+}
+
+void video_osd_configure(bool enabled)
+{
+    if (!s_lock) {
+        s_lock = xSemaphoreCreateMutex();
+        if (!s_lock) return;
+    }
+    s_osd_enabled = enabled;
+    ESP_LOGI(TAG, "Timestamp OSD %s", enabled ? "on" : "off");
+}
+
+bool video_osd_enabled(void)
+{
+    return s_osd_enabled;
+}
+
+void video_overlay_get_stats(video_overlay_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_mux);
+    *stats = s_stats;
+    stats->masks = s_mask_count;
+    stats->osd = s_osd_enabled;
+    portEXIT_CRITICAL(&s_mux);
+}
+
+static void *overlay_alloc(size_t size)
+{
+    void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return p ? p : malloc(size);
+}
+
+static void osd_format(char *buf, size_t size)
+{
+    const char *name = stored_hostname;
+    time_t now = time(NULL);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    if (tm.tm_year + 1900 >= 2024) {
+        snprintf(buf, size, "%s %04d-%02d-%02d %02d:%02d:%02d", name,
+                 tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+    } else {
+        // Clock not set yet
+        unsigned long up = esp_timer_get_time() / 1000000;
+        snprintf(buf, size, "%s UP %lu:%02lu:%02lu", name, up / 3600, up / 60 % 60, up % 60);
+    }
+}
+
+// Render the text into the cached band (overlay_blocks.c)
+static bool osd_build(const jpeg_dct_info_t *info, const char *text)
+{
+    const uint8_t *qt = info->qt[info->comp[0].tq];
+    s_osd.cols = s_osd.rows = 0;
+    snprintf(s_osd.text, sizeof(s_osd.text), "%s", text);
+    s_osd.width = info->width;
+    s_osd.height = info->height;
+    s_osd.mcu_w = info->mcu_w;
+    s_osd.mcu_h = info->mcu_h;
+    s_osd.ncomp = info->ncomp;
+    memcpy(s_osd.qt, qt, 64);
+    int cols, rows;
+    if (!overlay_osd_size(info, text, &cols, &rows)) return false;
+
+    size_t need = (size_t)cols * rows * info->blocks;
+    if (need > s_osd.capacity) {
+        free(s_osd.blocks);
+        s_osd.blocks = (int16_t (*)[64])overlay_alloc(need * sizeof(*s_osd.blocks));
+        s_osd.capacity = s_osd.blocks ? need : 0;
+        if (!s_osd.blocks) return false;
+    }
+    overlay_osd_render(info, text, cols, rows, s_osd.blocks);
+    s_osd.cols = cols;
+    s_osd.rows = rows;
+    return true;
+}
+
+// Bring the OSD blocks up to date for this frame; false if there is no band
+static bool osd_update(const jpeg_dct_info_t *info)
+{
+    char text[OSD_MAX_CHARS + 1];
+    osd_format(text, sizeof(text));
+    if (!strcmp(text, s_osd.text) && info->width == s_osd.width && info->height == s_osd.height &&
+        info->mcu_w == s_osd.mcu_w && info->mcu_h == s_osd.mcu_h && info->ncomp == s_osd.ncomp &&
+        !memcmp(info->qt[info->comp[0].tq], s_osd.qt, 64)) {
+        return s_osd.cols > 0;
+    }
+
+    int64_t t0 = esp_timer_get_time();
+    bool ok = osd_build(info, text);
+    uint32_t us = esp_timer_get_time() - t0;
+    portENTER_CRITICAL(&s_mux);
+    s_stats.osd_updates++;
+    s_stats.osd_build_us = us;
+    portEXIT_CRITICAL(&s_mux);
+    return ok;
+}
+
+// Rewrite the frame with the OSD band and masked MCUs replaced: in place
+// first; if the source's Huffman tables can't code the new blocks,
+// re-encode it with the standard ones. Once past the last replaced MCU,
+// the rest of the scan is copied.
+static bool edit_frame(const stream_frame_t *frame, const video_mask_t *masks, int count, bool osd,
+                       uint8_t **out, size_t *out_len)
+{
+    if (!s_dct && !(s_dct = jpeg_dct_new())) return false;
+    if (!jpeg_dct_begin(s_dct, frame->buf, frame->len)) return false;
+    const jpeg_dct_info_t *info = jpeg_dct_info(s_dct);
+
+    int osd_cols = 0, osd_rows = 0;
+    if (osd && osd_update(info)) {
+        osd_cols = s_osd.cols;
+        osd_rows = s_osd.rows;
+    }
+    int32_t last = osd_cols ? (osd_rows - 1) * info->mcus_x + osd_cols - 1 : -1;
+
+    video_mcu_rect_t rect[MASK_MAX];
+    count = overlay_mask_rects(info, masks, count, rect);
+    for (int i = 0; i < count; i++) {
+        int32_t end = (rect[i].y1 - 1) * info->mcus_x + rect[i].x1 - 1;
+        if (end > last) last = end;
+    }
+
+    overlay_flat_block(info, s_flat);
+
+    // Room for the standard tables coding worse than the camera's
+    size_t size = frame->len + frame->len / 4 + 4096;
+    uint8_t *buf = (uint8_t *)overlay_alloc(size);
+    if (!buf) return false;
+
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass) {
+            jpeg_dct_begin(s_dct, frame->buf, frame->len);
+            jpeg_dct_write_begin(s_dct, buf, size, NULL);
+        } else {
+            jpeg_dct_edit_begin(s_dct, buf, size);
+        }
+        bool ok = true;
+        int32_t m = 0;
+        for (int my = 0; ok && my < info->mcus_y && m <= last; my++) {
+            for (int mx = 0; mx < info->mcus_x && m <= last; mx++, m++) {
+                if (!jpeg_dct_read_mcu(s_dct, s_blocks, false)) {
+                    ok = false;
+                    break;
+                }
+                if (my < osd_rows && mx < osd_cols) {
+                    jpeg_dct_write_mcu(s_dct, s_osd.blocks + (size_t)(my * osd_cols + mx) * info->blocks);
+                    continue;
+                }
+                bool masked = false;
+                for (int i = 0; i < count && !masked; i++) {
+                    masked = mx >= rect[i].x0 && mx < rect[i].x1 && my >= rect[i].y0 && my < rect[i].y1;
+                }
+                if (masked) {
+                    jpeg_dct_write_mcu(s_dct, s_flat);
+                } else {
+                    jpeg_dct_copy_mcu(s_dct, s_blocks);
+                }
+            }
+        }
+        if (ok) ok = jpeg_dct_copy_rest(s_dct, s_blocks);
+        if (!ok) break;                 // corrupt frame, no point re-encoding
+        size_t len = jpeg_dct_write_end(s_dct);
+        if (len) {
+            *out = buf;
+            *out_len = len;
+            return true;
+        }
+    }
+    free(buf);
+    return false;
+}
+
+bool video_overlay_apply(stream_frame_t *frame)
+{
+    video_mask_t masks[MASK_MAX];
+    int count = video_mask_get(masks);
+    bool osd = s_osd_enabled;
+    if (!count && !osd) return true;
+
+    int64_t t0 = esp_timer_get_time();
+    uint8_t *buf = NULL;
+    size_t len = 0;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool ok = edit_frame(frame, masks, count, osd, &buf, &len);
+    xSemaphoreGive(s_lock);
+    uint32_t us = esp_timer_get_time() - t0;
+
+    portENTER_CRITICAL(&s_mux);
+    if (ok) {
+        s_stats.frames++;
+        EMA_UPDATE(s_stats.edit_us, us);
+    } else {
+        s_stats.failed++;
+    }
+    portEXIT_CRITICAL(&s_mux);
+
+    if (!ok) {
+        ESP_LOGW(TAG, "Frame dropped: overlay could not be applied (%u bytes)", (unsigned)frame->len);
+        return false;
+    }
+
+    // The camera buffer can go back to the driver right away
+    if (frame->fb) {
+        esp_camera_fb_return(frame->fb);
+        frame->fb = NULL;
+    } else {
+        free(frame->buf);
+    }
+    frame->buf = buf;
+    frame->len = len;
+    return true;
+}
+
+int video_overlay_mcu_rects(const jpeg_dct_info_t *info, video_mcu_rect_t *rects)
+{
+    video_mask_t masks[MASK_MAX];
+    int count = video_mask_get(masks);
+    int n = overlay_mask_rects(info, masks, count, rects);
+    if (!s_osd_enabled || !s_lock) return n;
+
+    // The band as last built, if it was for this layout
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_osd.cols && info->width == s_osd.width && info->height == s_osd.height &&
+        info->mcu_w == s_osd.mcu_w && info->mcu_h == s_osd.mcu_h) {
+        rects[n++] = (video_mcu_rect_t){ 0, 0, s_osd.cols, s_osd.rows };
+    }
+    xSemaphoreGive(s_lock);
+    return n;
+}
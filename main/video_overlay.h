@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "http_video_stream.h"
+#include "jpeg_dct.h"
+#include "overlay_blocks.h"
+
+// Edits burned into every captured frame before anything sees it (viewers,
+// snapshots, clips, the analyzer), in the compressed domain: the MCUs they
+// cover are encoded anew while the rest of the entropy-coded data is copied
+// bit for bit (jpeg_dct.h edit mode). No IDCT/FDCT, and nothing to do while
+// no edit is configured.
+
+// Privacy masks: rectangles in percent of the frame, rounded out to whole
+// MCUs and blanked to black. A frame that can't be masked is dropped rather
+// than sent unmasked. video_mask_t is in overlay_blocks.h.
+#define MASK_MAX              4
+
+// Timestamp OSD: "<HOSTNAME> YYYY-MM-DD HH:MM:SS" (UTC from SNTP, uptime
+// until the clock is set) in white on black at the top left, drawn over
+// any mask. The text's blocks are built with a forward DCT when it changes,
+// once per second, and cached; each frame only gets those MCUs encoded, and
+// the scan after them is copied without decoding it. The font and the band
+// layout are in overlay_blocks.h.
+#define OSD_MAX_CHARS         40
+
+typedef struct {
+    int masks;
+    bool osd;
+    uint32_t frames;          // frames edited
+    uint32_t edit_us;         // average edit time per frame
+    uint32_t osd_updates;     // OSD text changes
+    uint32_t osd_build_us;    // time to build the cached OSD blocks, last change
+    uint32_t failed;          // frames dropped because they couldn't be edited
+} video_overlay_stats_t;
+
+// Replace the mask list (up to MASK_MAX; empty rectangles are skipped).
+// Returns the number of masks now active.
+int video_mask_set(const video_mask_t *masks, int count);
+int video_mask_get(video_mask_t *masks);
+
+// NVS form of a mask (camera namespace, mask0..mask3), 0 = none
+int32_t video_mask_pack(const video_mask_t *mask);
+bool video_mask_unpack(int32_t packed, video_mask_t *mask);
+
+void video_osd_configure(bool enabled);
+bool video_osd_enabled(void);
+
+// Apply the edits to a new frame; false if the frame must be dropped
+bool video_overlay_apply(stream_frame_t *frame);
+
+// MCUs the edits replace in frames of this layout, as [x0, x1) x [y0, y1)
+// rectangles: the masks rounded out and the OSD band. Analyzers leave them
+// out, they aren't the scene. Returns the count (up to OVERLAY_MAX_RECTS).
+#define OVERLAY_MAX_RECTS     (MASK_MAX + 1)
+
+int video_overlay_mcu_rects(const jpeg_dct_info_t *info, video_mcu_rect_t *rects);
+
+void video_overlay_get_stats(video_overlay_stats_t *stats);
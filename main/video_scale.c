@@ -0,0 +1,285 @@
+#include "video_scale.h"
+#include "http_video_stream.h"
+#include "stream_engine.h"
+#include "jpeg_dct.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "esp_http_server.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "img_converters.h"
+#include "jpeg_decoder.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "video_scale";
+
+// Per scale and quality tier: the frame waiting to be processed (newest
+// request wins) and the last output. Guarded by s_lock.
+typedef struct {
+    stream_frame_t *job;
+    stream_frame_t *out;
+    uint32_t failed_seq;        // source seq the last failed attempt was for
+} scale_slot_t;
+
+static SemaphoreHandle_t s_lock = NULL;
+static scale_slot_t s_slots[SCALE_MAX + 1][QUALITY_TIERS];     // [0][0] unused
+static TaskHandle_t s_task = NULL;
+static video_scale_stats_t s_stats;
+static jpeg_dct_t *s_dct = NULL;        // worker task only
+
+static const int s_scale_quality[QUALITY_TIERS] = {
+    SCALE_JPEG_QUALITY, SCALE_QUALITY_MID, SCALE_QUALITY_LOW
+};
+static const int s_requant_factor[QUALITY_TIERS] = {
+    1, REQUANT_MID_FACTOR, REQUANT_LOW_FACTOR
+};
+
+// Sequence numbers wrap; a is at or after b
+#define SEQ_GEQ(a, b) ((int32_t)((a) - (b)) >= 0)
+
+// Exponential moving average, 1/8 weight for the new sample
+#define EMA_UPDATE(avg, sample) ((avg) += ((int32_t)(sample) - (int32_t)(avg)) / 8)
+
+int video_scale_parse(const char *query)
+{
+    char value[8];
+    if (!query || httpd_query_key_value(query, "scale", value, sizeof(value)) != ESP_OK) {
+        return 0;
+    }
+    const char *div = strchr(value, '/');
+    switch (atoi(div ? div + 1 : value)) {
+        case 2: return 1;
+        case 4: return 2;
+        case 8: return 3;
+        default: return 0;
+    }
+}
+
+int video_quality_parse(const char *query)
+{
+    char value[8];
+    if (!query || httpd_query_key_value(query, "q", value, sizeof(value)) != ESP_OK) {
+        return 0;
+    }
+    if (!strcmp(value, "low")) return 2;
+    if (!strcmp(value, "mid")) return 1;
+    return 0;
+}
+
+// Output buffer for a derived JPEG; PSRAM when there is some
+static uint8_t *scale_alloc(size_t size)
+{
+    uint8_t *buf = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return buf ? buf : (uint8_t *)malloc(size);
+}
+
+// Decode at 1/2^scale into RGB565 and re-encode; NULL on failure
+static stream_frame_t *scale_frame(const stream_frame_t *src, int scale, int quality)
+{
+    esp_jpeg_image_cfg_t cfg = {
+        .indata = src->buf,
+        .indata_size = src->len,
+        .out_format = JPEG_IMAGE_FORMAT_RGB565,
+        .out_scale = (esp_jpeg_image_scale_t)scale,
+        .flags = {
+            .swap_color_bytes = 1,      // esp32-camera's RGB565 is big-endian
+        },
+    };
+    esp_jpeg_image_output_t info;
+    if (esp_jpeg_get_image_info(&cfg, &info) != ESP_OK) {
+        return NULL;
+    }
+    uint16_t width = info.width >> scale;
+    uint16_t height = info.height >> scale;
+    size_t size = (size_t)width * height * 2;
+
+    uint8_t *rgb = scale_alloc(size);
+    if (!rgb) {
+        ESP_LOGW(TAG, "No memory for %ux%u scaled frame", width, height);
+        return NULL;
+    }
+    cfg.outbuf = rgb;
+    cfg.outbuf_size = size;
+
+    stream_frame_t *out = NULL;
+    esp_jpeg_image_output_t img;
+    if (esp_jpeg_decode(&cfg, &img) == ESP_OK) {
+        out = (stream_frame_t *)calloc(1, sizeof(stream_frame_t));
+        if (out && fmt2jpg(rgb, (size_t)img.width * img.height * 2, img.width, img.height,
+                           PIXFORMAT_RGB565, quality, &out->buf, &out->len)) {
+            out->timestamp = src->timestamp;
+            out->seq = src->seq;
+            out->refs = 1;
+        } else {
+            free(out);
+            out = NULL;
+        }
+    }
+    free(rgb);
+    return out;
+}
+
+// Requantize in the DCT domain with every quantizer step multiplied by
+// factor; NULL on failure (not a baseline JPEG, no memory)
+static stream_frame_t *requant_frame(const stream_frame_t *src, int factor)
+{
+    if (!s_dct && !(s_dct = jpeg_dct_new())) return NULL;
+    if (!jpeg_dct_begin(s_dct, src->buf, src->len)) return NULL;
+    const jpeg_dct_info_t *info = jpeg_dct_info(s_dct);
+
+    uint8_t qt[4][64];
+    jpeg_dct_scale_qt(info, factor, qt);
+
+    // Coarser steps never need more bits; the slack covers header changes
+    size_t size = src->len + 1024;
+    uint8_t *buf = scale_alloc(size);
+    if (!buf) return NULL;
+    jpeg_dct_write_begin(s_dct, buf, size, (const uint8_t (*)[64])qt);
+
+    int16_t blocks[JPEG_DCT_MAX_BLOCKS][64];
+    uint32_t mcus = (uint32_t)info->mcus_x * info->mcus_y;
+    for (uint32_t m = 0; m < mcus; m++) {
+        if (!jpeg_dct_read_mcu(s_dct, blocks, false)) {
+            free(buf);
+            return NULL;
+        }
+        for (int i = 0; i < info->blocks; i++) {
+            int tq = info->comp[info->block_comp[i]].tq;
+            jpeg_dct_requant(blocks[i], info->qt[tq], qt[tq]);
+        }
+        jpeg_dct_write_mcu(s_dct, (const int16_t (*)[64])blocks);
+    }
+
+    stream_frame_t *out = NULL;
+    size_t len = jpeg_dct_write_end(s_dct);
+    if (len) out = (stream_frame_t *)calloc(1, sizeof(stream_frame_t));
+    if (!out) {
+        free(buf);
+        return NULL;
+    }
+    out->buf = buf;
+    out->len = len;
+    out->timestamp = src->timestamp;
+    out->seq = src->seq;
+    out->refs = 1;
+    return out;
+}
+
+// Produce the slot's output: scale (re-encoding at the tier's quality), or
+// requantize a full-size frame
+static stream_frame_t *derive_frame(const stream_frame_t *src, int scale, int tier)
+{
+    int64_t t0 = esp_timer_get_time();
+    stream_frame_t *out = scale ? scale_frame(src, scale, s_scale_quality[tier])
+                                : requant_frame(src, s_requant_factor[tier]);
+    uint32_t us = esp_timer_get_time() - t0;
+    ESP_LOGD(TAG, "Frame %lu at 1/%d, tier %d: %u -> %u bytes, %uus", (unsigned long)src->seq,
+             1 << scale, tier, (unsigned)src->len, out ? (unsigned)out->len : 0, (unsigned)us);
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (!out) {
+        s_stats.failed++;
+    } else if (scale) {
+        s_stats.scaled++;
+        EMA_UPDATE(s_stats.scale_us, us);
+    } else {
+        s_stats.requantized++;
+        EMA_UPDATE(s_stats.requant_us, us);
+        EMA_UPDATE(s_stats.requant_in, src->len);
+        EMA_UPDATE(s_stats.requant_out, out->len);
+    }
+    xSemaphoreGive(s_lock);
+    return out;
+}
+
+static void video_scale_task(void *arg)
+{
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        for (int i = 1; i < (SCALE_MAX + 1) * QUALITY_TIERS; i++) {
+            int scale = i / QUALITY_TIERS;
+            int tier = i % QUALITY_TIERS;
+            scale_slot_t *slot = &s_slots[scale][tier];
+
+            xSemaphoreTake(s_lock, portMAX_DELAY);
+            stream_frame_t *src = slot->job;
+            slot->job = NULL;
+            xSemaphoreGive(s_lock);
+            if (!src) continue;
+
+            stream_frame_t *out = derive_frame(src, scale, tier);
+
+            xSemaphoreTake(s_lock, portMAX_DELAY);
+            stream_frame_t *prev = NULL;
+            if (out) {
+                prev = slot->out;
+                slot->out = out;
+            } else {
+                slot->failed_seq = src->seq;
+            }
+            xSemaphoreGive(s_lock);
+
+            stream_frame_release(prev);
+            stream_frame_release(src);
+            stream_engine_wake();
+        }
+    }
+}
+
+stream_frame_t *video_scale_get(stream_frame_t *src, int scale, int tier)
+{
+    if (scale < 0 || scale > SCALE_MAX) scale = 0;
+    if (tier < 0 || tier >= QUALITY_TIERS) tier = 0;
+    if (!scale && !tier) return stream_frame_ref(src);
+
+    if (!s_lock) {
+        s_lock = xSemaphoreCreateMutex();
+        if (!s_lock) return stream_frame_ref(src);
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    scale_slot_t *slot = &s_slots[scale][tier];
+    stream_frame_t *out = NULL;
+    stream_frame_t *replaced = NULL;
+    bool fallback = false;
+
+    if (slot->out && SEQ_GEQ(slot->out->seq, src->seq)) {
+        out = stream_frame_ref(slot->out);
+    } else if (slot->failed_seq == src->seq) {
+        fallback = true;
+    } else if (!slot->job || !SEQ_GEQ(slot->job->seq, src->seq)) {
+        replaced = slot->job;
+        slot->job = stream_frame_ref(src);
+        if (!s_task &&
+            xTaskCreatePinnedToCore(video_scale_task, "vid_scale", 8192, NULL, 4,
+                                    &s_task, STREAM_CAPTURE_CORE) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create scaler task");
+            s_task = NULL;
+            replaced = slot->job;
+            slot->job = NULL;
+            fallback = true;
+        }
+        if (s_task) xTaskNotifyGive(s_task);
+    }
+    xSemaphoreGive(s_lock);
+
+    stream_frame_release(replaced);
+    return fallback ? stream_frame_ref(src) : out;
+}
+
+void video_scale_get_stats(video_scale_stats_t *stats)
+{
+    if (!s_lock) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *stats = s_stats;
+    xSemaphoreGive(s_lock);
+}
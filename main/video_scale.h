@@ -0,0 +1,43 @@
+#pragma once
+
+#include "http_video_stream.h"
+
+// Downscaled sub-stream (/stream?scale=1/2|1/4|1/8) from the main capture.
+// A scaler task on the capture core decodes the JPEG at reduced size with
+// esp_jpeg (1/8 uses DC coefficients only) and re-encodes it. Each scale
+// keeps its newest output, so all viewers at that scale share one encode.
+#define SCALE_JPEG_QUALITY    70
+#define SCALE_MAX             3       // 1/8
+
+// Per-viewer quality tiers (?q=high|mid|low) for viewers on slow links.
+// Full-size frames are requantized in the DCT domain (jpeg_dct.h): entropy
+// decode, round each coefficient to a coarser quantizer step, Huffman
+// re-encode — no IDCT/FDCT. Scaled frames are re-encoded at a lower quality.
+#define QUALITY_TIERS         3       // high = as captured
+#define REQUANT_MID_FACTOR    2       // quantizer step multiplier for q=mid
+#define REQUANT_LOW_FACTOR    4       // ... and q=low
+#define SCALE_QUALITY_MID     50
+#define SCALE_QUALITY_LOW     30
+
+typedef struct {
+    uint32_t scaled;          // sub-stream frames produced
+    uint32_t scale_us;        // average decode + re-encode time
+    uint32_t requantized;     // quality tier frames produced
+    uint32_t requant_us;      // average requantization time
+    uint32_t requant_in;      // average frame size before/after, bytes
+    uint32_t requant_out;
+    uint32_t failed;          // frames sent unchanged because the worker failed
+} video_scale_stats_t;
+
+// ?scale=1/2, 1/4, 1/8 (or 2, 4, 8) → 1..SCALE_MAX; 0 = full size
+int video_scale_parse(const char *query);
+
+// ?q=high|mid|low → 0..QUALITY_TIERS-1
+int video_quality_parse(const char *query);
+
+// Scaled and/or requantized version of src (or a newer one) as a new
+// reference, NULL while the worker is still on it; the viewer just asks
+// again on its next pass. If the worker fails, src itself is returned.
+stream_frame_t *video_scale_get(stream_frame_t *src, int scale, int tier);
+
+void video_scale_get_stats(video_scale_stats_t *stats);
@@ -0,0 +1,362 @@
+#include "ws_stream.h"
+#include "http_video_stream.h"
+#include "http_audio_stream.h"
+#include "http_ui.h"
+#include "config.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_http_server.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "ws_stream";
+
+typedef struct {
+    bool used;
+    httpd_handle_t hd;
+    int fd;
+    bool video;
+    bool audio;
+    volatile bool stop;         // set under tx_lock by ws_stream_close_fn before fd closes
+    int refs;                   // audio sends in progress; the slot isn't freed until 0
+    SemaphoreHandle_t tx_lock;  // one message at a time: header and payload are two frames
+} ws_client_t;
+
+// s_lock guards the client table and refs. The audio task takes a ref on
+// each listener under it and sends outside it, so a slow socket never
+// holds up ws_open or another client's cleanup.
+static SemaphoreHandle_t s_lock = NULL;
+static ws_client_t s_clients[WS_MAX_CLIENTS];
+static volatile TaskHandle_t s_audio_task = NULL;
+
+// Send one message as a fragmented binary frame — header, then payload as
+// a continuation — so the payload goes out from where it is, uncopied.
+// stop is checked under tx_lock: httpd sets it under the same lock before
+// it closes the fd, so a send never reaches a reused fd.
+static esp_err_t ws_send(ws_client_t *client, const ws_msg_hdr_t *hdr, const uint8_t *payload, size_t len)
+{
+    httpd_ws_frame_t head = {
+        .final = false,
+        .fragmented = true,
+        .type = HTTPD_WS_TYPE_BINARY,
+        .payload = (uint8_t *)hdr,
+        .len = sizeof(*hdr),
+    };
+    httpd_ws_frame_t body = {
+        .final = true,
+        .fragmented = true,
+        .type = HTTPD_WS_TYPE_CONTINUE,
+        .payload = (uint8_t *)payload,
+        .len = len,
+    };
+
+    xSemaphoreTake(client->tx_lock, portMAX_DELAY);
+    esp_err_t err = ESP_FAIL;
+    if (!client->stop) {
+        err = httpd_ws_send_frame_async(client->hd, client->fd, &head);
+        if (err == ESP_OK) {
+            err = httpd_ws_send_frame_async(client->hd, client->fd, &body);
+        }
+        if (err != ESP_OK) client->stop = true;
+    }
+    xSemaphoreGive(client->tx_lock);
+    return err;
+}
+
+// httpd only stamps a session when it receives; a viewer only sends, so
+// its task queues this with each telemetry message or LRU purge closes it
+// first. Runs in the httpd task, where sessions don't change under it.
+static void ws_lru_stamp(void *arg)
+{
+    ws_client_t *client = (ws_client_t *)arg;
+    if (client->used && !client->stop) {
+        httpd_sess_update_lru_counter(client->hd, client->fd);
+    }
+}
+
+static void ws_send_telemetry(ws_client_t *client)
+{
+    video_stream_stats_t st;
+    video_stream_get_stats(&st);
+
+    char json[192];
+    int n = snprintf(json, sizeof(json),
+                     "{\"fps\":%.1f,\"viewers\":%d,\"dropped\":%lu,\"latency_us\":%lu,\"rssi\":%d}",
+                     st.fps, st.viewers, (unsigned long)st.dropped,
+                     (unsigned long)st.latency_us, get_wifi_rssi());
+    ws_msg_hdr_t hdr = {
+        .type = WS_MSG_TELEMETRY,
+        .ts_us = esp_timer_get_time(),
+    };
+    ws_send(client, &hdr, (const uint8_t *)json, n);
+}
+
+// Whether a client still wants audio. When none does, s_audio_task is
+// cleared under the lock, so a listener joining after that starts a new task.
+static bool ws_audio_wanted(void)
+{
+    bool wanted = false;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+        ws_client_t *client = &s_clients[i];
+        if (client->used && client->audio && !client->stop) wanted = true;
+    }
+    if (!wanted) s_audio_task = NULL;
+    xSemaphoreGive(s_lock);
+    return wanted;
+}
+
+// Send the reader's blocks to every listener until it stops or none is left
+static void ws_audio_pump(audio_reader_t *reader, int rate, uint8_t *pcm)
+{
+    while (!audio_reader_stopped(reader)) {
+        int64_t ts_us;
+        int bytes = audio_reader_read(reader, pcm, 16, &ts_us);
+        if (bytes < 0) break;
+        if (bytes == 0) continue;
+
+        ws_msg_hdr_t hdr = {
+            .type = WS_MSG_AUDIO,
+            .bits = 16,
+            .arg = rate,
+            .ts_us = ts_us,
+        };
+        ws_client_t *targets[WS_MAX_CLIENTS];
+        int listeners = 0;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+            ws_client_t *client = &s_clients[i];
+            if (client->used && client->audio && !client->stop) {
+                client->refs++;
+                targets[listeners++] = client;
+            }
+        }
+        xSemaphoreGive(s_lock);
+        if (!listeners) break;
+
+        for (int i = 0; i < listeners; i++) {
+            ws_send(targets[i], &hdr, pcm, bytes);
+        }
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        for (int i = 0; i < listeners; i++) {
+            targets[i]->refs--;
+        }
+        xSemaphoreGive(s_lock);
+    }
+}
+
+// One mic reader for all WebSocket listeners; exits with the last of them.
+// A reconfigured mic ends the reader, so it is reopened, at the new rate,
+// for as long as anyone listens.
+static void ws_audio_task(void *arg)
+{
+    uint8_t *pcm = (uint8_t *)malloc(DMA_BUF_LEN);
+    bool warned = false;
+
+    while (pcm && ws_audio_wanted()) {
+        int rate = stored_sample_rate;
+        audio_reader_t *reader = audio_reader_open(rate);
+        if (reader) {
+            warned = false;
+            ws_audio_pump(reader, rate, pcm);
+            audio_reader_close(reader);
+        } else if (!warned) {
+            ESP_LOGW(TAG, "Mic not available for WebSocket audio");
+            warned = true;
+        }
+        vTaskDelay(pdMS_TO_TICKS(WS_AUDIO_RETRY_MS));
+    }
+
+    free(pcm);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_audio_task == xTaskGetCurrentTaskHandle()) s_audio_task = NULL;
+    xSemaphoreGive(s_lock);
+    vTaskDelete(NULL);
+}
+
+// Per-connection task: video frames from the shared capture plus telemetry
+static void ws_client_task(void *arg)
+{
+    ws_client_t *client = (ws_client_t *)arg;
+    int viewer = client->video ? video_viewer_open(0) : -1;
+    uint32_t last_seq = 0;
+    int64_t telemetry_due = 0;
+
+    if (client->video && viewer < 0) {
+        ESP_LOGW(TAG, "No video viewer slot for WebSocket client");
+    }
+
+    while (!client->stop) {
+        if (viewer >= 0) {
+            int64_t t0 = esp_timer_get_time();
+            stream_frame_t *frame = video_viewer_next(viewer, &last_seq);
+            if (frame) {
+                ws_msg_hdr_t hdr = {
+                    .type = WS_MSG_VIDEO,
+                    .arg = frame->seq,
+                    .ts_us = stream_frame_time_us(frame),
+                };
+                int64_t t1 = esp_timer_get_time();
+                if (ws_send(client, &hdr, frame->buf, frame->len) == ESP_OK) {
+                    video_viewer_sent(viewer, frame, t0, t1);
+                }
+                stream_frame_release(frame);
+            }
+        } else {
+            vTaskDelay(pdMS_TO_TICKS(200));
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (now >= telemetry_due) {
+            ws_send_telemetry(client);
+            httpd_queue_work(client->hd, ws_lru_stamp, client);
+            telemetry_due = now + WS_TELEMETRY_MS * 1000LL;
+        }
+    }
+
+    if (viewer >= 0) {
+        video_viewer_close(viewer);
+    }
+
+    // Wait out an audio send in progress (stop is set, so no new ones)
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    while (client->refs) {
+        xSemaphoreGive(s_lock);
+        vTaskDelay(pdMS_TO_TICKS(10));
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+    }
+    vSemaphoreDelete(client->tx_lock);
+    client->tx_lock = NULL;
+    client->used = false;
+    xSemaphoreGive(s_lock);
+
+    ESP_LOGI(TAG, "WebSocket client closed");
+    vTaskDelete(NULL);
+}
+
+static esp_err_t ws_open(httpd_req_t *req)
+{
+    char query[64];
+    char value[8];
+    bool video = esp_camera_sensor_get() != NULL;
+    bool audio = mic_available;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "video", value, sizeof(value)) == ESP_OK && !atoi(value)) {
+            video = false;
+        }
+        if (httpd_query_key_value(query, "audio", value, sizeof(value)) == ESP_OK && !atoi(value)) {
+            audio = false;
+        }
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    ws_client_t *client = NULL;
+    int fd = httpd_req_to_sockfd(req);
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (!s_clients[i].used) {
+            client = &s_clients[i];
+            break;
+        }
+    }
+    if (client) {
+        memset(client, 0, sizeof(*client));
+        client->hd = req->handle;
+        client->fd = fd;
+        client->video = video;
+        client->audio = audio;
+        client->tx_lock = xSemaphoreCreateMutex();
+        client->used = (client->tx_lock != NULL);
+        if (client->used &&
+            xTaskCreatePinnedToCore(ws_client_task, "ws_client", 4096, client, 5,
+                                    NULL, STREAM_SEND_CORE) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create WebSocket client task");
+            vSemaphoreDelete(client->tx_lock);
+            client->used = false;
+        }
+        if (!client->used) client = NULL;
+    }
+    if (client && audio && !s_audio_task) {
+        if (xTaskCreate(ws_audio_task, "ws_audio", 4096, NULL, 5,
+                        (TaskHandle_t *)&s_audio_task) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create WebSocket audio task");
+            s_audio_task = NULL;
+        }
+    }
+    xSemaphoreGive(s_lock);
+
+    if (!client) {
+        ESP_LOGW(TAG, "WebSocket client limit (%d) reached", WS_MAX_CLIENTS);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "WebSocket client connected (video %d, audio %d)", video, audio);
+    return ESP_OK;
+}
+
+esp_err_t ws_stream_handler(httpd_req_t *req)
+{
+    if (!s_lock) {
+        s_lock = xSemaphoreCreateMutex();
+        if (!s_lock) return ESP_FAIL;
+    }
+
+    // GET is the handshake; after that the handler sees incoming frames
+    if (req->method == HTTP_GET) {
+        return ws_open(req);
+    }
+
+    // Nothing is expected from the client; drain small frames, drop big ones
+    uint8_t buf[128];
+    httpd_ws_frame_t frame = { .payload = buf };
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK || frame.len > sizeof(buf)) {
+        return ESP_FAIL;
+    }
+    return frame.len ? httpd_ws_recv_frame(req, &frame, sizeof(buf)) : ESP_OK;
+}
+
+void ws_stream_close_fn(httpd_handle_t hd, int sockfd)
+{
+    // Only the live session can hold an open fd, so a match by fd is it;
+    // once stop is set (under tx_lock) its task sends nothing more
+    if (s_lock) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+            ws_client_t *client = &s_clients[i];
+            if (client->used && !client->stop && client->hd == hd && client->fd == sockfd) {
+                xSemaphoreTake(client->tx_lock, portMAX_DELAY);
+                client->stop = true;
+                xSemaphoreGive(client->tx_lock);
+            }
+        }
+        xSemaphoreGive(s_lock);
+    }
+    close(sockfd);
+}
+
+void stop_ws_stream(void)
+{
+    if (!s_lock) return;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (s_clients[i].used) s_clients[i].stop = true;
+    }
+    xSemaphoreGive(s_lock);
+
+    for (int i = 0; i < 30; i++) {
+        bool active = false;
+        for (int k = 0; k < WS_MAX_CLIENTS; k++) {
+            if (s_clients[k].used) active = true;
+        }
+        if (!active) break;
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_http_server.h"
+
+// /ws on the UI server: video, audio and telemetry on one WebSocket.
+// Every message is binary: a ws_msg_hdr_t followed by the payload.
+// ?video=0 / ?audio=0 on the URL opt out of a stream.
+#define WS_MAX_CLIENTS        2
+#define WS_TELEMETRY_MS       1000
+#define WS_AUDIO_RETRY_MS     500     // mic reopen interval after a reconfigure
+
+typedef enum {
+    WS_MSG_VIDEO = 1,         // JPEG frame, arg = frame sequence number
+    WS_MSG_AUDIO = 2,         // little-endian PCM, arg = sample rate
+    WS_MSG_TELEMETRY = 3,     // JSON object
+} ws_msg_type_t;
+
+// Little-endian; ts_us is the capture time on the same clock for all types
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t bits;             // PCM sample bits
+    uint16_t reserved;
+    uint32_t arg;
+    int64_t ts_us;
+} ws_msg_hdr_t;
+
+esp_err_t ws_stream_handler(httpd_req_t *req);
+// The UI server's close_fn: stops the session's client before its fd is
+// closed (and can be reused), then closes it
+void ws_stream_close_fn(httpd_handle_t hd, int sockfd);
+void stop_ws_stream(void);
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""Regenerate the test frames (needs Pillow).
+
+There are no recorded camera frames in the repository, so these are
+synthetic scenes encoded the way the OV2640 encodes: baseline JPEG, YCbCr
+4:2:2 (2x1 luma blocks per MCU), the standard Huffman tables. The scene has
+flat sky, hard edges, fine texture and sensor-like noise, so the entropy
+coded data is about as dense as a real frame's. vga_rst.jpg adds a restart
+interval (the OV3660/OV5640 emit one).
+"""
+
+import random
+import sys
+
+from PIL import Image, ImageDraw, ImageFilter
+
+FRAMES = (
+    ("vga.jpg", 640, 480, 0),
+    ("svga.jpg", 800, 600, 0),
+    ("uxga.jpg", 1600, 1200, 0),
+    ("vga_rst.jpg", 640, 480, 4),
+)
+QUALITY = 80
+
+
+def scene(w, h):
+    rnd = random.Random(w * h)
+    img = Image.new("RGB", (w, h))
+    d = ImageDraw.Draw(img)
+    # Sky gradient
+    for y in range(h // 2):
+        c = 150 + 80 * y // (h // 2)
+        d.line([(0, y), (w, y)], fill=(c // 2, c * 3 // 4, c))
+    # Ground with texture
+    d.rectangle([0, h // 2, w, h], fill=(70, 90, 50))
+    for _ in range(w * h // 200):
+        x, y = rnd.randrange(w), rnd.randrange(h // 2, h)
+        g = rnd.randrange(40, 140)
+        d.point((x, y), fill=(g // 2, g, g // 3))
+    # Buildings with windows
+    x = 0
+    while x < w:
+        bw = rnd.randrange(w // 12, w // 5)
+        bh = rnd.randrange(h // 5, h // 2)
+        top = h // 2 + h // 10 - bh
+        shade = rnd.randrange(90, 200)
+        d.rectangle([x, top, x + bw, h // 2 + h // 10], fill=(shade, shade - 20, shade - 40))
+        for wy in range(top + 6, h // 2 + h // 10 - 8, max(8, h // 40)):
+            for wx in range(x + 4, x + bw - 6, max(8, w // 60)):
+                lit = rnd.random() < 0.3
+                d.rectangle([wx, wy, wx + 4, wy + 5], fill=(240, 220, 120) if lit else (40, 50, 60))
+        x += bw + rnd.randrange(2, w // 30)
+    # A tree, blurred a little like an out-of-focus foreground
+    for _ in range(400):
+        cx = w // 5 + rnd.randrange(-w // 12, w // 12)
+        cy = h * 3 // 5 + rnd.randrange(-h // 8, h // 8)
+        r = rnd.randrange(3, 10)
+        g = rnd.randrange(60, 160)
+        d.ellipse([cx - r, cy - r, cx + r, cy + r], fill=(20, g, 30))
+    img = img.filter(ImageFilter.GaussianBlur(0.6))
+    # Sensor noise
+    noise = Image.effect_noise((w, h), 6).convert("RGB")
+    return Image.blend(img, noise, 0.06)
+
+
+def main(out_dir):
+    for name, w, h, restart in FRAMES:
+        opts = {"quality": QUALITY, "subsampling": 1, "optimize": False}
+        if restart:
+            opts["restart_marker_rows"] = restart
+        scene(w, h).save("%s/%s" % (out_dir, name), "JPEG", **opts)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1] if len(sys.argv) > 1 else ".")
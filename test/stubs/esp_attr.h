@@ -0,0 +1,4 @@
+#pragma once
+
+// Host build: no IRAM, the attribute does nothing
+#define IRAM_ATTR
@@ -0,0 +1,474 @@
+// audio_codec.c on synthetic signals: the IMA ADPCM encoder's blocks must
+// decode with a reference decoder to the signal within a minimum SNR, in
+// the WAV 0x11 block layout; the G.711 encoders must give the reference
+// coder's byte for every 16-bit input; the resampler must keep a tone
+// clean (THD+N), flat in the passband and reject what would alias.
+//   test_audio_codec           correctness
+//   test_audio_codec --bench   timing
+#include "audio_codec.h"
+#include "http_audio_stream.h"
+#include "test.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define BENCH_MIN_US  300000          // run each benchmark at least this long
+#define SIGNAL_S      2               // seconds of each test signal
+
+static const int s_rates[] = { 8000, 11025, 16000, 22050, 44100 };
+#define RATE_COUNT (sizeof(s_rates) / sizeof(s_rates[0]))
+
+// ---------- Test signals ----------
+
+typedef enum { SIG_TONE_1K, SIG_TONE_LOUD, SIG_SWEEP, SIG_NOISE, SIG_SQUARE, SIG_COUNT } signal_t;
+
+static const char *s_signal_names[SIG_COUNT] = {
+    "1 kHz -12 dBFS", "1 kHz -0.5 dBFS", "sweep 100 Hz..Nyquist", "noise -20 dBFS", "square full scale",
+};
+
+static int16_t *make_signal(signal_t sig, int rate, int samples)
+{
+    int16_t *pcm = (int16_t *)malloc(samples * sizeof(int16_t));
+    uint32_t seed = 12345;
+    double phase = 0;
+    for (int i = 0; i < samples; i++) {
+        double v = 0;
+        switch (sig) {
+        case SIG_TONE_1K:   v = 8192 * sin(2 * M_PI * 1000 * i / rate); break;
+        case SIG_TONE_LOUD: v = 30900 * sin(2 * M_PI * 1000 * i / rate); break;
+        case SIG_SWEEP: {
+            // Exponential sweep, 100 Hz up to just below Nyquist
+            double f = 100 * pow(0.45 * rate / 100, (double)i / samples);
+            phase += 2 * M_PI * f / rate;
+            v = 16384 * sin(phase);
+            break;
+        }
+        case SIG_NOISE:
+            seed = seed * 1664525 + 1013904223;
+            v = (int16_t)(seed >> 16) / 10.0;
+            break;
+        case SIG_SQUARE:    v = (i / (rate / 200)) & 1 ? 32767 : -32768; break;
+        default: break;
+        }
+        pcm[i] = (int16_t)lrint(v);
+    }
+    return pcm;
+}
+
+// ---------- Reference decoder ----------
+
+// IMA ADPCM as the IMA/Microsoft specification gives it, written
+// independently of the encoder
+static const int s_ref_step[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767,
+};
+
+static const int s_ref_index[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+static int ref_decode_nibble(int *pred, int *index, int code)
+{
+    int step = s_ref_step[*index];
+    int diff = step >> 3;
+    if (code & 1) diff += step >> 2;
+    if (code & 2) diff += step >> 1;
+    if (code & 4) diff += step;
+    *pred += code & 8 ? -diff : diff;
+    if (*pred > 32767) *pred = 32767;
+    if (*pred < -32768) *pred = -32768;
+    *index += s_ref_index[code];
+    if (*index < 0) *index = 0;
+    if (*index > 88) *index = 88;
+    return *pred;
+}
+
+// One block of align bytes into ADPCM_BLOCK_SAMPLES(align) samples; pred
+// and index are left where the block ends
+static void ref_decode_block(const uint8_t *in, int align, int16_t *out, int *pred, int *index)
+{
+    *pred = (int16_t)(in[0] | in[1] << 8);
+    *index = in[2];
+    *out++ = (int16_t)*pred;
+    for (int i = 4; i < align; i++) {
+        *out++ = (int16_t)ref_decode_nibble(pred, index, in[i] & 0x0F);
+        *out++ = (int16_t)ref_decode_nibble(pred, index, in[i] >> 4);
+    }
+}
+
+// ---------- Tests ----------
+
+static double snr_db(const int16_t *ref, const int16_t *dec, int samples)
+{
+    double sig = 0, err = 0;
+    for (int i = 0; i < samples; i++) {
+        double e = (double)dec[i] - ref[i];
+        sig += (double)ref[i] * ref[i];
+        err += e * e;
+    }
+    return err ? 10 * log10(sig / err) : 200;
+}
+
+// Minimum SNR per signal, a few dB under what the encoder reaches at
+// 8 kHz (its worst rate). The square wave's edges are slew limited (the
+// step takes a few samples to reach full scale); a predictor that wraps
+// instead of clamping would take it below 0 dB.
+static const double s_min_snr[SIG_COUNT] = { 18, 18, 18, 14, 4 };
+
+static void test_adpcm(signal_t sig, int rate)
+{
+    int align = ADPCM_BLOCK_ALIGN(rate);
+    int per_block = ADPCM_BLOCK_SAMPLES(align);
+    int blocks = SIGNAL_S * rate / per_block;
+    int samples = blocks * per_block;
+    int16_t *pcm = make_signal(sig, rate, samples);
+    int16_t *dec = (int16_t *)malloc(samples * sizeof(int16_t));
+    uint8_t *block = (uint8_t *)malloc(align);
+
+    adpcm_state_t st = { 0 };
+    bool layout_ok = true, tracks = true;
+    for (int b = 0; b < blocks; b++) {
+        const int16_t *in = pcm + b * per_block;
+        int index_in = st.index;
+        memset(block, 0xA5, align);
+        adpcm_encode_block(&st, in, align, block);
+
+        // Header: first sample exact (little-endian), the step index the
+        // previous block ended with, a zero reserved byte
+        if ((int16_t)(block[0] | block[1] << 8) != in[0] || block[2] != index_in || block[3] != 0) {
+            if (layout_ok) {
+                CHECK(false, "%s at %d Hz, block %d: header %02x %02x %02x %02x, first sample %d, index %d",
+                      s_signal_names[sig], rate, b, block[0], block[1], block[2], block[3], in[0], index_in);
+            }
+            layout_ok = false;
+        }
+
+        // The encoder must end where a decoder ends, or the next block's
+        // index is wrong for it
+        int pred, index;
+        ref_decode_block(block, align, dec + b * per_block, &pred, &index);
+        if (pred != st.pred || index != st.index) {
+            if (tracks) {
+                CHECK(false, "%s at %d Hz, block %d: decoder ends at %d/%d, encoder at %d/%d",
+                      s_signal_names[sig], rate, b, pred, index, st.pred, st.index);
+            }
+            tracks = false;
+        }
+    }
+
+    double snr = snr_db(pcm, dec, samples);
+    CHECK(snr >= s_min_snr[sig], "%s at %d Hz: SNR %.1f dB, want >= %.0f",
+          s_signal_names[sig], rate, snr, s_min_snr[sig]);
+    printf("ADPCM %-22s %5d Hz  %4d-byte blocks of %4d samples  SNR %5.1f dB\n",
+           s_signal_names[sig], rate, align, per_block, snr);
+    free(block);
+    free(dec);
+    free(pcm);
+}
+
+// The block sizes WAV readers expect (256 bytes / 505 samples at 8 and
+// 11 kHz, 1024 / 2041 at 44.1 kHz)
+static void test_adpcm_align(void)
+{
+    CHECK(ADPCM_BLOCK_ALIGN(8000) == 256, "%d", ADPCM_BLOCK_ALIGN(8000));
+    CHECK(ADPCM_BLOCK_ALIGN(11025) == 256, "%d", ADPCM_BLOCK_ALIGN(11025));
+    CHECK(ADPCM_BLOCK_ALIGN(22050) == 512, "%d", ADPCM_BLOCK_ALIGN(22050));
+    CHECK(ADPCM_BLOCK_ALIGN(44100) == 1024, "%d", ADPCM_BLOCK_ALIGN(44100));
+    CHECK(ADPCM_BLOCK_SAMPLES(256) == 505, "%d", ADPCM_BLOCK_SAMPLES(256));
+    CHECK(ADPCM_BLOCK_SAMPLES(1024) == 2041, "%d", ADPCM_BLOCK_SAMPLES(1024));
+}
+
+// ---------- G.711 ----------
+
+// The Sun reference coder (g711.c, as in audioop and SoX): the segment by
+// searching the segment end points, not by a table
+static const int s_ref_uend[8] = { 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF };
+static const int s_ref_aend[8] = { 0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF };
+
+static int ref_segment(int v, const int *end)
+{
+    int seg = 0;
+    while (seg < 8 && v > end[seg]) seg++;
+    return seg;
+}
+
+static uint8_t ref_ulaw(int16_t pcm)
+{
+    int v = pcm >> 2, mask = 0xFF;
+    if (v < 0) {
+        v = -v;
+        mask = 0x7F;
+    }
+    if (v > 8159) v = 8159;                    // CLIP
+    v += 0x84 >> 2;                            // BIAS
+    int seg = ref_segment(v, s_ref_uend);
+    if (seg >= 8) return 0x7F ^ mask;
+    return ((seg << 4) | ((v >> (seg + 1)) & 0x0F)) ^ mask;
+}
+
+static uint8_t ref_alaw(int16_t pcm)
+{
+    int v = pcm >> 3, mask = 0xD5;
+    if (v < 0) {
+        v = -v - 1;
+        mask = 0x55;
+    }
+    int seg = ref_segment(v, s_ref_aend);
+    if (seg >= 8) return 0x7F ^ mask;
+    int mant = (seg < 2 ? v >> 1 : v >> seg) & 0x0F;
+    return ((seg << 4) | mant) ^ mask;
+}
+
+// Every int16 value, one at a time and as blocks
+static void test_g711(void)
+{
+    static int16_t pcm[65536];
+    static uint8_t ulaw[65536 + 1], alaw[65536 + 1];
+    int ubad = 0, abad = 0;
+    for (int i = 0; i < 65536; i++) {
+        int16_t s = (int16_t)(i - 32768);
+        pcm[i] = s;
+        if (g711_ulaw_encode(s) != ref_ulaw(s) && ubad++ == 0) {
+            CHECK(false, "u-law %d: 0x%02X, reference 0x%02X", s, g711_ulaw_encode(s), ref_ulaw(s));
+        }
+        if (g711_alaw_encode(s) != ref_alaw(s) && abad++ == 0) {
+            CHECK(false, "A-law %d: 0x%02X, reference 0x%02X", s, g711_alaw_encode(s), ref_alaw(s));
+        }
+    }
+    printf("G.711 u-law  %s\n", ubad ? "MISMATCH" : "matches the reference for all 65536 inputs");
+    printf("G.711 A-law  %s\n", abad ? "MISMATCH" : "matches the reference for all 65536 inputs");
+
+    // Whole range in one block, then a short odd one that must stop at its end
+    memset(ulaw, 0xA5, sizeof(ulaw));
+    memset(alaw, 0xA5, sizeof(alaw));
+    g711_ulaw_encode_block(pcm, 65536, ulaw);
+    g711_alaw_encode_block(pcm, 65536, alaw);
+    int diff = 0;
+    for (int i = 0; i < 65536; i++) diff += ulaw[i] != ref_ulaw(pcm[i]) || alaw[i] != ref_alaw(pcm[i]);
+    CHECK(!diff && ulaw[65536] == 0xA5 && alaw[65536] == 0xA5, "block: %d samples differ", diff);
+    memset(ulaw, 0xA5, 8);
+    memset(alaw, 0xA5, 8);
+    g711_ulaw_encode_block(pcm + 100, 7, ulaw);
+    g711_alaw_encode_block(pcm + 100, 7, alaw);
+    diff = 0;
+    for (int i = 0; i < 7; i++) diff += ulaw[i] != ref_ulaw(pcm[100 + i]) || alaw[i] != ref_alaw(pcm[100 + i]);
+    CHECK(!diff && ulaw[7] == 0xA5 && alaw[7] == 0xA5, "7-sample block: %d samples differ", diff);
+}
+
+// ---------- Resampler ----------
+
+// The mic's blocks as the readers pass them: one DMA block of 32-bit
+// samples, converted to 16 bits
+#define RESAMPLE_BLOCK  (DMA_BUF_LEN / 4)
+
+static int16_t *make_tone(double hz, double amp, int samples)
+{
+    int16_t *pcm = (int16_t *)malloc(samples * sizeof(int16_t));
+    for (int i = 0; i < samples; i++) pcm[i] = (int16_t)lrint(amp * sin(2 * M_PI * hz * i / SAMPLE_RATE));
+    return pcm;
+}
+
+// Resample in mic-sized blocks; returns the output count
+static int resample_blocks(int out_rate, const int16_t *in, int samples, int16_t *out)
+{
+    audio_resampler_t r;
+    if (!audio_resampler_init(&r, SAMPLE_RATE, out_rate)) return -1;
+    int n = 0;
+    for (int i = 0; i < samples; i += RESAMPLE_BLOCK) {
+        int len = samples - i < RESAMPLE_BLOCK ? samples - i : RESAMPLE_BLOCK;
+        n += audio_resample(&r, in + i, len, out + n);
+    }
+    audio_resampler_free(&r);
+    return n;
+}
+
+// Least-squares fit of a sine at hz (and DC) to x; returns the residual's
+// power relative to the whole signal, in dB, and the fitted amplitude
+static double thd_n_db(const int16_t *x, int n, double hz, int rate, double *amp)
+{
+    // Normal equations for [cos, sin, 1]
+    double a[3][4] = { { 0 } };
+    for (int i = 0; i < n; i++) {
+        double b[3] = { cos(2 * M_PI * hz * i / rate), sin(2 * M_PI * hz * i / rate), 1 };
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) a[r][c] += b[r] * b[c];
+            a[r][3] += b[r] * x[i];
+        }
+    }
+    for (int p = 0; p < 3; p++) {
+        for (int r = 0; r < 3; r++) {
+            if (r == p) continue;
+            double f = a[r][p] / a[p][p];
+            for (int c = 0; c < 4; c++) a[r][c] -= f * a[p][c];
+        }
+    }
+    double k[3] = { a[0][3] / a[0][0], a[1][3] / a[1][1], a[2][3] / a[2][2] };
+    double total = 0, resid = 0;
+    for (int i = 0; i < n; i++) {
+        double fit = k[0] * cos(2 * M_PI * hz * i / rate) + k[1] * sin(2 * M_PI * hz * i / rate) + k[2];
+        total += (double)x[i] * x[i];
+        resid += (x[i] - fit) * (x[i] - fit);
+    }
+    *amp = sqrt(k[0] * k[0] + k[1] * k[1]);
+    return 10 * log10(resid / total);
+}
+
+#define THD_N_MAX_DB     -70          // 1 kHz at -6 dBFS, every output rate
+#define PASSBAND_DB      0.1          // gain error allowed at 300 Hz and 0.6 x Nyquist
+#define STOPBAND_DB      -50          // an input tone at 1.2 x the output Nyquist
+
+static void test_resample(int out_rate)
+{
+    if (out_rate == SAMPLE_RATE) return;
+    int samples = SIGNAL_S * SAMPLE_RATE;
+    int16_t *out = (int16_t *)malloc(samples * sizeof(int16_t));
+    // Skip the filter's start-up (history of zeros)
+    int skip = out_rate / 50;
+
+    // Output count follows the rate ratio (the first output is at input 0)
+    int16_t *tone = make_tone(1000, 16384, samples);
+    int n = resample_blocks(out_rate, tone, samples, out);
+    int want = (int)((int64_t)samples * out_rate / SAMPLE_RATE);
+    CHECK(abs(n - want) <= 1, "%d -> %d Hz: %d outputs for %d inputs, want about %d",
+          SAMPLE_RATE, out_rate, n, samples, want);
+
+    double amp;
+    double thd_n = thd_n_db(out + skip, n - skip, 1000, out_rate, &amp);
+    CHECK(thd_n <= THD_N_MAX_DB, "%d -> %d Hz: THD+N %.1f dB, want <= %d",
+          SAMPLE_RATE, out_rate, thd_n, THD_N_MAX_DB);
+
+    // Chunking doesn't change a sample: one call with everything, or
+    // blocks of any size, give the same output
+    audio_resampler_t r;
+    int16_t *whole = (int16_t *)malloc(samples * sizeof(int16_t));
+    int m = 0;
+    if (audio_resampler_init(&r, SAMPLE_RATE, out_rate)) {
+        for (int i = 0, len = 1; i < samples; i += len, len = len * 7 % 1000 + 1) {
+            if (len > samples - i) len = samples - i;
+            m += audio_resample(&r, tone + i, len, whole + m);
+        }
+        audio_resampler_free(&r);
+    }
+    CHECK(m == n && !memcmp(whole, out, n * sizeof(int16_t)),
+          "%d -> %d Hz: odd-sized chunks give different output (%d vs %d samples)",
+          SAMPLE_RATE, out_rate, m, n);
+    free(whole);
+    free(tone);
+
+    // Passband: a low tone and one near the passband edge keep their level
+    double gain_lo, gain_hi;
+    double hi_hz = 0.3 * out_rate;
+    tone = make_tone(300, 16384, samples);
+    n = resample_blocks(out_rate, tone, samples, out);
+    thd_n_db(out + skip, n - skip, 300, out_rate, &amp);
+    gain_lo = 20 * log10(amp / 16384);
+    free(tone);
+    tone = make_tone(hi_hz, 16384, samples);
+    n = resample_blocks(out_rate, tone, samples, out);
+    thd_n_db(out + skip, n - skip, hi_hz, out_rate, &amp);
+    gain_hi = 20 * log10(amp / 16384);
+    free(tone);
+    CHECK(fabs(gain_lo) <= PASSBAND_DB && fabs(gain_hi) <= PASSBAND_DB,
+          "%d -> %d Hz: passband gain %.2f dB at 300 Hz, %.2f dB at %.0f Hz",
+          SAMPLE_RATE, out_rate, gain_lo, gain_hi, hi_hz);
+
+    // Stopband: a tone above the output Nyquist must not alias in
+    double alias_hz = 0.6 * out_rate;
+    tone = make_tone(alias_hz, 16384, samples);
+    n = resample_blocks(out_rate, tone, samples, out);
+    double power = 0;
+    for (int i = skip; i < n; i++) power += (double)out[i] * out[i];
+    double alias_db = 10 * log10(power / (n - skip) / (16384.0 * 16384 / 2) + 1e-20);
+    CHECK(alias_db <= STOPBAND_DB, "%d -> %d Hz: %.0f Hz comes through at %.1f dB, want <= %d",
+          SAMPLE_RATE, out_rate, alias_hz, alias_db, STOPBAND_DB);
+    free(tone);
+
+    printf("resample %5d -> %5d Hz  THD+N %6.1f dB  passband %+5.2f/%+5.2f dB  alias %6.1f dB\n",
+           SAMPLE_RATE, out_rate, thd_n, gain_lo, gain_hi, alias_db);
+    free(out);
+}
+
+// Every rate a reader may ask for has a table; equal rates pass through
+static void test_resample_rates(void)
+{
+    for (size_t i = 0; i < RATE_COUNT; i++) {
+        audio_resampler_t r;
+        CHECK(AUDIO_RATE_VALID(s_rates[i]), "%d", s_rates[i]);
+        CHECK(audio_resampler_init(&r, SAMPLE_RATE, s_rates[i]), "no table for %d -> %d Hz",
+              SAMPLE_RATE, s_rates[i]);
+        audio_resampler_free(&r);
+    }
+    int16_t in[64], out[64];
+    for (int i = 0; i < 64; i++) in[i] = (int16_t)(i * 1000 - 32000);
+    CHECK(resample_blocks(SAMPLE_RATE, in, 64, out) == 64 && !memcmp(in, out, sizeof(in)),
+          "%d Hz to itself isn't a copy", SAMPLE_RATE);
+}
+
+// ---------- Benchmarks ----------
+
+static void bench_adpcm(int rate)
+{
+    int align = ADPCM_BLOCK_ALIGN(rate);
+    int per_block = ADPCM_BLOCK_SAMPLES(align);
+    int blocks = rate / per_block;
+    int16_t *pcm = make_signal(SIG_SWEEP, rate, blocks * per_block);
+    uint8_t *out = (uint8_t *)malloc(align);
+    adpcm_state_t st = { 0 };
+
+    long runs = 0;
+    int64_t t0 = test_now_us(), t;
+    do {
+        for (int b = 0; b < blocks; b++) adpcm_encode_block(&st, pcm + b * per_block, align, out);
+        runs++;
+        t = test_now_us() - t0;
+    } while (t < BENCH_MIN_US);
+    double ns = t * 1000.0 / ((double)runs * blocks * per_block);
+    printf("ADPCM encode %5d Hz  %6.2f ns/sample  %6.1f Msamples/s\n", rate, ns, 1000 / ns);
+    free(out);
+    free(pcm);
+}
+
+// Per second of mic audio: how long resampling it takes, and the cost
+// per output sample
+static void bench_resample(int out_rate)
+{
+    if (out_rate == SAMPLE_RATE) return;
+    int16_t *in = make_signal(SIG_SWEEP, SAMPLE_RATE, SAMPLE_RATE);
+    int16_t *out = (int16_t *)malloc(SAMPLE_RATE * sizeof(int16_t));
+    long runs = 0, outputs = 0;
+    int64_t t0 = test_now_us(), t;
+    do {
+        outputs += resample_blocks(out_rate, in, SAMPLE_RATE, out);
+        runs++;
+        t = test_now_us() - t0;
+    } while (t < BENCH_MIN_US);
+    double us = (double)t / runs;
+    printf("resample %5d -> %5d Hz  %7.3f ms per second of audio  %6.1f ns/output sample\n",
+           SAMPLE_RATE, out_rate, us / 1000, t * 1000.0 / outputs);
+    free(out);
+    free(in);
+}
+
+int main(int argc, char **argv)
+{
+    bool run_bench = argc > 1 && !strcmp(argv[1], "--bench");
+    if (run_bench) {
+        for (size_t r = 0; r < RATE_COUNT; r++) bench_adpcm(s_rates[r]);
+        for (size_t r = 0; r < RATE_COUNT; r++) bench_resample(s_rates[r]);
+    } else {
+        test_adpcm_align();
+        test_g711();
+        for (int s = 0; s < SIG_COUNT; s++) {
+            for (size_t r = 0; r < RATE_COUNT; r++) test_adpcm((signal_t)s, s_rates[r]);
+        }
+        test_resample_rates();
+        for (size_t r = 0; r < RATE_COUNT; r++) test_resample(s_rates[r]);
+    }
+    printf(test_failures ? "%d check(s) failed\n" : "OK\n", test_failures);
+    return test_failures != 0;
+}
@@ -0,0 +1,672 @@
+// jpeg_dct.c and overlay_blocks.c on the test frames (frames/, see
+// gen_frames.py): decoding and re-encoding must not change a coefficient,
+// and the benchmarks report what each pipeline stage costs per frame.
+//   test_jpeg_dct <frames dir>           correctness
+//   test_jpeg_dct --bench <frames dir>   timing
+#include "jpeg_dct.h"
+#include "overlay_blocks.h"
+#include "test.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define BENCH_MIN_US  300000          // run each benchmark at least this long
+
+typedef struct {
+    const char *name;
+    uint8_t *buf;
+    size_t len;
+    uint8_t *out;                     // scratch for re-encoded frames
+    size_t out_size;
+} frame_t;
+
+static const char *s_frame_names[] = { "vga.jpg", "svga.jpg", "uxga.jpg", "vga_rst.jpg" };
+#define FRAME_COUNT (sizeof(s_frame_names) / sizeof(s_frame_names[0]))
+
+typedef int16_t block_t[64];
+
+// Every MCU's coefficients, in order; NULL if the frame doesn't decode
+static block_t *decode_all(jpeg_dct_t *d, const uint8_t *buf, size_t len, jpeg_dct_info_t *info)
+{
+    if (!jpeg_dct_begin(d, buf, len)) return NULL;
+    *info = *jpeg_dct_info(d);
+    size_t mcus = (size_t)info->mcus_x * info->mcus_y;
+    block_t *coef = (block_t *)malloc(mcus * info->blocks * sizeof(block_t));
+    if (!coef) return NULL;
+    for (size_t m = 0; m < mcus; m++) {
+        if (!jpeg_dct_read_mcu(d, coef + m * info->blocks, false)) {
+            free(coef);
+            return NULL;
+        }
+    }
+    return coef;
+}
+
+// ---------- Re-encoding ----------
+
+// Decode and re-encode with quantizers scaled by factor (1 = unchanged),
+// as video_scale.c's requant_frame() does
+static size_t reencode(jpeg_dct_t *d, const frame_t *f, int factor)
+{
+    if (!jpeg_dct_begin(d, f->buf, f->len)) return 0;
+    const jpeg_dct_info_t *info = jpeg_dct_info(d);
+    uint8_t qt[4][64];
+    jpeg_dct_scale_qt(info, factor, qt);
+    jpeg_dct_write_begin(d, f->out, f->out_size, factor == 1 ? NULL : (const uint8_t (*)[64])qt);
+
+    int16_t blocks[JPEG_DCT_MAX_BLOCKS][64];
+    uint32_t mcus = (uint32_t)info->mcus_x * info->mcus_y;
+    for (uint32_t m = 0; m < mcus; m++) {
+        if (!jpeg_dct_read_mcu(d, blocks, false)) return 0;
+        if (factor != 1) {
+            for (int i = 0; i < info->blocks; i++) {
+                int tq = info->comp[info->block_comp[i]].tq;
+                jpeg_dct_requant(blocks[i], info->qt[tq], qt[tq]);
+            }
+        }
+        jpeg_dct_write_mcu(d, (const int16_t (*)[64])blocks);
+    }
+    return jpeg_dct_write_end(d);
+}
+
+// read_mcu -> write_mcu with the source's quantizers gives back every
+// coefficient exactly (the Huffman tables may differ, the values may not)
+static void test_roundtrip(jpeg_dct_t *d, const frame_t *f)
+{
+    jpeg_dct_info_t in, out;
+    block_t *a = decode_all(d, f->buf, f->len, &in);
+    CHECK(a != NULL, "%s: decode", f->name);
+    if (!a) return;
+    CHECK(in.ncomp == 3 && in.comp[0].h == 2 && in.comp[0].v == 1 && in.blocks == 4,
+          "%s: expected YCbCr 4:2:2, got %d comps, %d blocks", f->name, in.ncomp, in.blocks);
+
+    size_t len = reencode(d, f, 1);
+    CHECK(len > 0, "%s: re-encode", f->name);
+    block_t *b = len ? decode_all(d, f->out, len, &out) : NULL;
+    CHECK(b != NULL, "%s: decode the re-encoded frame", f->name);
+    if (b) {
+        CHECK(out.width == in.width && out.height == in.height && out.blocks == in.blocks,
+              "%s: frame header changed", f->name);
+        CHECK(!memcmp(out.qt, in.qt, sizeof(in.qt)), "%s: quantization tables changed", f->name);
+        size_t n = (size_t)in.mcus_x * in.mcus_y * in.blocks;
+        size_t diff = 0;
+        for (size_t i = 0; i < n; i++) diff += memcmp(a[i], b[i], sizeof(block_t)) != 0;
+        CHECK(diff == 0, "%s: %zu of %zu blocks differ", f->name, diff, n);
+    }
+    free(a);
+    free(b);
+}
+
+// Requantized frames hold exactly the requantized coefficients and the
+// coarser tables, and are smaller
+static void test_requant(jpeg_dct_t *d, const frame_t *f)
+{
+    jpeg_dct_info_t in, out;
+    block_t *a = decode_all(d, f->buf, f->len, &in);
+    if (!a) return;
+    for (int factor = 2; factor <= 4; factor *= 2) {
+        uint8_t qt[4][64];
+        jpeg_dct_scale_qt(&in, factor, qt);
+        size_t len = reencode(d, f, factor);
+        CHECK(len > 0 && len < f->len, "%s: x%d: %zu bytes from %zu", f->name, factor, len, f->len);
+        block_t *b = len ? decode_all(d, f->out, len, &out) : NULL;
+        CHECK(b != NULL, "%s: x%d: decode", f->name, factor);
+        if (!b) continue;
+        for (int c = 0; c < in.ncomp; c++) {
+            int tq = in.comp[c].tq;
+            CHECK(!memcmp(out.qt[tq], qt[tq], 64), "%s: x%d: quantization table %d", f->name, factor, tq);
+        }
+        size_t n = (size_t)in.mcus_x * in.mcus_y * in.blocks;
+        size_t diff = 0;
+        for (size_t i = 0; i < n; i++) {
+            int tq = in.comp[in.block_comp[i % in.blocks]].tq;
+            block_t want;
+            memcpy(want, a[i], sizeof(want));
+            jpeg_dct_requant(want, in.qt[tq], qt[tq]);
+            diff += memcmp(want, b[i], sizeof(block_t)) != 0;
+        }
+        CHECK(diff == 0, "%s: x%d: %zu of %zu blocks differ", f->name, factor, diff, n);
+        free(b);
+    }
+    free(a);
+}
+
+// jpeg_dct_requant() against the arithmetic: every coefficient value for
+// a range of step pairs lands on the nearest multiple of the new step
+// (halves away from zero), and jpeg_dct_scale_qt() clamps to 1..255
+static void test_requant_rounding(void)
+{
+    static const uint8_t steps[][2] = { { 1, 2 }, { 3, 8 }, { 10, 20 }, { 7, 28 }, { 16, 16 }, { 99, 198 }, { 255, 255 } };
+    size_t bad = 0;
+    for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+        uint8_t from[64], to[64];
+        memset(from, steps[s][0], 64);
+        memset(to, steps[s][1], 64);
+        for (int v = -1024; v < 1024; v += 64) {
+            int16_t coef[64];
+            for (int k = 0; k < 64; k++) coef[k] = (int16_t)(v + k);
+            jpeg_dct_requant(coef, from, to);
+            for (int k = 0; k < 64; k++) {
+                double exact = (double)(v + k) * from[k] / to[k];
+                double want = exact < 0 ? -floor(-exact + 0.5) : floor(exact + 0.5);
+                bad += coef[k] != (int16_t)want;
+            }
+        }
+    }
+    CHECK(bad == 0, "%zu requantized coefficients not rounded to nearest", bad);
+
+    int16_t c[64] = { 5, -5, 7, -7, 1, -1, 0 };
+    uint8_t from[64], to[64];
+    memset(from, 10, 64);
+    memset(to, 20, 64);
+    jpeg_dct_requant(c, from, to);
+    CHECK(c[0] == 3 && c[1] == -3 && c[2] == 4 && c[3] == -4 && c[4] == 1 && c[5] == -1 && c[6] == 0,
+          "2.5 -> %d, -2.5 -> %d, 3.5 -> %d, -3.5 -> %d, 0.5 -> %d, -0.5 -> %d, 0 -> %d",
+          c[0], c[1], c[2], c[3], c[4], c[5], c[6]);
+
+    jpeg_dct_info_t info;
+    memset(&info, 0, sizeof(info));
+    info.qt[0][0] = 1;
+    info.qt[0][1] = 100;
+    info.qt[0][2] = 200;
+    uint8_t qt[4][64];
+    jpeg_dct_scale_qt(&info, 2, qt);
+    CHECK(qt[0][0] == 2 && qt[0][1] == 200 && qt[0][2] == 255 && qt[0][3] == 1,
+          "scaled steps %d %d %d %d", qt[0][0], qt[0][1], qt[0][2], qt[0][3]);
+}
+
+// ---------- Analysis ----------
+
+// The DC-only pass the motion/exposure analyzer runs gives the same DC
+// values as a full decode, and walks the whole scan
+static void test_dc_only(jpeg_dct_t *d, const frame_t *f)
+{
+    jpeg_dct_info_t in;
+    block_t *a = decode_all(d, f->buf, f->len, &in);
+    if (!a) return;
+    CHECK(jpeg_dct_begin(d, f->buf, f->len), "%s: begin", f->name);
+    int16_t blocks[JPEG_DCT_MAX_BLOCKS][64];
+    size_t mcus = (size_t)in.mcus_x * in.mcus_y;
+    size_t diff = 0;
+    for (size_t m = 0; m < mcus; m++) {
+        if (!jpeg_dct_read_mcu(d, blocks, true)) {
+            CHECK(false, "%s: DC-only read failed at MCU %zu", f->name, m);
+            break;
+        }
+        for (int i = 0; i < in.blocks; i++) diff += blocks[i][0] != a[m * in.blocks + i][0];
+    }
+    CHECK(diff == 0, "%s: %zu DC values differ from the full decode", f->name, diff);
+    free(a);
+}
+
+// ---------- Bitstream edits ----------
+
+// Mask rectangles (overlay_blocks.c) cover at least the mask's pixels,
+// start and end within an MCU of them, stay inside the frame, and leave
+// empty masks out
+static void test_mask_rects(const frame_t *f, const jpeg_dct_info_t *info)
+{
+    static const video_mask_t masks[] = {
+        { 0, 0, 100, 100 }, { 1, 1, 1, 1 }, { 33, 47, 21, 9 }, { 90, 95, 50, 50 }, { 20, 20, 0, 10 },
+    };
+    int count = sizeof(masks) / sizeof(masks[0]);
+    video_mcu_rect_t rects[sizeof(masks) / sizeof(masks[0])];
+    int n = overlay_mask_rects(info, masks, count, rects);
+    CHECK(n == count - 1, "%s: %d of %d masks kept", f->name, n, count);
+    for (int i = 0; i < n && i < count - 1; i++) {
+        const video_mask_t *m = &masks[i];
+        const video_mcu_rect_t *r = &rects[i];
+        int x0 = m->x * info->width / 100, x1 = (m->x + m->w) * info->width / 100;
+        int y0 = m->y * info->height / 100, y1 = (m->y + m->h) * info->height / 100;
+        if (x1 > info->width) x1 = info->width;
+        if (y1 > info->height) y1 = info->height;
+        bool covers = r->x0 * info->mcu_w <= x0 && r->x1 * info->mcu_w >= x1 &&
+                      r->y0 * info->mcu_h <= y0 && r->y1 * info->mcu_h >= y1;
+        bool tight = x0 - r->x0 * info->mcu_w < info->mcu_w && r->x1 * info->mcu_w - x1 < info->mcu_w &&
+                     y0 - r->y0 * info->mcu_h < info->mcu_h && r->y1 * info->mcu_h - y1 < info->mcu_h;
+        CHECK(covers && tight && r->x1 <= info->mcus_x && r->y1 <= info->mcus_y,
+              "%s: mask %d,%d %dx%d -> MCUs [%d,%d) x [%d,%d)", f->name, m->x, m->y, m->w, m->h,
+              r->x0, r->x1, r->y0, r->y1);
+    }
+    // Past the edge (not clamped by video_mask_set): ends at the last MCU
+    CHECK(n >= 4 && rects[3].x1 == info->mcus_x && rects[3].y1 == info->mcus_y,
+          "%s: mask past the edge not clamped", f->name);
+
+    int16_t flat[JPEG_DCT_MAX_BLOCKS][64];
+    overlay_flat_block(info, flat);
+    int wrong = 0;
+    for (int i = 0; i < info->blocks; i++) {
+        int step = info->qt[info->comp[info->block_comp[i]].tq][0];
+        int dc = info->block_comp[i] == 0 ? -1024 / step : 0;
+        wrong += flat[i][0] != dc;
+        for (int k = 1; k < 64; k++) wrong += flat[i][k] != 0;
+    }
+    CHECK(!wrong, "%s: flat block: %d coefficients not black", f->name, wrong);
+}
+
+// Edit mode with masks (none: copy_rest right away), as video_overlay.c
+// applies them: MCUs in a rectangle become flat black, the rest are copied
+// bit for bit; 0 if it fails
+static size_t edit_masks(jpeg_dct_t *d, const frame_t *f, const video_mcu_rect_t *rects, int count)
+{
+    if (!jpeg_dct_begin(d, f->buf, f->len)) return 0;
+    const jpeg_dct_info_t *info = jpeg_dct_info(d);
+    int16_t flat[JPEG_DCT_MAX_BLOCKS][64], blocks[JPEG_DCT_MAX_BLOCKS][64];
+    overlay_flat_block(info, flat);
+
+    int32_t last = -1;
+    for (int i = 0; i < count; i++) {
+        int32_t end = (rects[i].y1 - 1) * info->mcus_x + rects[i].x1 - 1;
+        if (end > last) last = end;
+    }
+    jpeg_dct_edit_begin(d, f->out, f->out_size);
+    int32_t m = 0;
+    for (int my = 0; my < info->mcus_y && m <= last; my++) {
+        for (int mx = 0; mx < info->mcus_x && m <= last; mx++, m++) {
+            if (!jpeg_dct_read_mcu(d, blocks, false)) return 0;
+            bool masked = false;
+            for (int i = 0; i < count && !masked; i++) {
+                masked = mx >= rects[i].x0 && mx < rects[i].x1 && my >= rects[i].y0 && my < rects[i].y1;
+            }
+            if (masked) {
+                jpeg_dct_write_mcu(d, flat);
+            } else {
+                jpeg_dct_copy_mcu(d, blocks);
+            }
+        }
+    }
+    if (!jpeg_dct_copy_rest(d, blocks)) return 0;
+    return jpeg_dct_write_end(d);
+}
+
+// Two masks: a window near the top and a strip that ends mid-frame, so
+// copy_rest takes over partway through a row (and, on vga_rst.jpg, partway
+// through a restart interval)
+static int test_masks(const jpeg_dct_info_t *info, video_mcu_rect_t *rects)
+{
+    static const video_mask_t masks[] = { { 60, 10, 20, 25 }, { 5, 40, 30, 15 } };
+    return overlay_mask_rects(info, masks, 2, rects);
+}
+
+// Edit mode without edits, and with masks: the masked MCUs decode to the
+// flat block, every other coefficient is the source's
+static void test_edit(jpeg_dct_t *d, const frame_t *f)
+{
+    jpeg_dct_info_t in, out;
+    block_t *a = decode_all(d, f->buf, f->len, &in);
+    if (!a) return;
+    size_t n = (size_t)in.mcus_x * in.mcus_y * in.blocks;
+
+    // Nothing edited: copy_rest copies the scan bit for bit
+    size_t len = edit_masks(d, f, NULL, 0);
+    CHECK(len == f->len && !memcmp(f->out, f->buf, len), "%s: edit without changes: %zu bytes from %zu",
+          f->name, len, f->len);
+    block_t *b = len ? decode_all(d, f->out, len, &out) : NULL;
+    CHECK(b != NULL, "%s: decode the copy", f->name);
+    if (b) {
+        size_t diff = 0;
+        for (size_t i = 0; i < n; i++) diff += memcmp(a[i], b[i], sizeof(block_t)) != 0;
+        CHECK(diff == 0, "%s: copy: %zu of %zu blocks differ", f->name, diff, n);
+        free(b);
+    }
+
+    test_mask_rects(f, &in);
+    video_mcu_rect_t rects[2];
+    int count = test_masks(&in, rects);
+    int16_t flat[JPEG_DCT_MAX_BLOCKS][64];
+    overlay_flat_block(&in, flat);
+    len = edit_masks(d, f, rects, count);
+    CHECK(len > 0, "%s: masked edit", f->name);
+    b = len ? decode_all(d, f->out, len, &out) : NULL;
+    CHECK(b != NULL, "%s: decode the masked frame", f->name);
+    if (b) {
+        size_t diff = 0, masked = 0;
+        for (size_t i = 0; i < n; i++) {
+            size_t m = i / in.blocks;
+            int mx = m % in.mcus_x, my = m / in.mcus_x;
+            bool in_mask = false;
+            for (int r = 0; r < count; r++) {
+                in_mask |= mx >= rects[r].x0 && mx < rects[r].x1 && my >= rects[r].y0 && my < rects[r].y1;
+            }
+            masked += in_mask;
+            diff += memcmp(in_mask ? flat[i % in.blocks] : a[i], b[i], sizeof(block_t)) != 0;
+        }
+        CHECK(masked > 0, "%s: masks cover no MCU", f->name);
+        CHECK(diff == 0, "%s: masked: %zu of %zu blocks wrong", f->name, diff, n);
+        free(b);
+    }
+    free(a);
+}
+
+// ---------- OSD ----------
+
+// Flat blocks code only DC, (v - 128) * 8 / step; a horizontal cosine at
+// the first frequency only coefficient 1 (within the pixels' rounding)
+static void test_fdct(void)
+{
+    uint8_t qt1[64], px[64];
+    int16_t coef[64];
+    memset(qt1, 1, sizeof(qt1));
+    for (int v = 0; v <= 255; v += 51) {
+        memset(px, v, sizeof(px));
+        jpeg_dct_fdct(px, 8, qt1, coef);
+        int ac = 0;
+        for (int k = 1; k < 64; k++) ac |= coef[k];
+        CHECK(coef[0] == (v - 128) * 8 && !ac, "flat %d: DC %d, AC %s", v, coef[0], ac ? "set" : "zero");
+    }
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) px[y * 8 + x] = (uint8_t)lroundf(128 + 100 * cosf((2 * x + 1) * (float)M_PI / 16));
+    }
+    jpeg_dct_fdct(px, 8, qt1, coef);
+    int stray = 0;
+    for (int k = 0; k < 64; k++) stray += k != 1 && abs(coef[k]) > 2;
+    CHECK(abs(coef[1] - 566) <= 2 && !stray, "cosine: coefficient 1 = %d, %d others", coef[1], stray);
+}
+
+// The band video_overlay.c stamps, for a timestamp-length text
+#define OSD_TEXT "chute 2026-10-16 12:34:56"
+
+typedef struct {
+    int cols, rows;
+    int16_t (*blocks)[64];
+} osd_band_t;
+
+static bool osd_band(const jpeg_dct_info_t *info, const char *text, osd_band_t *band)
+{
+    if (!overlay_osd_size(info, text, &band->cols, &band->rows)) return false;
+    band->blocks = (int16_t (*)[64])malloc((size_t)band->cols * band->rows * info->blocks * sizeof(*band->blocks));
+    if (!band->blocks) return false;
+    overlay_osd_render(info, text, band->cols, band->rows, band->blocks);
+    return true;
+}
+
+static bool same_band(const jpeg_dct_info_t *info, const osd_band_t *a, const osd_band_t *b)
+{
+    return a->cols == b->cols && a->rows == b->rows &&
+           !memcmp(a->blocks, b->blocks, (size_t)a->cols * a->rows * info->blocks * sizeof(*a->blocks));
+}
+
+// Glyph placement against pixels drawn by hand: "L-" is a column of
+// glyph pixel 0 over rows 0-5 plus all of row 6, then row 3 of the next
+// cell; each glyph pixel is scale x scale, one glyph pixel in from the
+// cell's left. Lower case draws as upper case, unknown characters as
+// spaces. Then the clamps: a long text on a narrow frame gets no more
+// columns or rows than it has, and no partial glyph.
+static void test_osd_glyphs(const frame_t *f, const jpeg_dct_info_t *in)
+{
+    int scale = 1 + in->width / OSD_SCALE_STEP, cell = 8 * scale;
+    osd_band_t band, other;
+    if (!osd_band(in, "L-", &band)) {
+        CHECK(false, "%s: no OSD band", f->name);
+        return;
+    }
+    CHECK(band.cols == (2 * cell + in->mcu_w - 1) / in->mcu_w && band.rows == (cell + in->mcu_h - 1) / in->mcu_h,
+          "%s: \"L-\" band %dx%d MCUs", f->name, band.cols, band.rows);
+    int w = band.cols * in->mcu_w, h = band.rows * in->mcu_h;
+    uint8_t *px = (uint8_t *)calloc((size_t)w * h, 1);
+    for (int y = 0; y < 7 * scale; y++) {
+        for (int x = scale; x < (y >= 6 * scale ? 6 : 2) * scale; x++) px[y * w + x] = 255;
+    }
+    for (int y = 3 * scale; y < 4 * scale; y++) {
+        for (int x = cell + scale; x < cell + 6 * scale; x++) px[y * w + x] = 255;
+    }
+    const uint8_t *qt = in->qt[in->comp[0].tq];
+    int wrong = 0;
+    int16_t want[64];
+    for (int m = 0; m < band.cols * band.rows; m++) {
+        for (int i = 0; i < in->blocks; i++) {
+            int x = m % band.cols * in->mcu_w + in->block_x[i] * 8;
+            int y = m / band.cols * in->mcu_h + in->block_y[i] * 8;
+            if (in->block_comp[i] == 0) {
+                jpeg_dct_fdct(px + (size_t)y * w + x, w, qt, want);
+            } else {
+                memset(want, 0, sizeof(want));
+            }
+            wrong += memcmp(want, band.blocks[m * in->blocks + i], sizeof(want)) != 0;
+        }
+    }
+    CHECK(!wrong, "%s: \"L-\": %d blocks not the glyphs", f->name, wrong);
+    free(px);
+
+    CHECK(osd_band(in, "l-", &other) && same_band(in, &band, &other), "%s: lower case", f->name);
+    free(other.blocks);
+    free(band.blocks);
+    CHECK(osd_band(in, "#", &band) && osd_band(in, " ", &other) && same_band(in, &band, &other),
+          "%s: unknown character isn't a space", f->name);
+    free(band.blocks);
+    free(other.blocks);
+
+    // Glyphs three times the size on a frame 4 x 2 MCUs big: the text is
+    // cut to the frame, and the third glyph, which would only partly fit,
+    // stays out (the band's last MCU column is black)
+    jpeg_dct_info_t small = *in;
+    small.width = 2 * OSD_SCALE_STEP;
+    small.mcus_x = 4;
+    small.mcus_y = 2;
+    cell = 24;
+    CHECK(osd_band(&small, "LLLLLLLLLL", &band), "%s: small band", f->name);
+    int want_rows = (cell + in->mcu_h - 1) / in->mcu_h;
+    if (want_rows > 2) want_rows = 2;
+    CHECK(band.cols == 4 && band.rows == want_rows, "%s: clamped band %dx%d MCUs, want 4x%d", f->name,
+          band.cols, band.rows, want_rows);
+    uint8_t dark[64] = { 0 };
+    int16_t flat[64];
+    jpeg_dct_fdct(dark, 8, in->qt[in->comp[0].tq], flat);
+    int drawn = 0, black = 0, expect_black = 0;
+    for (int m = 0; m < band.cols * band.rows; m++) {
+        for (int i = 0; i < in->blocks; i++) {
+            int x = m % band.cols * in->mcu_w + in->block_x[i] * 8;
+            if (in->block_comp[i] != 0) continue;
+            bool is_black = !memcmp(flat, band.blocks[m * in->blocks + i], sizeof(flat));
+            if (x >= 2 * cell) {
+                expect_black++;
+                black += is_black;
+            } else {
+                drawn += !is_black;
+            }
+        }
+    }
+    CHECK(black == expect_black && drawn > 0, "%s: partial glyph drawn (%d of %d blocks black)", f->name,
+          black, expect_black);
+    free(band.blocks);
+}
+
+// Stamp the band in edit mode; if the camera's Huffman tables can't code
+// it, re-encode with the standard ones (video_overlay.c's second pass)
+static size_t stamp_osd(jpeg_dct_t *d, const frame_t *f, const osd_band_t *band)
+{
+    for (int pass = 0; pass < 2; pass++) {
+        if (!jpeg_dct_begin(d, f->buf, f->len)) return 0;
+        const jpeg_dct_info_t *info = jpeg_dct_info(d);
+        int32_t last = (band->rows - 1) * info->mcus_x + band->cols - 1;
+        int16_t blocks[JPEG_DCT_MAX_BLOCKS][64];
+        if (pass) {
+            jpeg_dct_write_begin(d, f->out, f->out_size, NULL);
+        } else {
+            jpeg_dct_edit_begin(d, f->out, f->out_size);
+        }
+        int32_t m = 0;
+        for (int my = 0; my < info->mcus_y && m <= last; my++) {
+            for (int mx = 0; mx < info->mcus_x && m <= last; mx++, m++) {
+                if (!jpeg_dct_read_mcu(d, blocks, false)) return 0;
+                if (my < band->rows && mx < band->cols) {
+                    jpeg_dct_write_mcu(d, band->blocks + (size_t)(my * band->cols + mx) * info->blocks);
+                } else {
+                    jpeg_dct_copy_mcu(d, blocks);
+                }
+            }
+        }
+        if (!jpeg_dct_copy_rest(d, blocks)) return 0;
+        size_t len = jpeg_dct_write_end(d);
+        if (len) return len;
+    }
+    return 0;
+}
+
+// The band decodes to exactly its blocks, everything else to the source
+static void test_osd(jpeg_dct_t *d, const frame_t *f)
+{
+    jpeg_dct_info_t in, out;
+    osd_band_t band;
+    block_t *a = decode_all(d, f->buf, f->len, &in);
+    if (!a) return;
+    test_osd_glyphs(f, &in);
+    CHECK(osd_band(&in, OSD_TEXT, &band), "%s: OSD band", f->name);
+    size_t len = stamp_osd(d, f, &band);
+    CHECK(len > 0, "%s: OSD stamp", f->name);
+    block_t *b = len ? decode_all(d, f->out, len, &out) : NULL;
+    CHECK(b != NULL, "%s: decode the stamped frame", f->name);
+    if (b) {
+        size_t n = (size_t)in.mcus_x * in.mcus_y * in.blocks;
+        size_t diff = 0;
+        for (size_t i = 0; i < n; i++) {
+            size_t m = i / in.blocks;
+            int mx = m % in.mcus_x, my = m / in.mcus_x;
+            const int16_t *want = a[i];
+            if (mx < band.cols && my < band.rows) {
+                want = band.blocks[(size_t)(my * band.cols + mx) * in.blocks + i % in.blocks];
+            }
+            diff += memcmp(want, b[i], sizeof(block_t)) != 0;
+        }
+        CHECK(diff == 0, "%s: OSD: %zu of %zu blocks wrong", f->name, diff, n);
+    }
+    free(band.blocks);
+    free(a);
+    free(b);
+}
+
+// ---------- Benchmarks ----------
+
+typedef size_t (*bench_fn)(jpeg_dct_t *d, const frame_t *f);
+
+// Run op over the frame for BENCH_MIN_US; prints time per frame, source
+// megabytes per second and the output size (0 = no output)
+static void bench(const char *what, bench_fn op, jpeg_dct_t *d, const frame_t *f)
+{
+    size_t out = op(d, f);
+    int runs = 0;
+    int64_t t0 = test_now_us(), t;
+    do {
+        out = op(d, f);
+        runs++;
+        t = test_now_us() - t0;
+    } while (t < BENCH_MIN_US);
+    double us = (double)t / runs;
+    printf("%-12s %-18s %8.3f ms/frame %8.1f MB/s", f->name, what, us / 1000, f->len / us);
+    if (out) printf("  %6zu -> %6zu bytes (%.0f%%)", f->len, out, 100.0 * out / f->len);
+    printf("\n");
+}
+
+static size_t op_roundtrip(jpeg_dct_t *d, const frame_t *f) { return reencode(d, f, 1); }
+// REQUANT_MID_FACTOR and REQUANT_LOW_FACTOR (video_scale.h)
+static size_t op_requant_2(jpeg_dct_t *d, const frame_t *f) { return reencode(d, f, 2); }
+static size_t op_requant_4(jpeg_dct_t *d, const frame_t *f) { return reencode(d, f, 4); }
+
+// Entropy decode only, with and without AC coefficients
+static size_t read_all(jpeg_dct_t *d, const frame_t *f, bool dc_only)
+{
+    if (!jpeg_dct_begin(d, f->buf, f->len)) return 0;
+    const jpeg_dct_info_t *info = jpeg_dct_info(d);
+    int16_t blocks[JPEG_DCT_MAX_BLOCKS][64];
+    uint32_t mcus = (uint32_t)info->mcus_x * info->mcus_y;
+    for (uint32_t m = 0; m < mcus; m++) {
+        if (!jpeg_dct_read_mcu(d, blocks, dc_only)) break;
+    }
+    return 0;
+}
+
+static size_t op_edit_copy(jpeg_dct_t *d, const frame_t *f) { return edit_masks(d, f, NULL, 0); }
+
+static size_t op_edit_masks(jpeg_dct_t *d, const frame_t *f)
+{
+    if (!jpeg_dct_begin(d, f->buf, f->len)) return 0;
+    video_mcu_rect_t rects[2];
+    int count = test_masks(jpeg_dct_info(d), rects);
+    return edit_masks(d, f, rects, count);
+}
+
+// Per frame: stamp the cached band. Once a second: build it.
+static size_t op_osd_stamp(jpeg_dct_t *d, const frame_t *f)
+{
+    static osd_band_t band;
+    static const frame_t *built;
+    if (built != f) {
+        free(band.blocks);
+        if (!jpeg_dct_begin(d, f->buf, f->len) || !osd_band(jpeg_dct_info(d), OSD_TEXT, &band)) return 0;
+        built = f;
+    }
+    return stamp_osd(d, f, &band);
+}
+
+static size_t op_osd_build(jpeg_dct_t *d, const frame_t *f)
+{
+    osd_band_t band;
+    if (jpeg_dct_begin(d, f->buf, f->len) && osd_band(jpeg_dct_info(d), OSD_TEXT, &band)) free(band.blocks);
+    return 0;
+}
+
+static size_t op_read(jpeg_dct_t *d, const frame_t *f) { return read_all(d, f, false); }
+static size_t op_read_dc(jpeg_dct_t *d, const frame_t *f) { return read_all(d, f, true); }
+
+static void bench_frame(jpeg_dct_t *d, const frame_t *f)
+{
+    bench("read", op_read, d, f);
+    bench("read DC only", op_read_dc, d, f);
+    bench("read+write", op_roundtrip, d, f);
+    bench("edit, no change", op_edit_copy, d, f);
+    bench("edit, 2 masks", op_edit_masks, d, f);
+    bench("OSD stamp", op_osd_stamp, d, f);
+    bench("OSD build (1/s)", op_osd_build, d, f);
+    bench("requant q=mid", op_requant_2, d, f);
+    bench("requant q=low", op_requant_4, d, f);
+}
+
+int main(int argc, char **argv)
+{
+    bool run_bench = argc > 2 && !strcmp(argv[1], "--bench");
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s [--bench] <frames dir>\n", argv[0]);
+        return 2;
+    }
+    const char *dir = argv[argc - 1];
+
+    frame_t frames[FRAME_COUNT];
+    for (size_t i = 0; i < FRAME_COUNT; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir, s_frame_names[i]);
+        frames[i].name = s_frame_names[i];
+        frames[i].buf = test_load(path, &frames[i].len);
+        if (!frames[i].buf) {
+            fprintf(stderr, "can't read %s\n", path);
+            return 2;
+        }
+        frames[i].out_size = frames[i].len * 2 + 4096;
+        frames[i].out = (uint8_t *)malloc(frames[i].out_size);
+    }
+
+    jpeg_dct_t *d = jpeg_dct_new();
+    if (!run_bench) {
+        test_fdct();
+        test_requant_rounding();
+    }
+    for (size_t i = 0; i < FRAME_COUNT; i++) {
+        if (run_bench) {
+            bench_frame(d, &frames[i]);
+        } else {
+            test_roundtrip(d, &frames[i]);
+            test_requant(d, &frames[i]);
+            test_dc_only(d, &frames[i]);
+            test_edit(d, &frames[i]);
+            test_osd(d, &frames[i]);
+        }
+    }
+    jpeg_dct_free(d);
+
+    for (size_t i = 0; i < FRAME_COUNT; i++) {
+        free(frames[i].buf);
+        free(frames[i].out);
+    }
+    printf(test_failures ? "%d check(s) failed\n" : "OK\n", test_failures);
+    return test_failures != 0;
+}
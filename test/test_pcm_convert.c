@@ -0,0 +1,190 @@
+// pcm_convert.c: every kernel must give exactly what the spec in
+// pcm_convert.h gives (multiply, shift, saturate, pack) for every gain
+// step, edge-value inputs, any length and any output alignment; the
+// benchmark reports cost per sample on a mic DMA block.
+//   test_pcm_convert           correctness
+//   test_pcm_convert --bench   timing
+#include "pcm_convert.h"
+#include "http_audio_stream.h"
+#include "test.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define BENCH_MIN_US  300000          // run each benchmark at least this long
+#define MAX_SAMPLES   1024            // a DMA block of 32-bit samples
+#define GUARD         8               // bytes past the output that must stay untouched
+
+typedef struct {
+    const char *name;
+    pcm_convert_fn fn;
+    int in_bits, out_bits;
+} kernel_t;
+
+static const kernel_t s_kernels[] = {
+    { "s32 -> s16", pcm_s32_to_s16, 32, 16 },
+    { "s32 -> s16 ref", pcm_s32_to_s16_ref, 32, 16 },
+    { "s32 -> s24", pcm_s32_to_s24, 32, 24 },
+    { "s32 -> s24 ref", pcm_s32_to_s24_ref, 32, 24 },
+    { "s16 -> s16", pcm_s16_to_s16, 16, 16 },
+    { "s16 -> s16 ref", pcm_s16_to_s16_ref, 16, 16 },
+};
+#define KERNEL_COUNT (sizeof(s_kernels) / sizeof(s_kernels[0]))
+
+// ---------- Spec ----------
+
+// One sample as pcm_convert.h describes it, little-endian bytes into out
+static void spec_sample(const kernel_t *k, int64_t s, int32_t gain, uint8_t *out)
+{
+    int shift = k->in_bits == 16 ? 15 : k->out_bits == 24 ? 23 : 31;
+    int64_t max = (1 << (k->out_bits - 1)) - 1;
+    int64_t v = (s * gain) >> shift;
+    if (v > max) v = max;
+    if (v < -max - 1) v = -max - 1;
+    for (int b = 0; b < k->out_bits / 8; b++) out[b] = (uint8_t)(v >> (8 * b));
+}
+
+static uint32_t s_seed = 1;
+
+static uint32_t rnd(void)
+{
+    s_seed = s_seed * 1664525 + 1013904223;
+    return s_seed;
+}
+
+// Random full-scale and small samples, with the edge values (both limits
+// and around zero) mixed in
+static void fill_input(int in_bits, void *in, size_t samples)
+{
+    static const int32_t edges[] = { INT32_MIN, INT32_MIN + 1, -1, 0, 1, INT32_MAX - 1, INT32_MAX };
+    for (size_t i = 0; i < samples; i++) {
+        int32_t v = (int32_t)(rnd() ^ (rnd() << 16));
+        uint32_t pick = rnd() % 8;
+        if (pick < sizeof(edges) / sizeof(edges[0])) v = edges[pick];
+        // Small values too: gain matters most there
+        if (rnd() % 4 == 0) v >>= rnd() % 24;
+        if (in_bits == 16) ((int16_t *)in)[i] = (int16_t)(v >> 16);
+        else ((int32_t *)in)[i] = v;
+    }
+}
+
+// ---------- Tests ----------
+
+// Lengths to try: 0 to 39 (every tail of the packed loop), then a block
+static size_t next_length(size_t samples)
+{
+    return samples < 39 ? samples + 1 : samples < MAX_SAMPLES ? MAX_SAMPLES : MAX_SAMPLES + 1;
+}
+
+static void test_kernel(const kernel_t *k)
+{
+    int32_t in[MAX_SAMPLES];
+    uint8_t out[MAX_SAMPLES * 3 + GUARD + 4], want[MAX_SAMPLES * 3];
+    int bytes = k->out_bits / 8;
+    int mismatches = 0;
+
+    for (int db = PCM_GAIN_DB_MIN; db <= PCM_GAIN_DB_MAX; db++) {
+        int32_t gain = pcm_gain_q15(db);
+        // Output aligned and off by each sample-aligned offset (24-bit: by
+        // each byte, the packed version falls back when unaligned)
+        for (size_t samples = 0; samples <= MAX_SAMPLES; samples = next_length(samples)) {
+            for (int offset = 0; offset < 4; offset += bytes == 3 ? 1 : bytes) {
+                fill_input(k->in_bits, in, samples);
+                for (size_t i = 0; i < samples; i++) {
+                    int64_t s = k->in_bits == 16 ? ((int16_t *)in)[i] : in[i];
+                    spec_sample(k, s, gain, want + i * bytes);
+                }
+                memset(out, 0xA5, sizeof(out));
+                k->fn(in, out + offset, samples, gain);
+
+                size_t len = samples * bytes;
+                bool ok = !memcmp(out + offset, want, len);
+                for (size_t g = 0; g < GUARD; g++) ok = ok && out[offset + len + g] == 0xA5;
+                for (int g = 0; g < offset; g++) ok = ok && out[g] == 0xA5;
+                if (!ok && mismatches++ == 0) {
+                    CHECK(false, "%s at %d dB, %zu samples, output offset %d: not the spec's bytes",
+                          k->name, db, samples, offset);
+                }
+            }
+        }
+    }
+    printf("%-16s %s\n", k->name, mismatches ? "MISMATCH" : "bit-exact with the spec");
+}
+
+static void test_gain(void)
+{
+    CHECK(pcm_gain_q15(0) == 32768, "0 dB: %d", pcm_gain_q15(0));
+    CHECK(pcm_gain_q15(6) == 65381, "+6 dB: %d", pcm_gain_q15(6));
+    CHECK(pcm_gain_q15(PCM_GAIN_DB_MIN - 10) == pcm_gain_q15(PCM_GAIN_DB_MIN), "below the range isn't clamped");
+    CHECK(pcm_gain_q15(PCM_GAIN_DB_MAX + 10) == pcm_gain_q15(PCM_GAIN_DB_MAX), "above the range isn't clamped");
+    int32_t def = pcm_gain_q15(PCM_GAIN_DB_DEFAULT);
+    CHECK(def > 7.8 * 32768 && def < 8.2 * 32768, "default %d dB: %d, not about 8x", PCM_GAIN_DB_DEFAULT, def);
+
+    // The former multiplier: 8x was the default, 1..32 the range
+    CHECK(pcm_gain_db_from_factor(1) == 0, "1x: %d dB", pcm_gain_db_from_factor(1));
+    CHECK(pcm_gain_db_from_factor(8) == 18, "8x: %d dB", pcm_gain_db_from_factor(8));
+    CHECK(pcm_gain_db_from_factor(32) == 30, "32x: %d dB", pcm_gain_db_from_factor(32));
+    for (int f = 1; f <= PCM_GAIN_FACTOR_MAX; f++) {
+        int back = pcm_gain_factor(pcm_gain_db_from_factor(f));
+        CHECK(abs(back - f) <= (f + 9) / 10, "%dx -> %d dB -> %dx", f, pcm_gain_db_from_factor(f), back);
+    }
+    CHECK(pcm_gain_factor(PCM_GAIN_DB_MIN) == 1, "%d", pcm_gain_factor(PCM_GAIN_DB_MIN));
+    CHECK(pcm_gain_factor(PCM_GAIN_DB_MAX) == PCM_GAIN_FACTOR_MAX, "%d", pcm_gain_factor(PCM_GAIN_DB_MAX));
+
+    CHECK(pcm_convert_get(32, 16) == pcm_s32_to_s16, "32 -> 16");
+    CHECK(pcm_convert_get(32, 24) == pcm_s32_to_s24, "32 -> 24");
+    CHECK(pcm_convert_get(16, 16) == pcm_s16_to_s16, "16 -> 16");
+    CHECK(pcm_convert_get(16, 24) == NULL, "16 -> 24 needs 32-bit input");
+    CHECK(pcm_convert_get(24, 16) == NULL, "24-bit I2S input");
+}
+
+// ---------- Benchmarks ----------
+
+// One DMA block at the default gain, over and over; ns per sample and,
+// on x86, time-stamp counter ticks per sample
+static void bench_kernel(const kernel_t *k)
+{
+    static int32_t in[MAX_SAMPLES];
+    static uint32_t out[MAX_SAMPLES];
+    size_t samples = k->in_bits == 16 ? DMA_BUF_LEN / 2 : DMA_BUF_LEN / 4;
+    if (samples > MAX_SAMPLES) samples = MAX_SAMPLES;
+    int32_t gain = pcm_gain_q15(PCM_GAIN_DB_DEFAULT);
+    fill_input(k->in_bits, in, samples);
+
+    long runs = 0;
+    int64_t t0 = test_now_us(), t;
+#ifdef HAVE_TSC
+    uint64_t c0 = __rdtsc();
+#endif
+    do {
+        for (int i = 0; i < 100; i++) {
+            k->fn(in, out, samples, gain);
+            __asm__ volatile("" : : "r"(out) : "memory");
+        }
+        runs += 100;
+        t = test_now_us() - t0;
+    } while (t < BENCH_MIN_US);
+    double per = (double)runs * samples;
+    printf("%-16s %6.3f ns/sample", k->name, t * 1000.0 / per);
+#ifdef HAVE_TSC
+    printf("  %5.2f cycles/sample (TSC)", (__rdtsc() - c0) / per);
+#endif
+    printf("  %4zu samples/block\n", samples);
+}
+
+int main(int argc, char **argv)
+{
+    bool run_bench = argc > 1 && !strcmp(argv[1], "--bench");
+    for (size_t i = 0; i < KERNEL_COUNT; i++) {
+        if (run_bench) bench_kernel(&s_kernels[i]);
+        else test_kernel(&s_kernels[i]);
+    }
+    if (!run_bench) test_gain();
+    printf(test_failures ? "%d check(s) failed\n" : "OK\n", test_failures);
+    return test_failures != 0;
+}